@@ -0,0 +1,97 @@
+//
+// AVL tree runtime tests
+//
+// Each test times an operation on trees whose size doubles from run to run.
+// A logarithmic operation barely slows down as the tree grows, while a
+// linear one slows down by the same factor as the tree.
+//
+
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include "avlbst.h"
+
+using namespace std;
+
+typedef double (*RuntimeTrial)(uint64_t numElements);
+
+// Average seconds per operation over a few repetitions of a trial
+double timeTrial(RuntimeTrial trial, uint64_t numElements)
+{
+    double best = 0;
+    for(int rep = 0; rep < 5; rep++) {
+        double t = trial(numElements);
+        if(rep == 0 || t < best) {
+            best = t;
+        }
+    }
+    return best;
+}
+
+// Runs a trial from 2^minExp to 2^maxExp elements and checks that going
+// up the sizes costs far less than the growth in size.
+bool evaluateLogarithmic(const char* name, RuntimeTrial trial, int minExp, int maxExp)
+{
+    cout << name << endl;
+    double first = 0, last = 0;
+    for(int e = minExp; e <= maxExp; e++) {
+        double t = timeTrial(trial, uint64_t(1) << e);
+        cout << "  n = 2^" << e << ": " << t * 1e9 << " ns/op" << endl;
+        if(e == minExp) first = t;
+        last = t;
+    }
+    double sizeRatio = double(uint64_t(1) << (maxExp - minExp));
+    double timeRatio = last / first;
+    bool passed = timeRatio < sizeRatio / 8;
+    cout << "  time grew " << timeRatio << "x for " << sizeRatio << "x the keys: "
+         << (passed ? "PASSED" : "FAILED") << endl;
+    return passed;
+}
+
+// Fills a tree with keys 1..numElements-1 in increasing order
+void fillSequential(AVLTree<uint64_t, uint64_t>& tree, uint64_t numElements)
+{
+    for(uint64_t i = 1; i < numElements; ++i) {
+        tree.insert(std::make_pair(i, i));
+    }
+}
+
+// runtime test for removing keys spread over the whole tree
+double removeSpread(uint64_t numElements)
+{
+    AVLTree<uint64_t, uint64_t> tree;
+    fillSequential(tree, numElements);
+
+    const uint64_t ops = 512;
+    uint64_t step = numElements / ops + 1;
+    auto start = chrono::steady_clock::now();
+    for(uint64_t i = 1; i < numElements; i += step) {
+        tree.remove(i);
+    }
+    auto stop = chrono::steady_clock::now();
+    return chrono::duration<double>(stop - start).count() / ((numElements - 1) / step + 1);
+}
+
+// runtime test for removing the root, which needs the predecessor swap
+double removeRoot(uint64_t numElements)
+{
+    AVLTree<uint64_t, uint64_t> tree;
+    fillSequential(tree, numElements);
+
+    const int ops = 256;
+    auto start = chrono::steady_clock::now();
+    for(int i = 0; i < ops; i++) {
+        tree.remove(numElements / 2 + i);
+    }
+    auto stop = chrono::steady_clock::now();
+    return chrono::duration<double>(stop - start).count() / ops;
+}
+
+int main()
+{
+    bool passed = true;
+    passed &= evaluateLogarithmic("AVLTree::remove() with keys spread over the tree", removeSpread, 10, 17);
+    passed &= evaluateLogarithmic("AVLTree::remove() near the root with keys in sequential order", removeRoot, 10, 17);
+    return passed ? 0 : 1;
+}
@@ -6,7 +6,12 @@
 #include <cstdlib>
 #include <cstdint>
 #include <algorithm>
+#include <vector>
+#include <thread>
+#include <stdexcept>
+#include <cstring>
 #include "bst.h"
+#include "snapshot.h"
 
 struct KeyError { };
 
@@ -21,7 +26,7 @@ class AVLNode : public Node<Key, Value>
 public:
     // Constructor/destructor.
     AVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent);
-    virtual ~AVLNode();
+    ~AVLNode();
 
     // Getter/setter for the node's height.
     int getBalance () const;
@@ -29,14 +34,21 @@ public:
     void updateBalance(int diff);
 
     // Getters for parent, left, and right. These need to be redefined since they
-    // return pointers to AVLNodes - not plain Nodes. See the Node class in bst.h
-    // for more information.
-    virtual AVLNode<Key, Value>* getParent() const override;
-    virtual AVLNode<Key, Value>* getLeft() const override;
-    virtual AVLNode<Key, Value>* getRight() const override;
+    // return pointers to AVLNodes - not plain Nodes. They hide the Node versions
+    // rather than override them, so code holding an AVLNode* never makes an
+    // indirect call. See the Node class in bst.h for more information.
+    AVLNode<Key, Value>* getParent() const;
+    AVLNode<Key, Value>* getLeft() const;
+    AVLNode<Key, Value>* getRight() const;
 
 protected:
+#ifdef BST_PACKED_BALANCE
+    // The balance lives in the 3-bit tag of the parent pointer, as a
+    // two's complement number in [-4, 3]
+    static_assert(alignof(Node<Key, Value>) >= 8, "BST_PACKED_BALANCE needs 8-byte aligned nodes");
+#else
     int balance_;    // effectively a signed char
+#endif
 };
 
 /*
@@ -50,7 +62,10 @@ protected:
 */
 template<class Key, class Value>
 AVLNode<Key, Value>::AVLNode(const Key& key, const Value& value, AVLNode<Key, Value> *parent) :
-    Node<Key, Value>(key, value, parent), balance_(0)
+    Node<Key, Value>(key, value, parent)
+#ifndef BST_PACKED_BALANCE
+    , balance_(0)
+#endif
 {
 
 }
@@ -70,7 +85,12 @@ AVLNode<Key, Value>::~AVLNode()
 template<class Key, class Value>
 int AVLNode<Key, Value>::getBalance() const
 {
+#ifdef BST_PACKED_BALANCE
+    int tag = static_cast<int>(this->getParentTag());
+    return (tag ^ 4) - 4;
+#else
     return balance_;
+#endif
 }
 
 /**
@@ -79,7 +99,11 @@ int AVLNode<Key, Value>::getBalance() const
 template<class Key, class Value>
 void AVLNode<Key, Value>::setBalance(int balance)
 {
+#ifdef BST_PACKED_BALANCE
+    this->setParentTag(static_cast<unsigned>(balance) & 7);
+#else
     balance_ = balance;
+#endif
 }
 
 /**
@@ -88,21 +112,20 @@ void AVLNode<Key, Value>::setBalance(int balance)
 template<class Key, class Value>
 void AVLNode<Key, Value>::updateBalance(int diff)
 {
-    balance_ += diff;
+    setBalance(getBalance() + diff);
 }
 
 /**
-* An overridden function for getting the parent since a static_cast is necessary to make sure
-* that our node is a AVLNode.
+* A getter for the parent, with the static_cast that makes sure our node is a AVLNode.
 */
 template<class Key, class Value>
 AVLNode<Key, Value> *AVLNode<Key, Value>::getParent() const
 {
-    return static_cast<AVLNode<Key, Value>*>(this->parent_);
+    return static_cast<AVLNode<Key, Value>*>(Node<Key, Value>::getParent());
 }
 
 /**
-* Overridden for the same reasons as above.
+* Redefined for the same reasons as above.
 */
 template<class Key, class Value>
 AVLNode<Key, Value> *AVLNode<Key, Value>::getLeft() const
@@ -111,7 +134,7 @@ AVLNode<Key, Value> *AVLNode<Key, Value>::getLeft() const
 }
 
 /**
-* Overridden for the same reasons as above.
+* Redefined for the same reasons as above.
 */
 template<class Key, class Value>
 AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
@@ -131,27 +154,296 @@ template <class Key, class Value>
 class AVLTree : public BinarySearchTree<Key, Value>
 {
 public:
+    AVLTree();
+    template<typename InputIt>
+    AVLTree(InputIt first, InputIt last);
+    virtual ~AVLTree();
+
     virtual void insert (const std::pair<const Key, Value> &new_item); // TODO
     virtual void remove(const Key& key);  // TODO
+    size_t erase(const Key& key);
+    virtual void setScapegoatAlpha(double alpha);
+    virtual void rebalance();
+    virtual void rebuildOptimal();
 
     void printSpecificNode(int directions[]) const;
 
+    template<typename InputIt>
+    void assign(InputIt first, InputIt last);
+
+    // Binary snapshots, written in key order and read back in O(n)
+    template<typename KeyCodec = SnapshotCodec<Key>, typename ValueCodec = SnapshotCodec<Value> >
+    void save(std::ostream& out) const;
+    template<typename KeyCodec = SnapshotCodec<Key>, typename ValueCodec = SnapshotCodec<Value> >
+    void save(int fd) const;
+    template<typename KeyCodec = SnapshotCodec<Key>, typename ValueCodec = SnapshotCodec<Value> >
+    void load(std::istream& in);
+    template<typename KeyCodec = SnapshotCodec<Key>, typename ValueCodec = SnapshotCodec<Value> >
+    void load(int fd);
+
+    // Join, split and set algebra. These move nodes between trees
+    // instead of copying them.
+    void join(AVLTree<Key, Value>& left, const std::pair<const Key, Value>& pivot, AVLTree<Key, Value>& right);
+    bool split(const Key& key, AVLTree<Key, Value>& less, AVLTree<Key, Value>& greater);
+    void setUnion(AVLTree<Key, Value>& other);
+    void setIntersection(AVLTree<Key, Value>& other);
+    void setDifference(AVLTree<Key, Value>& other);
+
 protected:
     virtual void nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2);
+    virtual void destroyNode(Node<Key, Value>* current);
+    virtual Node<Key, Value>* insertLeaf(Node<Key, Value>* parent, bool left, size_t depth,
+        const Key& key, const Value& value);
 
     // Add helper functions here
     void insert_fix (AVLNode<Key,Value>* n2,  AVLNode<Key,Value>* n1); // TODO
-    // void removeFix(AVLNode<Key,Value>* n2,  int diff); // TODO
+    void removeFix(AVLNode<Key,Value>* node, int diff);
 
     void rotateRight(AVLNode<Key,Value>* grandparent);
     void rotateLeft(AVLNode<Key,Value>* grandparent);
+    static AVLNode<Key, Value>* rotateRightNodes(AVLNode<Key,Value>* grandparent);
+    static AVLNode<Key, Value>* rotateLeftNodes(AVLNode<Key,Value>* grandparent);
     AVLNode<Key, Value>* getPredecessor(AVLNode<Key, Value>* current); // TODO
 
-
+    AVLNode<Key, Value>* buildBalanced(const std::vector<std::pair<Key, Value> >& items,
+        size_t lo, size_t hi, AVLNode<Key, Value>* parent, int* height);
+
+    template<typename KeyCodec, typename ValueCodec>
+    void saveTo(SnapshotWriter& out) const;
+    template<typename KeyCodec, typename ValueCodec>
+    void loadFrom(SnapshotReader& in);
+    template<typename KeyCodec, typename ValueCodec>
+    AVLNode<Key, Value>* buildFromSnapshot(SnapshotReader& in, size_t count, const Key** previous, int* height);
+
+    // Helpers for join/split. They work on detached subtrees whose roots
+    // have no parent, and never touch root_, so they are safe to run on
+    // disjoint subtrees from several threads.
+    enum SetOperation { SET_UNION, SET_INTERSECTION, SET_DIFFERENCE };
+
+    static int subtreeHeight(AVLNode<Key, Value>* current);
+    static int resetBalances(AVLNode<Key, Value>* current);
+    static bool growFix(AVLNode<Key, Value>* node, bool fromRight);
+    static AVLNode<Key, Value>* joinNodes(AVLNode<Key, Value>* left, int leftHeight,
+        AVLNode<Key, Value>* pivot, AVLNode<Key, Value>* right, int rightHeight, int* height);
+    static AVLNode<Key, Value>* joinNodes(AVLNode<Key, Value>* left, int leftHeight,
+        AVLNode<Key, Value>* right, int rightHeight, int* height);
+    static void splitNodes(AVLNode<Key, Value>* current, int height, const Key& key,
+        AVLNode<Key, Value>** less, int* lessHeight, AVLNode<Key, Value>** found,
+        AVLNode<Key, Value>** greater, int* greaterHeight);
+    static void splitLast(AVLNode<Key, Value>* current, int height,
+        AVLNode<Key, Value>** rest, int* restHeight, AVLNode<Key, Value>** last);
+    static AVLNode<Key, Value>* setOperation(SetOperation op, AVLNode<Key, Value>* a, int aHeight,
+        AVLNode<Key, Value>* b, int bHeight, int* height, std::vector<AVLNode<Key, Value>*>* dropped, int depth);
+    static void dropSubtree(AVLNode<Key, Value>* current, std::vector<AVLNode<Key, Value>*>* dropped);
+    void runSetOperation(SetOperation op, AVLTree<Key, Value>& other);
 };
 
 
 
+template<class Key, class Value>
+AVLTree<Key, Value>::AVLTree()
+{
+
+}
+
+/**
+* Clears here rather than in ~BinarySearchTree(), where destroyNode() would
+* no longer reach the AVLNode version.
+*/
+template<class Key, class Value>
+AVLTree<Key, Value>::~AVLTree()
+{
+    this->clear();
+}
+
+template<class Key, class Value>
+void AVLTree<Key, Value>::destroyNode(Node<Key, Value>* current)
+{
+    this->template destroyNodeAs<AVLNode<Key, Value> >(current);
+}
+
+/**
+* Builds a perfectly balanced AVL tree out of the pairs in [first, last).
+*/
+template<class Key, class Value>
+template<typename InputIt>
+AVLTree<Key, Value>::AVLTree(InputIt first, InputIt last)
+{
+    assign(first, last);
+}
+
+/**
+* Replaces the contents of the tree with the pairs in [first, last) in O(n),
+* with no rotations. Unsorted input is sorted first, as in
+* BinarySearchTree::assign().
+*/
+template<class Key, class Value>
+template<typename InputIt>
+void AVLTree<Key, Value>::assign(InputIt first, InputIt last)
+{
+    std::vector<std::pair<Key, Value> > items;
+    BinarySearchTree<Key, Value>::sortedItems(first, last, items);
+    this->clear();
+    int height = 0;
+    this->root_ = buildBalanced(items, 0, items.size(), nullptr, &height);
+}
+
+/**
+* Builds the subtree holding items[lo, hi) around the middle item, setting
+* each node's balance from the heights of the two halves it was built from.
+*/
+template<class Key, class Value>
+AVLNode<Key, Value>* AVLTree<Key, Value>::buildBalanced(const std::vector<std::pair<Key, Value> >& items,
+    size_t lo, size_t hi, AVLNode<Key, Value>* parent, int* height)
+{
+    if(lo >= hi){
+        *height = 0;
+        return nullptr;
+    }
+    size_t mid = lo + (hi - lo) / 2;
+    AVLNode<Key, Value>* current =
+        this->template createNode<AVLNode<Key, Value> >(items[mid].first, items[mid].second, parent);
+    int leftHeight = 0, rightHeight = 0;
+    current->setLeft(buildBalanced(items, lo, mid, current, &leftHeight));
+    current->setRight(buildBalanced(items, mid + 1, hi, current, &rightHeight));
+    current->setBalance(rightHeight - leftHeight);
+    current->updateSubtreeSize();
+    *height = 1 + std::max(leftHeight, rightHeight);
+    return current;
+}
+
+/**
+* Writes the tree to out: a short header and the pair count, then every
+* pair in key order, each key encoded against the one before it.
+*/
+template<class Key, class Value>
+template<typename KeyCodec, typename ValueCodec>
+void AVLTree<Key, Value>::save(std::ostream& out) const
+{
+    SnapshotWriter writer(out);
+    saveTo<KeyCodec, ValueCodec>(writer);
+}
+
+template<class Key, class Value>
+template<typename KeyCodec, typename ValueCodec>
+void AVLTree<Key, Value>::save(int fd) const
+{
+    SnapshotWriter writer(fd);
+    saveTo<KeyCodec, ValueCodec>(writer);
+}
+
+/**
+* Replaces the contents of the tree with a snapshot written by save() with
+* the same codecs. The pairs arrive in order and the count is known up
+* front, so the tree is built in its final shape as they stream in: no key
+* is compared and nothing is rotated. Throws std::runtime_error if the
+* header is not one save() writes, leaving the tree as it was, or if the
+* snapshot breaks off partway, leaving it empty.
+*/
+template<class Key, class Value>
+template<typename KeyCodec, typename ValueCodec>
+void AVLTree<Key, Value>::load(std::istream& in)
+{
+    SnapshotReader reader(in);
+    loadFrom<KeyCodec, ValueCodec>(reader);
+}
+
+template<class Key, class Value>
+template<typename KeyCodec, typename ValueCodec>
+void AVLTree<Key, Value>::load(int fd)
+{
+    SnapshotReader reader(fd);
+    loadFrom<KeyCodec, ValueCodec>(reader);
+}
+
+template<class Key, class Value>
+template<typename KeyCodec, typename ValueCodec>
+void AVLTree<Key, Value>::saveTo(SnapshotWriter& out) const
+{
+    out.writeBytes(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    out.writeVarint(SNAPSHOT_VERSION);
+    out.writeVarint(this->size());
+    const Key* previous = nullptr;
+    for(typename BinarySearchTree<Key, Value>::iterator it = this->begin(); it != this->end(); ++it){
+        KeyCodec::write(out, it->first, previous);
+        ValueCodec::write(out, it->second, nullptr);
+        previous = &(it->first);
+    }
+    out.flush();
+}
+
+template<class Key, class Value>
+template<typename KeyCodec, typename ValueCodec>
+void AVLTree<Key, Value>::loadFrom(SnapshotReader& in)
+{
+    unsigned char magic[sizeof(SNAPSHOT_MAGIC)];
+    in.readBytes(magic, sizeof(magic));
+    if(std::memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) != 0){
+        throw std::runtime_error("Not a tree snapshot");
+    }
+    if(in.readVarint() != SNAPSHOT_VERSION){
+        throw std::runtime_error("Unsupported snapshot version");
+    }
+    size_t count = static_cast<size_t>(in.readVarint());
+    this->clear();
+    const Key* previous = nullptr;
+    int height = 0;
+    this->root_ = buildFromSnapshot<KeyCodec, ValueCodec>(in, count, &previous, &height);
+}
+
+/**
+* Builds the next count pairs into a subtree of the same shape that
+* buildBalanced() gives: the left half, then the middle pair, then the
+* right half, in the order they are read. previous points at the key read
+* last, for the key codec. If reading fails, whatever was built so far is
+* freed before the exception goes on.
+*/
+template<class Key, class Value>
+template<typename KeyCodec, typename ValueCodec>
+AVLNode<Key, Value>* AVLTree<Key, Value>::buildFromSnapshot(SnapshotReader& in, size_t count,
+    const Key** previous, int* height)
+{
+    if(count == 0){
+        *height = 0;
+        return nullptr;
+    }
+    size_t leftCount = count / 2;
+    int leftHeight = 0, rightHeight = 0;
+    AVLNode<Key, Value>* left = buildFromSnapshot<KeyCodec, ValueCodec>(in, leftCount, previous, &leftHeight);
+    AVLNode<Key, Value>* current = nullptr;
+    try{
+        Key key = KeyCodec::read(in, *previous);
+        Value value = ValueCodec::read(in, nullptr);
+        current = this->template createNode<AVLNode<Key, Value> >(key, value, nullptr);
+    }
+    catch(...){
+        this->clearHelper(left);
+        throw;
+    }
+    current->setLeft(left);
+    if(left != nullptr){
+        left->setParent(current);
+    }
+    *previous = &(current->getKey());
+
+    AVLNode<Key, Value>* right = nullptr;
+    try{
+        right = buildFromSnapshot<KeyCodec, ValueCodec>(in, count - leftCount - 1, previous, &rightHeight);
+    }
+    catch(...){
+        this->clearHelper(current);
+        throw;
+    }
+    current->setRight(right);
+    if(right != nullptr){
+        right->setParent(current);
+    }
+    current->setBalance(rightHeight - leftHeight);
+    current->updateSubtreeSize();
+    *height = 1 + std::max(leftHeight, rightHeight);
+    return current;
+}
+
 template<typename Key, typename Value>
 AVLNode<Key, Value>* AVLTree<Key, Value>::getPredecessor(AVLNode<Key, Value>* current){
     if (current == nullptr){
@@ -242,83 +534,54 @@ void AVLTree<Key, Value>::printSpecificNode(int directions[]) const
 template<class Key, class Value>
 void AVLTree<Key, Value>::insert (const std::pair<const Key, Value> &newpair)
 {
-    // TODO
-  // cout << "INSERTING " << newpair.first << endl;
-  // this->printRoot(this->root_);
-
-  if(this->root_ == nullptr){
-    this->root_ = new AVLNode<Key, Value>(newpair.first, newpair.second, nullptr);
+  Node<Key, Value>* parent;
+  bool left;
+  size_t depth;
+  Node<Key, Value>* found = this->findSlot(newpair.first, &parent, &left, &depth);
+  if(found != nullptr){
+    found->setValue(newpair.second);
     return;
-  }  
-
-  // cout << "LEFT HEIGHT: " << getSubtreeHeight(this->root_->getLeft(), 0) << endl;
-  // cout << "RIGHT HEIGHT: " << getSubtreeHeight(this->root_->getRight(), 0) << endl;
-
-  AVLNode<Key, Value>* temp = static_cast<AVLNode<Key, Value>*>(this->root_);
-    // cout << "========= ROOT BALANCE: " << temp->getBalance() << " ==========" << endl;
+  }
+  insertLeaf(parent, left, depth, newpair.first, newpair.second);
+}
 
-  while(true){
-    // If it finds a key thats the same
-    if(temp->getKey() == newpair.first){
-      // Overwrite it and exit
-      temp->setValue(newpair.second);
-      return;
-    }
-    // If its greater than the current node
-    if(newpair.first > temp->getKey()){
-      // If it has a right child, go to the right
-      if(temp->getRight() != nullptr){
-        temp = temp->getRight();
-      }
-      // If it doesnt have a right child
-      else{
-        AVLNode<Key, Value>* newNode = new AVLNode<Key, Value>(newpair.first, newpair.second, temp);
-        temp->setRight(newNode);
-        break;
-      }
-    }
-    // If its less than the current node
-    if(newpair.first < temp->getKey()){
-      // If it has a left child, go to the left
-      if(temp->getLeft() != nullptr){
-        temp = temp->getLeft();
-      }
-      // If it doesnt have a left child
-      else{
-        AVLNode<Key, Value>* newNode = new AVLNode<Key, Value>(newpair.first, newpair.second, temp);
-        temp->setLeft(newNode);
-        break;
-      }
-    }
+/**
+* Hangs a new AVLNode where findSlot() found room for it, then fixes the
+* balances from its parent up, rotating where needed.
+*/
+template<class Key, class Value>
+Node<Key, Value>* AVLTree<Key, Value>::insertLeaf(Node<Key, Value>* parentNode, bool left, size_t depth,
+    const Key& key, const Value& value)
+{
+  (void)depth;
+  AVLNode<Key, Value>* temp = static_cast<AVLNode<Key, Value>*>(parentNode);
+  AVLNode<Key, Value>* newNode = this->template createNode<AVLNode<Key, Value> >(key, value, temp);
+  if(temp == nullptr){
+    this->root_ = newNode;
+    return newNode;
+  }
+  if(left){
+    temp->setLeft(newNode);
+  }
+  else{
+    temp->setRight(newNode);
   }
 
+  // Sizes first, so that the rotations below see correct child sizes
+  this->updateSizesToRoot(temp);
+
   if(temp->getBalance() == -1 || temp->getBalance() == 1){
     temp->setBalance(0);
-    return;
   }
-  if(temp->getBalance() == 0){
-    if(newpair.first < temp->getKey()){
-      temp->updateBalance(-1);
-      insert_fix(temp, temp->getLeft());
-    }
-    else{
-      temp->updateBalance(1);
-      insert_fix(temp, temp->getRight());
-    }
+  else if(left){
+    temp->updateBalance(-1);
+    insert_fix(temp, newNode);
   }
-
-
-
-  // if(getSubtreeHeight(this->root_->getLeft(), 0) > getSubtreeHeight(this->root_->getRight(), 0) + 1){
-  //   insert_fix(temp->getLeft(), temp->getLeft()->getLeft());
-  // }
-  // if(getSubtreeHeight(this->root_->getRight(), 0) > getSubtreeHeight(this->root_->getLeft(), 0) + 1){
-  //   insert_fix(temp->getRight(), temp->getLeft()->getRight());
-  // }
-
-  // cout << "LEFT HEIGHT: " << getSubtreeHeight(this->root_->getLeft(), 0) << endl;
-  // cout << "RIGHT HEIGHT: " << getSubtreeHeight(this->root_->getRight(), 0) << endl;
-
+  else{
+    temp->updateBalance(1);
+    insert_fix(temp, newNode);
+  }
+  return newNode;
 }
 
 template<class Key, class Value>
@@ -408,62 +671,57 @@ void AVLTree<Key, Value>::insert_fix(AVLNode<Key,Value>* parent, AVLNode<Key,Val
 
 template<class Key, class Value>
 void AVLTree<Key, Value>::rotateRight(AVLNode<Key,Value>* grandparent){
-  // cout << "ROTATE RIGHT IS GETTING CALLED" << endl;
-  // cout << "------------------------------" << endl << endl;
-  //     this->printRoot(this->root_);
-  // cout << endl << endl << "------------------------------";
+  AVLNode<Key, Value>* parent = rotateRightNodes(grandparent);
+  if(parent->getParent() == nullptr){
+    this->root_ = parent;
+  }
+}
 
+template<class Key, class Value>
+void AVLTree<Key, Value>::rotateLeft(AVLNode<Key,Value>* grandparent){
+  AVLNode<Key, Value>* parent = rotateLeftNodes(grandparent);
+  if(parent->getParent() == nullptr){
+    this->root_ = parent;
+  }
+}
+
+/**
+* The pointer work of a right rotation. Unlike rotateRight() it never touches
+* root_, so it also works on subtrees that are not hung in any tree.
+* Returns the node that took grandparent's place.
+*/
+template<class Key, class Value>
+AVLNode<Key, Value>* AVLTree<Key, Value>::rotateRightNodes(AVLNode<Key,Value>* grandparent){
   AVLNode<Key, Value>* parent  = grandparent->getLeft();
-  // cout << "PARENT PRE: " << parent->getKey() << endl;
   parent->setParent(grandparent->getParent());
   // if grandparent isnt the root
-    // cout << "=====   3    =====" << endl;
-
   if(grandparent->getParent() != nullptr){
-      // cout << "=====   4    =====" << endl;
-
     // If grandparent is a left child
     if(grandparent->getParent()->getLeft() == grandparent){
-        // cout << "=====   5    =====" << endl;
-
       grandparent->getParent()->setLeft(parent);
     }
     // Otherwise, it must be a right child
     else{
-        // cout << "=====   6    =====" << endl;
-
       grandparent->getParent()->setRight(parent);
     }
-      // cout << "=====   7    =====" << endl;
-
-  }
-  else{
-    this->root_ = parent;
   }
 
-
   grandparent->setLeft(parent->getRight());
   if(parent->getRight() != nullptr){
     parent->getRight()->setParent(grandparent);
   }
-
   parent->setRight(grandparent);
-
   grandparent->setParent(parent);
-  // cout << endl << "Parent: " << parent->getKey() << endl;
-  // cout << endl << "Root: " << this->root_->getKey() << endl;
-
-  // cout << endl << "Left: " << this->root_->getLeft()->getKey() << endl;
-  // cout << endl << "Right: " << parent->getRight()->getKey() << endl;
-
-  // cout << "------------------------------" << endl << endl;
-  //     this->printRoot(this->root_);
-  // cout << endl << endl << "------------------------------";
+  grandparent->updateSubtreeSize();
+  parent->updateSubtreeSize();
+  return parent;
 }
 
+/**
+* The pointer work of a left rotation, see rotateRightNodes().
+*/
 template<class Key, class Value>
-void AVLTree<Key, Value>::rotateLeft(AVLNode<Key,Value>* grandparent){
-
+AVLNode<Key, Value>* AVLTree<Key, Value>::rotateLeftNodes(AVLNode<Key,Value>* grandparent){
   AVLNode<Key, Value>* parent  = grandparent->getRight();
   parent->setParent(grandparent->getParent());
   // if grandparent isnt the root
@@ -477,17 +735,16 @@ void AVLTree<Key, Value>::rotateLeft(AVLNode<Key,Value>* grandparent){
       grandparent->getParent()->setRight(parent);
     }
   }
-  else{
-    this->root_ = parent;
-  }
-  
+
   grandparent->setRight(parent->getLeft());
   if(parent->getLeft() != nullptr){
     parent->getLeft()->setParent(grandparent);
   }
   parent->setLeft(grandparent);
   grandparent->setParent(parent);
-
+  grandparent->updateSubtreeSize();
+  parent->updateSubtreeSize();
+  return parent;
 }
 
 
@@ -500,114 +757,771 @@ void AVLTree<Key, Value>::rotateLeft(AVLNode<Key,Value>* grandparent){
 template<class Key, class Value>
 void AVLTree<Key, Value>:: remove(const Key& key)
 {
-    // TODO
-    AVLNode<Key, Value>* temp = static_cast<AVLNode<Key, Value>*>(this->root_);
-    // find the node
-    while (true) {
-        if (temp == NULL){
-            return;
-        } 
-        if (key == temp->getKey()) {
-            break;
-        }
-        if (key < temp->getKey()) {
-            temp = temp->getLeft();
-        }
-        else {
-            temp = temp->getRight();
-        }
+    erase(key);
+}
+
+/**
+* An AVLTree is always balanced, and a scapegoat rebuild would leave
+* every balance it moves stale, so scapegoat mode can't be turned on.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::setScapegoatAlpha(double alpha)
+{
+    if(alpha != 0){
+        throw std::logic_error("AVLTree does not support scapegoat mode");
+    }
+}
+
+/**
+* Relinks the nodes into a complete tree as the plain tree does. With
+* every level full but the last, no two sibling subtrees differ in height
+* by more than 1, so the shape is a valid AVL tree once the balances are
+* recomputed for it.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::rebalance()
+{
+    BinarySearchTree<Key, Value>::rebalance();
+    resetBalances(static_cast<AVLNode<Key, Value>*>(this->root_));
+}
+
+/**
+* Not supported: a shape weighted by lookups is generally not an AVL tree.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::rebuildOptimal()
+{
+    throw std::logic_error("AVLTree cannot be rebuilt for lookup weights");
+}
+
+/**
+* Sets every balance under current from the subtree heights, and returns
+* the height of current's subtree. O(n).
+*/
+template<class Key, class Value>
+int AVLTree<Key, Value>::resetBalances(AVLNode<Key, Value>* current)
+{
+    if(current == nullptr){
+        return 0;
+    }
+    int leftHeight = resetBalances(current->getLeft());
+    int rightHeight = resetBalances(current->getRight());
+    current->setBalance(rightHeight - leftHeight);
+    return 1 + std::max(leftHeight, rightHeight);
+}
+
+/**
+* Removes key like remove(), and returns the number of keys removed, 0 or
+* 1, as std::map::erase() does, so callers need no find() first.
+*/
+template<class Key, class Value>
+size_t AVLTree<Key, Value>::erase(const Key& key)
+{
+    AVLNode<Key, Value>* temp = static_cast<AVLNode<Key, Value>*>(this->internalFind(key));
+    if(temp == nullptr){
+        return 0;
     }
-    bool blank = true;
-    if(this->recursiveBalancedCall(this->root_, &blank) >= 3){
+
+    // If it has 2 children, swap with the predecessor so it has at most 1
+    if(temp->getLeft() != nullptr && temp->getRight() != nullptr){
+        nodeSwap(temp, getPredecessor(temp));
+    }
+
+    AVLNode<Key, Value>* parent = temp->getParent();
+    int diff = 0;
+    if(parent != nullptr){
+        // Losing a left child makes the parent right heavier and vice versa
+        diff = (parent->getLeft() == temp) ? 1 : -1;
+    }
+
+    // Promote the only child (or nothing) into temp's place
+    AVLNode<Key, Value>* child = temp->getLeft();
+    if(child == nullptr){
+        child = temp->getRight();
+    }
+    if(child != nullptr){
+        child->setParent(parent);
+    }
+    if(parent == nullptr){
+        this->root_ = child;
+    }
+    else if(parent->getLeft() == temp){
+        parent->setLeft(child);
+    }
+    else{
+        parent->setRight(child);
+    }
+
+    this->destroyNode(temp);
+    this->updateSizesToRoot(parent);
+    removeFix(parent, diff);
+    return 1;
+}
+
+/**
+* Walks up from the parent of a removed node, adding diff to each balance
+* and rotating where a subtree became 2 out of balance. Stops as soon as
+* a subtree's height is unchanged, so it touches O(log n) nodes.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::removeFix(AVLNode<Key,Value>* node, int diff)
+{
+    if(node == nullptr){
         return;
     }
-    // while(this->root_ == temp){
-    if(temp->getParent() == nullptr){
-        if(temp->getLeft() == nullptr && temp->getRight() == nullptr){
-            delete temp;
-            this->root_ = nullptr;
-        }
-        else if(temp->getLeft() != nullptr && temp->getRight() != nullptr){
-            this->root_ = temp->getLeft();
-            temp->getLeft()->setRight(temp->getRight());
-            temp->getLeft()->setParent(nullptr);
-            delete temp;
-        }
-        else if(temp->getLeft() != nullptr){
-            this->root_ = temp->getLeft();
-            temp->getLeft()->setParent(nullptr);
-            delete temp;
+    AVLNode<Key, Value>* parent = node->getParent();
+    int nextDiff = 0;
+    if(parent != nullptr){
+        nextDiff = (parent->getLeft() == node) ? 1 : -1;
+    }
+
+    int balance = node->getBalance() + diff;
+    // Right heavy
+    if(balance == 2){
+        AVLNode<Key, Value>* child = node->getRight();
+        if(child->getBalance() == 1){
+            rotateLeft(node);
+            node->setBalance(0);
+            child->setBalance(0);
+            removeFix(parent, nextDiff);
         }
-        else if(temp->getRight() != nullptr){
-            this->root_ = temp->getLeft();
-            temp->getLeft()->setParent(nullptr);
-            delete temp;
-        // }
+        else if(child->getBalance() == 0){
+            rotateLeft(node);
+            node->setBalance(1);
+            child->setBalance(-1);
         }
-    }
-    else{
-        if(temp->getLeft() == nullptr && temp->getRight() == nullptr){
-            if(temp == temp->getParent()->getLeft()){
-                temp->getParent()->setLeft(nullptr);
+        else{
+            AVLNode<Key, Value>* grandchild = child->getLeft();
+            rotateRight(child);
+            rotateLeft(node);
+            if(grandchild->getBalance() == 1){
+                node->setBalance(-1);
+                child->setBalance(0);
+            }
+            else if(grandchild->getBalance() == 0){
+                node->setBalance(0);
+                child->setBalance(0);
             }
             else{
-                temp->getParent()->setRight(nullptr);
+                node->setBalance(0);
+                child->setBalance(1);
             }
-            delete temp;
+            grandchild->setBalance(0);
+            removeFix(parent, nextDiff);
+        }
+    }
+    // Left heavy
+    else if(balance == -2){
+        AVLNode<Key, Value>* child = node->getLeft();
+        if(child->getBalance() == -1){
+            rotateRight(node);
+            node->setBalance(0);
+            child->setBalance(0);
+            removeFix(parent, nextDiff);
+        }
+        else if(child->getBalance() == 0){
+            rotateRight(node);
+            node->setBalance(-1);
+            child->setBalance(1);
         }
-        else if(temp->getLeft() != nullptr && temp->getRight() != nullptr){
-            temp->getLeft()->setRight(temp->getRight());
-            temp->getLeft()->setParent(temp->getParent());
-            if(temp == temp->getParent()->getLeft()){
-                temp->getParent()->setLeft(temp->getLeft());
+        else{
+            AVLNode<Key, Value>* grandchild = child->getRight();
+            rotateLeft(child);
+            rotateRight(node);
+            if(grandchild->getBalance() == -1){
+                node->setBalance(1);
+                child->setBalance(0);
+            }
+            else if(grandchild->getBalance() == 0){
+                node->setBalance(0);
+                child->setBalance(0);
             }
             else{
-                temp->getParent()->setRight(temp->getLeft());
+                node->setBalance(0);
+                child->setBalance(-1);
             }
-            delete temp;
+            grandchild->setBalance(0);
+            removeFix(parent, nextDiff);
+        }
+    }
+    // The subtree got shorter, so the parent needs fixing too
+    else if(balance == 0){
+        node->setBalance(0);
+        removeFix(parent, nextDiff);
+    }
+    // Height unchanged
+    else{
+        node->setBalance(balance);
+    }
+}
+
+
+
+template<class Key, class Value>
+void AVLTree<Key, Value>::nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2)
+{
+    BinarySearchTree<Key, Value>::nodeSwap(n1, n2);
+    int8_t tempB = n1->getBalance();
+    n1->setBalance(n2->getBalance());
+    n2->setBalance(tempB);
+}
+
+/*
+  -------------------------------------------------
+  Begin implementations for join, split and set operations.
+  -------------------------------------------------
+*/
+
+/**
+* Makes this tree hold every pair of left, then pivot, then every pair of
+* right, and empties left and right. All keys in left must be smaller than
+* the pivot's and all keys in right bigger. Runs in O(log n).
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::join(AVLTree<Key, Value>& left, const std::pair<const Key, Value>& pivot, AVLTree<Key, Value>& right)
+{
+    if(&left == this || &right == this || &left == &right){
+        throw std::invalid_argument("AVLTree::join needs three different trees");
+    }
+    AVLNode<Key, Value>* leftRoot = static_cast<AVLNode<Key, Value>*>(left.root_);
+    AVLNode<Key, Value>* rightRoot = static_cast<AVLNode<Key, Value>*>(right.root_);
+
+    // Check the order against the largest key on the left and the smallest on the right
+    Node<Key, Value>* temp = leftRoot;
+    while(temp != nullptr && temp->getRight() != nullptr){
+        temp = temp->getRight();
+    }
+    if(temp != nullptr && !(temp->getKey() < pivot.first)){
+        throw std::invalid_argument("AVLTree::join keys out of order");
+    }
+    temp = rightRoot;
+    while(temp != nullptr && temp->getLeft() != nullptr){
+        temp = temp->getLeft();
+    }
+    if(temp != nullptr && !(pivot.first < temp->getKey())){
+        throw std::invalid_argument("AVLTree::join keys out of order");
+    }
+
+    this->checkNodesFrom(left);
+    this->checkNodesFrom(right);
+
+    // The middle node is made first, while pivot is still valid even if it
+    // is an item of this tree, and out of left's memory, which this tree
+    // takes over below. If anything throws, left and right are unchanged.
+    AVLNode<Key, Value>* middle = left.template createNode<AVLNode<Key, Value> >(pivot.first, pivot.second, nullptr);
+    this->clear();
+    try{
+        this->takeNodesFrom(left);
+    }
+    catch(...){
+        left.destroyNode(middle);
+        throw;
+    }
+    try{
+        this->takeNodesFrom(right);
+    }
+    catch(...){
+        // This tree holds just left's old memory, which fits back into
+        // left's arena without allocating
+        left.takeNodesFrom(*this);
+        left.destroyNode(middle);
+        throw;
+    }
+    left.root_ = nullptr;
+    right.root_ = nullptr;
+
+    int height = 0;
+    this->root_ = joinNodes(leftRoot, subtreeHeight(leftRoot), middle, rightRoot, subtreeHeight(rightRoot), &height);
+}
+
+/**
+* Moves the keys smaller than key into less and the rest into greater,
+* leaving this tree empty. Returns true if key itself was in the tree
+* (it ends up in greater). Runs in O(log n).
+*/
+template<class Key, class Value>
+bool AVLTree<Key, Value>::split(const Key& key, AVLTree<Key, Value>& less, AVLTree<Key, Value>& greater)
+{
+    if(&less == this || &greater == this || &less == &greater){
+        throw std::invalid_argument("AVLTree::split needs three different trees");
+    }
+    // Both checks come first, so a mismatch leaves all three trees as they were
+    less.checkNodesFrom(*this);
+    less.checkNodesFrom(greater);
+    less.clear();
+    greater.clear();
+    AVLNode<Key, Value>* root = static_cast<AVLNode<Key, Value>*>(this->root_);
+    less.takeNodesFrom(*this);
+    less.shareNodesWith(greater);
+    this->root_ = nullptr;
+
+    AVLNode<Key, Value>* lessRoot = nullptr;
+    AVLNode<Key, Value>* found = nullptr;
+    AVLNode<Key, Value>* greaterRoot = nullptr;
+    int lessHeight = 0, greaterHeight = 0;
+    splitNodes(root, subtreeHeight(root), key, &lessRoot, &lessHeight, &found, &greaterRoot, &greaterHeight);
+    if(found != nullptr){
+        greaterRoot = joinNodes(nullptr, 0, found, greaterRoot, greaterHeight, &greaterHeight);
+    }
+    less.root_ = lessRoot;
+    greater.root_ = greaterRoot;
+    return found != nullptr;
+}
+
+/**
+* Adds every pair of other to this tree, overwriting the values of keys
+* that are in both (as insert() would), and leaves other empty.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::setUnion(AVLTree<Key, Value>& other)
+{
+    runSetOperation(SET_UNION, other);
+}
+
+/**
+* Keeps only the keys that are also in other, and leaves other empty.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::setIntersection(AVLTree<Key, Value>& other)
+{
+    runSetOperation(SET_INTERSECTION, other);
+}
+
+/**
+* Removes every key that is in other, and leaves other empty.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::setDifference(AVLTree<Key, Value>& other)
+{
+    runSetOperation(SET_DIFFERENCE, other);
+}
+
+/**
+* Runs a set operation over the nodes of both trees. The top levels of
+* the recursion are split across threads, one level per doubling of the
+* hardware threads. Nodes that drop out are freed once all threads are done.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::runSetOperation(SetOperation op, AVLTree<Key, Value>& other)
+{
+    if(&other == this){
+        if(op == SET_DIFFERENCE){
+            this->clear();
+        }
+        return;
+    }
+    AVLNode<Key, Value>* a = static_cast<AVLNode<Key, Value>*>(this->root_);
+    AVLNode<Key, Value>* b = static_cast<AVLNode<Key, Value>*>(other.root_);
+    this->takeNodesFrom(other);
+    other.root_ = nullptr;
+
+    int depth = 0;
+    while((1u << depth) < std::thread::hardware_concurrency()){
+        depth++;
+    }
+    std::vector<AVLNode<Key, Value>*> dropped;
+    int height = 0;
+    this->root_ = setOperation(op, a, subtreeHeight(a), b, subtreeHeight(b), &height, &dropped, depth);
+    for(size_t i = 0; i < dropped.size(); i++){
+        this->destroyNode(dropped[i]);
+    }
+}
+
+/**
+* The height of the subtree under current, found in O(log n) by following
+* the taller child down.
+*/
+template<class Key, class Value>
+int AVLTree<Key, Value>::subtreeHeight(AVLNode<Key, Value>* current)
+{
+    int height = 0;
+    while(current != nullptr){
+        height++;
+        if(current->getBalance() < 0){
+            current = current->getLeft();
+        }
+        else{
+            current = current->getRight();
+        }
+    }
+    return height;
+}
+
+/**
+* Called when the right (fromRight) or left subtree of node grew by one
+* level. Like insert_fix it walks up updating balances and rotating, but
+* it also handles a grown child with a balance of 0, which join can make.
+* Returns true if the growth reached the top of the subtree.
+*/
+template<class Key, class Value>
+bool AVLTree<Key, Value>::growFix(AVLNode<Key, Value>* node, bool fromRight)
+{
+    while(node != nullptr){
+        node->updateBalance(fromRight ? 1 : -1);
+        // The node at the top of the grown subtree
+        AVLNode<Key, Value>* top = node;
+        if(node->getBalance() == 0){
+            return false;
         }
-        else if(temp->getLeft() != nullptr){
-            temp->getLeft()->setParent(temp->getParent());
-            if(temp == temp->getParent()->getLeft()){
-                temp->getParent()->setLeft(temp->getLeft());
+        // Right heavy
+        else if(node->getBalance() == 2){
+            AVLNode<Key, Value>* child = node->getRight();
+            if(child->getBalance() == 1){
+                rotateLeftNodes(node);
+                node->setBalance(0);
+                child->setBalance(0);
+                return false;
+            }
+            else if(child->getBalance() == 0){
+                rotateLeftNodes(node);
+                node->setBalance(1);
+                child->setBalance(-1);
+                top = child;
             }
             else{
-                temp->getParent()->setRight(temp->getLeft());
+                AVLNode<Key, Value>* grandchild = child->getLeft();
+                rotateRightNodes(child);
+                rotateLeftNodes(node);
+                node->setBalance(grandchild->getBalance() == 1 ? -1 : 0);
+                child->setBalance(grandchild->getBalance() == -1 ? 1 : 0);
+                grandchild->setBalance(0);
+                return false;
             }
-            delete temp;
         }
-        else if(temp->getRight() != nullptr){
-            temp->getLeft()->setParent(temp->getParent());
-            if(temp == temp->getParent()->getLeft()){
-                temp->getParent()->setLeft(temp->getRight());
+        // Left heavy
+        else if(node->getBalance() == -2){
+            AVLNode<Key, Value>* child = node->getLeft();
+            if(child->getBalance() == -1){
+                rotateRightNodes(node);
+                node->setBalance(0);
+                child->setBalance(0);
+                return false;
+            }
+            else if(child->getBalance() == 0){
+                rotateRightNodes(node);
+                node->setBalance(-1);
+                child->setBalance(1);
+                top = child;
             }
             else{
-                temp->getParent()->setRight(temp->getRight());
+                AVLNode<Key, Value>* grandchild = child->getRight();
+                rotateLeftNodes(child);
+                rotateRightNodes(node);
+                node->setBalance(grandchild->getBalance() == -1 ? 1 : 0);
+                child->setBalance(grandchild->getBalance() == 1 ? -1 : 0);
+                grandchild->setBalance(0);
+                return false;
             }
-            delete temp;
-        // }
         }
+
+        AVLNode<Key, Value>* parent = top->getParent();
+        if(parent != nullptr){
+            fromRight = (parent->getRight() == top);
+        }
+        node = parent;
     }
+    return true;
+}
 
+/**
+* Joins two detached subtrees and a detached pivot whose key lies between
+* them. If their heights are close the pivot just becomes the root;
+* otherwise the pivot is hung on the inner spine of the taller subtree at
+* the height of the shorter one and the path above it is rebalanced.
+* Costs O(|leftHeight - rightHeight| + 1). Sets height to the new height.
+*/
+template<class Key, class Value>
+AVLNode<Key, Value>* AVLTree<Key, Value>::joinNodes(AVLNode<Key, Value>* left, int leftHeight,
+    AVLNode<Key, Value>* pivot, AVLNode<Key, Value>* right, int rightHeight, int* height)
+{
+    pivot->setParent(nullptr);
+    if(leftHeight - rightHeight <= 1 && rightHeight - leftHeight <= 1){
+        pivot->setLeft(left);
+        pivot->setRight(right);
+        if(left != nullptr){
+            left->setParent(pivot);
+        }
+        if(right != nullptr){
+            right->setParent(pivot);
+        }
+        pivot->setBalance(rightHeight - leftHeight);
+        pivot->updateSubtreeSize();
+        *height = 1 + std::max(leftHeight, rightHeight);
+        return pivot;
+    }
 
-}
+    bool tallLeft = leftHeight > rightHeight;
+    AVLNode<Key, Value>* tallRoot = tallLeft ? left : right;
+    AVLNode<Key, Value>* shortRoot = tallLeft ? right : left;
+    int tallHeight = tallLeft ? leftHeight : rightHeight;
+    int shortHeight = tallLeft ? rightHeight : leftHeight;
+
+    // Walk down the inner spine to a subtree at most one level taller than the short side
+    AVLNode<Key, Value>* parent = nullptr;
+    AVLNode<Key, Value>* current = tallRoot;
+    int currentHeight = tallHeight;
+    while(currentHeight > shortHeight + 1){
+        parent = current;
+        if(tallLeft){
+            currentHeight -= (current->getBalance() < 0) ? 2 : 1;
+            current = current->getRight();
+        }
+        else{
+            currentHeight -= (current->getBalance() > 0) ? 2 : 1;
+            current = current->getLeft();
+        }
+    }
 
+    // The pivot takes current's place with current and the short side as children
+    if(tallLeft){
+        pivot->setLeft(current);
+        pivot->setRight(shortRoot);
+        pivot->setBalance(shortHeight - currentHeight);
+        parent->setRight(pivot);
+    }
+    else{
+        pivot->setLeft(shortRoot);
+        pivot->setRight(current);
+        pivot->setBalance(currentHeight - shortHeight);
+        parent->setLeft(pivot);
+    }
+    if(current != nullptr){
+        current->setParent(pivot);
+    }
+    if(shortRoot != nullptr){
+        shortRoot->setParent(pivot);
+    }
+    pivot->setParent(parent);
+    BinarySearchTree<Key, Value>::updateSizesToRoot(pivot);
 
+    // The pivot's subtree is one level taller than current's was
+    bool grew = growFix(parent, tallLeft);
+    *height = tallHeight + (grew ? 1 : 0);
 
+    AVLNode<Key, Value>* root = pivot;
+    while(root->getParent() != nullptr){
+        root = root->getParent();
+    }
+    return root;
+}
 
+/**
+* Joins two detached subtrees without a pivot by using the largest node on
+* the left as the pivot.
+*/
+template<class Key, class Value>
+AVLNode<Key, Value>* AVLTree<Key, Value>::joinNodes(AVLNode<Key, Value>* left, int leftHeight,
+    AVLNode<Key, Value>* right, int rightHeight, int* height)
+{
+    if(left == nullptr){
+        *height = rightHeight;
+        return right;
+    }
+    if(right == nullptr){
+        *height = leftHeight;
+        return left;
+    }
+    AVLNode<Key, Value>* rest = nullptr;
+    AVLNode<Key, Value>* last = nullptr;
+    int restHeight = 0;
+    splitLast(left, leftHeight, &rest, &restHeight, &last);
+    return joinNodes(rest, restHeight, last, right, rightHeight, height);
+}
 
+/**
+* Splits a detached subtree into the keys less than key, the node with the
+* key if there is one, and the keys greater than key. Each level joins the
+* side it did not recurse into back onto the result, and the heights of
+* those joins telescope, so the whole split is O(log n).
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::splitNodes(AVLNode<Key, Value>* current, int height, const Key& key,
+    AVLNode<Key, Value>** less, int* lessHeight, AVLNode<Key, Value>** found,
+    AVLNode<Key, Value>** greater, int* greaterHeight)
+{
+    if(current == nullptr){
+        *less = nullptr;
+        *greater = nullptr;
+        *found = nullptr;
+        *lessHeight = 0;
+        *greaterHeight = 0;
+        return;
+    }
+    AVLNode<Key, Value>* left = current->getLeft();
+    AVLNode<Key, Value>* right = current->getRight();
+    int leftHeight = height - 1 - (current->getBalance() > 0 ? 1 : 0);
+    int rightHeight = height - 1 - (current->getBalance() < 0 ? 1 : 0);
+    if(left != nullptr){
+        left->setParent(nullptr);
+    }
+    if(right != nullptr){
+        right->setParent(nullptr);
+    }
+    current->setLeft(nullptr);
+    current->setRight(nullptr);
+    current->setParent(nullptr);
+    current->setBalance(0);
+    current->updateSubtreeSize();
+
+    if(key < current->getKey()){
+        AVLNode<Key, Value>* middle = nullptr;
+        int middleHeight = 0;
+        splitNodes(left, leftHeight, key, less, lessHeight, found, &middle, &middleHeight);
+        *greater = joinNodes(middle, middleHeight, current, right, rightHeight, greaterHeight);
+    }
+    else if(current->getKey() < key){
+        AVLNode<Key, Value>* middle = nullptr;
+        int middleHeight = 0;
+        splitNodes(right, rightHeight, key, &middle, &middleHeight, found, greater, greaterHeight);
+        *less = joinNodes(left, leftHeight, current, middle, middleHeight, lessHeight);
+    }
+    else{
+        *less = left;
+        *lessHeight = leftHeight;
+        *found = current;
+        *greater = right;
+        *greaterHeight = rightHeight;
+    }
+}
 
+/**
+* Takes the largest node out of a detached subtree.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::splitLast(AVLNode<Key, Value>* current, int height,
+    AVLNode<Key, Value>** rest, int* restHeight, AVLNode<Key, Value>** last)
+{
+    AVLNode<Key, Value>* left = current->getLeft();
+    AVLNode<Key, Value>* right = current->getRight();
+    int leftHeight = height - 1 - (current->getBalance() > 0 ? 1 : 0);
+    int rightHeight = height - 1 - (current->getBalance() < 0 ? 1 : 0);
+    if(left != nullptr){
+        left->setParent(nullptr);
+    }
+    if(right != nullptr){
+        right->setParent(nullptr);
+    }
+    current->setLeft(nullptr);
+    current->setRight(nullptr);
+    current->setParent(nullptr);
+    current->setBalance(0);
+    current->updateSubtreeSize();
+
+    if(right == nullptr){
+        *rest = left;
+        *restHeight = leftHeight;
+        *last = current;
+        return;
+    }
+    AVLNode<Key, Value>* rightRest = nullptr;
+    int rightRestHeight = 0;
+    splitLast(right, rightHeight, &rightRest, &rightRestHeight, last);
+    *rest = joinNodes(left, leftHeight, current, rightRest, rightRestHeight, restHeight);
+}
 
+/**
+* Union, intersection or difference of two detached subtrees: split a
+* around the root of b, recurse on the two halves and join the results.
+* That is O(m log(n/m + 1)) work for trees of m <= n keys. While depth is
+* positive and both sides are big enough the two halves run in parallel.
+* Nodes that are not part of the result are collected in dropped.
+*/
 template<class Key, class Value>
-void AVLTree<Key, Value>::nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2)
+AVLNode<Key, Value>* AVLTree<Key, Value>::setOperation(SetOperation op, AVLNode<Key, Value>* a, int aHeight,
+    AVLNode<Key, Value>* b, int bHeight, int* height, std::vector<AVLNode<Key, Value>*>* dropped, int depth)
 {
-    BinarySearchTree<Key, Value>::nodeSwap(n1, n2);
-    int8_t tempB = n1->getBalance();
-    n1->setBalance(n2->getBalance());
-    n2->setBalance(tempB);
+    if(b == nullptr){
+        if(op == SET_INTERSECTION){
+            dropSubtree(a, dropped);
+            *height = 0;
+            return nullptr;
+        }
+        *height = aHeight;
+        return a;
+    }
+    if(a == nullptr){
+        if(op == SET_UNION){
+            *height = bHeight;
+            return b;
+        }
+        dropSubtree(b, dropped);
+        *height = 0;
+        return nullptr;
+    }
+
+    // Take b apart at its root and split a around the same key
+    AVLNode<Key, Value>* pivot = b;
+    AVLNode<Key, Value>* bLeft = b->getLeft();
+    AVLNode<Key, Value>* bRight = b->getRight();
+    int bLeftHeight = bHeight - 1 - (b->getBalance() > 0 ? 1 : 0);
+    int bRightHeight = bHeight - 1 - (b->getBalance() < 0 ? 1 : 0);
+    if(bLeft != nullptr){
+        bLeft->setParent(nullptr);
+    }
+    if(bRight != nullptr){
+        bRight->setParent(nullptr);
+    }
+    pivot->setLeft(nullptr);
+    pivot->setRight(nullptr);
+    pivot->setBalance(0);
+    pivot->updateSubtreeSize();
+
+    AVLNode<Key, Value>* aLess = nullptr;
+    AVLNode<Key, Value>* aFound = nullptr;
+    AVLNode<Key, Value>* aGreater = nullptr;
+    int aLessHeight = 0, aGreaterHeight = 0;
+    splitNodes(a, aHeight, pivot->getKey(), &aLess, &aLessHeight, &aFound, &aGreater, &aGreaterHeight);
+
+    AVLNode<Key, Value>* low = nullptr;
+    AVLNode<Key, Value>* high = nullptr;
+    int lowHeight = 0, highHeight = 0;
+    if(depth > 0 && std::min(aHeight, bHeight) >= 12){
+        std::vector<AVLNode<Key, Value>*> lowDropped;
+        std::thread worker([&](){
+            low = setOperation(op, aLess, aLessHeight, bLeft, bLeftHeight, &lowHeight, &lowDropped, depth - 1);
+        });
+        high = setOperation(op, aGreater, aGreaterHeight, bRight, bRightHeight, &highHeight, dropped, depth - 1);
+        worker.join();
+        dropped->insert(dropped->end(), lowDropped.begin(), lowDropped.end());
+    }
+    else{
+        low = setOperation(op, aLess, aLessHeight, bLeft, bLeftHeight, &lowHeight, dropped, 0);
+        high = setOperation(op, aGreater, aGreaterHeight, bRight, bRightHeight, &highHeight, dropped, 0);
+    }
+
+    if(op == SET_UNION){
+        // b's pair wins, as if it had been inserted
+        if(aFound != nullptr){
+            dropped->push_back(aFound);
+        }
+        return joinNodes(low, lowHeight, pivot, high, highHeight, height);
+    }
+    dropped->push_back(pivot);
+    if(op == SET_INTERSECTION && aFound != nullptr){
+        return joinNodes(low, lowHeight, aFound, high, highHeight, height);
+    }
+    if(aFound != nullptr){
+        dropped->push_back(aFound);
+    }
+    return joinNodes(low, lowHeight, high, highHeight, height);
 }
 
+template<class Key, class Value>
+void AVLTree<Key, Value>::dropSubtree(AVLNode<Key, Value>* current, std::vector<AVLNode<Key, Value>*>* dropped)
+{
+    if(current == nullptr){
+        return;
+    }
+    dropSubtree(current->getLeft(), dropped);
+    dropSubtree(current->getRight(), dropped);
+    dropped->push_back(current);
+}
 
-#endif
+/*
+  -------------------------------------------------
+  End implementations for join, split and set operations.
+  -------------------------------------------------
+*/
 
 
+#endif
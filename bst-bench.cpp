@@ -0,0 +1,814 @@
+//
+// Throughput benchmarks for the search trees.
+//
+// Build with "make bst-bench" (optimized) and run "./bst-bench [name]"
+// to run only the benchmarks whose name contains the argument.
+//
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cstdint>
+#include <thread>
+#include <mutex>
+#include <map>
+#include <sstream>
+#include <cstdio>
+#include <cmath>
+#include <cstdlib>
+#include "bst.h"
+#include "avlbst.h"
+#include "concurrent_avl.h"
+#include "sharded_avl.h"
+#include "btree.h"
+#include "compact_avl.h"
+#include "mapped_tree.h"
+#include "bulk_build.h"
+#include "durable_avl.h"
+#include "rbbst.h"
+#include "splaybst.h"
+
+using namespace std;
+
+// Keeps the optimizer from throwing away the results we compute
+volatile uint64_t benchSink;
+
+double secondsSince(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+void report(const string& name, uint64_t ops, double seconds)
+{
+    cout << "  " << name << ": " << ops / seconds / 1e6 << " Mops/s" << endl;
+}
+
+// Distinct random keys, in random order
+vector<uint64_t> randomKeys(size_t n, uint64_t seed)
+{
+    vector<uint64_t> keys(n);
+    for(size_t i = 0; i < n; i++) {
+        keys[i] = i * 2 + 1;
+    }
+    mt19937_64 gen(seed);
+    shuffle(keys.begin(), keys.end(), gen);
+    return keys;
+}
+
+// find() in a loop against find_many() in batches
+void benchFindMany()
+{
+    const size_t n = 1 << 21;
+    const size_t lookups = 1 << 22;
+    const size_t batch = 256;
+    cout << "find_many: " << n << " keys, " << lookups << " lookups in batches of " << batch << endl;
+
+    vector<uint64_t> keys = randomKeys(n, 1);
+    BinarySearchTree<uint64_t, uint64_t> tree;
+    for(size_t i = 0; i < n; i++) {
+        tree.insert(std::make_pair(keys[i], keys[i]));
+    }
+    // Half hits, half misses
+    mt19937_64 gen(2);
+    vector<uint64_t> queries(lookups);
+    for(size_t i = 0; i < lookups; i++) {
+        queries[i] = gen() % (2 * n);
+    }
+
+    uint64_t found = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(size_t i = 0; i < lookups; i++) {
+        if(tree.find(queries[i]) != tree.end()) found++;
+    }
+    report("find() loop", lookups, secondsSince(start));
+
+    vector<uint64_t> batchKeys(batch);
+    vector<BinarySearchTree<uint64_t, uint64_t>::iterator> results;
+    uint64_t foundMany = 0;
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < lookups; i += batch) {
+        batchKeys.assign(queries.begin() + i, queries.begin() + i + batch);
+        tree.find_many(batchKeys, results);
+        for(size_t j = 0; j < batch; j++) {
+            if(results[j] != tree.end()) foundMany++;
+        }
+    }
+    report("find_many()", lookups, secondsSince(start));
+
+    if(found != foundMany) {
+        cout << "  MISMATCH: " << found << " vs " << foundMany << endl;
+    }
+    benchSink = found;
+}
+
+// Runs work(thread, ops) on each of threads threads at once and returns
+// the combined throughput in Mops/s
+template<typename Work>
+double runThreads(unsigned threads, uint64_t opsPerThread, Work work)
+{
+    vector<std::thread> workers;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(unsigned t = 0; t < threads; t++) {
+        workers.push_back(std::thread(work, t, opsPerThread));
+    }
+    for(unsigned t = 0; t < threads; t++) {
+        workers[t].join();
+    }
+    return threads * opsPerThread / secondsSince(start) / 1e6;
+}
+
+// One thread's share of a workload: writePercent of the operations insert
+// or remove a random key, the rest look one up
+template<typename Find, typename Insert, typename Remove>
+void mixedOps(unsigned thread, uint64_t ops, uint64_t keyRange, unsigned writePercent,
+              Find find, Insert insert, Remove remove)
+{
+    mt19937_64 gen(thread + 100);
+    uint64_t found = 0;
+    for(uint64_t i = 0; i < ops; i++) {
+        uint64_t key = gen() % keyRange;
+        unsigned dice = gen() % 100;
+        if(dice < writePercent / 2) insert(key);
+        else if(dice < writePercent) remove(key);
+        else if(find(key)) found++;
+    }
+    benchSink = found;
+}
+
+// ConcurrentAVLTree and ShardedAVLMap against an AVLTree behind one mutex,
+// for read-only and mixed workloads as the number of threads doubles up to
+// the core count
+void benchConcurrent()
+{
+    const uint64_t n = 1 << 20;
+    const uint64_t opsPerThread = 1 << 20;
+    unsigned cores = std::thread::hardware_concurrency();
+    unsigned maxThreads = (cores > 2) ? cores : 2;
+    cout << "concurrent: " << n << " keys, " << opsPerThread << " ops per thread, "
+         << cores << " cores" << endl;
+
+    vector<uint64_t> keys = randomKeys(n, 3);
+    ConcurrentAVLTree<uint64_t, uint64_t> shared;
+    ShardedAVLMap<uint64_t, uint64_t> sharded;
+    AVLTree<uint64_t, uint64_t> locked;
+    std::mutex lock;
+    for(size_t i = 0; i < n; i++) {
+        shared.insert(std::make_pair(keys[i], keys[i]));
+        sharded.insert(std::make_pair(keys[i], keys[i]));
+        locked.insert(std::make_pair(keys[i], keys[i]));
+    }
+
+    const unsigned writePercents[] = { 0, 10 };
+    for(size_t w = 0; w < sizeof(writePercents) / sizeof(writePercents[0]); w++) {
+        unsigned writePercent = writePercents[w];
+        cout << "  " << (100 - writePercent) << "% reads, " << writePercent << "% writes" << endl;
+        for(unsigned threads = 1; threads <= maxThreads; threads *= 2) {
+            double concurrent = runThreads(threads, opsPerThread, [&](unsigned t, uint64_t ops) {
+                uint64_t value;
+                mixedOps(t, ops, 2 * n, writePercent,
+                    [&](uint64_t key) { return shared.find(key, value); },
+                    [&](uint64_t key) { shared.insert(std::make_pair(key, key)); },
+                    [&](uint64_t key) { shared.remove(key); });
+            });
+            double shards = runThreads(threads, opsPerThread, [&](unsigned t, uint64_t ops) {
+                uint64_t value;
+                mixedOps(t, ops, 2 * n, writePercent,
+                    [&](uint64_t key) { return sharded.find(key, value); },
+                    [&](uint64_t key) { sharded.insert(std::make_pair(key, key)); },
+                    [&](uint64_t key) { sharded.remove(key); });
+            });
+            double mutexed = runThreads(threads, opsPerThread, [&](unsigned t, uint64_t ops) {
+                mixedOps(t, ops, 2 * n, writePercent,
+                    [&](uint64_t key) { std::lock_guard<std::mutex> g(lock); return locked.find(key) != locked.end(); },
+                    [&](uint64_t key) { std::lock_guard<std::mutex> g(lock); locked.insert(std::make_pair(key, key)); },
+                    [&](uint64_t key) { std::lock_guard<std::mutex> g(lock); locked.remove(key); });
+            });
+            cout << "    " << threads << " threads: ConcurrentAVLTree " << concurrent
+                 << " Mops/s, ShardedAVLMap " << shards
+                 << " Mops/s, AVLTree + mutex " << mutexed << " Mops/s" << endl;
+        }
+    }
+}
+
+// Random inserts, half-hit lookups and a full in-order scan on one map
+template<typename Map>
+void benchMap(const string& name, const vector<uint64_t>& keys, const vector<uint64_t>& queries)
+{
+    Map map;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(size_t i = 0; i < keys.size(); i++) {
+        map.insert(std::make_pair(keys[i], keys[i]));
+    }
+    double insertSeconds = secondsSince(start);
+
+    uint64_t found = 0;
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < queries.size(); i++) {
+        if(map.find(queries[i]) != map.end()) found++;
+    }
+    double findSeconds = secondsSince(start);
+
+    uint64_t sum = 0;
+    start = chrono::steady_clock::now();
+    for(typename Map::iterator it = map.begin(); it != map.end(); ++it) {
+        sum += it->second;
+    }
+    double scanSeconds = secondsSince(start);
+
+    cout << "  " << name << ": insert " << keys.size() / insertSeconds / 1e6
+         << " Mops/s, find " << queries.size() / findSeconds / 1e6
+         << " Mops/s, scan " << keys.size() / scanSeconds / 1e6 << " Mops/s" << endl;
+    benchSink = found + sum;
+}
+
+// BTreeMap at a few fanouts against AVLTree and std::map
+void benchBTree()
+{
+    const size_t n = 1 << 21;
+    const size_t lookups = 1 << 22;
+    cout << "btree: " << n << " keys, " << lookups << " lookups" << endl;
+
+    vector<uint64_t> keys = randomKeys(n, 4);
+    mt19937_64 gen(5);
+    vector<uint64_t> queries(lookups);
+    for(size_t i = 0; i < lookups; i++) {
+        queries[i] = gen() % (2 * n);
+    }
+
+    benchMap<AVLTree<uint64_t, uint64_t> >("AVLTree", keys, queries);
+    benchMap<std::map<uint64_t, uint64_t> >("std::map", keys, queries);
+    benchMap<BTreeMap<uint64_t, uint64_t, 16> >("BTreeMap<16>", keys, queries);
+    benchMap<BTreeMap<uint64_t, uint64_t, 32> >("BTreeMap<32>", keys, queries);
+    benchMap<BTreeMap<uint64_t, uint64_t, 64> >("BTreeMap<64>", keys, queries);
+}
+
+// find() on the AVLTree against the frozen index it exports
+void benchFreeze()
+{
+    const size_t n = 1 << 22;
+    const size_t lookups = 1 << 22;
+    cout << "freeze: " << n << " keys, " << lookups << " lookups" << endl;
+
+    vector<uint64_t> keys = randomKeys(n, 6);
+    AVLTree<uint64_t, uint64_t> tree;
+    for(size_t i = 0; i < n; i++) {
+        tree.insert(std::make_pair(keys[i], keys[i]));
+    }
+    mt19937_64 gen(7);
+    vector<uint64_t> queries(lookups);
+    for(size_t i = 0; i < lookups; i++) {
+        queries[i] = gen() % (2 * n);
+    }
+
+    uint64_t found = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(size_t i = 0; i < lookups; i++) {
+        if(tree.find(queries[i]) != tree.end()) found++;
+    }
+    report("AVLTree find()", lookups, secondsSince(start));
+
+    const FrozenLayout layouts[] = { EYTZINGER_LAYOUT, VEB_LAYOUT };
+    const char* names[] = { "Eytzinger find()", "van Emde Boas find()" };
+    for(size_t l = 0; l < 2; l++) {
+        FrozenIndex<uint64_t, uint64_t> frozen = tree.freeze(layouts[l]);
+        uint64_t frozenFound = 0;
+        start = chrono::steady_clock::now();
+        for(size_t i = 0; i < lookups; i++) {
+            if(frozen.find(queries[i]) != frozen.end()) frozenFound++;
+        }
+        report(names[l], lookups, secondsSince(start));
+        if(found != frozenFound) {
+            cout << "  MISMATCH: " << found << " vs " << frozenFound << endl;
+        }
+    }
+    benchSink = found;
+}
+
+// AVLTree against the parentless CompactAVLTree, with pointer links and
+// with 32-bit index links, and the bytes each node takes (the arena hands
+// out blocks of exactly that size)
+void benchCompact()
+{
+    const size_t n = 1 << 21;
+    const size_t lookups = 1 << 22;
+    cout << "compact: " << n << " keys, " << lookups << " lookups" << endl;
+    cout << "  node bytes for <uint64_t, uint64_t>: AVLNode " << sizeof(AVLNode<uint64_t, uint64_t>)
+         << ", CompactAVLNode " << sizeof(CompactAVLNode<uint64_t, uint64_t>)
+         << ", IndexedAVLNode " << sizeof(IndexedAVLNode<uint64_t, uint64_t>) << endl;
+    cout << "  node bytes for <int, int>: AVLNode " << sizeof(AVLNode<int, int>)
+         << ", CompactAVLNode " << sizeof(CompactAVLNode<int, int>)
+         << ", IndexedAVLNode " << sizeof(IndexedAVLNode<int, int>) << endl;
+
+    vector<uint64_t> keys = randomKeys(n, 8);
+    mt19937_64 gen(9);
+    vector<uint64_t> queries(lookups);
+    for(size_t i = 0; i < lookups; i++) {
+        queries[i] = gen() % (2 * n);
+    }
+    benchMap<AVLTree<uint64_t, uint64_t> >("AVLTree", keys, queries);
+    benchMap<CompactAVLTree<uint64_t, uint64_t> >("CompactAVLTree", keys, queries);
+    benchMap<IndexedAVLTree<uint64_t, uint64_t> >("IndexedAVLTree", keys, queries);
+}
+
+// Restoring a tree from a snapshot against inserting every key again
+void benchSnapshot()
+{
+    const size_t n = 1 << 22;
+    cout << "snapshot: " << n << " keys" << endl;
+
+    vector<uint64_t> keys = randomKeys(n, 10);
+    AVLTree<uint64_t, uint64_t> tree;
+    for(size_t i = 0; i < n; i++) {
+        tree.insert(std::make_pair(keys[i], i));
+    }
+
+    stringstream snapshot;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    tree.save(snapshot);
+    report("save", n, secondsSince(start));
+    cout << "  " << snapshot.str().size() / double(n) << " bytes per pair" << endl;
+
+    AVLTree<uint64_t, uint64_t> loaded;
+    start = chrono::steady_clock::now();
+    loaded.load(snapshot);
+    report("load", n, secondsSince(start));
+
+    AVLTree<uint64_t, uint64_t> reinserted;
+    start = chrono::steady_clock::now();
+    for(AVLTree<uint64_t, uint64_t>::iterator it = tree.begin(); it != tree.end(); ++it) {
+        reinserted.insert(*it);
+    }
+    report("insert in key order", n, secondsSince(start));
+    benchSink = loaded.size() + reinserted.size();
+}
+
+// Opening a mapped tree file and searching it in place, against AVLTree
+void benchMapped()
+{
+    const size_t n = 1 << 22;
+    const size_t lookups = 1 << 22;
+    const char* path = "bst-bench.map";
+    cout << "mapped: " << n << " keys, " << lookups << " lookups" << endl;
+
+    vector<uint64_t> keys = randomKeys(n, 11);
+    AVLTree<uint64_t, uint64_t> tree;
+    for(size_t i = 0; i < n; i++) {
+        tree.insert(std::make_pair(keys[i], keys[i]));
+    }
+    mt19937_64 gen(12);
+    vector<uint64_t> queries(lookups);
+    for(size_t i = 0; i < lookups; i++) {
+        queries[i] = gen() % (2 * n);
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    MappedTree<uint64_t, uint64_t>::write(path, tree.begin(), tree.end());
+    report("write", n, secondsSince(start));
+
+    start = chrono::steady_clock::now();
+    MappedTree<uint64_t, uint64_t> mapped(path);
+    cout << "  open: " << secondsSince(start) * 1e6 << " us" << endl;
+
+    uint64_t found = 0;
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < lookups; i++) {
+        if(tree.find(queries[i]) != tree.end()) found++;
+    }
+    report("AVLTree find", lookups, secondsSince(start));
+
+    uint64_t mappedFound = 0;
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < lookups; i++) {
+        if(mapped.find(queries[i]) != mapped.end()) mappedFound++;
+    }
+    report("MappedTree find", lookups, secondsSince(start));
+    if(found != mappedFound) {
+        cout << "  MISMATCH: " << found << " vs " << mappedFound << endl;
+    }
+    benchSink = found;
+    mapped.close();
+    remove(path);
+}
+
+// Building from unsorted pairs through sorted runs on disk, against
+// inserting them one at a time
+void benchBulk()
+{
+    const size_t n = 1 << 22;
+    const size_t budget = 16 << 20;
+    cout << "bulk: " << n << " keys, " << (budget >> 20) << " MB budget" << endl;
+
+    vector<uint64_t> keys = randomKeys(n, 13);
+    BulkBuilder<uint64_t, uint64_t> builder(budget);
+    AVLTree<uint64_t, uint64_t> built;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(size_t i = 0; i < n; i++) {
+        builder.insert(std::make_pair(keys[i], keys[i]));
+    }
+    size_t runs = builder.runs();
+    builder.buildTree(built);
+    report("BulkBuilder", n, secondsSince(start));
+    cout << "  " << runs << " runs" << endl;
+
+    AVLTree<uint64_t, uint64_t> inserted;
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < n; i++) {
+        inserted.insert(std::make_pair(keys[i], keys[i]));
+    }
+    report("insert", n, secondsSince(start));
+    benchSink = built.size() + inserted.size();
+}
+
+// Logged inserts, then a restart from a snapshot and a short log tail
+// against one that replays every insert
+void benchDurable()
+{
+    const size_t n = 1 << 20;
+    const size_t tail = n / 64;
+    const char* directory = "bst-bench.db";
+    cout << "durable: " << n << " keys, " << tail << " after the snapshot" << endl;
+
+    vector<uint64_t> keys = randomKeys(n + tail, 14);
+    DurableAVLTree<uint64_t, uint64_t>::destroy(directory);
+    chrono::steady_clock::time_point start;
+    {
+        DurableAVLTree<uint64_t, uint64_t> durable(directory, 1024);
+        start = chrono::steady_clock::now();
+        for(size_t i = 0; i < n; i++) {
+            durable.insert(std::make_pair(keys[i], keys[i]));
+        }
+        durable.sync();
+        report("logged insert", n, secondsSince(start));
+
+        durable.compact();
+        for(size_t i = n; i < n + tail; i++) {
+            durable.insert(std::make_pair(keys[i], keys[i]));
+        }
+    }
+    start = chrono::steady_clock::now();
+    {
+        DurableAVLTree<uint64_t, uint64_t> reopened(directory);
+        cout << "  snapshot + tail restart: " << secondsSince(start) * 1e3 << " ms, "
+             << reopened.replayed() << " replayed" << endl;
+        benchSink = reopened.tree().size();
+    }
+    DurableAVLTree<uint64_t, uint64_t>::destroy(directory);
+
+    {
+        DurableAVLTree<uint64_t, uint64_t> durable(directory, 1024);
+        for(size_t i = 0; i < n + tail; i++) {
+            durable.insert(std::make_pair(keys[i], keys[i]));
+        }
+    }
+    start = chrono::steady_clock::now();
+    {
+        DurableAVLTree<uint64_t, uint64_t> reopened(directory);
+        cout << "  full replay restart: " << secondsSince(start) * 1e3 << " ms, "
+             << reopened.replayed() << " replayed" << endl;
+        benchSink += reopened.tree().size();
+    }
+    DurableAVLTree<uint64_t, uint64_t>::destroy(directory);
+}
+
+// A key that counts its comparisons, to measure how deep lookups go
+uint64_t keyComparisons;
+
+struct CountedKey
+{
+    uint64_t value;
+    bool operator<(const CountedKey& rhs) const { keyComparisons++; return value < rhs.value; }
+    bool operator>(const CountedKey& rhs) const { keyComparisons++; return value > rhs.value; }
+    bool operator==(const CountedKey& rhs) const { keyComparisons++; return value == rhs.value; }
+};
+
+// For printRoot(), which every tree instantiates
+ostream& operator<<(ostream& out, const CountedKey& key)
+{
+    return out << key.value;
+}
+
+// Inserts, then a stream of removes each followed by an insert, then
+// comparisons per lookup on the resulting tree
+template<template<typename, typename> class Tree>
+void benchUpdates(const string& name, const vector<uint64_t>& keys, size_t churn)
+{
+    Tree<uint64_t, uint64_t> tree;
+    size_t n = keys.size() - churn;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(size_t i = 0; i < n; i++) {
+        tree.insert(std::make_pair(keys[i], keys[i]));
+    }
+    double insertSeconds = secondsSince(start);
+
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < churn; i++) {
+        tree.remove(keys[i]);
+        tree.insert(std::make_pair(keys[n + i], keys[n + i]));
+    }
+    double churnSeconds = secondsSince(start);
+    cout << "  " << name << ": insert " << n / insertSeconds / 1e6
+         << " Mops/s, remove+insert " << churn / churnSeconds / 1e6 << " Mops/s" << endl;
+    benchSink = tree.size();
+
+    Tree<CountedKey, uint64_t> counted;
+    for(size_t i = 0; i < keys.size(); i++) {
+        CountedKey key = { keys[i] };
+        counted.insert(std::make_pair(key, keys[i]));
+    }
+    keyComparisons = 0;
+    for(size_t i = 0; i < keys.size(); i++) {
+        CountedKey key = { keys[i] };
+        benchSink += counted.find(key)->second;
+    }
+    cout << "  " << name << ": " << static_cast<double>(keyComparisons) / keys.size()
+         << " comparisons per find" << endl;
+}
+
+// RedBlackTree against AVLTree on a write-heavy stream
+void benchRedBlack()
+{
+    const size_t n = 1 << 20;
+    const size_t churn = 1 << 21;
+    cout << "redblack: " << n << " keys, " << churn << " remove+insert pairs" << endl;
+
+    vector<uint64_t> keys = randomKeys(n + churn, 15);
+    benchUpdates<AVLTree>("AVLTree", keys, churn);
+    benchUpdates<RedBlackTree>("RedBlackTree", keys, churn);
+}
+
+// Lookups drawn from a Zipf distribution with exponent s over the keys,
+// where the hot keys move to a different part of the key space every
+// phase lookups
+vector<uint64_t> zipfQueries(const vector<uint64_t>& keys, size_t lookups, double s, size_t phase, uint64_t seed)
+{
+    vector<double> cdf(keys.size());
+    double total = 0;
+    for(size_t i = 0; i < keys.size(); i++) {
+        total += 1.0 / pow(static_cast<double>(i + 1), s);
+        cdf[i] = total;
+    }
+    mt19937_64 gen(seed);
+    uniform_real_distribution<double> uniform(0, total);
+    vector<uint64_t> queries(lookups);
+    size_t shift = 0;
+    for(size_t i = 0; i < lookups; i++) {
+        if(i % phase == 0) {
+            shift = gen() % keys.size();
+        }
+        size_t rank = lower_bound(cdf.begin(), cdf.end(), uniform(gen)) - cdf.begin();
+        queries[i] = keys[(std::min(rank, keys.size() - 1) + shift) % keys.size()];
+    }
+    return queries;
+}
+
+template<typename Tree>
+void benchSkewedFind(const string& name, Tree& tree, const vector<uint64_t>& queries)
+{
+    uint64_t sum = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(size_t i = 0; i < queries.size(); i++) {
+        sum += tree.find(queries[i])->second;
+    }
+    report(name, queries.size(), secondsSince(start));
+    benchSink = sum;
+}
+
+// Sorted inserts, which would make a plain tree a path, then random
+// lookups, for scapegoat mode at two alphas against AVLTree
+template<typename Tree>
+void benchSortedInserts(const string& name, Tree& tree, size_t n, const vector<uint64_t>& queries)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(size_t i = 0; i < n; i++) {
+        tree.insert(std::make_pair(uint64_t(i * 2 + 1), uint64_t(i)));
+    }
+    double insertSeconds = secondsSince(start);
+
+    uint64_t found = 0;
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < queries.size(); i++) {
+        if(tree.find(queries[i]) != tree.end()) found++;
+    }
+    double findSeconds = secondsSince(start);
+    cout << "  " << name << ": sorted insert " << n / insertSeconds / 1e6
+         << " Mops/s, find " << queries.size() / findSeconds / 1e6 << " Mops/s" << endl;
+    benchSink = found;
+}
+
+void benchScapegoat()
+{
+    const size_t n = 1 << 21;
+    const size_t lookups = 1 << 22;
+    cout << "scapegoat: " << n << " keys, " << lookups << " lookups, "
+         << sizeof(Node<uint64_t, uint64_t>) << " bytes per node against "
+         << sizeof(AVLNode<uint64_t, uint64_t>) << " for AVL" << endl;
+
+    mt19937_64 gen(18);
+    vector<uint64_t> queries(lookups);
+    for(size_t i = 0; i < lookups; i++) {
+        queries[i] = gen() % (2 * n);
+    }
+
+    AVLTree<uint64_t, uint64_t> avl;
+    benchSortedInserts("AVLTree", avl, n, queries);
+    double alphas[] = { 0.6, 0.75 };
+    for(int a = 0; a < 2; a++) {
+        BinarySearchTree<uint64_t, uint64_t> scapegoat;
+        scapegoat.setScapegoatAlpha(alphas[a]);
+        ostringstream name;
+        name << "scapegoat, alpha " << alphas[a];
+        benchSortedInserts(name.str(), scapegoat, n, queries);
+    }
+}
+
+// Lookups on a plain tree loaded in a bad order, before and after
+// rebalance()
+void benchRebalanceOnce(const string& name, const vector<uint64_t>& keys, size_t lookups)
+{
+    BinarySearchTree<uint64_t, uint64_t> tree;
+    for(size_t i = 0; i < keys.size(); i++) {
+        tree.insert(std::make_pair(keys[i], keys[i]));
+    }
+    mt19937_64 gen(19);
+    vector<uint64_t> queries(lookups);
+    for(size_t i = 0; i < lookups; i++) {
+        queries[i] = gen() % (2 * keys.size());
+    }
+
+    uint64_t found = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(size_t i = 0; i < lookups; i++) {
+        if(tree.find(queries[i]) != tree.end()) found++;
+    }
+    double beforeSeconds = secondsSince(start);
+
+    start = chrono::steady_clock::now();
+    tree.rebalance();
+    double rebalanceSeconds = secondsSince(start);
+
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < lookups; i++) {
+        if(tree.find(queries[i]) != tree.end()) found++;
+    }
+    double afterSeconds = secondsSince(start);
+    cout << "  " << name << ": find " << lookups / beforeSeconds / 1e6 << " Mops/s before, "
+         << lookups / afterSeconds / 1e6 << " Mops/s after, rebalance "
+         << keys.size() / rebalanceSeconds / 1e6 << " Mnodes/s" << endl;
+    benchSink = found;
+}
+
+void benchRebalance()
+{
+    const size_t pathKeys = 1 << 14;
+    const size_t randomCount = 1 << 21;
+    cout << "rebalance: " << pathKeys << " sorted keys, " << randomCount << " random keys" << endl;
+
+    vector<uint64_t> sorted(pathKeys);
+    for(size_t i = 0; i < pathKeys; i++) {
+        sorted[i] = i * 2 + 1;
+    }
+    benchRebalanceOnce("sorted", sorted, 1 << 14);
+    benchRebalanceOnce("random", randomKeys(randomCount, 20), 1 << 22);
+}
+
+// Zipfian lookups on a perfectly balanced plain tree, then again after
+// rebuildOptimal() has used the hits counted during the first round.
+// Only meaningful when built with BST_HIT_COUNTERS.
+void benchOptimal()
+{
+    const size_t n = 1 << 20;
+    const size_t lookups = 1 << 23;
+    cout << "optimal: " << n << " keys, " << lookups << " Zipf(1.2) lookups" << endl;
+#ifndef BST_HIT_COUNTERS
+    cout << "  built without BST_HIT_COUNTERS, rebuildOptimal() only balances" << endl;
+#endif
+
+    vector<uint64_t> keys = randomKeys(n, 21);
+    vector<uint64_t> queries = zipfQueries(keys, lookups, 1.2, lookups, 22);
+    vector<pair<uint64_t, uint64_t> > items;
+    for(size_t i = 0; i < n; i++) {
+        items.push_back(std::make_pair(keys[i], keys[i]));
+    }
+    BinarySearchTree<uint64_t, uint64_t> tree(items.begin(), items.end());
+
+    uint64_t sum = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(size_t i = 0; i < lookups; i++) {
+        sum += tree.find(queries[i])->second;
+    }
+    report("balanced find", lookups, secondsSince(start));
+
+    start = chrono::steady_clock::now();
+    tree.rebuildOptimal();
+    cout << "  rebuildOptimal: " << secondsSince(start) * 1e3 << " ms" << endl;
+
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < lookups; i++) {
+        sum += tree.find(queries[i])->second;
+    }
+    report("optimal find", lookups, secondsSince(start));
+    benchSink = sum;
+}
+
+// SplayTree in each mode against AVLTree on Zipfian lookups. With s = 1.2
+// about 80% of them go to the 1000 hottest keys.
+void benchSplay()
+{
+    const size_t n = 1 << 20;
+    const size_t lookups = 1 << 23;
+    const size_t phase = 1 << 20;
+    cout << "splay: " << n << " keys, " << lookups << " Zipf(1.2) lookups, hot set moves every "
+         << phase << endl;
+
+    vector<uint64_t> keys = randomKeys(n, 16);
+    vector<uint64_t> queries = zipfQueries(keys, lookups, 1.2, phase, 17);
+
+    AVLTree<uint64_t, uint64_t> avl;
+    for(size_t i = 0; i < n; i++) {
+        avl.insert(std::make_pair(keys[i], keys[i]));
+    }
+    benchSkewedFind("AVLTree find", avl, queries);
+
+    const char* names[] = { "SplayTree find, full splay", "SplayTree find, semi-splay",
+                            "SplayTree find, splay on write" };
+    SplayMode modes[] = { FULL_SPLAY, SEMI_SPLAY, SPLAY_ON_WRITE };
+    for(int m = 0; m < 3; m++) {
+        SplayTree<uint64_t, uint64_t> splay(modes[m]);
+        for(size_t i = 0; i < n; i++) {
+            splay.insert(std::make_pair(keys[i], keys[i]));
+        }
+        benchSkewedFind(names[m], splay, queries);
+    }
+}
+
+// Counting occurrences in AVLTree: find() and then insert() on a miss or
+// operator[] on a hit, against a single compute() call
+void benchUpsert()
+{
+    const size_t n = 1 << 20;
+    const size_t updates = 1 << 22;
+    cout << "upsert: " << updates << " counter updates over " << n << " keys" << endl;
+
+    mt19937_64 gen(23);
+    vector<uint64_t> updateKeys(updates);
+    for(size_t i = 0; i < updates; i++) {
+        updateKeys[i] = gen() % n;
+    }
+
+    AVLTree<uint64_t, uint64_t> lookedUp;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(size_t i = 0; i < updates; i++) {
+        if(lookedUp.find(updateKeys[i]) == lookedUp.end()) {
+            lookedUp.insert(std::make_pair(updateKeys[i], 1));
+        }
+        else {
+            lookedUp[updateKeys[i]]++;
+        }
+    }
+    report("find + insert/operator[]", updates, secondsSince(start));
+
+    AVLTree<uint64_t, uint64_t> computed;
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < updates; i++) {
+        computed.compute(updateKeys[i], [](uint64_t& count) { count++; });
+    }
+    report("compute", updates, secondsSince(start));
+    benchSink = lookedUp.size() + computed.size();
+}
+
+struct Benchmark
+{
+    const char* name;
+    void (*run)();
+};
+
+int main(int argc, char* argv[])
+{
+    Benchmark benchmarks[] = {
+        { "find_many", benchFindMany },
+        { "concurrent", benchConcurrent },
+        { "btree", benchBTree },
+        { "freeze", benchFreeze },
+        { "compact", benchCompact },
+        { "snapshot", benchSnapshot },
+        { "mapped", benchMapped },
+        { "bulk", benchBulk },
+        { "durable", benchDurable },
+        { "redblack", benchRedBlack },
+        { "splay", benchSplay },
+        { "scapegoat", benchScapegoat },
+        { "rebalance", benchRebalance },
+        { "optimal", benchOptimal },
+        { "upsert", benchUpsert },
+    };
+    string filter = (argc > 1) ? argv[1] : "";
+    for(size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++) {
+        if(string(benchmarks[i].name).find(filter) != string::npos) {
+            benchmarks[i].run();
+        }
+    }
+    return 0;
+}
@@ -1,10 +1,48 @@
 #include <iostream>
 #include <map>
+#include <vector>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
 #include "bst.h"
 #include "avlbst.h"
+#include "persistent_avl.h"
+#include "concurrent_avl.h"
+#include "sharded_avl.h"
+#include "btree.h"
+#include "compact_avl.h"
+#include "mapped_tree.h"
+#include "bulk_build.h"
+#include "durable_avl.h"
+#include "rbbst.h"
+#include "splaybst.h"
+#include <thread>
 
 using namespace std;
 
+// Every failed check is reported, and makes the program exit with 1
+int failures = 0;
+
+void check(bool passed, const string& what)
+{
+    if(!passed) {
+        cout << "FAILED: " << what << endl;
+        failures++;
+    }
+}
+
+// Whether tree iterates over exactly the pairs of expected, in order
+template<typename Tree, typename Key, typename Value>
+bool matches(const Tree& tree, const map<Key, Value>& expected)
+{
+    typename Tree::iterator it = tree.begin();
+    for(typename map<Key, Value>::const_iterator want = expected.begin(); want != expected.end(); ++want, ++it) {
+        if(it == tree.end() || it->first != want->first || it->second != want->second) {
+            return false;
+        }
+    }
+    return it == tree.end();
+}
 
 int main(int argc, char *argv[])
 {
@@ -25,6 +63,7 @@ int main(int argc, char *argv[])
     }
     cout << "Erasing b" << endl;
     bt.remove('b');
+    check(bt.find('b') == bt.end() && bt.find('a') != bt.end(), "BinarySearchTree remove");
 
     // AVL Tree Tests
     AVLTree<char,int> at;
@@ -43,6 +82,552 @@ int main(int argc, char *argv[])
     }
     cout << "Erasing b" << endl;
     at.remove('b');
+    check(at.find('b') == at.end() && at.find('a') != at.end(), "AVLTree remove");
+
+    // Node pool tests
+    NewDeleteResource heap;
+    BinarySearchTree<int,int> pooled;
+    pooled.setNodeResource(&heap);
+    for(int i = 0; i < 1000; i++) {
+        pooled.insert(std::make_pair((i * 37) % 1000, i));
+    }
+    pooled.clear();
+    pooled.setNodeResource(NULL);
+    for(int i = 0; i < 1000; i++) {
+        pooled.insert(std::make_pair((i * 37) % 1000, i));
+    }
+    if(pooled.find(999) != pooled.end()) {
+        cout << "\nPooled tree found 999" << endl;
+    }
+    else {
+        cout << "\nPooled tree did not find 999" << endl;
+    }
+    map<int,int> pooledKeys;
+    for(int i = 0; i < 1000; i++) {
+        pooledKeys[(i * 37) % 1000] = i;
+    }
+    check(matches(pooled, pooledKeys), "tree with a node resource");
+    pooled.clear();
+
+    // Bulk load tests
+    vector<pair<int,int> > sortedPairs;
+    for(int i = 0; i < 100; i++) {
+        sortedPairs.push_back(std::make_pair(i, i * i));
+    }
+    AVLTree<int,int> bulk(sortedPairs.begin(), sortedPairs.end());
+    cout << "\nBulk loaded AVLTree is " << (bulk.isBalanced() ? "balanced" : "not balanced")
+         << ", 9 -> " << bulk[9] << endl;
+    bt.assign(sortedPairs.rbegin(), sortedPairs.rend());
+    cout << "Bulk loaded BinarySearchTree from reversed input is "
+         << (bt.isBalanced() ? "balanced" : "not balanced") << endl;
+    map<int,int> bulkKeys(sortedPairs.begin(), sortedPairs.end());
+    check(bulk.isBalanced() && matches(bulk, bulkKeys), "AVLTree bulk load");
+    check(bt.isBalanced() && matches(bt, bulkKeys), "BinarySearchTree bulk load from reversed input");
+
+    // Join, split and set operation tests
+    AVLTree<int,int> evens, odds, low, high;
+    for(int i = 0; i < 20; i++) {
+        if(i % 2 == 0) evens.insert(std::make_pair(i, i));
+        else odds.insert(std::make_pair(i, i));
+    }
+    evens.setUnion(odds);
+    map<int,int> lowKeys, highKeys, allKeys;
+    for(int i = 0; i < 20; i++) {
+        (i < 10 ? lowKeys : highKeys)[i] = i;
+        allKeys[i] = i;
+    }
+    check(matches(evens, allKeys) && odds.empty(), "setUnion");
+    bool splitFound = evens.split(10, low, high);
+    cout << "\nSplit at 10: low starts at " << low.begin()->first
+         << ", high starts at " << high.begin()->first << endl;
+    check(splitFound && matches(low, lowKeys) && matches(high, highKeys) && evens.empty(), "split");
+    AVLTree<int,int> overlap(sortedPairs.begin(), sortedPairs.end());
+    overlap.setIntersection(low);
+    map<int,int> overlapKeys;
+    for(int i = 0; i < 10; i++) {
+        overlapKeys[i] = i * i;
+    }
+    check(matches(overlap, overlapKeys), "setIntersection");
+    bulk.setDifference(high);
+    cout << "Bulk tree " << (bulk.find(15) == bulk.end() ? "lost" : "kept")
+         << " 15 and " << (bulk.find(5) == bulk.end() ? "lost" : "kept") << " 5" << endl;
+    for(int i = 10; i < 20; i++) {
+        bulkKeys.erase(i);
+    }
+    check(matches(bulk, bulkKeys) && bulk.isBalanced(), "setDifference");
+
+    // A pivot taken from the tree being joined into, then a split whose
+    // trees cannot share nodes, which must leave all three as they were
+    AVLTree<int,int> joinLeft, joinRight, joined;
+    joined.insert(std::make_pair(50, 500));
+    joinLeft.insert(std::make_pair(10, 100));
+    joinRight.insert(std::make_pair(90, 900));
+    joined.join(joinLeft, *joined.begin(), joinRight);
+    map<int,int> joinedKeys;
+    joinedKeys[10] = 100;
+    joinedKeys[50] = 500;
+    joinedKeys[90] = 900;
+    check(matches(joined, joinedKeys) && joinLeft.empty() && joinRight.empty(), "join around an item of the tree");
+    NewDeleteResource splitHeap;
+    AVLTree<int,int> splitLess, splitGreater;
+    splitLess.insert(std::make_pair(1, 1));
+    splitGreater.setNodeResource(&splitHeap);
+    bool splitRejected = false;
+    try {
+        joined.split(50, splitLess, splitGreater);
+    }
+    catch(std::logic_error& e) {
+        splitRejected = true;
+    }
+    check(splitRejected && matches(joined, joinedKeys) && splitLess.size() == 1 && splitGreater.empty(),
+          "split into trees with different node resources");
+
+    // Batched lookup tests
+    vector<int> queries;
+    for(int i = -5; i < 120; i += 5) {
+        queries.push_back(i);
+    }
+    vector<AVLTree<int,int>::iterator> results;
+    bulk.find_many(queries, results);
+    int hits = 0;
+    for(size_t i = 0; i < queries.size(); i++) {
+        check(results[i] == bulk.find(queries[i]), "find_many agrees with find");
+        if(results[i] != bulk.end()) hits++;
+    }
+    cout << "\nfind_many found " << hits << " of " << queries.size() << " keys" << endl;
+
+    // Order statistic tests
+    cout << "\nBulk tree has " << bulk.size() << " keys, the 10th smallest is "
+         << bulk.select(10)->first << ", " << bulk.rank(50) << " keys are below 50 and "
+         << bulk.count_range(20, 29) << " are in [20, 29]" << endl;
+    map<int,int>::iterator tenth = bulkKeys.begin();
+    std::advance(tenth, 10);
+    check(bulk.size() == bulkKeys.size(), "size");
+    check(bulk.select(10)->first == tenth->first, "select");
+    check(bulk.rank(50) == size_t(std::distance(bulkKeys.begin(), bulkKeys.lower_bound(50))), "rank");
+    check(bulk.count_range(20, 29) == size_t(std::distance(bulkKeys.lower_bound(20), bulkKeys.upper_bound(29))),
+          "count_range");
+
+    // Range query tests
+    cout << "\nKeys in [42, 47] from largest to smallest:";
+    AVLTree<int,int>::iterator stop = bulk.lower_bound(42);
+    map<int,int>::iterator want = bulkKeys.upper_bound(47);
+    for(AVLTree<int,int>::iterator it = bulk.upper_bound(47); it != stop; ) {
+        --it;
+        --want;
+        cout << " " << it->first;
+        check(it->first == want->first, "stepping back from upper_bound");
+    }
+    check(want == bulkKeys.lower_bound(42), "stepping back to lower_bound");
+    cout << endl << "floor(15) is " << bulk.floor(15)->first
+         << ", ceiling(15) is " << bulk.ceiling(15)->first
+         << ", largest key is " << bulk.rbegin()->first << endl;
+    check(bulk.floor(15)->first == (--bulkKeys.upper_bound(15))->first, "floor");
+    check(bulk.ceiling(15)->first == bulkKeys.lower_bound(15)->first, "ceiling");
+    check(bulk.rbegin()->first == bulkKeys.rbegin()->first, "rbegin");
+
+    // Persistent snapshot tests
+    PersistentAVLTree<int,int> versions;
+    for(int i = 0; i < 8; i++) {
+        versions.insert(std::make_pair(i, i * i));
+    }
+    PersistentAVLTree<int,int>::Snapshot before = versions.snapshot();
+    versions.remove(3);
+    versions.insert(std::make_pair(100, 0));
+    PersistentAVLTree<int,int>::Snapshot after = versions.snapshot();
+    cout << "\nSnapshot before:";
+    for(PersistentAVLTree<int,int>::Snapshot::iterator it = before.begin(); it != before.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << endl << "Snapshot after:";
+    for(PersistentAVLTree<int,int>::Snapshot::iterator it = after.begin(); it != after.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << endl << "before[3] is " << before[3] << ", after "
+         << (after.find(3) == after.end() ? "has no 3" : "still has 3") << endl;
+    map<int,int> beforeKeys;
+    for(int i = 0; i < 8; i++) {
+        beforeKeys[i] = i * i;
+    }
+    map<int,int> afterKeys(beforeKeys);
+    afterKeys.erase(3);
+    afterKeys[100] = 0;
+    check(matches(before, beforeKeys) && matches(after, afterKeys), "persistent snapshots");
 
+    // Concurrent tree tests
+    ConcurrentAVLTree<int,int> shared;
+    vector<std::thread> writers;
+    for(int t = 0; t < 4; t++) {
+        writers.push_back(std::thread([&shared, t]() {
+            for(int i = t; i < 400; i += 4) {
+                shared.insert(std::make_pair(i, i));
+                if(i % 8 == 0) shared.remove(i);
+            }
+        }));
+    }
+    for(size_t t = 0; t < writers.size(); t++) {
+        writers[t].join();
+    }
+    int sharedCount = 0, value = 0;
+    for(ConcurrentAVLTree<int,int>::iterator it = shared.begin(); it != shared.end(); ++it) {
+        sharedCount++;
+    }
+    cout << "\nConcurrent tree has " << sharedCount << " keys after 4 writers, "
+         << (shared.find(7, value) ? "found" : "missing") << " 7, "
+         << (shared.contains(8) ? "found" : "missing") << " 8" << endl;
+    check(sharedCount == 350 && shared.find(7, value) && value == 7 && !shared.contains(8), "concurrent writers");
+
+    // Sharded map tests
+    ShardedAVLMap<int,int> sharded(4, 16);
+    vector<std::thread> ingest;
+    for(int t = 0; t < 4; t++) {
+        ingest.push_back(std::thread([&sharded, t]() {
+            for(int i = t; i < 1000; i += 4) {
+                sharded.insert(std::make_pair(i, -i));
+            }
+        }));
+    }
+    for(size_t t = 0; t < ingest.size(); t++) {
+        ingest[t].join();
+    }
+    int inOrder = 0, last = -1;
+    for(ShardedAVLMap<int,int>::iterator it = sharded.begin(); it != sharded.end(); ++it) {
+        if(it->first > last) inOrder++;
+        last = it->first;
+    }
+    cout << "\nSharded map has " << sharded.size() << " keys in " << sharded.shardCount()
+         << " shards, " << inOrder << " of them in order" << endl;
+    map<int,int> shardedKeys;
+    for(int i = 0; i < 1000; i++) {
+        shardedKeys[i] = -i;
+    }
+    check(sharded.size() == 1000 && matches(sharded, shardedKeys), "sharded map");
+
+    // B-tree map tests
+    BTreeMap<int,int,4> btree;
+    for(int i = 0; i < 40; i++) {
+        btree.insert(std::make_pair((i * 7) % 40, i));
+    }
+    for(int i = 0; i < 40; i += 3) {
+        btree.remove(i);
+    }
+    cout << "\nB-tree map has " << btree.size() << " keys:";
+    for(BTreeMap<int,int,4>::iterator it = btree.begin(); it != btree.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << endl << "btree[7] is " << btree[7] << ", lower_bound(9) is "
+         << btree.lower_bound(9)->first << ", largest key is " << btree.rbegin()->first << endl;
+    map<int,int> btreeKeys;
+    for(int i = 0; i < 40; i++) {
+        btreeKeys[(i * 7) % 40] = i;
+    }
+    for(int i = 0; i < 40; i += 3) {
+        btreeKeys.erase(i);
+    }
+    check(matches(btree, btreeKeys) && btree.size() == btreeKeys.size(), "B-tree map");
+    check(btree.lower_bound(9)->first == btreeKeys.lower_bound(9)->first
+          && btree.rbegin()->first == btreeKeys.rbegin()->first, "B-tree map bounds");
+
+    // Frozen index tests
+    AVLTree<int,int> live;
+    for(int i = 1; i <= 10; i++) {
+        live.insert(std::make_pair(i * 10, i));
+    }
+    FrozenIndex<int,int> eytzinger = live.freeze(EYTZINGER_LAYOUT);
+    FrozenIndex<int,int> veb = live.freeze(VEB_LAYOUT);
+    live.remove(50);
+    cout << "\nFrozen index:";
+    for(FrozenIndex<int,int>::iterator it = veb.begin(); it != veb.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << endl << "frozen[50] is " << eytzinger[50] << ", lower_bound(55) is "
+         << eytzinger.lower_bound(55)->first << " and " << veb.lower_bound(55)->first << endl;
+    map<int,int> frozenKeys;
+    for(int i = 1; i <= 10; i++) {
+        frozenKeys[i * 10] = i;
+    }
+    check(matches(eytzinger, frozenKeys) && matches(veb, frozenKeys), "frozen index keeps the frozen keys");
+    check(eytzinger[50] == 5 && eytzinger.lower_bound(55)->first == 60 && veb.lower_bound(55)->first == 60,
+          "frozen index lookups");
+
+    // Compact tree tests
+    CompactAVLTree<int,int> compact;
+    for(int i = 0; i < 100; i++) {
+        compact.insert(std::make_pair(i, i * 2));
+    }
+    for(int i = 0; i < 100; i += 2) {
+        compact.remove(i);
+    }
+    int compactCount = 0;
+    for(CompactAVLTree<int,int>::iterator it = compact.begin(); it != compact.end(); ++it) {
+        compactCount++;
+    }
+    cout << "\nCompact tree has " << compactCount << " keys, height " << compact.height()
+         << ", compact[51] is " << compact[51] << ", " << sizeof(CompactAVLNode<int,int>)
+         << " bytes per node" << endl;
+    map<int,int> oddKeys;
+    for(int i = 1; i < 100; i += 2) {
+        oddKeys[i] = i * 2;
+    }
+    check(matches(compact, oddKeys), "compact tree");
+
+    // Indexed tree tests
+    IndexedAVLTree<int,int> indexed;
+    for(int i = 0; i < 100; i++) {
+        indexed.insert(std::make_pair(i, i * 2));
+    }
+    for(int i = 0; i < 100; i += 2) {
+        indexed.remove(i);
+    }
+    IndexedAVLTree<int,int> indexedCopy(indexed);
+    indexed.clear();
+    cout << "Indexed tree copy has " << indexedCopy.size() << " keys, indexedCopy[51] is "
+         << indexedCopy[51] << ", " << sizeof(IndexedAVLNode<int,int>) << " bytes per node" << endl;
+    check(matches(indexedCopy, oddKeys) && indexed.size() == 0, "indexed tree copy");
+
+    // Snapshot tests
+    AVLTree<int,string> saved;
+    for(int i = 0; i < 1000; i++) {
+        saved.insert(std::make_pair(i * 7, to_string(i)));
+    }
+    stringstream snapshot;
+    saved.save(snapshot);
+    AVLTree<int,string> restored;
+    restored.load(snapshot);
+    cout << "Snapshot of " << restored.size() << " pairs is " << snapshot.str().size()
+         << " bytes, restored[700] is " << restored[700] << endl;
+    map<int,string> savedKeys(saved.begin(), saved.end());
+    check(matches(restored, savedKeys), "snapshot save and load");
+
+    // Mapped tree tests
+    AVLTree<int,int> toMap;
+    for(int i = 0; i < 100; i++) {
+        toMap.insert(std::make_pair(i * 3, i));
+    }
+    MappedTree<int,int>::write("bst-test.map", toMap.begin(), toMap.end());
+    {
+        MappedTree<int,int> mapped("bst-test.map");
+        cout << "Mapped tree has " << mapped.size() << " keys, mapped[150] is " << mapped[150]
+             << ", upper_bound(150) is " << mapped.upper_bound(150)->first << endl;
+        map<int,int> mappedKeys(toMap.begin(), toMap.end());
+        check(matches(mapped, mappedKeys) && mapped.upper_bound(150)->first == 153, "mapped tree");
+    }
+    remove("bst-test.map");
+
+    // Bulk build tests
+    BulkBuilder<int,int> builder(4096);
+    for(int i = 0; i < 2000; i++) {
+        builder.insert(std::make_pair((i * 7919) % 2000, i));
+    }
+    size_t builderRuns = builder.runs();
+    AVLTree<int,int> bulkBuilt;
+    builder.buildTree(bulkBuilt);
+    cout << "Bulk built " << bulkBuilt.size() << " keys from " << builderRuns << " runs, bulk[0] is "
+         << bulkBuilt[0] << endl;
+    map<int,int> builtKeys;
+    for(int i = 0; i < 2000; i++) {
+        builtKeys[(i * 7919) % 2000] = i;
+    }
+    check(matches(bulkBuilt, builtKeys) && bulkBuilt.isBalanced(), "bulk builder");
+
+    // Durable tree tests
+    DurableAVLTree<int,int>::destroy("bst-test.db");
+    {
+        DurableAVLTree<int,int> durable("bst-test.db", 16);
+        for(int i = 0; i < 500; i++) {
+            durable.insert(std::make_pair(i, i * i));
+        }
+        durable.compact();
+        for(int i = 0; i < 100; i++) {
+            durable.remove(i);
+        }
+    }
+    {
+        DurableAVLTree<int,int> reopened("bst-test.db");
+        cout << "Durable tree reopened with " << reopened.tree().size() << " keys after replaying "
+             << reopened.replayed() << " operations, [200] is " << reopened.tree().find(200)->second << endl;
+        map<int,int> durableKeys;
+        for(int i = 100; i < 500; i++) {
+            durableKeys[i] = i * i;
+        }
+        check(matches(reopened.tree(), durableKeys), "durable tree after reopening");
+    }
+    DurableAVLTree<int,int>::destroy("bst-test.db");
+
+    // Red-black tree tests
+    RedBlackTree<int,int> redBlack;
+    for(int i = 0; i < 1000; i++) {
+        redBlack.insert(std::make_pair(i, i * 2));
+    }
+    for(int i = 0; i < 1000; i += 3) {
+        redBlack.remove(i);
+    }
+    cout << "Red-black tree has " << redBlack.size() << " keys, redBlack[500] is " << redBlack[500]
+         << ", lower_bound(501) is " << redBlack.lower_bound(501)->first << endl;
+
+    // Check the red-black rules through a random mix of inserts and removes,
+    // against a std::map holding the same keys
+    srand(20);
+    map<int,int> redBlackKeys;
+    bool redBlackValid = redBlack.isRedBlack();
+    for(int i = 0; i < 1000; i++) {
+        redBlackKeys[i] = i * 2;
+    }
+    for(int i = 0; i < 1000; i += 3) {
+        redBlackKeys.erase(i);
+    }
+    for(int i = 0; i < 20000 && redBlackValid; i++) {
+        int key = rand() % 2000;
+        if(rand() % 2 == 0) {
+            redBlack.insert(std::make_pair(key, i));
+            redBlackKeys[key] = i;
+        }
+        else {
+            redBlack.remove(key);
+            redBlackKeys.erase(key);
+        }
+        redBlackValid = redBlack.isRedBlack() && redBlack.size() == redBlackKeys.size();
+    }
+    RedBlackTree<int,int>::iterator redBlackIt = redBlack.begin();
+    for(map<int,int>::iterator it = redBlackKeys.begin(); it != redBlackKeys.end() && redBlackValid; ++it, ++redBlackIt) {
+        redBlackValid = redBlackIt->first == it->first && redBlackIt->second == it->second;
+    }
+    cout << "Red-black rules held through 20000 random inserts and removes: " << redBlackValid << endl;
+    check(redBlackValid, "red-black rules through random inserts and removes");
+
+    // Splay tree tests
+    SplayTree<int,int> splay;
+    for(int i = 0; i < 100; i++) {
+        splay.insert(std::make_pair(i, i + 1));
+    }
+    splay.find(42);
+    splay.remove(7);
+    cout << "Splay tree has " << splay.size() << " keys, splay[42] is " << splay[42]
+         << ", first key is " << splay.begin()->first << endl;
+    map<int,int> splayKeys;
+    for(int i = 0; i < 100; i++) {
+        splayKeys[i] = i + 1;
+    }
+    splayKeys.erase(7);
+    check(matches(splay, splayKeys) && splay[42] == 43, "splay tree");
+
+    // Sorted inserts leave a splay tree one long left path, and a plain tree
+    // one long right path; clearing and destroying them must not recurse
+    SplayTree<int,string>* splayPath = new SplayTree<int,string>();
+    for(int i = 0; i < 1000000; i++) {
+        splayPath->insert(std::make_pair(i, string("splay")));
+    }
+    check(splayPath->size() == 1000000, "sorted inserts into a splay tree");
+    splayPath->clear();
+    check(splayPath->empty(), "clearing a sorted splay tree");
+    for(int i = 0; i < 1000000; i++) {
+        splayPath->insert(std::make_pair(i, string("splay")));
+    }
+    delete splayPath;
+    BinarySearchTree<int,string>* plainPath = new BinarySearchTree<int,string>();
+    for(int i = 0; i < 20000; i++) {
+        plainPath->insert(std::make_pair(i, string("plain")));
+    }
+    check(plainPath->size() == 20000 && !plainPath->isBalanced(), "sorted inserts into a plain tree");
+    delete plainPath;
+    cout << "Cleared and destroyed trees built from sorted inserts" << endl;
+
+    // Scapegoat mode tests
+    BinarySearchTree<int,int> scapegoat;
+    scapegoat.setScapegoatAlpha(0.7);
+    for(int i = 0; i < 1000; i++) {
+        scapegoat.insert(std::make_pair(i, -i));
+    }
+    for(int i = 0; i < 1000; i += 2) {
+        scapegoat.remove(i);
+    }
+    cout << "Scapegoat tree has " << scapegoat.size() << " keys after sorted inserts, scapegoat[999] is "
+         << scapegoat[999] << endl;
+    map<int,int> scapegoatKeys;
+    for(int i = 1; i < 1000; i += 2) {
+        scapegoatKeys[i] = -i;
+    }
+    check(matches(scapegoat, scapegoatKeys), "scapegoat mode");
+    AVLTree<int,int> notScapegoat;
+    BinarySearchTree<int,int>& notScapegoatBase = notScapegoat;
+    bool rejected = false;
+    try {
+        notScapegoatBase.setScapegoatAlpha(0.7);
+    }
+    catch(std::logic_error& e) {
+        rejected = true;
+    }
+    cout << "AVLTree rejects scapegoat mode: " << rejected << endl;
+    check(rejected, "AVLTree rejects scapegoat mode");
+
+    // Rebalance tests
+    BinarySearchTree<int,int> vine;
+    for(int i = 0; i < 100; i++) {
+        vine.insert(std::make_pair(i, i));
+    }
+    cout << "Tree of 100 sorted inserts balanced: " << vine.isBalanced();
+    vine.rebalance();
+    cout << ", after rebalance(): " << vine.isBalanced() << ", vine[64] is " << vine[64] << endl;
+    map<int,int> vineKeys;
+    for(int i = 0; i < 100; i++) {
+        vineKeys[i] = i;
+    }
+    check(vine.isBalanced() && matches(vine, vineKeys), "rebalance");
+    AVLTree<int,int> avlRebalanced;
+    for(int i = 0; i < 1000; i++) {
+        avlRebalanced.insert(std::make_pair(i, i));
+    }
+    avlRebalanced.rebalance();
+    for(int i = 1000; i < 2000; i++) {
+        avlRebalanced.insert(std::make_pair(i, i));
+        avlRebalanced.remove(i - 1000);
+    }
+    redBlack.rebalance();
+    cout << "AVLTree balanced after rebalance() and updates: " << avlRebalanced.isBalanced()
+         << ", red-black rules hold after rebalance(): " << redBlack.isRedBlack() << endl;
+    check(avlRebalanced.isBalanced() && avlRebalanced.size() == 1000, "AVLTree rebalance");
+    check(redBlack.isRedBlack() && matches(redBlack, redBlackKeys), "RedBlackTree rebalance");
+
+    // Optimal rebuild tests
+    for(int i = 0; i < 1000; i++) {
+        vine.find(i % 3);
+    }
+    vine.rebuildOptimal();
+    cout << "After rebuildOptimal() the tree still has " << vine.size() << " keys, vine[2] is " << vine[2]
+         << ", balanced: " << vine.isBalanced() << endl;
+    check(matches(vine, vineKeys), "rebuildOptimal keeps every pair");
+    rejected = false;
+    try {
+        avlRebalanced.rebuildOptimal();
+    }
+    catch(std::logic_error& e) {
+        rejected = true;
+    }
+    cout << "AVLTree rejects rebuildOptimal(): " << rejected << ", still balanced: " << avlRebalanced.isBalanced() << endl;
+    check(rejected && avlRebalanced.isBalanced(), "AVLTree rejects rebuildOptimal");
+
+    // Upsert tests
+    AVLTree<string,int> words;
+    istringstream text("the cat and the dog and the bird");
+    string word;
+    while(text >> word) {
+        words.compute(word, [](int& count) { count++; });
+    }
+    bool added = words.try_insert("cat", 100).second;
+    words.insert_or_assign("dog", 7);
+    cout << "Counted " << words.size() << " words, \"the\" " << words["the"] << " times; try_insert(\"cat\") added: "
+         << added << ", dog is now " << words["dog"] << endl;
+    map<string,int> wordCounts;
+    wordCounts["the"] = 3;
+    wordCounts["cat"] = 1;
+    wordCounts["and"] = 2;
+    wordCounts["dog"] = 7;
+    wordCounts["bird"] = 1;
+    check(!added && matches(words, wordCounts), "upserts");
+
+    if(failures > 0) {
+        cout << failures << " checks FAILED" << endl;
+        return 1;
+    }
     return 0;
 }
@@ -3,23 +3,40 @@
 
 #include <iostream>
 #include <exception>
+#include <stdexcept>
 #include <cstdlib>
+#include <cstdint>
 #include <utility>
+#include <type_traits>
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <cmath>
+#ifdef BST_HIT_COUNTERS
+#include <atomic>
+#endif
+#include "node_pool.h"
+#include "frozen_index.h"
 
 using namespace std;
 /**
  * A templated class for a Node in a search tree.
- * The getters for parent/left/right are virtual so
- * that they can be overridden for future kinds of
- * search trees, such as Red Black trees, Splay trees,
- * and AVL trees.
+ * Nothing here is virtual, so nodes carry no vtable
+ * pointer and every step of a descent inlines. Node
+ * types for other kinds of search trees, such as Red
+ * Black trees, Splay trees, and AVL trees, derive from
+ * this and hide getParent/getLeft/getRight with
+ * versions that return their own type, which is only a
+ * static_cast. The tree for such a node type overrides
+ * BinarySearchTree::destroyNode() so the right
+ * destructor runs.
  */
 template <typename Key, typename Value>
 class Node
 {
 public:
     Node(const Key& key, const Value& value, Node<Key, Value>* parent);
-    virtual ~Node();
+    ~Node();
 
     const std::pair<const Key, Value>& getItem() const;
     std::pair<const Key, Value>& getItem();
@@ -27,20 +44,55 @@ public:
     const Value& getValue() const;
     Value& getValue();
 
-    virtual Node<Key, Value>* getParent() const;
-    virtual Node<Key, Value>* getLeft() const;
-    virtual Node<Key, Value>* getRight() const;
+    Node<Key, Value>* getParent() const;
+    Node<Key, Value>* getLeft() const;
+    Node<Key, Value>* getRight() const;
 
     void setParent(Node<Key, Value>* parent);
     void setLeft(Node<Key, Value>* left);
     void setRight(Node<Key, Value>* right);
     void setValue(const Value &value);
 
+#ifdef BST_ORDER_STATISTICS
+    // Number of nodes in the subtree rooted here, including this one
+    size_t getSubtreeSize() const;
+    void setSubtreeSize(size_t size);
+#endif
+    void updateSubtreeSize();
+
+#ifdef BST_HIT_COUNTERS
+    // Number of times find() or operator[] found this node
+    size_t getHits() const;
+    void setHits(size_t hits);
+#endif
+    void recordHit() const;
+
 protected:
+#ifdef BST_PACKED_BALANCE
+    // Nodes are 8-byte aligned, so the low 3 bits of the parent pointer
+    // are always zero. Derived nodes keep a small tag there instead of in
+    // a field of their own, e.g. the AVL balance.
+    static const std::uintptr_t PARENT_TAG_MASK = 7;
+    unsigned getParentTag() const;
+    void setParentTag(unsigned tag);
+#endif
+
     std::pair<const Key, Value> item_;
+#ifdef BST_PACKED_BALANCE
+    std::uintptr_t parentAndTag_;
+#else
     Node<Key, Value>* parent_;
+#endif
     Node<Key, Value>* left_;
     Node<Key, Value>* right_;
+#ifdef BST_ORDER_STATISTICS
+    size_t size_;
+#endif
+#ifdef BST_HIT_COUNTERS
+    // Lookups are const and may run on several threads at once, so the
+    // count is a relaxed atomic: it orders nothing, it just loses no hits
+    mutable std::atomic<size_t> hits_;
+#endif
 };
 
 /*
@@ -55,9 +107,19 @@ protected:
 template<typename Key, typename Value>
 Node<Key, Value>::Node(const Key& key, const Value& value, Node<Key, Value>* parent) :
     item_(key, value),
+#ifdef BST_PACKED_BALANCE
+    parentAndTag_(reinterpret_cast<std::uintptr_t>(parent)),
+#else
     parent_(parent),
+#endif
     left_(NULL),
     right_(NULL)
+#ifdef BST_ORDER_STATISTICS
+    , size_(1)
+#endif
+#ifdef BST_HIT_COUNTERS
+    , hits_(0)
+#endif
 {
 
 }
@@ -119,16 +181,20 @@ Value& Node<Key, Value>::getValue()
 }
 
 /**
-* An implementation of the virtual function for retreiving the parent.
+* A getter for the parent.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getParent() const
 {
+#ifdef BST_PACKED_BALANCE
+    return reinterpret_cast<Node<Key, Value>*>(parentAndTag_ & ~PARENT_TAG_MASK);
+#else
     return parent_;
+#endif
 }
 
 /**
-* An implementation of the virtual function for retreiving the left child.
+* A getter for the left child.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getLeft() const
@@ -137,7 +203,7 @@ Node<Key, Value>* Node<Key, Value>::getLeft() const
 }
 
 /**
-* An implementation of the virtual function for retreiving the right child.
+* A getter for the right child.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getRight() const
@@ -151,7 +217,12 @@ Node<Key, Value>* Node<Key, Value>::getRight() const
 template<typename Key, typename Value>
 void Node<Key, Value>::setParent(Node<Key, Value>* parent)
 {
+#ifdef BST_PACKED_BALANCE
+    // The tag belongs to this node, so it stays when the parent changes
+    parentAndTag_ = reinterpret_cast<std::uintptr_t>(parent) | (parentAndTag_ & PARENT_TAG_MASK);
+#else
     parent_ = parent;
+#endif
 }
 
 /**
@@ -181,6 +252,92 @@ void Node<Key, Value>::setValue(const Value& value)
     item_.second = value;
 }
 
+#ifdef BST_ORDER_STATISTICS
+/**
+* A getter for the number of nodes in this node's subtree.
+*/
+template<typename Key, typename Value>
+size_t Node<Key, Value>::getSubtreeSize() const
+{
+    return size_;
+}
+
+/**
+* A setter for the number of nodes in this node's subtree.
+*/
+template<typename Key, typename Value>
+void Node<Key, Value>::setSubtreeSize(size_t size)
+{
+    size_ = size;
+}
+#endif
+
+#ifdef BST_PACKED_BALANCE
+/**
+* A getter for the tag kept in the low bits of the parent pointer.
+*/
+template<typename Key, typename Value>
+unsigned Node<Key, Value>::getParentTag() const
+{
+    return static_cast<unsigned>(parentAndTag_ & PARENT_TAG_MASK);
+}
+
+/**
+* A setter for the tag kept in the low bits of the parent pointer.
+*/
+template<typename Key, typename Value>
+void Node<Key, Value>::setParentTag(unsigned tag)
+{
+    parentAndTag_ = (parentAndTag_ & ~PARENT_TAG_MASK) | (tag & PARENT_TAG_MASK);
+}
+#endif
+
+#ifdef BST_HIT_COUNTERS
+/**
+* A getter for the number of lookups that found this node.
+*/
+template<typename Key, typename Value>
+size_t Node<Key, Value>::getHits() const
+{
+    return hits_.load(std::memory_order_relaxed);
+}
+
+/**
+* A setter for the number of lookups that found this node.
+*/
+template<typename Key, typename Value>
+void Node<Key, Value>::setHits(size_t hits)
+{
+    hits_.store(hits, std::memory_order_relaxed);
+}
+#endif
+
+/**
+* Counts a lookup that found this node. Does nothing unless
+* BST_HIT_COUNTERS is defined.
+*/
+template<typename Key, typename Value>
+void Node<Key, Value>::recordHit() const
+{
+#ifdef BST_HIT_COUNTERS
+    hits_.fetch_add(1, std::memory_order_relaxed);
+#endif
+}
+
+/**
+* Recomputes the subtree size from the children, which must already be
+* up to date. Does nothing unless BST_ORDER_STATISTICS is defined.
+*/
+template<typename Key, typename Value>
+void Node<Key, Value>::updateSubtreeSize()
+{
+#ifdef BST_ORDER_STATISTICS
+    size_ = 1;
+    if(left_ != NULL) size_ += left_->size_;
+    if(right_ != NULL) size_ += right_->size_;
+#endif
+}
+
 /*
   ---------------------------------------
   End implementations for the Node class.
@@ -195,10 +352,20 @@ class BinarySearchTree
 {
 public:
     BinarySearchTree(); //TODO
+    template<typename InputIt>
+    BinarySearchTree(InputIt first, InputIt last);
     virtual ~BinarySearchTree(); //TODO
     virtual void insert(const std::pair<const Key, Value>& keyValuePair); //TODO
     virtual void remove(const Key& key); //TODO
     void clear(); //TODO
+    void setNodeResource(NodeResource* resource);
+    // Scapegoat mode, which keeps the plain tree O(log n) deep
+    virtual void setScapegoatAlpha(double alpha);
+    double getScapegoatAlpha() const;
+    template<typename InputIt>
+    void assign(InputIt first, InputIt last);
+    virtual void rebalance();
+    virtual void rebuildOptimal();
 
     bool isBalanced() const; //TODO
     void print() const;
@@ -216,6 +383,12 @@ public:
     class iterator  // TODO
     {
     public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key,Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef std::pair<const Key,Value>* pointer;
+        typedef std::pair<const Key,Value>& reference;
+
         iterator();
 
         std::pair<const Key,Value>& operator*() const;
@@ -225,29 +398,102 @@ public:
         bool operator!=(const iterator& rhs) const;
 
         iterator& operator++();
+        iterator operator++(int);
+        iterator& operator--();
+        iterator operator--(int);
 
     protected:
         friend class BinarySearchTree<Key, Value>;
         iterator(Node<Key,Value>* ptr);
+        iterator(Node<Key,Value>* ptr, const BinarySearchTree<Key, Value>* tree);
         Node<Key, Value> *current_;
+        // Lets the end iterator step back to the largest key
+        const BinarySearchTree<Key, Value>* tree_;
     };
 
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+
 public:
+    // Upserts that find the key and insert it in the same descent
+    std::pair<iterator, bool> try_insert(const Key& key, const Value& value);
+    std::pair<iterator, bool> insert_or_assign(const Key& key, const Value& value);
+    template<typename Fn>
+    Value& compute(const Key& key, Fn fn);
+
     iterator begin() const;
     iterator end() const;
+    reverse_iterator rbegin() const;
+    reverse_iterator rend() const;
     iterator find(const Key& key) const;
+
+    // Ordered range queries, all O(log n)
+    iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key) const;
+    std::pair<iterator, iterator> equal_range(const Key& key) const;
+    iterator floor(const Key& key) const;
+    iterator ceiling(const Key& key) const;
+    void find_many(const std::vector<Key>& keys, std::vector<iterator>& out) const;
+
+    // Order statistics. O(log n) when built with BST_ORDER_STATISTICS,
+    // otherwise they fall back to walking the tree in order.
+    size_t size() const;
+    iterator select(size_t k) const;
+    size_t rank(const Key& key) const;
+    size_t count_range(const Key& lo, const Key& hi) const;
     Value& operator[](const Key& key);
     Value const & operator[](const Key& key) const;
 
+    // A read-only copy of the tree laid out for fast searching
+    FrozenIndex<Key, Value> freeze(FrozenLayout layout = EYTZINGER_LAYOUT) const;
+
 protected:
     // Mandatory helper functions
     Node<Key, Value>* internalFind(const Key& k) const; // TODO
+    Node<Key, Value>* findSlot(const Key& key, Node<Key, Value>** parent, bool* left, size_t* depth) const;
+    virtual Node<Key, Value>* insertLeaf(Node<Key, Value>* parent, bool left, size_t depth,
+        const Key& key, const Value& value);
+    virtual void accessed(Node<Key, Value>* current);
+    iterator iteratorAt(Node<Key, Value>* current) const;
+    static void prefetchNode(const Node<Key, Value>* current);
+    static void updateSizesToRoot(Node<Key, Value>* current);
+    size_t countLess(const Key& key, bool inclusive) const;
     Node<Key, Value> *getSmallestNode() const;  // TODO
+    Node<Key, Value> *getLargestNode() const;
     static Node<Key, Value>* predecessor(Node<Key, Value>* current); // TODO
     // Note:  static means these functions don't have a "this" pointer
     //        and instead just use the input argument.
     void clearHelper(Node<Key, Value>* current); //TODO
 
+    // Node allocation goes through these so the nodes live in resource_
+    template<typename NodeType>
+    NodeType* createNode(const Key& key, const Value& value, NodeType* parent);
+    virtual void destroyNode(Node<Key, Value>* current);
+    template<typename NodeType>
+    void destroyNodeAs(Node<Key, Value>* current);
+    void checkNodesFrom(const BinarySearchTree<Key, Value>& other) const;
+    void takeNodesFrom(BinarySearchTree<Key, Value>& other);
+    void shareNodesWith(BinarySearchTree<Key, Value>& other);
+
+    // Bulk building helpers
+    template<typename InputIt>
+    static void sortedItems(InputIt first, InputIt last, std::vector<std::pair<Key, Value> >& items);
+    Node<Key, Value>* buildBalanced(const std::vector<std::pair<Key, Value> >& items,
+        size_t lo, size_t hi, Node<Key, Value>* parent);
+
+    // rebalance() helpers
+    void replaceChild(Node<Key, Value>* parent, Node<Key, Value>* child, Node<Key, Value>* replacement);
+    void compressVine(size_t count);
+    static size_t lookupWeight(const Node<Key, Value>* current);
+    static Node<Key, Value>* linkWeighted(const std::vector<Node<Key, Value>*>& nodes,
+        const std::vector<std::uint64_t>& weightBefore, size_t lo, size_t hi, Node<Key, Value>* parent);
+
+    // Scapegoat mode helpers
+    void scapegoatInserted(Node<Key, Value>* added, size_t depth);
+    void scapegoatRemoved();
+    void rebuildSubtree(Node<Key, Value>* current);
+    static size_t countNodes(Node<Key, Value>* current);
+    static Node<Key, Value>* linkBalanced(const std::vector<Node<Key, Value>*>& nodes,
+        size_t lo, size_t hi, Node<Key, Value>* parent);
 
 
     // Provided helper functions
@@ -266,7 +512,15 @@ protected:
 
 protected:
     Node<Key, Value>* root_;
-    // You should not need other data members
+    // Built-in slab pool, used unless setNodeResource() supplies another one
+    NodeArena arena_;
+    NodeResource* resource_;
+    // Scapegoat mode is on when alpha is not 0. It then keeps count of
+    // the nodes, and of the most there have been since the last rebuild
+    // of the whole tree.
+    double scapegoatAlpha_;
+    size_t scapegoatCount_;
+    size_t scapegoatMaxCount_;
 };
 
 /*
@@ -280,17 +534,28 @@ Begin implementations for the BinarySearchTree::iterator class.
 */
 template<class Key, class Value>
 BinarySearchTree<Key, Value>::iterator::iterator(Node<Key,Value> *ptr)
-: current_(ptr)
+: current_(ptr), tree_(nullptr)
 {
     // TODO
 }
 
+/**
+* Constructor for iterators handed out by a tree. Knowing the tree lets
+* the end iterator be decremented.
+*/
+template<class Key, class Value>
+BinarySearchTree<Key, Value>::iterator::iterator(Node<Key,Value> *ptr, const BinarySearchTree<Key, Value>* tree)
+: current_(ptr), tree_(tree)
+{
+
+}
+
 /**
 * A default constructor that initializes the iterator to NULL.
 */
 template<class Key, class Value>
 BinarySearchTree<Key, Value>::iterator::iterator() 
-: current_(nullptr)
+: current_(nullptr), tree_(nullptr)
 {
     // TODO
 }
@@ -356,6 +621,49 @@ BinarySearchTree<Key, Value>::iterator::operator++()
 
 }
 
+/**
+* Postfix increment.
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::iterator::operator++(int)
+{
+    iterator old = *this;
+    ++(*this);
+    return old;
+}
+
+/**
+* Moves the iterator back to the previous key in order. Decrementing the
+* end iterator gives the largest key.
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator&
+BinarySearchTree<Key, Value>::iterator::operator--()
+{
+    if(current_ == nullptr){
+        if(tree_ != nullptr){
+            current_ = tree_->getLargestNode();
+        }
+    }
+    else{
+        current_ = predecessor(current_);
+    }
+    return *this;
+}
+
+/**
+* Postfix decrement.
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::iterator::operator--(int)
+{
+    iterator old = *this;
+    --(*this);
+    return old;
+}
+
 
 /*
 -------------------------------------------------------------
@@ -374,11 +682,25 @@ Begin implementations for the BinarySearchTree class.
 */
 template<class Key, class Value>
 BinarySearchTree<Key, Value>::BinarySearchTree() 
-: root_(nullptr)
+: root_(nullptr), arena_(), resource_(&arena_),
+  scapegoatAlpha_(0), scapegoatCount_(0), scapegoatMaxCount_(0)
 {
     // TODO
 }
 
+/**
+* Builds a perfectly balanced tree out of the key/value pairs in [first, last).
+* See assign().
+*/
+template<class Key, class Value>
+template<typename InputIt>
+BinarySearchTree<Key, Value>::BinarySearchTree(InputIt first, InputIt last)
+: root_(nullptr), arena_(), resource_(&arena_),
+  scapegoatAlpha_(0), scapegoatCount_(0), scapegoatMaxCount_(0)
+{
+    assign(first, last);
+}
+
 template<typename Key, typename Value>
 BinarySearchTree<Key, Value>::~BinarySearchTree()
 {
@@ -409,7 +731,7 @@ template<class Key, class Value>
 typename BinarySearchTree<Key, Value>::iterator
 BinarySearchTree<Key, Value>::begin() const
 {
-    BinarySearchTree<Key, Value>::iterator begin(getSmallestNode());
+    BinarySearchTree<Key, Value>::iterator begin(getSmallestNode(), this);
     return begin;
 }
 
@@ -420,10 +742,30 @@ template<class Key, class Value>
 typename BinarySearchTree<Key, Value>::iterator
 BinarySearchTree<Key, Value>::end() const
 {
-    BinarySearchTree<Key, Value>::iterator end(NULL);
+    BinarySearchTree<Key, Value>::iterator end(NULL, this);
     return end;
 }
 
+/**
+* Returns a reverse iterator to the largest item in the tree
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::reverse_iterator
+BinarySearchTree<Key, Value>::rbegin() const
+{
+    return reverse_iterator(end());
+}
+
+/**
+* Returns the reverse iterator past the smallest item
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::reverse_iterator
+BinarySearchTree<Key, Value>::rend() const
+{
+    return reverse_iterator(begin());
+}
+
 /**
 * Returns an iterator to the item with the given key, k
 * or the end iterator if k does not exist in the tree
@@ -433,295 +775,460 @@ typename BinarySearchTree<Key, Value>::iterator
 BinarySearchTree<Key, Value>::find(const Key & k) const
 {
     Node<Key, Value> *curr = internalFind(k);
-    BinarySearchTree<Key, Value>::iterator it(curr);
+    if(curr != NULL) curr->recordHit();
+    BinarySearchTree<Key, Value>::iterator it(curr, this);
     return it;
 }
 
 /**
- * @precondition The key exists in the map
- * Returns the value associated with the key
- */
+* Returns an iterator to a node of this tree, for subclasses that find
+* nodes their own way
+*/
 template<class Key, class Value>
-Value& BinarySearchTree<Key, Value>::operator[](const Key& key)
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::iteratorAt(Node<Key, Value>* current) const
 {
-    Node<Key, Value> *curr = internalFind(key);
-    if(curr == NULL) throw std::out_of_range("Invalid key");
-    return curr->getValue();
+    return iterator(current, this);
 }
+
+/**
+* Returns an iterator to the first item whose key is not less than key,
+* or the end iterator if there is none
+*/
 template<class Key, class Value>
-Value const & BinarySearchTree<Key, Value>::operator[](const Key& key) const
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::lower_bound(const Key& key) const
 {
-    Node<Key, Value> *curr = internalFind(key);
-    if(curr == NULL) throw std::out_of_range("Invalid key");
-    return curr->getValue();
+    Node<Key, Value>* temp = root_;
+    Node<Key, Value>* best = nullptr;
+    while(temp != nullptr){
+        if(temp->getKey() < key){
+            temp = temp->getRight();
+        }
+        else{
+            best = temp;
+            temp = temp->getLeft();
+        }
+    }
+    return iterator(best, this);
 }
 
 /**
-* An insert method to insert into a Binary Search Tree.
-* The tree will not remain balanced when inserting.
-* Recall: If key is already in the tree, you should 
-* overwrite the current value with the updated value.
+* Returns an iterator to the first item whose key is greater than key,
+* or the end iterator if there is none
 */
 template<class Key, class Value>
-void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &keyValuePair)
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::upper_bound(const Key& key) const
 {
-
-
-  Node<Key, Value>* newNode = new Node<Key, Value>(keyValuePair.first, keyValuePair.second, nullptr);
-  Node<Key, Value>* temp = this->root_;
-  if(this->root_ == nullptr){
-    this->root_ = newNode;
-    return;
-  }  
-
-
-
-  while(temp != nullptr){
-    if(newNode->getKey() < temp->getKey()){
-      if(temp->getLeft() == nullptr){
-        temp->setLeft(newNode);
-        newNode->setParent(temp);
-        return;
-      }
-    temp = temp->getLeft();
-    }
-    else if(temp->getKey() < newNode->getKey()){
-      // cout << "---   1   ---" << endl;
-      // cout << "INSERTING " << keyValuePair.first << endl;
-      // cout << temp->getKey() << endl;
-      // cout << "Past Priting temp->getKey()" << endl;
-      // this->printRoot(this->root_);
-      // cout << "---   2  ---" << endl;
-      if(temp->getRight() == nullptr){
-        temp->setRight(newNode);
-        newNode->setParent(temp);
-        return;
-      }
-    temp = temp->getRight();
-    }
-    else{
-      temp->setValue(keyValuePair.second);
-      delete newNode;
-      return;
+    Node<Key, Value>* temp = root_;
+    Node<Key, Value>* best = nullptr;
+    while(temp != nullptr){
+        if(key < temp->getKey()){
+            best = temp;
+            temp = temp->getLeft();
+        }
+        else{
+            temp = temp->getRight();
+        }
     }
-  }
-
-
-
-
-    
-
+    return iterator(best, this);
 }
 
-
 /**
-* A remove method to remove a specific key from a Binary Search Tree.
-* Recall: The writeup specifies that if a node has 2 children you
-* should swap with the predecessor and then remove.
+* Returns the range of items with the given key, as
+* (lower_bound(key), upper_bound(key))
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::remove(const Key& key)
+template<class Key, class Value>
+std::pair<typename BinarySearchTree<Key, Value>::iterator, typename BinarySearchTree<Key, Value>::iterator>
+BinarySearchTree<Key, Value>::equal_range(const Key& key) const
 {
-    // TODO
-    /******
-    void remove(const Key& key) : This function will remove the node with the 
-    specified key from the tree. There is no guarantee the tree is balanced 
-    before or after the removal. If the key is not already in the tree, this function 
-    will do nothing. If the node to be removed has two children, swap with its 
-    predecessor (not its successor) in the BST removal algorithm. If the node to 
-    be removed has exactly one child, you can promote the child. You may NOT just 
-    swap key,value pairs. You must swap the actual nodes by changing pointers, but 
-    we have given you a helper function to do this in the BST class: swapNode(). 
-    Runtime of removal should be O(h).
-    ******/
-    // cout << "---------" << endl;
-    // this->printRoot(this->root_);
-    // cout << "Node to delete: " << key << endl;
-    // cout << "---------" << endl;
+    return std::make_pair(lower_bound(key), upper_bound(key));
+}
 
-    if(root_ == nullptr){
-        return;
-    }
+/**
+* Returns an iterator to the item with the largest key not greater than
+* key, or the end iterator if every key is greater
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::floor(const Key& key) const
+{
     Node<Key, Value>* temp = root_;
-    // if(internalFind(temp->getKey()) == nullptr){
-    //     return;
-    // }
-
-    while(true){
-        if(temp == nullptr){
-          return;
-        }
-        if(temp->getKey() == key){
-            break;
-        }
-        if(temp->getKey() > key){
-            temp = temp->getRight();
-        }
-        else{
+    Node<Key, Value>* best = nullptr;
+    while(temp != nullptr){
+        if(key < temp->getKey()){
             temp = temp->getLeft();
         }
-    }
-    // If it has no children
-    if(temp->getLeft() == nullptr && temp->getRight() == nullptr){
-      // if root is the only one, we need to set it equal to null
-        if(root_ == temp){
-          delete temp;
-          root_ = nullptr;
+        else{
+            best = temp;
+            temp = temp->getRight();
         }
-        else {delete temp;}
-        return;
     }
-    // If it only has 1 child to the right
-    if(temp->getLeft() == nullptr){
-
-        //Set the child's parent to temp's parent
-        temp->getRight()->setParent(temp->getParent());
-        
-        // If Temp is the root
-        if(temp->getParent() == nullptr){
-          root_ = temp->getRight();
-        }
-        // If temp is a left child
-        else if(temp->getParent()->getLeft() == temp){
+    return iterator(best, this);
+}
 
-            // Set the parent's left to the child
-            temp->getParent()->setLeft(temp->getRight());
+/**
+* Returns an iterator to the item with the smallest key not less than
+* key, or the end iterator if every key is smaller
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::ceiling(const Key& key) const
+{
+    return lower_bound(key);
+}
 
+/**
+* Looks up a whole batch of keys; out[i] is find(keys[i]). The searches
+* advance together one level at a time, and each step prefetches the child
+* the search goes to next, so the cache misses of a batch overlap instead
+* of being paid one after another.
+*/
+template<class Key, class Value>
+void BinarySearchTree<Key, Value>::find_many(const std::vector<Key>& keys, std::vector<iterator>& out) const
+{
+    // Enough searches in flight to cover memory latency without
+    // running out of line fill buffers
+    const size_t lanes = 16;
+    Node<Key, Value>* current[lanes];
+
+    out.assign(keys.size(), end());
+    for(size_t base = 0; base < keys.size(); base += lanes){
+        size_t count = std::min(lanes, keys.size() - base);
+        for(size_t i = 0; i < count; i++){
+            current[i] = root_;
         }
-        // If temp is a right child
-        else{
-            // Set the parent's right to the child
-            temp->getParent()->setRight(temp->getRight());
-
+        size_t active = (root_ == nullptr) ? 0 : count;
+        while(active > 0){
+            active = 0;
+            for(size_t i = 0; i < count; i++){
+                Node<Key, Value>* temp = current[i];
+                if(temp == nullptr){
+                    continue;
+                }
+                const Key& key = keys[base + i];
+                if(key < temp->getKey()){
+                    temp = temp->getLeft();
+                }
+                else if(temp->getKey() < key){
+                    temp = temp->getRight();
+                }
+                else{
+                    temp->recordHit();
+                    out[base + i] = iterator(temp, this);
+                    temp = nullptr;
+                }
+                current[i] = temp;
+                if(temp != nullptr){
+                    prefetchNode(temp);
+                    active++;
+                }
+            }
         }
+    }
+}
 
-        delete temp;
-
-        return;
+/**
+* Returns the number of keys in the tree.
+*/
+template<class Key, class Value>
+size_t BinarySearchTree<Key, Value>::size() const
+{
+#ifdef BST_ORDER_STATISTICS
+    return (root_ == nullptr) ? 0 : root_->getSubtreeSize();
+#else
+    size_t count = 0;
+    for(iterator it = begin(); it != end(); ++it){
+        count++;
     }
-    // If it only has 1 child to the left
-    else if (temp->getRight() == nullptr){
+    return count;
+#endif
+}
 
-        //Set the child's parent to temp's parent
-        temp->getLeft()->setParent(temp->getParent());
-        // If Temp is the root
-        if(temp->getParent() == nullptr){
-          root_ = temp->getLeft();
+/**
+* Returns an iterator to the k-th smallest key (counting from 0),
+* or the end iterator if the tree has k keys or fewer.
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::select(size_t k) const
+{
+#ifdef BST_ORDER_STATISTICS
+    Node<Key, Value>* temp = root_;
+    while(temp != nullptr){
+        size_t leftSize = (temp->getLeft() == nullptr) ? 0 : temp->getLeft()->getSubtreeSize();
+        if(k < leftSize){
+            temp = temp->getLeft();
         }
-
-        // If temp is a right child
-        else if(temp->getParent()->getRight() == temp){
-
-            // Set the parent's Right to the child
-            temp->getParent()->setRight(temp->getLeft());
-
+        else if(k == leftSize){
+            return iterator(temp, this);
         }
-        // If temp is a left child
         else{
-            // Set the parent's left to the child
-            temp->getParent()->setLeft(temp->getLeft());
-
+            k -= leftSize + 1;
+            temp = temp->getRight();
         }
-
-
-        delete temp;
-        return;
     }
-    //If it has 2 nodes
-    else{
-        // cout << "1" << endl;
-        cout << predecessor(temp)->getKey() << endl;
-        nodeSwap(temp, predecessor(temp));
-        // cout << "NODES Have Been Swapped" << endl;
-        // cout << "Root: " << root_->getKey() << endl;
-        // cout << "Left: " << root_->getLeft()->getKey() << endl;
-        // cout << "Right: " << root_->getRight()->getKey() << endl;
-        // this->printRoot(this->root_);
-
-        if(temp->getLeft() == nullptr && temp->getRight() == nullptr){
-          // cout << "?" << endl;
-          if(temp->getParent()->getLeft() == temp){
-            temp->getParent()->setLeft(nullptr);
-          }
-          else{
-            temp->getParent()->setRight(nullptr);
-          }
-          delete temp;
-          this->printRoot(this->root_);
-          cout << "!" << endl;
-          return;
-        }
+    return end();
+#else
+    iterator it = begin();
+    for(; it != end() && k > 0; --k){
+        ++it;
+    }
+    return it;
+#endif
+}
 
-        if(temp->getLeft() == nullptr){
+/**
+* Returns the number of keys in the tree that are smaller than key.
+*/
+template<class Key, class Value>
+size_t BinarySearchTree<Key, Value>::rank(const Key& key) const
+{
+    return countLess(key, false);
+}
 
-        //Set the child's parent to temp's parent
-        temp->getRight()->setParent(temp->getParent());
-        
-        // If Temp is the root
-        if(temp->getParent() == nullptr){
-          root_ = temp->getRight();
-        }
-        // If temp is a left child
-        else if(temp->getParent()->getLeft() == temp){
-                          cout << "5" << endl;
+/**
+* Returns the number of keys k in the tree with lo <= k <= hi.
+*/
+template<class Key, class Value>
+size_t BinarySearchTree<Key, Value>::count_range(const Key& lo, const Key& hi) const
+{
+    if(hi < lo){
+        return 0;
+    }
+    return countLess(hi, true) - countLess(lo, false);
+}
 
+/**
+* Copies the pairs into an immutable, pointer-free FrozenIndex in the given
+* layout. Later changes to the tree do not show up in the index.
+*/
+template<class Key, class Value>
+FrozenIndex<Key, Value> BinarySearchTree<Key, Value>::freeze(FrozenLayout layout) const
+{
+    return FrozenIndex<Key, Value>(begin(), end(), layout);
+}
 
-            // Set the parent's left to the child
-            temp->getParent()->setLeft(temp->getRight());
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<class Key, class Value>
+Value& BinarySearchTree<Key, Value>::operator[](const Key& key)
+{
+    Node<Key, Value> *curr = internalFind(key);
+    if(curr == NULL) throw std::out_of_range("Invalid key");
+    curr->recordHit();
+    return curr->getValue();
+}
+template<class Key, class Value>
+Value const & BinarySearchTree<Key, Value>::operator[](const Key& key) const
+{
+    Node<Key, Value> *curr = internalFind(key);
+    if(curr == NULL) throw std::out_of_range("Invalid key");
+    curr->recordHit();
+    return curr->getValue();
+}
 
-        }
-        // If temp is a right child
-        else{
-                          cout << "6" << endl;
+/**
+* An insert method to insert into a Binary Search Tree.
+* The tree will not remain balanced when inserting.
+* Recall: If key is already in the tree, you should 
+* overwrite the current value with the updated value.
+*/
+template<class Key, class Value>
+void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &keyValuePair)
+{
+  Node<Key, Value>* parent;
+  bool left;
+  size_t depth;
+  Node<Key, Value>* found = findSlot(keyValuePair.first, &parent, &left, &depth);
+  if(found != nullptr){
+    found->setValue(keyValuePair.second);
+    accessed(found);
+    return;
+  }
+  insertLeaf(parent, left, depth, keyValuePair.first, keyValuePair.second);
+}
 
-            // Set the parent's right to the child
-            temp->getParent()->setRight(temp->getRight());
+/**
+* Inserts the pair unless key is already in the tree, in which case the
+* old value stays. Returns an iterator to key's item and whether it was
+* inserted. One descent. Nodes are made by the virtual insertLeaf(), which
+* takes the value by reference, so it is copied in rather than emplaced.
+*/
+template<class Key, class Value>
+std::pair<typename BinarySearchTree<Key, Value>::iterator, bool>
+BinarySearchTree<Key, Value>::try_insert(const Key& key, const Value& value)
+{
+  Node<Key, Value>* parent;
+  bool left;
+  size_t depth;
+  Node<Key, Value>* found = findSlot(key, &parent, &left, &depth);
+  if(found != nullptr){
+    accessed(found);
+    return std::make_pair(iteratorAt(found), false);
+  }
+  Node<Key, Value>* added = insertLeaf(parent, left, depth, key, value);
+  return std::make_pair(iteratorAt(added), true);
+}
 
-        }
-                cout << "9" << endl;
+/**
+* Inserts the pair, or overwrites the value if key is already in the
+* tree. Returns an iterator to key's item and whether it was inserted.
+*/
+template<class Key, class Value>
+std::pair<typename BinarySearchTree<Key, Value>::iterator, bool>
+BinarySearchTree<Key, Value>::insert_or_assign(const Key& key, const Value& value)
+{
+  Node<Key, Value>* parent;
+  bool left;
+  size_t depth;
+  Node<Key, Value>* found = findSlot(key, &parent, &left, &depth);
+  if(found != nullptr){
+    found->setValue(value);
+    accessed(found);
+    return std::make_pair(iteratorAt(found), false);
+  }
+  Node<Key, Value>* added = insertLeaf(parent, left, depth, key, value);
+  return std::make_pair(iteratorAt(added), true);
+}
 
-        delete temp;
+/**
+* Calls fn on key's value, inserting key with Value() first if it is not
+* in the tree, all in one descent, and returns the value. For example
+* compute(word, [](int& count){ count++; }) counts words.
+*/
+template<class Key, class Value>
+template<typename Fn>
+Value& BinarySearchTree<Key, Value>::compute(const Key& key, Fn fn)
+{
+  Node<Key, Value>* parent;
+  bool left;
+  size_t depth;
+  Node<Key, Value>* found = findSlot(key, &parent, &left, &depth);
+  if(found == nullptr){
+    found = insertLeaf(parent, left, depth, key, Value());
+  }
+  else{
+    accessed(found);
+  }
+  fn(found->getValue());
+  return found->getValue();
+}
 
-        return;
+/**
+* Looks for key. Returns its node if it is in the tree; otherwise returns
+* NULL and sets where a new node for it would go: under parent (NULL for
+* an empty tree), on the left if left is set, at the given depth with the
+* root at 0.
+*/
+template<class Key, class Value>
+Node<Key, Value>* BinarySearchTree<Key, Value>::findSlot(const Key& key, Node<Key, Value>** parent,
+    bool* left, size_t* depth) const
+{
+  Node<Key, Value>* temp = root_;
+  *parent = nullptr;
+  *left = false;
+  *depth = 0;
+  while(temp != nullptr){
+    if(key < temp->getKey()){
+      *left = true;
     }
-    // If it only has 1 child to the left
-    else if (temp->getRight() == nullptr){
-                cout << "3" << endl;
-
-        //Set the child's parent to temp's parent
-        temp->getLeft()->setParent(temp->getParent());
-        // If Temp is the root
-        if(temp->getParent() == nullptr){
-          root_ = temp->getLeft();
-        }
-
-        // If temp is a right child
-        else if(temp->getParent()->getRight() == temp){
-
-            // Set the parent's Right to the child
-            temp->getParent()->setRight(temp->getLeft());
+    else if(temp->getKey() < key){
+      *left = false;
+    }
+    else{
+      return temp;
+    }
+    *parent = temp;
+    temp = *left ? temp->getLeft() : temp->getRight();
+    (*depth)++;
+  }
+  return nullptr;
+}
 
-        }
-        // If temp is a left child
-        else{
-            // Set the parent's left to the child
-            temp->getParent()->setLeft(temp->getLeft());
+/**
+* Adds a node for key where findSlot() said it goes and rebalances as
+* the tree requires, returning the new node. Trees with their own node
+* type override this, so the single-descent upserts work for them too.
+*/
+template<class Key, class Value>
+Node<Key, Value>* BinarySearchTree<Key, Value>::insertLeaf(Node<Key, Value>* parent, bool left, size_t depth,
+    const Key& key, const Value& value)
+{
+  Node<Key, Value>* added = createNode<Node<Key, Value> >(key, value, parent);
+  if(parent == nullptr){
+    root_ = added;
+  }
+  else if(left){
+    parent->setLeft(added);
+  }
+  else{
+    parent->setRight(added);
+  }
+  updateSizesToRoot(parent);
+  scapegoatInserted(added, depth);
+  return added;
+}
 
-        }
+/**
+* Called when insert() or one of the upserts finds its key already in the
+* tree. Does nothing here; SplayTree splays the node.
+*/
+template<class Key, class Value>
+void BinarySearchTree<Key, Value>::accessed(Node<Key, Value>* current)
+{
+  (void)current;
+}
 
 
-        delete temp;
+/**
+* A remove method to remove a specific key from a Binary Search Tree.
+* Recall: The writeup specifies that if a node has 2 children you
+* should swap with the predecessor and then remove.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::remove(const Key& key)
+{
+    Node<Key, Value>* temp = internalFind(key);
+    if(temp == nullptr){
         return;
     }
-    }
 
+    // If it has 2 children, swap with the predecessor so it has at most 1
+    if(temp->getLeft() != nullptr && temp->getRight() != nullptr){
+        nodeSwap(temp, predecessor(temp));
+    }
 
+    // Promote the only child (or nothing) into temp's place
+    Node<Key, Value>* parent = temp->getParent();
+    Node<Key, Value>* child = temp->getLeft();
+    if(child == nullptr){
+        child = temp->getRight();
+    }
+    if(child != nullptr){
+        child->setParent(parent);
+    }
 
+    // If Temp is the root
+    if(parent == nullptr){
+        root_ = child;
+    }
+    // If temp is a left child
+    else if(parent->getLeft() == temp){
+        parent->setLeft(child);
+    }
+    // If temp is a right child
+    else{
+        parent->setRight(child);
+    }
 
+    destroyNode(temp);
+    updateSizesToRoot(parent);
+    scapegoatRemoved();
 }
-
-
-
 template<class Key, class Value>
 Node<Key, Value>* BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
 {
@@ -857,20 +1364,531 @@ Node<Key, Value>* BinarySearchTree<Key, Value>::successor(Node<Key, Value>* curr
 template<typename Key, typename Value>
 void BinarySearchTree<Key, Value>::clear()
 {
-  clearHelper(root_);   
+  // Nodes whose pairs need no destructor can be dropped a slab at a time
+  bool dropped = false;
+  if(std::is_trivially_destructible<std::pair<const Key, Value> >::value){
+    dropped = resource_->release();
+  }
+  if(!dropped){
+    clearHelper(root_);
+    resource_->release();
+  }
   root_ = nullptr; 
+  scapegoatCount_ = 0;
+  scapegoatMaxCount_ = 0;
 }
 
+/**
+* Destroys every node under current without recursing, so a degenerate
+* tree (a splay tree after sorted inserts, say) cannot overflow the stack.
+* Left children are rotated up until current has none, then current is
+* destroyed and the walk moves on to its right child.
+*/
 template<typename Key, typename Value>
 void BinarySearchTree<Key, Value>::clearHelper(Node<Key, Value>* current){
+  while(current != nullptr){
+    Node<Key, Value>* left = current->getLeft();
+    if(left != nullptr){
+      current->setLeft(left->getRight());
+      left->setRight(current);
+      current = left;
+    }
+    else{
+      Node<Key, Value>* right = current->getRight();
+      destroyNode(current);
+      current = right;
+    }
+  }
+}
+
+/**
+* Switches the tree over to a different node resource. Only allowed on an
+* empty tree; passing NULL goes back to the built-in arena. The resource
+* must outlive the tree, and must not be shared with other trees unless
+* its release() is a no-op, since clear() releases all of it at once.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::setNodeResource(NodeResource* resource)
+{
+  if(root_ != nullptr){
+    throw std::logic_error("setNodeResource() on a non-empty tree");
+  }
+  resource_->release();
+  resource_ = (resource == nullptr) ? &arena_ : resource;
+}
+
+/**
+* Allocates a node of the given type out of the tree's node resource.
+*/
+template<typename Key, typename Value>
+template<typename NodeType>
+NodeType* BinarySearchTree<Key, Value>::createNode(const Key& key, const Value& value, NodeType* parent)
+{
+  void* block = resource_->allocate(sizeof(NodeType));
+  try{
+    return new (block) NodeType(key, value, parent);
+  }
+  catch(...){
+    resource_->deallocate(block);
+    throw;
+  }
+}
+
+/**
+* Destroys a node made by createNode() and hands its memory back. Nodes
+* have no virtual destructor, so trees that create a derived node type
+* override this to call destroyNodeAs() with that type.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::destroyNode(Node<Key, Value>* current)
+{
+  destroyNodeAs<Node<Key, Value> >(current);
+}
+
+template<typename Key, typename Value>
+template<typename NodeType>
+void BinarySearchTree<Key, Value>::destroyNodeAs(Node<Key, Value>* current)
+{
+  static_cast<NodeType*>(current)->~NodeType();
+  resource_->deallocate(current);
+}
+
+/**
+* Makes this tree's resource own the memory of other's nodes, so that they
+* can be linked into this tree. other must not use its nodes afterwards.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::takeNodesFrom(BinarySearchTree<Key, Value>& other)
+{
+  checkNodesFrom(other);
+  if(resource_ == &arena_ && other.resource_ == &other.arena_){
+    arena_.absorb(other.arena_);
+  }
+}
+
+/**
+* Throws if other's nodes cannot be moved into this tree, so that callers
+* can check before they change anything.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::checkNodesFrom(const BinarySearchTree<Key, Value>& other) const
+{
+  bool bothArenas = (resource_ == &arena_ && other.resource_ == &other.arena_);
+  if(!bothArenas && resource_ != other.resource_){
+    throw std::logic_error("cannot move nodes between trees with different node resources");
+  }
+}
+
+/**
+* Lets other hold nodes that were allocated by this tree, while this tree
+* keeps using the rest of its nodes.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::shareNodesWith(BinarySearchTree<Key, Value>& other)
+{
+  checkNodesFrom(other);
+  if(resource_ == &arena_ && other.resource_ == &other.arena_){
+    other.arena_.attach(arena_);
+  }
+}
+
+/**
+* Replaces the contents of the tree with the pairs in [first, last),
+* built directly into a perfectly balanced shape in O(n). Input that is
+* not sorted by key is sorted first; for duplicate keys the last pair
+* wins, just like repeated insert() calls.
+*/
+template<typename Key, typename Value>
+template<typename InputIt>
+void BinarySearchTree<Key, Value>::assign(InputIt first, InputIt last)
+{
+  std::vector<std::pair<Key, Value> > items;
+  sortedItems(first, last, items);
+  clear();
+  root_ = buildBalanced(items, 0, items.size(), nullptr);
+  scapegoatCount_ = items.size();
+  scapegoatMaxCount_ = items.size();
+}
+
+/**
+* Copies [first, last) into items, sorted by key with no duplicate keys.
+* Already-sorted input is only checked, never sorted.
+*/
+template<typename Key, typename Value>
+template<typename InputIt>
+void BinarySearchTree<Key, Value>::sortedItems(InputIt first, InputIt last, std::vector<std::pair<Key, Value> >& items)
+{
+  bool sorted = true;
+  for(; first != last; ++first){
+    if(!items.empty() && !(items.back().first < first->first)){
+      sorted = false;
+    }
+    items.push_back(std::pair<Key, Value>(first->first, first->second));
+  }
+  if(sorted){
+    return;
+  }
+
+  // Stable so that the last of several equal keys is still last
+  std::stable_sort(items.begin(), items.end(),
+    [](const std::pair<Key, Value>& a, const std::pair<Key, Value>& b){ return a.first < b.first; });
+  size_t kept = 0;
+  for(size_t i = 0; i < items.size(); i++){
+    if(kept > 0 && !(items[kept - 1].first < items[i].first)){
+      items[kept - 1].second = items[i].second;
+    }
+    else{
+      if(kept != i){
+        items[kept] = items[i];
+      }
+      kept++;
+    }
+  }
+  items.resize(kept);
+}
+
+/**
+* Builds the subtree holding items[lo, hi) by making the middle item
+* the root and recursing on both halves.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>* BinarySearchTree<Key, Value>::buildBalanced(const std::vector<std::pair<Key, Value> >& items,
+    size_t lo, size_t hi, Node<Key, Value>* parent)
+{
+  if(lo >= hi){
+    return nullptr;
+  }
+  size_t mid = lo + (hi - lo) / 2;
+  Node<Key, Value>* current = createNode<Node<Key, Value> >(items[mid].first, items[mid].second, parent);
+  current->setLeft(buildBalanced(items, lo, mid, current));
+  current->setRight(buildBalanced(items, mid + 1, hi, current));
+  current->updateSubtreeSize();
+  return current;
+}
+
+/**
+* Relinks the nodes into a complete tree, every level full but the last,
+* in O(n) time and O(1) extra memory, by the Day-Stout-Warren method.
+* Right rotations first straighten the tree into a vine, a path of right
+* children in key order, and rounds of left rotations down the vine then
+* fold it up a level at a time. No node is allocated or copied, so
+* iterators and references stay valid. Meant for the plain tree, e.g.
+* after loading it in a bad order; AVLTree and RedBlackTree override it
+* to reset their balances or colors for the new shape.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::rebalance()
+{
+  Node<Key, Value>* tail = nullptr;
+  Node<Key, Value>* rest = root_;
+  size_t count = 0;
+  while(rest != nullptr){
+    Node<Key, Value>* left = rest->getLeft();
+    if(left == nullptr){
+      tail = rest;
+      rest = rest->getRight();
+      count++;
+    }
+    else{
+      // Rotate right, so the left child takes rest's place on the vine
+      rest->setLeft(left->getRight());
+      if(left->getRight() != nullptr){
+        left->getRight()->setParent(rest);
+      }
+      left->setRight(rest);
+      rest->setParent(left);
+      left->setParent(tail);
+      replaceChild(tail, rest, left);
+      rest->updateSubtreeSize();
+      left->updateSubtreeSize();
+      rest = left;
+    }
+  }
+
+  // First fold away the nodes past the largest perfect tree, which
+  // become the partial last level, then halve the vine until it is gone
+  size_t perfect = 0;
+  while(perfect * 2 + 1 <= count){
+    perfect = perfect * 2 + 1;
+  }
+  compressVine(count - perfect);
+  while(perfect > 1){
+    perfect /= 2;
+    compressVine(perfect);
+  }
+  scapegoatMaxCount_ = scapegoatCount_;
+}
+
+/**
+* Relinks the nodes into a nearly optimal tree for the lookups counted so
+* far, with Mehlhorn's bisection rule: each subtree's root is the node
+* holding the middle of its range's total weight. A node of weight w out
+* of W ends up within about log2(W / w) + 2 levels of the root, so the
+* expected search depth follows the entropy of the lookups rather than
+* log n. Weights are hits + 1, so keys never looked up still get a
+* place, and without BST_HIT_COUNTERS all weights are equal and the tree
+* comes out perfectly balanced. Runs in O(n log n) and keeps the counts,
+* and like rebalance() it relinks the existing nodes. It applies to the
+* plain tree (and SplayTree) only: a weighted shape cannot meet the AVL or
+* red-black rules, so those trees throw std::logic_error instead.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::rebuildOptimal()
+{
+  std::vector<Node<Key, Value>*> nodes;
+  std::vector<std::uint64_t> weightBefore(1, 0);
+  for(Node<Key, Value>* temp = getSmallestNode(); temp != nullptr; temp = successor(temp)){
+    nodes.push_back(temp);
+    weightBefore.push_back(weightBefore.back() + lookupWeight(temp));
+  }
+  root_ = linkWeighted(nodes, weightBefore, 0, nodes.size(), nullptr);
+  scapegoatMaxCount_ = scapegoatCount_;
+}
+
+template<typename Key, typename Value>
+size_t BinarySearchTree<Key, Value>::lookupWeight(const Node<Key, Value>* current)
+{
+#ifdef BST_HIT_COUNTERS
+  return current->getHits() + 1;
+#else
+  (void)current;
+  return 1;
+#endif
+}
+
+/**
+* Links nodes[lo, hi) under parent around the node whose weight spans the
+* midpoint of the range's weight, found by binary search on the running
+* totals in weightBefore.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>* BinarySearchTree<Key, Value>::linkWeighted(const std::vector<Node<Key, Value>*>& nodes,
+    const std::vector<std::uint64_t>& weightBefore, size_t lo, size_t hi, Node<Key, Value>* parent)
+{
+  if(lo >= hi){
+    return nullptr;
+  }
+  // The first node whose weight ends past the midpoint, compared doubled
+  // to stay in integers
+  std::uint64_t twiceMiddle = weightBefore[lo] + weightBefore[hi];
+  size_t mid = std::upper_bound(weightBefore.begin() + lo + 1, weightBefore.begin() + hi + 1, twiceMiddle,
+    [](std::uint64_t twice, std::uint64_t total){ return twice < 2 * total; }) - weightBefore.begin() - 1;
+  Node<Key, Value>* current = nodes[mid];
+  current->setParent(parent);
+  current->setLeft(linkWeighted(nodes, weightBefore, lo, mid, current));
+  current->setRight(linkWeighted(nodes, weightBefore, mid + 1, hi, current));
+  current->updateSubtreeSize();
+  return current;
+}
+
+/**
+* Puts replacement where child hangs under parent, or at the root when
+* parent is NULL.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::replaceChild(Node<Key, Value>* parent, Node<Key, Value>* child,
+    Node<Key, Value>* replacement)
+{
+  if(parent == nullptr){
+    root_ = replacement;
+  }
+  else if(parent->getLeft() == child){
+    parent->setLeft(replacement);
+  }
+  else{
+    parent->setRight(replacement);
+  }
+}
+
+/**
+* Rotates left at every other node of the vine hanging right from the
+* root, count times, so each node rotated becomes the left child of the
+* one after it.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::compressVine(size_t count)
+{
+  Node<Key, Value>* tail = nullptr;
+  for(size_t i = 0; i < count; i++){
+    Node<Key, Value>* child = (tail == nullptr) ? root_ : tail->getRight();
+    Node<Key, Value>* next = child->getRight();
+    child->setRight(next->getLeft());
+    if(next->getLeft() != nullptr){
+      next->getLeft()->setParent(child);
+    }
+    next->setLeft(child);
+    child->setParent(next);
+    next->setParent(tail);
+    replaceChild(tail, child, next);
+    child->updateSubtreeSize();
+    next->updateSubtreeSize();
+    tail = next;
+  }
+}
+
+/**
+* Turns scapegoat mode on, or off when alpha is 0. In scapegoat mode
+* insert() and remove() keep every node's subtrees within alpha of its
+* own size, alpha in [0.5, 1), by rebuilding a subtree into perfect
+* balance when an insert lands deeper than log base 1/alpha of the node
+* count. Lookups and updates are then O(log n) amortized, with no data
+* in the nodes: 0.5 keeps the tree nearly perfect at the cost of more
+* rebuilds, values near 1 rebuild rarely. Turning it on rebuilds the
+* whole tree. It is for the plain BinarySearchTree only: the subclasses
+* override this to throw std::logic_error for any alpha but 0.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::setScapegoatAlpha(double alpha)
+{
+  if(alpha != 0 && !(alpha >= 0.5 && alpha < 1)){
+    throw std::invalid_argument("Scapegoat alpha must be 0 or in [0.5, 1)");
+  }
+  if(alpha != 0 && scapegoatAlpha_ == 0){
+    scapegoatCount_ = countNodes(root_);
+    scapegoatMaxCount_ = scapegoatCount_;
+    rebuildSubtree(root_);
+  }
+  scapegoatAlpha_ = alpha;
+}
+
+template<typename Key, typename Value>
+double BinarySearchTree<Key, Value>::getScapegoatAlpha() const
+{
+  return scapegoatAlpha_;
+}
+
+/**
+* Called with each node insert() adds and its depth, counting the root as
+* 0. If the node is too deep, walks up to the lowest ancestor with a
+* subtree heavier than alpha of its own size, the scapegoat, and rebuilds
+* its subtree. One is always found when the node is too deep.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::scapegoatInserted(Node<Key, Value>* added, size_t depth)
+{
+  if(scapegoatAlpha_ == 0){
+    return;
+  }
+  scapegoatCount_++;
+  scapegoatMaxCount_ = std::max(scapegoatMaxCount_, scapegoatCount_);
+  if(depth <= std::log(static_cast<double>(scapegoatCount_)) / std::log(1 / scapegoatAlpha_)){
+    return;
+  }
+
+  Node<Key, Value>* child = added;
+  size_t childSize = 1;
+  for(Node<Key, Value>* current = added->getParent(); current != nullptr; current = current->getParent()){
+    Node<Key, Value>* sibling = (current->getLeft() == child) ? current->getRight() : current->getLeft();
+    size_t size = childSize + countNodes(sibling) + 1;
+    if(childSize > scapegoatAlpha_ * size){
+      rebuildSubtree(current);
+      return;
+    }
+    child = current;
+    childSize = size;
+  }
+}
+
+/**
+* Called after remove() takes out a node. Rebuilds the whole tree once
+* it has shrunk below alpha of its largest size since the last time.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::scapegoatRemoved()
+{
+  if(scapegoatAlpha_ == 0){
+    return;
+  }
+  scapegoatCount_--;
+  if(scapegoatCount_ < scapegoatAlpha_ * scapegoatMaxCount_){
+    rebuildSubtree(root_);
+    scapegoatMaxCount_ = scapegoatCount_;
+  }
+}
+
+/**
+* Relinks the nodes of the subtree at current into a perfectly balanced
+* subtree in the same place, reusing the nodes. The nodes are gathered
+* without recursion, since the subtree may be a long path.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::rebuildSubtree(Node<Key, Value>* current)
+{
   if(current == nullptr){
     return;
   }
-  clearHelper(current->getLeft());
-  clearHelper(current->getRight());
+  Node<Key, Value>* parent = current->getParent();
+  bool isLeft = parent != nullptr && parent->getLeft() == current;
+
+  std::vector<Node<Key, Value>*> nodes;
+  std::vector<Node<Key, Value>*> pending;
+  Node<Key, Value>* temp = current;
+  while(temp != nullptr || !pending.empty()){
+    while(temp != nullptr){
+      pending.push_back(temp);
+      temp = temp->getLeft();
+    }
+    temp = pending.back();
+    pending.pop_back();
+    nodes.push_back(temp);
+    temp = temp->getRight();
+  }
+
+  Node<Key, Value>* rebuilt = linkBalanced(nodes, 0, nodes.size(), parent);
+  if(parent == nullptr){
+    root_ = rebuilt;
+  }
+  else if(isLeft){
+    parent->setLeft(rebuilt);
+  }
+  else{
+    parent->setRight(rebuilt);
+  }
+}
+
+/**
+* Counts the nodes of a subtree, in O(1) with BST_ORDER_STATISTICS.
+*/
+template<typename Key, typename Value>
+size_t BinarySearchTree<Key, Value>::countNodes(Node<Key, Value>* current)
+{
+  if(current == nullptr){
+    return 0;
+  }
+#ifdef BST_ORDER_STATISTICS
+  return current->getSubtreeSize();
+#else
+  size_t count = 0;
+  std::vector<Node<Key, Value>*> pending(1, current);
+  while(!pending.empty()){
+    Node<Key, Value>* temp = pending.back();
+    pending.pop_back();
+    count++;
+    if(temp->getLeft() != nullptr) pending.push_back(temp->getLeft());
+    if(temp->getRight() != nullptr) pending.push_back(temp->getRight());
+  }
+  return count;
+#endif
+}
 
-  delete current;
-  
+/**
+* Links nodes[lo, hi), which are in key order, into a perfectly balanced
+* subtree under parent, as buildBalanced() does with new nodes.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>* BinarySearchTree<Key, Value>::linkBalanced(const std::vector<Node<Key, Value>*>& nodes,
+    size_t lo, size_t hi, Node<Key, Value>* parent)
+{
+  if(lo >= hi){
+    return nullptr;
+  }
+  size_t mid = lo + (hi - lo) / 2;
+  Node<Key, Value>* current = nodes[mid];
+  current->setParent(parent);
+  current->setLeft(linkBalanced(nodes, lo, mid, current));
+  current->setRight(linkBalanced(nodes, mid + 1, hi, current));
+  current->updateSubtreeSize();
+  return current;
 }
 
 
@@ -896,6 +1914,25 @@ BinarySearchTree<Key, Value>::getSmallestNode() const
 
 }
 
+/**
+* A helper function to find the largest node in the tree.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>*
+BinarySearchTree<Key, Value>::getLargestNode() const
+{
+    Node<Key, Value>* temp = root_;
+    if(temp == nullptr){
+      return nullptr;
+    }
+
+    while(temp->getRight() != nullptr){
+      temp = temp->getRight();
+    }
+
+    return temp;
+}
+
 /**
 * Helper function to find a node with given key, k and
 * return a pointer to it or NULL if no item with that key
@@ -922,6 +1959,66 @@ Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) con
     }
     return nullptr;
 }
+/**
+* Counts the keys smaller than key, or no bigger than key if inclusive.
+* With subtree sizes this adds up the left subtrees along one path.
+*/
+template<typename Key, typename Value>
+size_t BinarySearchTree<Key, Value>::countLess(const Key& key, bool inclusive) const
+{
+    size_t count = 0;
+#ifdef BST_ORDER_STATISTICS
+    Node<Key, Value>* temp = root_;
+    while(temp != nullptr){
+        if(temp->getKey() < key || (inclusive && !(key < temp->getKey()))){
+            count += 1 + ((temp->getLeft() == nullptr) ? 0 : temp->getLeft()->getSubtreeSize());
+            temp = temp->getRight();
+        }
+        else{
+            temp = temp->getLeft();
+        }
+    }
+#else
+    for(iterator it = begin(); it != end(); ++it){
+        if(!(it->first < key || (inclusive && !(key < it->first)))){
+            break;
+        }
+        count++;
+    }
+#endif
+    return count;
+}
+
+/**
+* Recomputes the subtree sizes from current up to the root, after a node
+* was added or removed below current.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::updateSizesToRoot(Node<Key, Value>* current)
+{
+#ifdef BST_ORDER_STATISTICS
+    while(current != nullptr){
+        current->updateSubtreeSize();
+        current = current->getParent();
+    }
+#else
+    (void)current;
+#endif
+}
+
+/**
+* Asks the CPU to start loading a node we are about to visit.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::prefetchNode(const Node<Key, Value>* current)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(current);
+#else
+    (void)current;
+#endif
+}
+
 /**
  * Return true iff the BST is balanced.
  */
@@ -1053,6 +2150,13 @@ void BinarySearchTree<Key, Value>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value
         this->root_ = n1;
     }
 
+#ifdef BST_ORDER_STATISTICS
+    // Each node now heads the subtree the other one used to head
+    size_t tempSize = n1->getSubtreeSize();
+    n1->setSubtreeSize(n2->getSubtreeSize());
+    n2->setSubtreeSize(tempSize);
+#endif
+
 }
 
 /**
@@ -1079,3 +2183,4 @@ End implementations for the BinarySearchTree class.
 
 
 
+
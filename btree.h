@@ -0,0 +1,911 @@
+#ifndef BTREE_H
+#define BTREE_H
+
+#include <iostream>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <iterator>
+#include <new>
+#include <type_traits>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/**
+* Counts how many of the n sorted keys are smaller than key, i.e. the
+* lower bound of key within a node. Any key type uses a binary search;
+* 32 and 64-bit integers are compared a whole SSE register at a time.
+*/
+template<typename Key, bool Integral = std::is_integral<Key>::value && (sizeof(Key) == 4 || sizeof(Key) == 8)>
+struct BTreeKeySearch
+{
+    static int countLess(const Key* keys, int n, const Key& key)
+    {
+        int lo = 0, hi = n;
+        while(lo < hi){
+            int mid = (lo + hi) / 2;
+            if(keys[mid] < key) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo;
+    }
+};
+
+/**
+* The integer version. The loads may run past n up to the next multiple of
+* four keys, so the key arrays it searches must be sized to allow that
+* (BTreeMap requires a fanout that is a multiple of 4); the lanes past n
+* are masked off.
+*/
+template<typename Key>
+struct BTreeKeySearch<Key, true>
+{
+    static int countLess(const Key* keys, int n, const Key& key)
+    {
+#if defined(__SSE2__)
+        return countLessSSE2(keys, n, key, std::integral_constant<std::size_t, sizeof(Key)>());
+#else
+        int count = 0;
+        for(int i = 0; i < n; i++){
+            count += (keys[i] < key) ? 1 : 0;
+        }
+        return count;
+#endif
+    }
+
+#if defined(__SSE2__)
+    static int popcount4(int mask)
+    {
+        static const int bits[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+        return bits[mask & 15];
+    }
+
+    // SSE2 only compares signed 32-bit lanes, so unsigned keys get their
+    // sign bit flipped first
+    static int countLessSSE2(const Key* keys, int n, const Key& key, std::integral_constant<std::size_t, 4>)
+    {
+        const __m128i bias = _mm_set1_epi32(std::is_signed<Key>::value ? 0 : INT32_MIN);
+        const __m128i needle = _mm_xor_si128(_mm_set1_epi32(static_cast<int32_t>(key)), bias);
+        int count = 0;
+        for(int i = 0; i < n; i += 4){
+            __m128i block = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i)), bias);
+            int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(needle, block)));
+            if(n - i < 4){
+                mask &= (1 << (n - i)) - 1;
+            }
+            count += popcount4(mask);
+        }
+        return count;
+    }
+
+    // A 64-bit compare built from 32-bit ones: the high halves decide
+    // unless they are equal, in which case the low halves (always compared
+    // as unsigned) do
+    static int countLessSSE2(const Key* keys, int n, const Key& key, std::integral_constant<std::size_t, 8>)
+    {
+        const int highBias = std::is_signed<Key>::value ? 0 : INT32_MIN;
+        const __m128i bias = _mm_set_epi32(highBias, INT32_MIN, highBias, INT32_MIN);
+        const __m128i needle = _mm_xor_si128(_mm_set1_epi64x(static_cast<long long>(key)), bias);
+        int count = 0;
+        for(int i = 0; i < n; i += 2){
+            __m128i block = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i)), bias);
+            __m128i greater = _mm_cmpgt_epi32(needle, block);
+            __m128i equal = _mm_cmpeq_epi32(needle, block);
+            __m128i result = _mm_or_si128(greater, _mm_and_si128(equal, _mm_slli_epi64(greater, 32)));
+            int mask = _mm_movemask_pd(_mm_castsi128_pd(result));
+            if(n - i < 2){
+                mask &= 1;
+            }
+            count += popcount4(mask);
+        }
+        return count;
+    }
+#endif
+};
+
+/**
+* A B+ tree map with the same interface as BinarySearchTree, for when the
+* tree is too big for the cache. Each node holds up to Fanout keys in one
+* array, so a lookup takes about log_Fanout(n) cache misses instead of
+* log_2(n). All pairs live in the leaves, which are linked for iteration.
+*
+* Unlike in BinarySearchTree, pairs move between nodes as the tree changes,
+* so insert() and remove() invalidate iterators and references into the
+* map. Keys must be default constructible and assignable.
+*/
+template <typename Key, typename Value, int Fanout = 16>
+class BTreeMap
+{
+    static_assert(Fanout >= 4 && Fanout % 4 == 0, "BTreeMap fanout must be a multiple of 4");
+
+public:
+    BTreeMap();
+    ~BTreeMap();
+
+protected:
+    struct NodeBase
+    {
+        explicit NodeBase(bool leaf) : isLeaf(leaf), count(0), keys() { }
+        bool isLeaf;
+        int count;
+        Key keys[Fanout];
+    };
+
+    struct Internal : NodeBase
+    {
+        Internal() : NodeBase(false) { }
+        NodeBase* children[Fanout + 1];
+    };
+
+    struct Leaf : NodeBase
+    {
+        Leaf() : NodeBase(true), prev(nullptr), next(nullptr) { }
+        ~Leaf();
+        std::pair<const Key, Value>* item(int i);
+        Leaf* prev;
+        Leaf* next;
+        typename std::aligned_storage<sizeof(std::pair<const Key, Value>),
+            alignof(std::pair<const Key, Value>)>::type slots[Fanout];
+    };
+
+public:
+    /**
+    * An iterator over the leaves, in key order.
+    */
+    class iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key,Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef std::pair<const Key,Value>* pointer;
+        typedef std::pair<const Key,Value>& reference;
+
+        iterator();
+
+        std::pair<const Key,Value>& operator*() const;
+        std::pair<const Key,Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+        iterator operator++(int);
+        iterator& operator--();
+        iterator operator--(int);
+
+    protected:
+        friend class BTreeMap<Key, Value, Fanout>;
+        iterator(Leaf* leaf, int index, const BTreeMap* tree);
+        Leaf* leaf_;
+        int index_;
+        const BTreeMap* tree_;
+    };
+
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    bool empty() const;
+    size_t size() const;
+
+    iterator begin() const;
+    iterator end() const;
+    reverse_iterator rbegin() const;
+    reverse_iterator rend() const;
+    iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key) const;
+    Value& operator[](const Key& key);
+    Value const & operator[](const Key& key) const;
+
+protected:
+    static const int MIN_KEYS = Fanout / 2;
+
+    static int countLess(const NodeBase* node, const Key& key);
+    static int childIndex(const Internal* node, const Key& key);
+    Leaf* findLeaf(const Key& key) const;
+    Leaf* lastLeaf() const;
+
+    bool insertInto(NodeBase* node, const std::pair<const Key, Value>& keyValuePair,
+                    Key* separator, NodeBase** right);
+    bool insertIntoLeaf(Leaf* leaf, const std::pair<const Key, Value>& keyValuePair,
+                        Key* separator, NodeBase** right);
+    bool removeFrom(NodeBase* node, const Key& key);
+    void fixUnderflow(Internal* parent, int index);
+
+    static void insertItem(Leaf* leaf, int index, const std::pair<const Key, Value>& keyValuePair);
+    static void moveItem(Leaf* from, int fromIndex, Leaf* to, int toIndex);
+    static void eraseItem(Leaf* leaf, int index);
+    static void deleteSubtree(NodeBase* node);
+
+    NodeBase* root_;
+    size_t size_;
+    // Set by insertInto() when a new key went in
+    bool added_;
+
+private:
+    BTreeMap(const BTreeMap&);
+    BTreeMap& operator=(const BTreeMap&);
+};
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the BTreeMap::iterator class.
+  ---------------------------------------------------
+*/
+
+template<typename Key, typename Value, int Fanout>
+BTreeMap<Key, Value, Fanout>::iterator::iterator() :
+    leaf_(nullptr),
+    index_(0),
+    tree_(nullptr)
+{
+
+}
+
+template<typename Key, typename Value, int Fanout>
+BTreeMap<Key, Value, Fanout>::iterator::iterator(Leaf* leaf, int index, const BTreeMap* tree) :
+    leaf_(leaf),
+    index_(index),
+    tree_(tree)
+{
+
+}
+
+template<typename Key, typename Value, int Fanout>
+std::pair<const Key,Value>& BTreeMap<Key, Value, Fanout>::iterator::operator*() const
+{
+    return *leaf_->item(index_);
+}
+
+template<typename Key, typename Value, int Fanout>
+std::pair<const Key,Value>* BTreeMap<Key, Value, Fanout>::iterator::operator->() const
+{
+    return leaf_->item(index_);
+}
+
+template<typename Key, typename Value, int Fanout>
+bool BTreeMap<Key, Value, Fanout>::iterator::operator==(const iterator& rhs) const
+{
+    return leaf_ == rhs.leaf_ && (leaf_ == nullptr || index_ == rhs.index_);
+}
+
+template<typename Key, typename Value, int Fanout>
+bool BTreeMap<Key, Value, Fanout>::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+template<typename Key, typename Value, int Fanout>
+typename BTreeMap<Key, Value, Fanout>::iterator&
+BTreeMap<Key, Value, Fanout>::iterator::operator++()
+{
+    if(++index_ == leaf_->count){
+        leaf_ = leaf_->next;
+        index_ = 0;
+    }
+    return *this;
+}
+
+template<typename Key, typename Value, int Fanout>
+typename BTreeMap<Key, Value, Fanout>::iterator
+BTreeMap<Key, Value, Fanout>::iterator::operator++(int)
+{
+    iterator old = *this;
+    ++(*this);
+    return old;
+}
+
+/**
+* Steps back one pair; the end iterator steps back to the largest key.
+*/
+template<typename Key, typename Value, int Fanout>
+typename BTreeMap<Key, Value, Fanout>::iterator&
+BTreeMap<Key, Value, Fanout>::iterator::operator--()
+{
+    if(leaf_ == nullptr){
+        leaf_ = tree_->lastLeaf();
+        index_ = leaf_->count - 1;
+    }
+    else if(index_ == 0){
+        leaf_ = leaf_->prev;
+        index_ = leaf_->count - 1;
+    }
+    else{
+        index_--;
+    }
+    return *this;
+}
+
+template<typename Key, typename Value, int Fanout>
+typename BTreeMap<Key, Value, Fanout>::iterator
+BTreeMap<Key, Value, Fanout>::iterator::operator--(int)
+{
+    iterator old = *this;
+    --(*this);
+    return old;
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the BTreeMap::iterator class.
+  -------------------------------------------------
+*/
+
+/*
+  ------------------------------------------
+  Begin implementations for the BTreeMap class.
+  ------------------------------------------
+*/
+
+template<typename Key, typename Value, int Fanout>
+BTreeMap<Key, Value, Fanout>::Leaf::~Leaf()
+{
+    for(int i = 0; i < this->count; i++){
+        item(i)->~pair();
+    }
+}
+
+template<typename Key, typename Value, int Fanout>
+std::pair<const Key, Value>* BTreeMap<Key, Value, Fanout>::Leaf::item(int i)
+{
+    return reinterpret_cast<std::pair<const Key, Value>*>(&slots[i]);
+}
+
+template<typename Key, typename Value, int Fanout>
+BTreeMap<Key, Value, Fanout>::BTreeMap() :
+    root_(nullptr),
+    size_(0),
+    added_(false)
+{
+
+}
+
+template<typename Key, typename Value, int Fanout>
+BTreeMap<Key, Value, Fanout>::~BTreeMap()
+{
+    clear();
+}
+
+/**
+* Inserts a pair, or overwrites the value if the key is already there.
+* A node that overflows is split in half and its parent gets the new node,
+* so the tree only grows in height when the root splits.
+*/
+template<typename Key, typename Value, int Fanout>
+void BTreeMap<Key, Value, Fanout>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    if(root_ == nullptr){
+        root_ = new Leaf();
+    }
+    Key separator = Key();
+    NodeBase* right = nullptr;
+    added_ = false;
+    if(insertInto(root_, keyValuePair, &separator, &right)){
+        Internal* root = new Internal();
+        root->keys[0] = separator;
+        root->children[0] = root_;
+        root->children[1] = right;
+        root->count = 1;
+        root_ = root;
+    }
+    if(added_){
+        size_++;
+    }
+}
+
+/**
+* Removes the key if it is there. A node left less than half full borrows
+* from a sibling or is merged into one, and the root goes away once it has
+* a single child.
+*/
+template<typename Key, typename Value, int Fanout>
+void BTreeMap<Key, Value, Fanout>::remove(const Key& key)
+{
+    if(root_ == nullptr || !removeFrom(root_, key)){
+        return;
+    }
+    size_--;
+    if(root_->count == 0){
+        NodeBase* old = root_;
+        root_ = old->isLeaf ? nullptr : static_cast<Internal*>(old)->children[0];
+        if(old->isLeaf){
+            delete static_cast<Leaf*>(old);
+        }
+        else{
+            delete static_cast<Internal*>(old);
+        }
+    }
+}
+
+template<typename Key, typename Value, int Fanout>
+void BTreeMap<Key, Value, Fanout>::clear()
+{
+    deleteSubtree(root_);
+    root_ = nullptr;
+    size_ = 0;
+}
+
+template<typename Key, typename Value, int Fanout>
+bool BTreeMap<Key, Value, Fanout>::empty() const
+{
+    return size_ == 0;
+}
+
+template<typename Key, typename Value, int Fanout>
+size_t BTreeMap<Key, Value, Fanout>::size() const
+{
+    return size_;
+}
+
+template<typename Key, typename Value, int Fanout>
+typename BTreeMap<Key, Value, Fanout>::iterator
+BTreeMap<Key, Value, Fanout>::begin() const
+{
+    if(root_ == nullptr){
+        return end();
+    }
+    NodeBase* current = root_;
+    while(!current->isLeaf){
+        current = static_cast<Internal*>(current)->children[0];
+    }
+    return iterator(static_cast<Leaf*>(current), 0, this);
+}
+
+template<typename Key, typename Value, int Fanout>
+typename BTreeMap<Key, Value, Fanout>::iterator
+BTreeMap<Key, Value, Fanout>::end() const
+{
+    return iterator(nullptr, 0, this);
+}
+
+template<typename Key, typename Value, int Fanout>
+typename BTreeMap<Key, Value, Fanout>::reverse_iterator
+BTreeMap<Key, Value, Fanout>::rbegin() const
+{
+    return reverse_iterator(end());
+}
+
+template<typename Key, typename Value, int Fanout>
+typename BTreeMap<Key, Value, Fanout>::reverse_iterator
+BTreeMap<Key, Value, Fanout>::rend() const
+{
+    return reverse_iterator(begin());
+}
+
+template<typename Key, typename Value, int Fanout>
+typename BTreeMap<Key, Value, Fanout>::iterator
+BTreeMap<Key, Value, Fanout>::find(const Key& key) const
+{
+    Leaf* leaf = findLeaf(key);
+    if(leaf == nullptr){
+        return end();
+    }
+    int index = countLess(leaf, key);
+    if(index == leaf->count || key < leaf->keys[index]){
+        return end();
+    }
+    return iterator(leaf, index, this);
+}
+
+/**
+* Returns an iterator to the smallest key that is not less than key.
+*/
+template<typename Key, typename Value, int Fanout>
+typename BTreeMap<Key, Value, Fanout>::iterator
+BTreeMap<Key, Value, Fanout>::lower_bound(const Key& key) const
+{
+    Leaf* leaf = findLeaf(key);
+    if(leaf == nullptr){
+        return end();
+    }
+    int index = countLess(leaf, key);
+    if(index == leaf->count){
+        return iterator(leaf->next, 0, this);
+    }
+    return iterator(leaf, index, this);
+}
+
+/**
+* Returns an iterator to the smallest key that is greater than key.
+*/
+template<typename Key, typename Value, int Fanout>
+typename BTreeMap<Key, Value, Fanout>::iterator
+BTreeMap<Key, Value, Fanout>::upper_bound(const Key& key) const
+{
+    Leaf* leaf = findLeaf(key);
+    if(leaf == nullptr){
+        return end();
+    }
+    int index = countLess(leaf, key);
+    if(index < leaf->count && !(key < leaf->keys[index])){
+        index++;
+    }
+    if(index == leaf->count){
+        return iterator(leaf->next, 0, this);
+    }
+    return iterator(leaf, index, this);
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<typename Key, typename Value, int Fanout>
+Value& BTreeMap<Key, Value, Fanout>::operator[](const Key& key)
+{
+    iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+template<typename Key, typename Value, int Fanout>
+Value const & BTreeMap<Key, Value, Fanout>::operator[](const Key& key) const
+{
+    iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+template<typename Key, typename Value, int Fanout>
+int BTreeMap<Key, Value, Fanout>::countLess(const NodeBase* node, const Key& key)
+{
+    return BTreeKeySearch<Key>::countLess(node->keys, node->count, key);
+}
+
+/**
+* The child whose range holds key. keys[i] is the smallest key under
+* children[i + 1], so a key equal to it belongs on the right.
+*/
+template<typename Key, typename Value, int Fanout>
+int BTreeMap<Key, Value, Fanout>::childIndex(const Internal* node, const Key& key)
+{
+    int index = countLess(node, key);
+    if(index < node->count && !(key < node->keys[index])){
+        index++;
+    }
+    return index;
+}
+
+template<typename Key, typename Value, int Fanout>
+typename BTreeMap<Key, Value, Fanout>::Leaf*
+BTreeMap<Key, Value, Fanout>::findLeaf(const Key& key) const
+{
+    NodeBase* current = root_;
+    if(current == nullptr){
+        return nullptr;
+    }
+    while(!current->isLeaf){
+        Internal* internal = static_cast<Internal*>(current);
+        current = internal->children[childIndex(internal, key)];
+    }
+    return static_cast<Leaf*>(current);
+}
+
+template<typename Key, typename Value, int Fanout>
+typename BTreeMap<Key, Value, Fanout>::Leaf*
+BTreeMap<Key, Value, Fanout>::lastLeaf() const
+{
+    NodeBase* current = root_;
+    while(!current->isLeaf){
+        Internal* internal = static_cast<Internal*>(current);
+        current = internal->children[internal->count];
+    }
+    return static_cast<Leaf*>(current);
+}
+
+/**
+* Inserts below node. Returns true if node had to split, in which case
+* right is the new node that follows it and separator its smallest key.
+*/
+template<typename Key, typename Value, int Fanout>
+bool BTreeMap<Key, Value, Fanout>::insertInto(NodeBase* node, const std::pair<const Key, Value>& keyValuePair,
+                                              Key* separator, NodeBase** right)
+{
+    if(node->isLeaf){
+        return insertIntoLeaf(static_cast<Leaf*>(node), keyValuePair, separator, right);
+    }
+
+    Internal* internal = static_cast<Internal*>(node);
+    int index = childIndex(internal, keyValuePair.first);
+    Key childSeparator = Key();
+    NodeBase* childRight = nullptr;
+    if(!insertInto(internal->children[index], keyValuePair, &childSeparator, &childRight)){
+        return false;
+    }
+
+    if(internal->count < Fanout){
+        for(int i = internal->count; i > index; i--){
+            internal->keys[i] = internal->keys[i - 1];
+            internal->children[i + 1] = internal->children[i];
+        }
+        internal->keys[index] = childSeparator;
+        internal->children[index + 1] = childRight;
+        internal->count++;
+        return false;
+    }
+
+    // Full: lay out all Fanout + 1 keys in order, keep the first half,
+    // move the middle key up and the rest to a new node
+    Key keys[Fanout + 1];
+    NodeBase* children[Fanout + 2];
+    for(int i = 0, j = 0; i <= Fanout; i++){
+        if(i == index){
+            keys[i] = childSeparator;
+        }
+        else{
+            keys[i] = internal->keys[j++];
+        }
+    }
+    for(int i = 0, j = 0; i <= Fanout + 1; i++){
+        if(i == index + 1){
+            children[i] = childRight;
+        }
+        else{
+            children[i] = internal->children[j++];
+        }
+    }
+
+    int middle = (Fanout + 1) / 2;
+    Internal* sibling = new Internal();
+    internal->count = middle;
+    for(int i = 0; i < middle; i++){
+        internal->keys[i] = keys[i];
+        internal->children[i] = children[i];
+    }
+    internal->children[middle] = children[middle];
+    sibling->count = Fanout - middle;
+    for(int i = 0; i < sibling->count; i++){
+        sibling->keys[i] = keys[middle + 1 + i];
+        sibling->children[i] = children[middle + 1 + i];
+    }
+    sibling->children[sibling->count] = children[Fanout + 1];
+
+    *separator = keys[middle];
+    *right = sibling;
+    return true;
+}
+
+template<typename Key, typename Value, int Fanout>
+bool BTreeMap<Key, Value, Fanout>::insertIntoLeaf(Leaf* leaf, const std::pair<const Key, Value>& keyValuePair,
+                                                  Key* separator, NodeBase** right)
+{
+    int index = countLess(leaf, keyValuePair.first);
+    if(index < leaf->count && !(keyValuePair.first < leaf->keys[index])){
+        leaf->item(index)->second = keyValuePair.second;
+        return false;
+    }
+    added_ = true;
+    if(leaf->count < Fanout){
+        insertItem(leaf, index, keyValuePair);
+        return false;
+    }
+
+    // Full: move the upper half to a new leaf, then insert into whichever half
+    Leaf* sibling = new Leaf();
+    int keep = Fanout / 2;
+    for(int i = keep; i < Fanout; i++){
+        moveItem(leaf, i, sibling, i - keep);
+    }
+    sibling->count = Fanout - keep;
+    leaf->count = keep;
+    if(index <= keep){
+        insertItem(leaf, index, keyValuePair);
+    }
+    else{
+        insertItem(sibling, index - keep, keyValuePair);
+    }
+
+    sibling->next = leaf->next;
+    sibling->prev = leaf;
+    if(leaf->next != nullptr){
+        leaf->next->prev = sibling;
+    }
+    leaf->next = sibling;
+
+    *separator = sibling->keys[0];
+    *right = sibling;
+    return true;
+}
+
+/**
+* Removes key below node. Returns true if it was there. Children that end
+* up less than half full are fixed on the way back up.
+*/
+template<typename Key, typename Value, int Fanout>
+bool BTreeMap<Key, Value, Fanout>::removeFrom(NodeBase* node, const Key& key)
+{
+    if(node->isLeaf){
+        Leaf* leaf = static_cast<Leaf*>(node);
+        int index = countLess(leaf, key);
+        if(index == leaf->count || key < leaf->keys[index]){
+            return false;
+        }
+        eraseItem(leaf, index);
+        return true;
+    }
+
+    Internal* internal = static_cast<Internal*>(node);
+    int index = childIndex(internal, key);
+    if(!removeFrom(internal->children[index], key)){
+        return false;
+    }
+    if(internal->children[index]->count < MIN_KEYS){
+        fixUnderflow(internal, index);
+    }
+    return true;
+}
+
+/**
+* parent->children[index] has too few keys. Borrows one from a sibling
+* that can spare it, otherwise merges with a sibling, which takes a key
+* out of parent.
+*/
+template<typename Key, typename Value, int Fanout>
+void BTreeMap<Key, Value, Fanout>::fixUnderflow(Internal* parent, int index)
+{
+    NodeBase* child = parent->children[index];
+    NodeBase* left = (index > 0) ? parent->children[index - 1] : nullptr;
+    NodeBase* right = (index < parent->count) ? parent->children[index + 1] : nullptr;
+
+    if(left != nullptr && left->count > MIN_KEYS){
+        if(child->isLeaf){
+            Leaf* leaf = static_cast<Leaf*>(child);
+            Leaf* from = static_cast<Leaf*>(left);
+            for(int i = leaf->count; i > 0; i--){
+                moveItem(leaf, i - 1, leaf, i);
+            }
+            moveItem(from, from->count - 1, leaf, 0);
+            from->count--;
+            leaf->count++;
+            parent->keys[index - 1] = leaf->keys[0];
+        }
+        else{
+            Internal* internal = static_cast<Internal*>(child);
+            Internal* from = static_cast<Internal*>(left);
+            internal->children[internal->count + 1] = internal->children[internal->count];
+            for(int i = internal->count; i > 0; i--){
+                internal->keys[i] = internal->keys[i - 1];
+                internal->children[i] = internal->children[i - 1];
+            }
+            internal->keys[0] = parent->keys[index - 1];
+            internal->children[0] = from->children[from->count];
+            internal->count++;
+            parent->keys[index - 1] = from->keys[from->count - 1];
+            from->count--;
+        }
+        return;
+    }
+
+    if(right != nullptr && right->count > MIN_KEYS){
+        if(child->isLeaf){
+            Leaf* leaf = static_cast<Leaf*>(child);
+            Leaf* from = static_cast<Leaf*>(right);
+            moveItem(from, 0, leaf, leaf->count);
+            leaf->count++;
+            for(int i = 1; i < from->count; i++){
+                moveItem(from, i, from, i - 1);
+            }
+            from->count--;
+            parent->keys[index] = from->keys[0];
+        }
+        else{
+            Internal* internal = static_cast<Internal*>(child);
+            Internal* from = static_cast<Internal*>(right);
+            internal->keys[internal->count] = parent->keys[index];
+            internal->children[internal->count + 1] = from->children[0];
+            internal->count++;
+            parent->keys[index] = from->keys[0];
+            for(int i = 1; i < from->count; i++){
+                from->keys[i - 1] = from->keys[i];
+            }
+            for(int i = 1; i <= from->count; i++){
+                from->children[i - 1] = from->children[i];
+            }
+            from->count--;
+        }
+        return;
+    }
+
+    // Neither sibling can spare a key: merge the pair around separator
+    // parent->keys[at] into the left one
+    int at = (left != nullptr) ? index - 1 : index;
+    NodeBase* into = parent->children[at];
+    NodeBase* from = parent->children[at + 1];
+    if(into->isLeaf){
+        Leaf* leaf = static_cast<Leaf*>(into);
+        Leaf* gone = static_cast<Leaf*>(from);
+        for(int i = 0; i < gone->count; i++){
+            moveItem(gone, i, leaf, leaf->count + i);
+        }
+        leaf->count += gone->count;
+        gone->count = 0;
+        leaf->next = gone->next;
+        if(gone->next != nullptr){
+            gone->next->prev = leaf;
+        }
+        delete gone;
+    }
+    else{
+        Internal* internal = static_cast<Internal*>(into);
+        Internal* gone = static_cast<Internal*>(from);
+        internal->keys[internal->count] = parent->keys[at];
+        for(int i = 0; i < gone->count; i++){
+            internal->keys[internal->count + 1 + i] = gone->keys[i];
+        }
+        for(int i = 0; i <= gone->count; i++){
+            internal->children[internal->count + 1 + i] = gone->children[i];
+        }
+        internal->count += gone->count + 1;
+        delete gone;
+    }
+
+    for(int i = at + 1; i < parent->count; i++){
+        parent->keys[i - 1] = parent->keys[i];
+        parent->children[i] = parent->children[i + 1];
+    }
+    parent->count--;
+}
+
+template<typename Key, typename Value, int Fanout>
+void BTreeMap<Key, Value, Fanout>::insertItem(Leaf* leaf, int index, const std::pair<const Key, Value>& keyValuePair)
+{
+    for(int i = leaf->count; i > index; i--){
+        moveItem(leaf, i - 1, leaf, i);
+    }
+    new (leaf->item(index)) std::pair<const Key, Value>(keyValuePair);
+    leaf->keys[index] = keyValuePair.first;
+    leaf->count++;
+}
+
+/**
+* Moves a pair into an empty slot, leaving the old slot empty. The key is
+* const in the pair, so this is a move construction rather than an assignment.
+*/
+template<typename Key, typename Value, int Fanout>
+void BTreeMap<Key, Value, Fanout>::moveItem(Leaf* from, int fromIndex, Leaf* to, int toIndex)
+{
+    std::pair<const Key, Value>* source = from->item(fromIndex);
+    new (to->item(toIndex)) std::pair<const Key, Value>(std::move(*source));
+    source->~pair();
+    to->keys[toIndex] = from->keys[fromIndex];
+}
+
+template<typename Key, typename Value, int Fanout>
+void BTreeMap<Key, Value, Fanout>::eraseItem(Leaf* leaf, int index)
+{
+    leaf->item(index)->~pair();
+    for(int i = index + 1; i < leaf->count; i++){
+        moveItem(leaf, i, leaf, i - 1);
+    }
+    leaf->count--;
+}
+
+template<typename Key, typename Value, int Fanout>
+void BTreeMap<Key, Value, Fanout>::deleteSubtree(NodeBase* node)
+{
+    if(node == nullptr){
+        return;
+    }
+    if(node->isLeaf){
+        delete static_cast<Leaf*>(node);
+        return;
+    }
+    Internal* internal = static_cast<Internal*>(node);
+    for(int i = 0; i <= internal->count; i++){
+        deleteSubtree(internal->children[i]);
+    }
+    delete internal;
+}
+
+/*
+  ----------------------------------------
+  End implementations for the BTreeMap class.
+  ----------------------------------------
+*/
+
+#endif
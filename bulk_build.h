@@ -0,0 +1,597 @@
+#ifndef BULK_BUILD_H
+#define BULK_BUILD_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <iterator>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <unistd.h>
+#include "avlbst.h"
+#include "frozen_index.h"
+#include "mapped_tree.h"
+#include "snapshot.h"
+
+/**
+* An input iterator over count pairs read from a SnapshotReader, as
+* written by a key codec and a value codec. Two iterators are equal when
+* they have the same number of pairs left, so the end of a run of count
+* pairs is SnapshotPairIterator(), and the pairs can be handed to anything
+* that takes an iterator range and reads it once.
+*/
+template <typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+class SnapshotPairIterator
+{
+public:
+    typedef std::input_iterator_tag iterator_category;
+    typedef std::pair<Key, Value> value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const std::pair<Key, Value>* pointer;
+    typedef const std::pair<Key, Value>& reference;
+
+    SnapshotPairIterator();
+    SnapshotPairIterator(SnapshotReader* in, size_t count);
+
+    const std::pair<Key, Value>& operator*() const;
+    const std::pair<Key, Value>* operator->() const;
+
+    bool operator==(const SnapshotPairIterator& rhs) const;
+    bool operator!=(const SnapshotPairIterator& rhs) const;
+
+    SnapshotPairIterator& operator++();
+
+protected:
+    void readNext();
+
+    SnapshotReader* in_;
+    size_t remaining_;
+    bool started_;
+    std::pair<Key, Value> current_;
+};
+
+/**
+* Builds a tree out of more pairs than fit in memory. Pairs are buffered
+* up to a memory budget, and each time the buffer fills it is sorted and
+* appended to a temporary file as a run. Finishing merges the runs into
+* one sorted stream, which is then turned into an AVLTree, a MappedTree
+* file or a FrozenIndex without ever holding more than the budget.
+*
+* Runs are written with the same codecs as AVLTree::save(), so the runs
+* of integer keys are delta encoded. As with insert(), a key given twice
+* keeps the value given last. Keys must be default constructible.
+*
+* The budget covers the buffered pairs and the sort's scratch space, and
+* while merging, one read buffer per run; if there are too many runs for
+* that, they are merged a group at a time first, appending each merged
+* run to the same file. Memory owned by the pairs themselves (such as
+* string contents) is not counted.
+*/
+template <typename Key, typename Value,
+          typename KeyCodec = SnapshotCodec<Key>, typename ValueCodec = SnapshotCodec<Value> >
+class BulkBuilder
+{
+public:
+    typedef SnapshotPairIterator<Key, Value, KeyCodec, ValueCodec> pair_iterator;
+
+    explicit BulkBuilder(size_t memoryBudget, const std::string& tempDir = "/tmp");
+    ~BulkBuilder();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+
+    // Each of these consumes every pair inserted so far and leaves the
+    // builder empty
+    void buildTree(AVLTree<Key, Value>& tree);
+    void writeMapped(const std::string& path);
+    FrozenIndex<Key, Value> freeze(FrozenLayout layout = EYTZINGER_LAYOUT);
+
+    size_t runs() const;
+
+protected:
+    // A sorted run of count pairs, starting offset bytes into the run file
+    struct Run
+    {
+        off_t offset;
+        size_t count;
+    };
+
+    // A run being merged, with the pair at its front
+    struct RunCursor
+    {
+        RunCursor(int fd, off_t offset, size_t count);
+        SnapshotReader reader;
+        size_t remaining;
+        std::pair<Key, Value> front;
+    };
+
+    // Orders a priority queue of cursor indices so that the smallest key
+    // comes out first, and of equal keys the one from the newest run
+    struct CursorOrder
+    {
+        explicit CursorOrder(const std::vector<RunCursor>* cursors) : cursors_(cursors) { }
+        bool operator()(size_t a, size_t b) const;
+        const std::vector<RunCursor>* cursors_;
+    };
+
+    int createTempFile();
+    void openRun(Run* run);
+    void closeRun();
+    void spill();
+    size_t sortBuffer();
+    int mergeToSnapshot(size_t* count);
+    size_t mergeRuns(size_t first, size_t last, SnapshotWriter& out);
+    static void rewind(int fd);
+    void reset();
+
+    // Copying would close the run files twice
+    BulkBuilder(const BulkBuilder& other);
+    BulkBuilder& operator=(const BulkBuilder& other);
+
+    std::string tempDir_;
+    size_t bufferLimit_;
+    size_t maxFanIn_;
+    std::vector<std::pair<Key, Value> > buffer_;
+    std::vector<Run> runs_;
+    // Every run is appended to this one unlinked file
+    int runFile_;
+    off_t runFileEnd_;
+};
+
+/*
+  ----------------------------------------------------------
+  Begin implementations for the SnapshotPairIterator class.
+  ----------------------------------------------------------
+*/
+
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+SnapshotPairIterator<Key, Value, KeyCodec, ValueCodec>::SnapshotPairIterator() :
+    in_(nullptr),
+    remaining_(0),
+    started_(false)
+{
+
+}
+
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+SnapshotPairIterator<Key, Value, KeyCodec, ValueCodec>::SnapshotPairIterator(SnapshotReader* in, size_t count) :
+    in_(in),
+    remaining_(count),
+    started_(false)
+{
+    if(remaining_ > 0){
+        readNext();
+    }
+}
+
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+const std::pair<Key, Value>& SnapshotPairIterator<Key, Value, KeyCodec, ValueCodec>::operator*() const
+{
+    return current_;
+}
+
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+const std::pair<Key, Value>* SnapshotPairIterator<Key, Value, KeyCodec, ValueCodec>::operator->() const
+{
+    return &current_;
+}
+
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+bool SnapshotPairIterator<Key, Value, KeyCodec, ValueCodec>::operator==(const SnapshotPairIterator& rhs) const
+{
+    return remaining_ == rhs.remaining_;
+}
+
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+bool SnapshotPairIterator<Key, Value, KeyCodec, ValueCodec>::operator!=(const SnapshotPairIterator& rhs) const
+{
+    return remaining_ != rhs.remaining_;
+}
+
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+SnapshotPairIterator<Key, Value, KeyCodec, ValueCodec>&
+SnapshotPairIterator<Key, Value, KeyCodec, ValueCodec>::operator++()
+{
+    if(--remaining_ > 0){
+        readNext();
+    }
+    return *this;
+}
+
+/**
+* Reads the next pair, decoding its key against the current one.
+*/
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+void SnapshotPairIterator<Key, Value, KeyCodec, ValueCodec>::readNext()
+{
+    current_.first = KeyCodec::read(*in_, started_ ? &current_.first : nullptr);
+    current_.second = ValueCodec::read(*in_, nullptr);
+    started_ = true;
+}
+
+/*
+  --------------------------------------------------------
+  End implementations for the SnapshotPairIterator class.
+  --------------------------------------------------------
+*/
+
+/*
+  ---------------------------------------------
+  Begin implementations for the BulkBuilder class.
+  ---------------------------------------------
+*/
+
+/**
+* Two thirds of the budget go to the buffer, leaving room for the scratch
+* space std::stable_sort takes, which is half the buffer. A merge reads
+* as many runs at once as there are read buffers in the budget, less the
+* one for writing.
+*/
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+BulkBuilder<Key, Value, KeyCodec, ValueCodec>::BulkBuilder(size_t memoryBudget, const std::string& tempDir) :
+    tempDir_(tempDir),
+    bufferLimit_(std::max<size_t>(1, memoryBudget / 3 * 2 / sizeof(std::pair<Key, Value>))),
+    maxFanIn_(std::max<size_t>(2, memoryBudget / SnapshotReader::BUFFER_SIZE - 1)),
+    runFile_(-1),
+    runFileEnd_(0)
+{
+
+}
+
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+BulkBuilder<Key, Value, KeyCodec, ValueCodec>::~BulkBuilder()
+{
+    reset();
+}
+
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+void BulkBuilder<Key, Value, KeyCodec, ValueCodec>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    if(buffer_.empty()){
+        buffer_.reserve(bufferLimit_);
+    }
+    buffer_.push_back(std::pair<Key, Value>(keyValuePair.first, keyValuePair.second));
+    if(buffer_.size() >= bufferLimit_){
+        spill();
+    }
+}
+
+/**
+* Replaces the contents of tree with every pair inserted. The merged pairs
+* are written out as a snapshot, which AVLTree::load() then builds from
+* in O(n).
+*/
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+void BulkBuilder<Key, Value, KeyCodec, ValueCodec>::buildTree(AVLTree<Key, Value>& tree)
+{
+    size_t count = 0;
+    int fd = mergeToSnapshot(&count);
+    try{
+        tree.template load<KeyCodec, ValueCodec>(fd);
+    }
+    catch(...){
+        ::close(fd);
+        throw;
+    }
+    ::close(fd);
+}
+
+/**
+* Writes every pair inserted as a MappedTree file at path.
+*/
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+void BulkBuilder<Key, Value, KeyCodec, ValueCodec>::writeMapped(const std::string& path)
+{
+    size_t count = 0;
+    int fd = mergeToSnapshot(&count);
+    try{
+        SnapshotReader in(fd, 0);
+        unsigned char header[sizeof(SNAPSHOT_MAGIC)];
+        in.readBytes(header, sizeof(header));
+        in.readVarint();
+        in.readVarint();
+        MappedTree<Key, Value>::writeN(path, pair_iterator(&in, count), count);
+    }
+    catch(...){
+        ::close(fd);
+        throw;
+    }
+    ::close(fd);
+}
+
+/**
+* Builds a FrozenIndex of every pair inserted.
+*/
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+FrozenIndex<Key, Value> BulkBuilder<Key, Value, KeyCodec, ValueCodec>::freeze(FrozenLayout layout)
+{
+    size_t count = 0;
+    int fd = mergeToSnapshot(&count);
+    try{
+        SnapshotReader in(fd, 0);
+        unsigned char header[sizeof(SNAPSHOT_MAGIC)];
+        in.readBytes(header, sizeof(header));
+        in.readVarint();
+        in.readVarint();
+        FrozenIndex<Key, Value> index(pair_iterator(&in, count), pair_iterator(), layout);
+        ::close(fd);
+        return index;
+    }
+    catch(...){
+        ::close(fd);
+        throw;
+    }
+}
+
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+size_t BulkBuilder<Key, Value, KeyCodec, ValueCodec>::runs() const
+{
+    return runs_.size();
+}
+
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+bool BulkBuilder<Key, Value, KeyCodec, ValueCodec>::CursorOrder::operator()(size_t a, size_t b) const
+{
+    const Key& keyA = (*cursors_)[a].front.first;
+    const Key& keyB = (*cursors_)[b].front.first;
+    if(keyA < keyB){
+        return false;
+    }
+    if(keyB < keyA){
+        return true;
+    }
+    return a < b;
+}
+
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+BulkBuilder<Key, Value, KeyCodec, ValueCodec>::RunCursor::RunCursor(int fd, off_t offset, size_t count) :
+    reader(fd, offset),
+    remaining(count)
+{
+
+}
+
+/**
+* Opens a temporary file in tempDir_ and unlinks it at once, so that it
+* goes away with its descriptor however the builder is torn down.
+*/
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+int BulkBuilder<Key, Value, KeyCodec, ValueCodec>::createTempFile()
+{
+    std::string pattern = tempDir_ + "/avl-bulk-XXXXXX";
+    std::vector<char> name(pattern.begin(), pattern.end());
+    name.push_back('\0');
+    int fd = ::mkstemp(&name[0]);
+    if(fd < 0){
+        throw std::runtime_error("Cannot create a temporary file in " + tempDir_ + ": " + std::strerror(errno));
+    }
+    ::unlink(&name[0]);
+    return fd;
+}
+
+/**
+* Starts a run at the end of the run file, creating the file if need be.
+* Runs are only ever written through the file's own offset, which stays at
+* the end because merges read with pread().
+*/
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+void BulkBuilder<Key, Value, KeyCodec, ValueCodec>::openRun(Run* run)
+{
+    if(runFile_ < 0){
+        runFile_ = createTempFile();
+        runFileEnd_ = 0;
+    }
+    run->offset = runFileEnd_;
+    run->count = 0;
+}
+
+/**
+* Records where the run just written ends.
+*/
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+void BulkBuilder<Key, Value, KeyCodec, ValueCodec>::closeRun()
+{
+    runFileEnd_ = ::lseek(runFile_, 0, SEEK_CUR);
+    if(runFileEnd_ < 0){
+        throw std::runtime_error(std::string("Cannot find the end of a run: ") + std::strerror(errno));
+    }
+}
+
+/**
+* Sorts the buffer and writes it out as a new run.
+*/
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+void BulkBuilder<Key, Value, KeyCodec, ValueCodec>::spill()
+{
+    Run run;
+    openRun(&run);
+    run.count = sortBuffer();
+    SnapshotWriter out(runFile_);
+    const Key* previous = nullptr;
+    for(size_t i = 0; i < run.count; i++){
+        KeyCodec::write(out, buffer_[i].first, previous);
+        ValueCodec::write(out, buffer_[i].second, nullptr);
+        previous = &buffer_[i].first;
+    }
+    out.flush();
+    closeRun();
+    runs_.push_back(run);
+    buffer_.clear();
+}
+
+/**
+* Sorts the buffer by key, keeping the last value given for each key, and
+* returns how many pairs are left at the front of it.
+*/
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+size_t BulkBuilder<Key, Value, KeyCodec, ValueCodec>::sortBuffer()
+{
+    struct KeyLess
+    {
+        bool operator()(const std::pair<Key, Value>& a, const std::pair<Key, Value>& b) const
+        {
+            return a.first < b.first;
+        }
+    };
+    std::stable_sort(buffer_.begin(), buffer_.end(), KeyLess());
+    size_t kept = 0;
+    for(size_t i = 0; i < buffer_.size(); i++){
+        if(i + 1 < buffer_.size() && !(buffer_[i].first < buffer_[i + 1].first)){
+            continue;
+        }
+        if(kept != i){
+            buffer_[kept] = buffer_[i];
+        }
+        kept++;
+    }
+    return kept;
+}
+
+/**
+* Merges everything inserted into an unlinked file in the format of
+* AVLTree::save(), rewound to its start, and sets count to the number of
+* pairs in it. The count goes in the header as a padded varint, filled in
+* once the merge has found out what it is. The builder is left empty.
+*/
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+int BulkBuilder<Key, Value, KeyCodec, ValueCodec>::mergeToSnapshot(size_t* count)
+{
+    if(!buffer_.empty() && !runs_.empty()){
+        spill();
+    }
+    // Merge groups of runs, oldest first, until one read buffer per run
+    // fits. Each pass leaves the runs in the same order of age.
+    while(runs_.size() > maxFanIn_){
+        std::vector<Run> merged;
+        for(size_t first = 0; first < runs_.size(); first += maxFanIn_){
+            size_t last = std::min(first + maxFanIn_, runs_.size());
+            Run run;
+            openRun(&run);
+            SnapshotWriter out(runFile_);
+            run.count = mergeRuns(first, last, out);
+            out.flush();
+            closeRun();
+            merged.push_back(run);
+        }
+        runs_.swap(merged);
+    }
+
+    int fd = createTempFile();
+    try{
+        SnapshotWriter out(fd);
+        out.writeBytes(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+        out.writeVarint(SNAPSHOT_VERSION);
+        out.writePaddedVarint(0);
+        if(runs_.empty()){
+            // Everything fit in memory, so there is nothing to merge
+            *count = sortBuffer();
+            const Key* previous = nullptr;
+            for(size_t i = 0; i < *count; i++){
+                KeyCodec::write(out, buffer_[i].first, previous);
+                ValueCodec::write(out, buffer_[i].second, nullptr);
+                previous = &buffer_[i].first;
+            }
+        }
+        else{
+            *count = mergeRuns(0, runs_.size(), out);
+        }
+        out.flush();
+
+        unsigned char padded[SnapshotWriter::PADDED_VARINT_SIZE];
+        SnapshotWriter::encodePaddedVarint(*count, padded);
+        // The count follows the magic and the one-byte version
+        off_t offset = sizeof(SNAPSHOT_MAGIC) + 1;
+        if(::pwrite(fd, padded, sizeof(padded), offset) != static_cast<ssize_t>(sizeof(padded))){
+            throw std::runtime_error(std::string("Cannot write merged run: ") + std::strerror(errno));
+        }
+        rewind(fd);
+    }
+    catch(...){
+        ::close(fd);
+        throw;
+    }
+    reset();
+    return fd;
+}
+
+/**
+* Merges runs_[first, last) into out and returns the number of pairs
+* written. Where several runs have the same key, the newest run wins.
+*/
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+size_t BulkBuilder<Key, Value, KeyCodec, ValueCodec>::mergeRuns(size_t first, size_t last, SnapshotWriter& out)
+{
+    std::vector<RunCursor> cursors;
+    cursors.reserve(last - first);
+    for(size_t i = first; i < last; i++){
+        cursors.push_back(RunCursor(runFile_, runs_[i].offset, runs_[i].count));
+    }
+
+    CursorOrder order(&cursors);
+    std::priority_queue<size_t, std::vector<size_t>, CursorOrder> heap(order);
+    for(size_t i = 0; i < cursors.size(); i++){
+        RunCursor& cursor = cursors[i];
+        if(cursor.remaining > 0){
+            cursor.front.first = KeyCodec::read(cursor.reader, nullptr);
+            cursor.front.second = ValueCodec::read(cursor.reader, nullptr);
+            heap.push(i);
+        }
+    }
+
+    size_t written = 0;
+    Key previous = Key();
+    while(!heap.empty()){
+        size_t winner = heap.top();
+        bool duplicate = written > 0 && !(previous < cursors[winner].front.first);
+        if(!duplicate){
+            KeyCodec::write(out, cursors[winner].front.first, written > 0 ? &previous : nullptr);
+            ValueCodec::write(out, cursors[winner].front.second, nullptr);
+            previous = cursors[winner].front.first;
+            written++;
+        }
+        heap.pop();
+        RunCursor& cursor = cursors[winner];
+        if(--cursor.remaining > 0){
+            cursor.front.first = KeyCodec::read(cursor.reader, &cursor.front.first);
+            cursor.front.second = ValueCodec::read(cursor.reader, nullptr);
+            heap.push(winner);
+        }
+    }
+    return written;
+}
+
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+void BulkBuilder<Key, Value, KeyCodec, ValueCodec>::rewind(int fd)
+{
+    if(::lseek(fd, 0, SEEK_SET) != 0){
+        throw std::runtime_error(std::string("Cannot rewind the merged pairs: ") + std::strerror(errno));
+    }
+}
+
+/**
+* Drops the buffer and every run.
+*/
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+void BulkBuilder<Key, Value, KeyCodec, ValueCodec>::reset()
+{
+    std::vector<std::pair<Key, Value> >().swap(buffer_);
+    runs_.clear();
+    if(runFile_ >= 0){
+        ::close(runFile_);
+    }
+    runFile_ = -1;
+    runFileEnd_ = 0;
+}
+
+/*
+  -------------------------------------------
+  End implementations for the BulkBuilder class.
+  -------------------------------------------
+*/
+
+#endif
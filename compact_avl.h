@@ -0,0 +1,1065 @@
+#ifndef COMPACT_AVL_H
+#define COMPACT_AVL_H
+
+#include <iostream>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <iterator>
+#include <type_traits>
+#include <vector>
+#include "node_pool.h"
+
+/**
+* A node of a CompactAVLTree: the pair and two child pointers, nothing
+* else. There is no parent pointer, and the balance (-1, 0 or 1) is kept in
+* the low two bits of the left pointer, which are always zero for an
+* aligned node. With small keys and values a node is 24 bytes.
+*/
+template <typename Key, typename Value>
+class CompactAVLNode
+{
+public:
+    CompactAVLNode(const Key& key, const Value& value);
+
+    const std::pair<const Key, Value>& getItem() const;
+    std::pair<const Key, Value>& getItem();
+    const Key& getKey() const;
+    Value& getValue();
+
+    CompactAVLNode<Key, Value>* getLeft() const;
+    CompactAVLNode<Key, Value>* getRight() const;
+    int getBalance() const;
+
+    void setLeft(CompactAVLNode<Key, Value>* left);
+    void setRight(CompactAVLNode<Key, Value>* right);
+    void setBalance(int balance);
+
+private:
+    static const std::uintptr_t BALANCE_MASK = 3;
+
+    std::pair<const Key, Value> item_;
+    // Left child pointer, with the balance + 1 in its low two bits
+    std::uintptr_t leftAndBalance_;
+    CompactAVLNode<Key, Value>* right_;
+};
+
+/**
+* A node that links to its children by their index in an IndexNodeStorage.
+* Each link is 32 bits, of which the top one holds half of the balance + 1,
+* so a node is the pair plus 8 bytes and a tree holds up to 2^31 - 1 nodes.
+*/
+template <typename Key, typename Value>
+class IndexedAVLNode
+{
+public:
+    // The link to no node
+    static const std::uint32_t NIL = 0x7FFFFFFF;
+
+    IndexedAVLNode(const Key& key, const Value& value);
+
+    const std::pair<const Key, Value>& getItem() const;
+    std::pair<const Key, Value>& getItem();
+    const Key& getKey() const;
+    Value& getValue();
+
+    std::uint32_t getLeft() const;
+    std::uint32_t getRight() const;
+    int getBalance() const;
+
+    void setLeft(std::uint32_t left);
+    void setRight(std::uint32_t right);
+    void setBalance(int balance);
+
+private:
+    static const std::uint32_t LINK_MASK = 0x7FFFFFFF;
+
+    std::pair<const Key, Value> item_;
+    // The top bit of left_ is the low bit of balance + 1, the top bit of
+    // right_ the high bit
+    std::uint32_t left_;
+    std::uint32_t right_;
+};
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the CompactAVLNode class.
+  ---------------------------------------------------
+*/
+
+template<typename Key, typename Value>
+CompactAVLNode<Key, Value>::CompactAVLNode(const Key& key, const Value& value) :
+    item_(key, value),
+    leftAndBalance_(1),
+    right_(nullptr)
+{
+    static_assert(alignof(CompactAVLNode<Key, Value>) >= 4, "CompactAVLNode needs two free pointer bits");
+}
+
+template<typename Key, typename Value>
+const std::pair<const Key, Value>& CompactAVLNode<Key, Value>::getItem() const
+{
+    return item_;
+}
+
+template<typename Key, typename Value>
+std::pair<const Key, Value>& CompactAVLNode<Key, Value>::getItem()
+{
+    return item_;
+}
+
+template<typename Key, typename Value>
+const Key& CompactAVLNode<Key, Value>::getKey() const
+{
+    return item_.first;
+}
+
+template<typename Key, typename Value>
+Value& CompactAVLNode<Key, Value>::getValue()
+{
+    return item_.second;
+}
+
+template<typename Key, typename Value>
+CompactAVLNode<Key, Value>* CompactAVLNode<Key, Value>::getLeft() const
+{
+    return reinterpret_cast<CompactAVLNode<Key, Value>*>(leftAndBalance_ & ~BALANCE_MASK);
+}
+
+template<typename Key, typename Value>
+CompactAVLNode<Key, Value>* CompactAVLNode<Key, Value>::getRight() const
+{
+    return right_;
+}
+
+template<typename Key, typename Value>
+int CompactAVLNode<Key, Value>::getBalance() const
+{
+    return static_cast<int>(leftAndBalance_ & BALANCE_MASK) - 1;
+}
+
+/**
+* A setter for the left child that keeps this node's balance.
+*/
+template<typename Key, typename Value>
+void CompactAVLNode<Key, Value>::setLeft(CompactAVLNode<Key, Value>* left)
+{
+    leftAndBalance_ = reinterpret_cast<std::uintptr_t>(left) | (leftAndBalance_ & BALANCE_MASK);
+}
+
+template<typename Key, typename Value>
+void CompactAVLNode<Key, Value>::setRight(CompactAVLNode<Key, Value>* right)
+{
+    right_ = right;
+}
+
+template<typename Key, typename Value>
+void CompactAVLNode<Key, Value>::setBalance(int balance)
+{
+    leftAndBalance_ = (leftAndBalance_ & ~BALANCE_MASK) | static_cast<std::uintptr_t>(balance + 1);
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the CompactAVLNode class.
+  -------------------------------------------------
+*/
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the IndexedAVLNode class.
+  ---------------------------------------------------
+*/
+
+template<typename Key, typename Value>
+IndexedAVLNode<Key, Value>::IndexedAVLNode(const Key& key, const Value& value) :
+    item_(key, value),
+    left_(NIL | 0x80000000u),
+    right_(NIL)
+{
+
+}
+
+template<typename Key, typename Value>
+const std::pair<const Key, Value>& IndexedAVLNode<Key, Value>::getItem() const
+{
+    return item_;
+}
+
+template<typename Key, typename Value>
+std::pair<const Key, Value>& IndexedAVLNode<Key, Value>::getItem()
+{
+    return item_;
+}
+
+template<typename Key, typename Value>
+const Key& IndexedAVLNode<Key, Value>::getKey() const
+{
+    return item_.first;
+}
+
+template<typename Key, typename Value>
+Value& IndexedAVLNode<Key, Value>::getValue()
+{
+    return item_.second;
+}
+
+template<typename Key, typename Value>
+std::uint32_t IndexedAVLNode<Key, Value>::getLeft() const
+{
+    return left_ & LINK_MASK;
+}
+
+template<typename Key, typename Value>
+std::uint32_t IndexedAVLNode<Key, Value>::getRight() const
+{
+    return right_ & LINK_MASK;
+}
+
+template<typename Key, typename Value>
+int IndexedAVLNode<Key, Value>::getBalance() const
+{
+    return static_cast<int>((left_ >> 31) | ((right_ >> 31) << 1)) - 1;
+}
+
+template<typename Key, typename Value>
+void IndexedAVLNode<Key, Value>::setLeft(std::uint32_t left)
+{
+    left_ = (left_ & ~LINK_MASK) | left;
+}
+
+template<typename Key, typename Value>
+void IndexedAVLNode<Key, Value>::setRight(std::uint32_t right)
+{
+    right_ = (right_ & ~LINK_MASK) | right;
+}
+
+template<typename Key, typename Value>
+void IndexedAVLNode<Key, Value>::setBalance(int balance)
+{
+    std::uint32_t bits = static_cast<std::uint32_t>(balance + 1);
+    left_ = (left_ & LINK_MASK) | ((bits & 1) << 31);
+    right_ = (right_ & LINK_MASK) | ((bits >> 1) << 31);
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the IndexedAVLNode class.
+  -------------------------------------------------
+*/
+
+/**
+* Where a CompactAVLTree keeps its nodes, and how it names them. Each
+* storage has a Link type, null(), node(link), create(), destroy() and
+* release(), which drops every node at once without running destructors.
+*
+* PointerNodeStorage links nodes by pointer and carves them out of a
+* NodeArena.
+*/
+template <typename Key, typename Value>
+class PointerNodeStorage
+{
+public:
+    typedef CompactAVLNode<Key, Value> NodeType;
+    typedef NodeType* Link;
+
+    static Link null();
+    NodeType& node(Link link) const;
+    Link create(const Key& key, const Value& value);
+    void destroy(Link link);
+    void release();
+
+private:
+    NodeArena arena_;
+};
+
+/**
+* IndexNodeStorage keeps every node in one vector and links them by 32-bit
+* index. Removed nodes go on a free list, threaded through their left links,
+* and are reused first. The nodes hold no pointers, so the vector can be
+* copied, or written out and read back, as one block of bytes; for that
+* the pairs must be trivially copyable.
+*/
+template <typename Key, typename Value>
+class IndexNodeStorage
+{
+public:
+    typedef IndexedAVLNode<Key, Value> NodeType;
+    typedef std::uint32_t Link;
+
+    IndexNodeStorage();
+
+    static Link null();
+    NodeType& node(Link link) const;
+    Link create(const Key& key, const Value& value);
+    void destroy(Link link);
+    void release();
+
+private:
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+                  "IndexNodeStorage moves nodes as bytes, so keys and values must be trivially copyable");
+
+    typedef typename std::aligned_storage<sizeof(NodeType), alignof(NodeType)>::type Slot;
+
+    std::vector<Slot> slots_;
+    Link freeList_;
+};
+
+/*
+  -------------------------------------------------------
+  Begin implementations for the PointerNodeStorage class.
+  -------------------------------------------------------
+*/
+
+template<typename Key, typename Value>
+typename PointerNodeStorage<Key, Value>::Link PointerNodeStorage<Key, Value>::null()
+{
+    return nullptr;
+}
+
+template<typename Key, typename Value>
+typename PointerNodeStorage<Key, Value>::NodeType& PointerNodeStorage<Key, Value>::node(Link link) const
+{
+    return *link;
+}
+
+template<typename Key, typename Value>
+typename PointerNodeStorage<Key, Value>::Link
+PointerNodeStorage<Key, Value>::create(const Key& key, const Value& value)
+{
+    void* block = arena_.allocate(sizeof(NodeType));
+    try{
+        return new (block) NodeType(key, value);
+    }
+    catch(...){
+        arena_.deallocate(block);
+        throw;
+    }
+}
+
+template<typename Key, typename Value>
+void PointerNodeStorage<Key, Value>::destroy(Link link)
+{
+    link->~NodeType();
+    arena_.deallocate(link);
+}
+
+template<typename Key, typename Value>
+void PointerNodeStorage<Key, Value>::release()
+{
+    arena_.release();
+}
+
+/*
+  -----------------------------------------------------
+  End implementations for the PointerNodeStorage class.
+  -----------------------------------------------------
+*/
+
+/*
+  -----------------------------------------------------
+  Begin implementations for the IndexNodeStorage class.
+  -----------------------------------------------------
+*/
+
+template<typename Key, typename Value>
+IndexNodeStorage<Key, Value>::IndexNodeStorage() :
+    freeList_(NodeType::NIL)
+{
+
+}
+
+template<typename Key, typename Value>
+typename IndexNodeStorage<Key, Value>::Link IndexNodeStorage<Key, Value>::null()
+{
+    return NodeType::NIL;
+}
+
+/**
+* Like BinarySearchTree, a const tree still hands out mutable pairs, so
+* this gives a mutable node even through a const storage.
+*/
+template<typename Key, typename Value>
+typename IndexNodeStorage<Key, Value>::NodeType& IndexNodeStorage<Key, Value>::node(Link link) const
+{
+    return *reinterpret_cast<NodeType*>(const_cast<Slot*>(&slots_[link]));
+}
+
+template<typename Key, typename Value>
+typename IndexNodeStorage<Key, Value>::Link
+IndexNodeStorage<Key, Value>::create(const Key& key, const Value& value)
+{
+    Link link = freeList_;
+    if(link != NodeType::NIL){
+        freeList_ = node(link).getLeft();
+    }
+    else{
+        if(slots_.size() >= NodeType::NIL){
+            throw std::length_error("IndexNodeStorage is full");
+        }
+        slots_.push_back(Slot());
+        link = static_cast<Link>(slots_.size() - 1);
+    }
+    new (&slots_[link]) NodeType(key, value);
+    return link;
+}
+
+template<typename Key, typename Value>
+void IndexNodeStorage<Key, Value>::destroy(Link link)
+{
+    node(link).setLeft(freeList_);
+    freeList_ = link;
+}
+
+template<typename Key, typename Value>
+void IndexNodeStorage<Key, Value>::release()
+{
+    std::vector<Slot>().swap(slots_);
+    freeList_ = NodeType::NIL;
+}
+
+/*
+  ---------------------------------------------------
+  End implementations for the IndexNodeStorage class.
+  ---------------------------------------------------
+*/
+
+/**
+* An AVL tree for when memory per key matters most. The nodes have no
+* parent pointers and no balance field (see CompactAVLNode), so insert and
+* remove rebalance on the way back out of a recursive descent, and
+* iterators keep the path from the root on an explicit stack.
+*
+* Storage decides how nodes are stored and linked. The default gives each
+* node its own block of exactly the node size in a NodeArena; an
+* IndexNodeStorage (see IndexedAVLTree below) keeps them all in one vector
+* with 32-bit links. An iterator is invalidated by any insert or remove.
+*/
+template <typename Key, typename Value, typename Storage = PointerNodeStorage<Key, Value> >
+class CompactAVLTree
+{
+public:
+    typedef typename Storage::NodeType NodeType;
+    typedef typename Storage::Link Link;
+
+    /**
+    * An in-order iterator. The stack holds the nodes still to come whose
+    * right subtrees have not been started, so it is never deeper than
+    * the tree.
+    */
+    class iterator
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef std::pair<const Key, Value>* pointer;
+        typedef std::pair<const Key, Value>& reference;
+
+        iterator();
+        iterator(const iterator& other);
+        iterator& operator=(const iterator& other);
+
+        std::pair<const Key, Value>& operator*() const;
+        std::pair<const Key, Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+        iterator operator++(int);
+
+    protected:
+        friend class CompactAVLTree<Key, Value, Storage>;
+        explicit iterator(const CompactAVLTree* tree);
+        void push(Link current);
+        void pushLeftPath(Link current);
+
+        // An AVL tree of 2^64 nodes is less than 93 levels deep
+        static const int MAX_DEPTH = 96;
+        const CompactAVLTree* tree_;
+        Link path_[MAX_DEPTH];
+        int depth_;
+    };
+
+    CompactAVLTree();
+    ~CompactAVLTree();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    bool empty() const;
+    size_t size() const;
+    int height() const;
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    Value& operator[](const Key& key);
+    Value const & operator[](const Key& key) const;
+
+protected:
+    NodeType& node(Link link) const;
+
+    // Each helper returns the new root of the subtree it was given
+    Link insertHelper(Link current, const std::pair<const Key, Value>& keyValuePair, bool* grew);
+    Link removeHelper(Link current, const Key& key, bool* shrank);
+    Link removeSmallest(Link current, Link* smallest, bool* shrank);
+    Link leftGrew(Link current, bool* grew);
+    Link rightGrew(Link current, bool* grew);
+    Link leftShrank(Link current, bool* shrank);
+    Link rightShrank(Link current, bool* shrank);
+    Link fixLeftHeavy(Link current, bool* shrank);
+    Link fixRightHeavy(Link current, bool* shrank);
+
+    Link createNode(const std::pair<const Key, Value>& keyValuePair);
+    void destroyNode(Link current);
+    void clearHelper(Link current);
+
+    Storage storage_;
+    Link root_;
+    size_t size_;
+};
+
+/**
+* A CompactAVLTree whose nodes live in one vector and link by 32-bit index.
+* Copying one copies its node vector as a single block.
+*/
+template <typename Key, typename Value>
+using IndexedAVLTree = CompactAVLTree<Key, Value, IndexNodeStorage<Key, Value> >;
+
+/*
+  ------------------------------------------------------------
+  Begin implementations for the CompactAVLTree::iterator class.
+  ------------------------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Storage>
+CompactAVLTree<Key, Value, Storage>::iterator::iterator() :
+    tree_(nullptr),
+    depth_(0)
+{
+
+}
+
+template<typename Key, typename Value, typename Storage>
+CompactAVLTree<Key, Value, Storage>::iterator::iterator(const CompactAVLTree* tree) :
+    tree_(tree),
+    depth_(0)
+{
+
+}
+
+/**
+* Copies only the part of the stack in use.
+*/
+template<typename Key, typename Value, typename Storage>
+CompactAVLTree<Key, Value, Storage>::iterator::iterator(const iterator& other) :
+    tree_(other.tree_),
+    depth_(other.depth_)
+{
+    for(int i = 0; i < depth_; i++){
+        path_[i] = other.path_[i];
+    }
+}
+
+template<typename Key, typename Value, typename Storage>
+typename CompactAVLTree<Key, Value, Storage>::iterator&
+CompactAVLTree<Key, Value, Storage>::iterator::operator=(const iterator& other)
+{
+    tree_ = other.tree_;
+    depth_ = other.depth_;
+    for(int i = 0; i < depth_; i++){
+        path_[i] = other.path_[i];
+    }
+    return *this;
+}
+
+template<typename Key, typename Value, typename Storage>
+std::pair<const Key, Value>& CompactAVLTree<Key, Value, Storage>::iterator::operator*() const
+{
+    return tree_->node(path_[depth_ - 1]).getItem();
+}
+
+template<typename Key, typename Value, typename Storage>
+std::pair<const Key, Value>* CompactAVLTree<Key, Value, Storage>::iterator::operator->() const
+{
+    return &(tree_->node(path_[depth_ - 1]).getItem());
+}
+
+template<typename Key, typename Value, typename Storage>
+bool CompactAVLTree<Key, Value, Storage>::iterator::operator==(const iterator& rhs) const
+{
+    if(depth_ == 0 || rhs.depth_ == 0){
+        return depth_ == rhs.depth_;
+    }
+    return path_[depth_ - 1] == rhs.path_[rhs.depth_ - 1];
+}
+
+template<typename Key, typename Value, typename Storage>
+bool CompactAVLTree<Key, Value, Storage>::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Advances to the leftmost node of the right subtree if there is one,
+* otherwise to the nearest ancestor still on the stack.
+*/
+template<typename Key, typename Value, typename Storage>
+typename CompactAVLTree<Key, Value, Storage>::iterator&
+CompactAVLTree<Key, Value, Storage>::iterator::operator++()
+{
+    Link current = path_[--depth_];
+    pushLeftPath(tree_->node(current).getRight());
+    return *this;
+}
+
+template<typename Key, typename Value, typename Storage>
+typename CompactAVLTree<Key, Value, Storage>::iterator
+CompactAVLTree<Key, Value, Storage>::iterator::operator++(int)
+{
+    iterator old = *this;
+    ++(*this);
+    return old;
+}
+
+template<typename Key, typename Value, typename Storage>
+void CompactAVLTree<Key, Value, Storage>::iterator::push(Link current)
+{
+    path_[depth_++] = current;
+}
+
+template<typename Key, typename Value, typename Storage>
+void CompactAVLTree<Key, Value, Storage>::iterator::pushLeftPath(Link current)
+{
+    while(current != Storage::null()){
+        push(current);
+        current = tree_->node(current).getLeft();
+    }
+}
+
+/*
+  ----------------------------------------------------------
+  End implementations for the CompactAVLTree::iterator class.
+  ----------------------------------------------------------
+*/
+
+/*
+  -----------------------------------------------
+  Begin implementations for the CompactAVLTree class.
+  -----------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Storage>
+CompactAVLTree<Key, Value, Storage>::CompactAVLTree() :
+    root_(Storage::null()),
+    size_(0)
+{
+
+}
+
+template<typename Key, typename Value, typename Storage>
+CompactAVLTree<Key, Value, Storage>::~CompactAVLTree()
+{
+    clear();
+}
+
+/**
+* Inserts a pair, or overwrites the value if the key is already there.
+*/
+template<typename Key, typename Value, typename Storage>
+void CompactAVLTree<Key, Value, Storage>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    bool grew = false;
+    root_ = insertHelper(root_, keyValuePair, &grew);
+}
+
+template<typename Key, typename Value, typename Storage>
+void CompactAVLTree<Key, Value, Storage>::remove(const Key& key)
+{
+    bool shrank = false;
+    root_ = removeHelper(root_, key, &shrank);
+}
+
+template<typename Key, typename Value, typename Storage>
+void CompactAVLTree<Key, Value, Storage>::clear()
+{
+    // Nodes whose pairs need no destructor are dropped all at once
+    if(!std::is_trivially_destructible<std::pair<const Key, Value> >::value){
+        clearHelper(root_);
+    }
+    storage_.release();
+    root_ = Storage::null();
+    size_ = 0;
+}
+
+template<typename Key, typename Value, typename Storage>
+bool CompactAVLTree<Key, Value, Storage>::empty() const
+{
+    return root_ == Storage::null();
+}
+
+template<typename Key, typename Value, typename Storage>
+size_t CompactAVLTree<Key, Value, Storage>::size() const
+{
+    return size_;
+}
+
+/**
+* Walks down the taller side at each node, so it takes O(log n).
+*/
+template<typename Key, typename Value, typename Storage>
+int CompactAVLTree<Key, Value, Storage>::height() const
+{
+    int height = 0;
+    for(Link current = root_; current != Storage::null(); height++){
+        NodeType& here = node(current);
+        current = (here.getBalance() < 0) ? here.getLeft() : here.getRight();
+    }
+    return height;
+}
+
+template<typename Key, typename Value, typename Storage>
+typename CompactAVLTree<Key, Value, Storage>::iterator CompactAVLTree<Key, Value, Storage>::begin() const
+{
+    iterator it(this);
+    it.pushLeftPath(root_);
+    return it;
+}
+
+template<typename Key, typename Value, typename Storage>
+typename CompactAVLTree<Key, Value, Storage>::iterator CompactAVLTree<Key, Value, Storage>::end() const
+{
+    return iterator(this);
+}
+
+template<typename Key, typename Value, typename Storage>
+typename CompactAVLTree<Key, Value, Storage>::iterator CompactAVLTree<Key, Value, Storage>::find(const Key& key) const
+{
+    iterator it = lower_bound(key);
+    if(it.depth_ == 0 || key < it->first){
+        return end();
+    }
+    return it;
+}
+
+/**
+* Returns an iterator to the smallest key that is not less than key. The
+* stack keeps the nodes we went left from, which are exactly the ones
+* still to come in order.
+*/
+template<typename Key, typename Value, typename Storage>
+typename CompactAVLTree<Key, Value, Storage>::iterator
+CompactAVLTree<Key, Value, Storage>::lower_bound(const Key& key) const
+{
+    iterator it(this);
+    Link current = root_;
+    while(current != Storage::null()){
+        NodeType& here = node(current);
+        if(here.getKey() < key){
+            current = here.getRight();
+        }
+        else{
+            it.push(current);
+            if(!(key < here.getKey())){
+                break;
+            }
+            current = here.getLeft();
+        }
+    }
+    return it;
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<typename Key, typename Value, typename Storage>
+Value& CompactAVLTree<Key, Value, Storage>::operator[](const Key& key)
+{
+    iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+template<typename Key, typename Value, typename Storage>
+Value const & CompactAVLTree<Key, Value, Storage>::operator[](const Key& key) const
+{
+    iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+template<typename Key, typename Value, typename Storage>
+typename CompactAVLTree<Key, Value, Storage>::NodeType& CompactAVLTree<Key, Value, Storage>::node(Link link) const
+{
+    return storage_.node(link);
+}
+
+/**
+* Inserts below current. grew is set if the subtree got taller, which the
+* caller then absorbs into its own balance.
+*/
+template<typename Key, typename Value, typename Storage>
+typename CompactAVLTree<Key, Value, Storage>::Link
+CompactAVLTree<Key, Value, Storage>::insertHelper(Link current, const std::pair<const Key, Value>& keyValuePair, bool* grew)
+{
+    if(current == Storage::null()){
+        *grew = true;
+        return createNode(keyValuePair);
+    }
+    if(keyValuePair.first < node(current).getKey()){
+        Link left = insertHelper(node(current).getLeft(), keyValuePair, grew);
+        node(current).setLeft(left);
+        return *grew ? leftGrew(current, grew) : current;
+    }
+    if(node(current).getKey() < keyValuePair.first){
+        Link right = insertHelper(node(current).getRight(), keyValuePair, grew);
+        node(current).setRight(right);
+        return *grew ? rightGrew(current, grew) : current;
+    }
+    node(current).getValue() = keyValuePair.second;
+    *grew = false;
+    return current;
+}
+
+/**
+* Removes key below current. shrank is set if the subtree got shorter.
+* A node with two children is replaced by its successor node, relinked in
+* its place, since the key in a pair cannot be overwritten.
+*/
+template<typename Key, typename Value, typename Storage>
+typename CompactAVLTree<Key, Value, Storage>::Link
+CompactAVLTree<Key, Value, Storage>::removeHelper(Link current, const Key& key, bool* shrank)
+{
+    if(current == Storage::null()){
+        *shrank = false;
+        return current;
+    }
+    if(key < node(current).getKey()){
+        Link left = removeHelper(node(current).getLeft(), key, shrank);
+        node(current).setLeft(left);
+        return *shrank ? leftShrank(current, shrank) : current;
+    }
+    if(node(current).getKey() < key){
+        Link right = removeHelper(node(current).getRight(), key, shrank);
+        node(current).setRight(right);
+        return *shrank ? rightShrank(current, shrank) : current;
+    }
+
+    Link left = node(current).getLeft();
+    Link right = node(current).getRight();
+    if(left == Storage::null() || right == Storage::null()){
+        destroyNode(current);
+        *shrank = true;
+        return (left != Storage::null()) ? left : right;
+    }
+
+    Link successor = Storage::null();
+    right = removeSmallest(right, &successor, shrank);
+    node(successor).setLeft(left);
+    node(successor).setRight(right);
+    node(successor).setBalance(node(current).getBalance());
+    destroyNode(current);
+    return *shrank ? rightShrank(successor, shrank) : successor;
+}
+
+/**
+* Unlinks the smallest node below current and hands it back in smallest.
+*/
+template<typename Key, typename Value, typename Storage>
+typename CompactAVLTree<Key, Value, Storage>::Link
+CompactAVLTree<Key, Value, Storage>::removeSmallest(Link current, Link* smallest, bool* shrank)
+{
+    if(node(current).getLeft() == Storage::null()){
+        *smallest = current;
+        *shrank = true;
+        return node(current).getRight();
+    }
+    Link left = removeSmallest(node(current).getLeft(), smallest, shrank);
+    node(current).setLeft(left);
+    return *shrank ? leftShrank(current, shrank) : current;
+}
+
+template<typename Key, typename Value, typename Storage>
+typename CompactAVLTree<Key, Value, Storage>::Link
+CompactAVLTree<Key, Value, Storage>::leftGrew(Link current, bool* grew)
+{
+    int balance = node(current).getBalance();
+    if(balance == 1){
+        node(current).setBalance(0);
+        *grew = false;
+        return current;
+    }
+    if(balance == 0){
+        node(current).setBalance(-1);
+        return current;
+    }
+    *grew = false;
+    return fixLeftHeavy(current, nullptr);
+}
+
+template<typename Key, typename Value, typename Storage>
+typename CompactAVLTree<Key, Value, Storage>::Link
+CompactAVLTree<Key, Value, Storage>::rightGrew(Link current, bool* grew)
+{
+    int balance = node(current).getBalance();
+    if(balance == -1){
+        node(current).setBalance(0);
+        *grew = false;
+        return current;
+    }
+    if(balance == 0){
+        node(current).setBalance(1);
+        return current;
+    }
+    *grew = false;
+    return fixRightHeavy(current, nullptr);
+}
+
+template<typename Key, typename Value, typename Storage>
+typename CompactAVLTree<Key, Value, Storage>::Link
+CompactAVLTree<Key, Value, Storage>::leftShrank(Link current, bool* shrank)
+{
+    int balance = node(current).getBalance();
+    if(balance == -1){
+        node(current).setBalance(0);
+        return current;
+    }
+    if(balance == 0){
+        node(current).setBalance(1);
+        *shrank = false;
+        return current;
+    }
+    return fixRightHeavy(current, shrank);
+}
+
+template<typename Key, typename Value, typename Storage>
+typename CompactAVLTree<Key, Value, Storage>::Link
+CompactAVLTree<Key, Value, Storage>::rightShrank(Link current, bool* shrank)
+{
+    int balance = node(current).getBalance();
+    if(balance == 1){
+        node(current).setBalance(0);
+        return current;
+    }
+    if(balance == 0){
+        node(current).setBalance(-1);
+        *shrank = false;
+        return current;
+    }
+    return fixLeftHeavy(current, shrank);
+}
+
+/**
+* current's left side is two levels taller than its right. Rotates right,
+* or left-right if the left child leans right. shrank, if given, is set to
+* whether the subtree ended up shorter than before the fix.
+*/
+template<typename Key, typename Value, typename Storage>
+typename CompactAVLTree<Key, Value, Storage>::Link
+CompactAVLTree<Key, Value, Storage>::fixLeftHeavy(Link current, bool* shrank)
+{
+    NodeType& top = node(current);
+    Link child = top.getLeft();
+    NodeType& left = node(child);
+    if(left.getBalance() <= 0){
+        bool leaning = left.getBalance() == -1;
+        top.setLeft(left.getRight());
+        left.setRight(current);
+        top.setBalance(leaning ? 0 : -1);
+        left.setBalance(leaning ? 0 : 1);
+        if(shrank != nullptr){
+            *shrank = leaning;
+        }
+        return child;
+    }
+
+    Link grandchild = left.getRight();
+    NodeType& middle = node(grandchild);
+    left.setRight(middle.getLeft());
+    top.setLeft(middle.getRight());
+    middle.setLeft(child);
+    middle.setRight(current);
+    top.setBalance(middle.getBalance() == -1 ? 1 : 0);
+    left.setBalance(middle.getBalance() == 1 ? -1 : 0);
+    middle.setBalance(0);
+    if(shrank != nullptr){
+        *shrank = true;
+    }
+    return grandchild;
+}
+
+/**
+* The mirror image of fixLeftHeavy().
+*/
+template<typename Key, typename Value, typename Storage>
+typename CompactAVLTree<Key, Value, Storage>::Link
+CompactAVLTree<Key, Value, Storage>::fixRightHeavy(Link current, bool* shrank)
+{
+    NodeType& top = node(current);
+    Link child = top.getRight();
+    NodeType& right = node(child);
+    if(right.getBalance() >= 0){
+        bool leaning = right.getBalance() == 1;
+        top.setRight(right.getLeft());
+        right.setLeft(current);
+        top.setBalance(leaning ? 0 : 1);
+        right.setBalance(leaning ? 0 : -1);
+        if(shrank != nullptr){
+            *shrank = leaning;
+        }
+        return child;
+    }
+
+    Link grandchild = right.getLeft();
+    NodeType& middle = node(grandchild);
+    right.setLeft(middle.getRight());
+    top.setRight(middle.getLeft());
+    middle.setRight(child);
+    middle.setLeft(current);
+    top.setBalance(middle.getBalance() == 1 ? -1 : 0);
+    right.setBalance(middle.getBalance() == -1 ? 1 : 0);
+    middle.setBalance(0);
+    if(shrank != nullptr){
+        *shrank = true;
+    }
+    return grandchild;
+}
+
+template<typename Key, typename Value, typename Storage>
+typename CompactAVLTree<Key, Value, Storage>::Link
+CompactAVLTree<Key, Value, Storage>::createNode(const std::pair<const Key, Value>& keyValuePair)
+{
+    Link current = storage_.create(keyValuePair.first, keyValuePair.second);
+    size_++;
+    return current;
+}
+
+template<typename Key, typename Value, typename Storage>
+void CompactAVLTree<Key, Value, Storage>::destroyNode(Link current)
+{
+    storage_.destroy(current);
+    size_--;
+}
+
+template<typename Key, typename Value, typename Storage>
+void CompactAVLTree<Key, Value, Storage>::clearHelper(Link current)
+{
+    if(current == Storage::null()){
+        return;
+    }
+    clearHelper(node(current).getLeft());
+    clearHelper(node(current).getRight());
+    destroyNode(current);
+}
+
+/*
+  ---------------------------------------------
+  End implementations for the CompactAVLTree class.
+  ---------------------------------------------
+*/
+
+#endif
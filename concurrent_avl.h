@@ -0,0 +1,1308 @@
+#ifndef CONCURRENT_AVL_H
+#define CONCURRENT_AVL_H
+
+#include <iostream>
+#include <cstdint>
+#include <algorithm>
+#include <utility>
+#include <iterator>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "epoch.h"
+
+template <typename Key, typename Value> class ConcurrentAVLNode;
+
+/**
+* The links of a node in a ConcurrentAVLTree. The tree's root holder is a
+* bare link with the real root as its right child, so that the root can be
+* locked and replaced like any other child.
+*
+* Every field may be read without a lock, so all of them are atomic. A node
+* is only written with its lock held, and a rotation that shrinks the range
+* of keys under a node bumps the node's version, which is what lets readers
+* tell that the path they took may no longer lead to their key.
+*/
+template <typename Key, typename Value>
+class ConcurrentAVLLink
+{
+public:
+    typedef ConcurrentAVLNode<Key, Value> NodeType;
+
+    // Bits of the version
+    static const std::uint64_t UNLINKED = 1;
+    static const std::uint64_t SHRINKING = 2;
+    static const std::uint64_t SHRINK_INCREMENT = 4;
+
+    ConcurrentAVLLink(ConcurrentAVLLink* parent, const Value* value);
+
+    NodeType* getChild(int dir) const;
+    NodeType* getLeft() const;
+    NodeType* getRight() const;
+    ConcurrentAVLLink* getParent() const;
+    int getHeight() const;
+    std::uint64_t getVersion() const;
+    const Value* getValue() const;
+
+    void setChild(int dir, NodeType* child);
+    void setLeft(NodeType* left);
+    void setRight(NodeType* right);
+    void setParent(ConcurrentAVLLink* parent);
+    void setHeight(int height);
+    void setVersion(std::uint64_t version);
+    void setValue(const Value* value);
+
+    void waitUntilNotShrinking();
+
+    static bool isShrinkingOrUnlinked(std::uint64_t version);
+    static bool isUnlinked(std::uint64_t version);
+
+    std::mutex lock;
+
+private:
+    std::atomic<NodeType*> left_;
+    std::atomic<NodeType*> right_;
+    std::atomic<ConcurrentAVLLink*> parent_;
+    std::atomic<int> height_;
+    std::atomic<std::uint64_t> version_;
+    // nullptr for a routing node, i.e. a removed key still needed as a branch
+    std::atomic<const Value*> value_;
+};
+
+/**
+* A node of a ConcurrentAVLTree. Only the key never changes.
+*/
+template <typename Key, typename Value>
+class ConcurrentAVLNode : public ConcurrentAVLLink<Key, Value>
+{
+public:
+    ConcurrentAVLNode(const Key& key, const Value* value, ConcurrentAVLLink<Key, Value>* parent);
+
+    const Key& getKey() const;
+
+private:
+    const Key key_;
+};
+
+/*
+  --------------------------------------------------------
+  Begin implementations for the ConcurrentAVLLink/Node classes.
+  --------------------------------------------------------
+*/
+
+template<typename Key, typename Value>
+ConcurrentAVLLink<Key, Value>::ConcurrentAVLLink(ConcurrentAVLLink* parent, const Value* value) :
+    left_(nullptr),
+    right_(nullptr),
+    parent_(parent),
+    height_(1),
+    version_(0),
+    value_(value)
+{
+
+}
+
+/**
+* dir < 0 is the left child, dir > 0 the right one, as returned by compare().
+*/
+template<typename Key, typename Value>
+ConcurrentAVLNode<Key, Value>* ConcurrentAVLLink<Key, Value>::getChild(int dir) const
+{
+    return (dir < 0) ? left_.load() : right_.load();
+}
+
+template<typename Key, typename Value>
+ConcurrentAVLNode<Key, Value>* ConcurrentAVLLink<Key, Value>::getLeft() const
+{
+    return left_.load();
+}
+
+template<typename Key, typename Value>
+ConcurrentAVLNode<Key, Value>* ConcurrentAVLLink<Key, Value>::getRight() const
+{
+    return right_.load();
+}
+
+template<typename Key, typename Value>
+ConcurrentAVLLink<Key, Value>* ConcurrentAVLLink<Key, Value>::getParent() const
+{
+    return parent_.load();
+}
+
+template<typename Key, typename Value>
+int ConcurrentAVLLink<Key, Value>::getHeight() const
+{
+    return height_.load();
+}
+
+template<typename Key, typename Value>
+std::uint64_t ConcurrentAVLLink<Key, Value>::getVersion() const
+{
+    return version_.load();
+}
+
+template<typename Key, typename Value>
+const Value* ConcurrentAVLLink<Key, Value>::getValue() const
+{
+    return value_.load();
+}
+
+template<typename Key, typename Value>
+void ConcurrentAVLLink<Key, Value>::setChild(int dir, NodeType* child)
+{
+    if(dir < 0){
+        left_.store(child);
+    }
+    else{
+        right_.store(child);
+    }
+}
+
+template<typename Key, typename Value>
+void ConcurrentAVLLink<Key, Value>::setLeft(NodeType* left)
+{
+    left_.store(left);
+}
+
+template<typename Key, typename Value>
+void ConcurrentAVLLink<Key, Value>::setRight(NodeType* right)
+{
+    right_.store(right);
+}
+
+template<typename Key, typename Value>
+void ConcurrentAVLLink<Key, Value>::setParent(ConcurrentAVLLink* parent)
+{
+    parent_.store(parent);
+}
+
+template<typename Key, typename Value>
+void ConcurrentAVLLink<Key, Value>::setHeight(int height)
+{
+    height_.store(height);
+}
+
+template<typename Key, typename Value>
+void ConcurrentAVLLink<Key, Value>::setVersion(std::uint64_t version)
+{
+    version_.store(version);
+}
+
+template<typename Key, typename Value>
+void ConcurrentAVLLink<Key, Value>::setValue(const Value* value)
+{
+    value_.store(value);
+}
+
+/**
+* Spins while a rotation shrinks this node. The rotation holds the node's
+* lock, so after a short spin we block on the lock instead.
+*/
+template<typename Key, typename Value>
+void ConcurrentAVLLink<Key, Value>::waitUntilNotShrinking()
+{
+    for(int spins = 0; (getVersion() & SHRINKING) != 0; spins++){
+        if(spins >= 100){
+            std::lock_guard<std::mutex> guard(lock);
+        }
+    }
+}
+
+template<typename Key, typename Value>
+bool ConcurrentAVLLink<Key, Value>::isShrinkingOrUnlinked(std::uint64_t version)
+{
+    return (version & (SHRINKING | UNLINKED)) != 0;
+}
+
+template<typename Key, typename Value>
+bool ConcurrentAVLLink<Key, Value>::isUnlinked(std::uint64_t version)
+{
+    return (version & UNLINKED) != 0;
+}
+
+template<typename Key, typename Value>
+ConcurrentAVLNode<Key, Value>::ConcurrentAVLNode(const Key& key, const Value* value, ConcurrentAVLLink<Key, Value>* parent) :
+    ConcurrentAVLLink<Key, Value>(parent, value),
+    key_(key)
+{
+
+}
+
+template<typename Key, typename Value>
+const Key& ConcurrentAVLNode<Key, Value>::getKey() const
+{
+    return key_;
+}
+
+/*
+  ------------------------------------------------------
+  End implementations for the ConcurrentAVLLink/Node classes.
+  ------------------------------------------------------
+*/
+
+/**
+* An AVL tree that many threads can use at once, after Bronson et al.,
+* "A Practical Concurrent Binary Search Tree".
+*
+* find() and iteration take no locks. They descend hand over hand, checking
+* each node's version after reading its child, and back up when a rotation
+* has moved the key range they were searching. insert() and remove() lock
+* only the nodes they change, and rebalancing locks the parent, node and
+* child (and grandchild for a double rotation) of each rotation, top down.
+* A key with two children is removed by clearing its value, leaving a
+* routing node that is unlinked once it has at most one child.
+*
+* Unlinked nodes and replaced values are retired to an EpochDomain, so a
+* reader can never see memory being freed under it.
+*
+* Values are copied out rather than returned by reference, since another
+* thread may replace them at any time. Iterators are weakly consistent:
+* each step finds the next key after the current one in the tree as it is
+* at that moment, so a step costs O(log n).
+*/
+template <typename Key, typename Value>
+class ConcurrentAVLTree
+{
+public:
+    typedef ConcurrentAVLLink<Key, Value> Link;
+    typedef ConcurrentAVLNode<Key, Value> NodeType;
+
+    ConcurrentAVLTree();
+    ~ConcurrentAVLTree();
+
+    class iterator
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef std::pair<Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const std::pair<Key, Value>* pointer;
+        typedef const std::pair<Key, Value>& reference;
+
+        iterator();
+
+        const std::pair<Key, Value>& operator*() const;
+        const std::pair<Key, Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+    protected:
+        friend class ConcurrentAVLTree<Key, Value>;
+        explicit iterator(const ConcurrentAVLTree* tree);
+        void seek(const Key* after);
+
+        const ConcurrentAVLTree* tree_;
+        std::pair<Key, Value> item_;
+        bool atEnd_;
+    };
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+    bool empty() const;
+
+    iterator begin() const;
+    iterator end() const;
+
+protected:
+    // Results of one optimistic attempt
+    enum Attempt { RETRY, FOUND, NOT_FOUND, DONE };
+
+    // nodeCondition() results other than a new height
+    static const int UNLINK_REQUIRED = -1;
+    static const int REBALANCE_REQUIRED = -2;
+    static const int NOTHING_REQUIRED = -3;
+
+    static int compare(const Key& key, const Key& nodeKey);
+    static int height(const Link* node);
+
+    Attempt attemptGet(const Key& key, Link* node, int dirToChild, std::uint64_t nodeVersion, const Value** value) const;
+    Attempt attemptHigher(const Key* key, Link* node, int dirToChild, std::uint64_t nodeVersion,
+                          NodeType* best, NodeType** result) const;
+    Attempt update(const Key& key, const Value* value);
+    Attempt attemptUpdate(const Key& key, const Value* value, Link* parent, NodeType* node, std::uint64_t nodeVersion);
+    Attempt attemptNodeUpdate(const Value* value, Link* parent, NodeType* node);
+    bool attemptUnlink_nl(Link* parent, NodeType* node);
+
+    // Rebalancing; the _nl functions expect their nodes to be locked
+    static int nodeCondition(Link* node);
+    void fixHeightAndRebalance(Link* node);
+    Link* fixHeight_nl(Link* node);
+    Link* rebalance_nl(Link* nParent, NodeType* n);
+    Link* rebalanceToRight_nl(Link* nParent, NodeType* n, NodeType* nL, int hR0);
+    Link* rebalanceToLeft_nl(Link* nParent, NodeType* n, NodeType* nR, int hL0);
+    Link* rotateRight_nl(Link* nParent, NodeType* n, NodeType* nL, int hR, int hLL, NodeType* nLR, int hLR);
+    Link* rotateLeft_nl(Link* nParent, NodeType* n, NodeType* nR, int hL, int hRR, NodeType* nRL, int hRL);
+    Link* rotateRightOverLeft_nl(Link* nParent, NodeType* n, NodeType* nL, int hR, int hLL, NodeType* nLR, int hLRL);
+    Link* rotateLeftOverRight_nl(Link* nParent, NodeType* n, NodeType* nR, int hL, int hRR, NodeType* nRL, int hRLR);
+
+    static void deleteSubtree(NodeType* node);
+
+    // Epochs come first so that they are destroyed after the nodes
+    mutable EpochDomain epochs_;
+    mutable Link holder_;
+
+private:
+    ConcurrentAVLTree(const ConcurrentAVLTree&);
+    ConcurrentAVLTree& operator=(const ConcurrentAVLTree&);
+};
+
+/*
+  -------------------------------------------------------------
+  Begin implementations for the ConcurrentAVLTree::iterator class.
+  -------------------------------------------------------------
+*/
+
+template<typename Key, typename Value>
+ConcurrentAVLTree<Key, Value>::iterator::iterator() :
+    tree_(nullptr),
+    item_(),
+    atEnd_(true)
+{
+
+}
+
+template<typename Key, typename Value>
+ConcurrentAVLTree<Key, Value>::iterator::iterator(const ConcurrentAVLTree* tree) :
+    tree_(tree),
+    item_(),
+    atEnd_(true)
+{
+
+}
+
+template<typename Key, typename Value>
+const std::pair<Key, Value>& ConcurrentAVLTree<Key, Value>::iterator::operator*() const
+{
+    return item_;
+}
+
+template<typename Key, typename Value>
+const std::pair<Key, Value>* ConcurrentAVLTree<Key, Value>::iterator::operator->() const
+{
+    return &item_;
+}
+
+/**
+* Iterators are equal when both are at the end or both are at the same key.
+*/
+template<typename Key, typename Value>
+bool ConcurrentAVLTree<Key, Value>::iterator::operator==(const iterator& rhs) const
+{
+    if(atEnd_ || rhs.atEnd_){
+        return atEnd_ && rhs.atEnd_;
+    }
+    return !(item_.first < rhs.item_.first) && !(rhs.item_.first < item_.first);
+}
+
+template<typename Key, typename Value>
+bool ConcurrentAVLTree<Key, Value>::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+template<typename Key, typename Value>
+typename ConcurrentAVLTree<Key, Value>::iterator&
+ConcurrentAVLTree<Key, Value>::iterator::operator++()
+{
+    Key current = item_.first;
+    seek(&current);
+    return *this;
+}
+
+/**
+* Moves to the smallest key greater than *after (or the smallest key if
+* after is NULL) that still has a value, copying it out while the epoch
+* guard keeps the node alive.
+*/
+template<typename Key, typename Value>
+void ConcurrentAVLTree<Key, Value>::iterator::seek(const Key* after)
+{
+    EpochDomain::Guard guard(tree_->epochs_);
+    while(true){
+        NodeType* next = nullptr;
+        while(tree_->attemptHigher(after, &tree_->holder_, 1, tree_->holder_.getVersion(), nullptr, &next) == RETRY){
+        }
+        if(next == nullptr){
+            atEnd_ = true;
+            return;
+        }
+        const Value* value = next->getValue();
+        if(value != nullptr){
+            item_ = std::pair<Key, Value>(next->getKey(), *value);
+            atEnd_ = false;
+            return;
+        }
+        // A routing node; skip past its key
+        after = &next->getKey();
+    }
+}
+
+/*
+  -----------------------------------------------------------
+  End implementations for the ConcurrentAVLTree::iterator class.
+  -----------------------------------------------------------
+*/
+
+/*
+  -----------------------------------------------------
+  Begin implementations for the ConcurrentAVLTree class.
+  -----------------------------------------------------
+*/
+
+template<typename Key, typename Value>
+ConcurrentAVLTree<Key, Value>::ConcurrentAVLTree() :
+    holder_(nullptr, nullptr)
+{
+
+}
+
+/**
+* No other thread may be using the tree anymore.
+*/
+template<typename Key, typename Value>
+ConcurrentAVLTree<Key, Value>::~ConcurrentAVLTree()
+{
+    deleteSubtree(holder_.getRight());
+}
+
+/**
+* Inserts a pair, or overwrites the value if the key is already there.
+*/
+template<typename Key, typename Value>
+void ConcurrentAVLTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    EpochDomain::Guard guard(epochs_);
+    const Value* value = new Value(keyValuePair.second);
+    while(update(keyValuePair.first, value) == RETRY){
+    }
+}
+
+template<typename Key, typename Value>
+void ConcurrentAVLTree<Key, Value>::remove(const Key& key)
+{
+    EpochDomain::Guard guard(epochs_);
+    while(update(key, nullptr) == RETRY){
+    }
+}
+
+/**
+* Copies the value for key into value and returns true, or returns false
+* if the key is not there.
+*/
+template<typename Key, typename Value>
+bool ConcurrentAVLTree<Key, Value>::find(const Key& key, Value& value) const
+{
+    EpochDomain::Guard guard(epochs_);
+    const Value* found = nullptr;
+    Attempt result;
+    while((result = attemptGet(key, &holder_, 1, holder_.getVersion(), &found)) == RETRY){
+    }
+    if(result != FOUND){
+        return false;
+    }
+    value = *found;
+    return true;
+}
+
+template<typename Key, typename Value>
+bool ConcurrentAVLTree<Key, Value>::contains(const Key& key) const
+{
+    EpochDomain::Guard guard(epochs_);
+    const Value* found = nullptr;
+    Attempt result;
+    while((result = attemptGet(key, &holder_, 1, holder_.getVersion(), &found)) == RETRY){
+    }
+    return result == FOUND;
+}
+
+/**
+* Whether the tree has no nodes; routing nodes count, so a tree whose keys
+* were all just removed may still report false until it is rebalanced.
+*/
+template<typename Key, typename Value>
+bool ConcurrentAVLTree<Key, Value>::empty() const
+{
+    return holder_.getRight() == nullptr;
+}
+
+template<typename Key, typename Value>
+typename ConcurrentAVLTree<Key, Value>::iterator
+ConcurrentAVLTree<Key, Value>::begin() const
+{
+    iterator it(this);
+    it.seek(nullptr);
+    return it;
+}
+
+template<typename Key, typename Value>
+typename ConcurrentAVLTree<Key, Value>::iterator
+ConcurrentAVLTree<Key, Value>::end() const
+{
+    return iterator(this);
+}
+
+template<typename Key, typename Value>
+int ConcurrentAVLTree<Key, Value>::compare(const Key& key, const Key& nodeKey)
+{
+    if(key < nodeKey) return -1;
+    if(nodeKey < key) return 1;
+    return 0;
+}
+
+template<typename Key, typename Value>
+int ConcurrentAVLTree<Key, Value>::height(const Link* node)
+{
+    return (node == nullptr) ? 0 : node->getHeight();
+}
+
+/**
+* One attempt at finding key below node, whose version was nodeVersion when
+* we stepped onto it. Returns RETRY if node has since shrunk, in which case
+* our caller must revalidate its own step before trying again.
+*/
+template<typename Key, typename Value>
+typename ConcurrentAVLTree<Key, Value>::Attempt
+ConcurrentAVLTree<Key, Value>::attemptGet(const Key& key, Link* node, int dirToChild,
+                                          std::uint64_t nodeVersion, const Value** value) const
+{
+    while(true){
+        NodeType* child = node->getChild(dirToChild);
+        if(child == nullptr){
+            if(node->getVersion() != nodeVersion){
+                return RETRY;
+            }
+            return NOT_FOUND;
+        }
+
+        int childCmp = compare(key, child->getKey());
+        if(childCmp == 0){
+            // Linearized at this read; removed and routing nodes have no value
+            *value = child->getValue();
+            return (*value != nullptr) ? FOUND : NOT_FOUND;
+        }
+
+        std::uint64_t childVersion = child->getVersion();
+        if(Link::isShrinkingOrUnlinked(childVersion)){
+            child->waitUntilNotShrinking();
+            if(node->getVersion() != nodeVersion){
+                return RETRY;
+            }
+        }
+        else if(child != node->getChild(dirToChild)){
+            // The child changed before we read its version
+            if(node->getVersion() != nodeVersion){
+                return RETRY;
+            }
+        }
+        else{
+            if(node->getVersion() != nodeVersion){
+                return RETRY;
+            }
+            // Both steps were valid at this point, so only child can shrink on us now
+            Attempt result = attemptGet(key, child, childCmp, childVersion, value);
+            if(result != RETRY){
+                return result;
+            }
+        }
+    }
+}
+
+/**
+* Like attemptGet(), but finds the node with the smallest key greater than
+* *key, or the smallest key of all if key is NULL. best is the last node we
+* went left at, which is the answer if we run out of tree.
+*/
+template<typename Key, typename Value>
+typename ConcurrentAVLTree<Key, Value>::Attempt
+ConcurrentAVLTree<Key, Value>::attemptHigher(const Key* key, Link* node, int dirToChild, std::uint64_t nodeVersion,
+                                             NodeType* best, NodeType** result) const
+{
+    while(true){
+        NodeType* child = node->getChild(dirToChild);
+        if(child == nullptr){
+            if(node->getVersion() != nodeVersion){
+                return RETRY;
+            }
+            *result = best;
+            return FOUND;
+        }
+
+        bool goLeft = (key == nullptr) || (*key < child->getKey());
+        std::uint64_t childVersion = child->getVersion();
+        if(Link::isShrinkingOrUnlinked(childVersion)){
+            child->waitUntilNotShrinking();
+            if(node->getVersion() != nodeVersion){
+                return RETRY;
+            }
+        }
+        else if(child != node->getChild(dirToChild)){
+            if(node->getVersion() != nodeVersion){
+                return RETRY;
+            }
+        }
+        else{
+            if(node->getVersion() != nodeVersion){
+                return RETRY;
+            }
+            Attempt attempt = attemptHigher(key, child, goLeft ? -1 : 1, childVersion,
+                                            goLeft ? child : best, result);
+            if(attempt != RETRY){
+                return attempt;
+            }
+        }
+    }
+}
+
+/**
+* Sets key to value, or removes it if value is NULL. The root is a child of
+* holder_ like any other node, but holder_ never shrinks so nothing above it
+* needs validating.
+*/
+template<typename Key, typename Value>
+typename ConcurrentAVLTree<Key, Value>::Attempt
+ConcurrentAVLTree<Key, Value>::update(const Key& key, const Value* value)
+{
+    while(true){
+        NodeType* root = holder_.getRight();
+        if(root == nullptr){
+            if(value == nullptr){
+                return DONE;
+            }
+            std::lock_guard<std::mutex> guard(holder_.lock);
+            if(holder_.getRight() == nullptr){
+                holder_.setRight(new NodeType(key, value, &holder_));
+                return DONE;
+            }
+        }
+        else{
+            std::uint64_t rootVersion = root->getVersion();
+            if(Link::isShrinkingOrUnlinked(rootVersion)){
+                root->waitUntilNotShrinking();
+            }
+            else if(root == holder_.getRight()){
+                Attempt result = attemptUpdate(key, value, &holder_, root, rootVersion);
+                if(result != RETRY){
+                    return result;
+                }
+            }
+        }
+    }
+}
+
+/**
+* One attempt at updating key below node, which we reached from parent and
+* whose version was nodeVersion then. A missing key is linked in as a new
+* leaf with only the would-be parent locked.
+*/
+template<typename Key, typename Value>
+typename ConcurrentAVLTree<Key, Value>::Attempt
+ConcurrentAVLTree<Key, Value>::attemptUpdate(const Key& key, const Value* value, Link* parent,
+                                             NodeType* node, std::uint64_t nodeVersion)
+{
+    int cmp = compare(key, node->getKey());
+    if(cmp == 0){
+        return attemptNodeUpdate(value, parent, node);
+    }
+
+    while(true){
+        NodeType* child = node->getChild(cmp);
+        if(node->getVersion() != nodeVersion){
+            return RETRY;
+        }
+
+        if(child == nullptr){
+            if(value == nullptr){
+                // Nothing to remove
+                return DONE;
+            }
+            Link* damaged = nullptr;
+            bool linked = false;
+            {
+                std::lock_guard<std::mutex> guard(node->lock);
+                // With the lock held no rotation can move node anymore
+                if(node->getVersion() != nodeVersion){
+                    return RETRY;
+                }
+                if(node->getChild(cmp) == nullptr){
+                    node->setChild(cmp, new NodeType(key, value, node));
+                    damaged = fixHeight_nl(node);
+                    linked = true;
+                }
+            }
+            if(linked){
+                fixHeightAndRebalance(damaged);
+                return DONE;
+            }
+            // Lost a race with another insert; look again
+        }
+        else{
+            std::uint64_t childVersion = child->getVersion();
+            if(Link::isShrinkingOrUnlinked(childVersion)){
+                child->waitUntilNotShrinking();
+            }
+            else if(child != node->getChild(cmp)){
+                // Read again, this time protected by childVersion
+            }
+            else{
+                if(node->getVersion() != nodeVersion){
+                    return RETRY;
+                }
+                Attempt result = attemptUpdate(key, value, node, child, childVersion);
+                if(result != RETRY){
+                    return result;
+                }
+            }
+        }
+    }
+}
+
+/**
+* Updates the node holding our key. Removing a node with at most one child
+* unlinks it, which needs its parent locked too; removing one with two
+* children just clears its value.
+*/
+template<typename Key, typename Value>
+typename ConcurrentAVLTree<Key, Value>::Attempt
+ConcurrentAVLTree<Key, Value>::attemptNodeUpdate(const Value* value, Link* parent, NodeType* node)
+{
+    if(value == nullptr && node->getValue() == nullptr){
+        // Already removed
+        return DONE;
+    }
+
+    if(value == nullptr && (node->getLeft() == nullptr || node->getRight() == nullptr)){
+        Link* damaged = nullptr;
+        const Value* previous = nullptr;
+        {
+            std::lock_guard<std::mutex> parentGuard(parent->lock);
+            if(Link::isUnlinked(parent->getVersion()) || node->getParent() != parent){
+                return RETRY;
+            }
+            {
+                std::lock_guard<std::mutex> nodeGuard(node->lock);
+                previous = node->getValue();
+                if(previous == nullptr){
+                    return DONE;
+                }
+                if(!attemptUnlink_nl(parent, node)){
+                    return RETRY;
+                }
+            }
+            damaged = fixHeight_nl(parent);
+        }
+        epochs_.retire(const_cast<Value*>(previous));
+        fixHeightAndRebalance(damaged);
+        return DONE;
+    }
+
+    const Value* previous = nullptr;
+    {
+        std::lock_guard<std::mutex> guard(node->lock);
+        if(Link::isUnlinked(node->getVersion())){
+            return RETRY;
+        }
+        // The node may have lost a child since we looked, and must be unlinked instead
+        if(value == nullptr && (node->getLeft() == nullptr || node->getRight() == nullptr)){
+            return RETRY;
+        }
+        previous = node->getValue();
+        node->setValue(value);
+    }
+    if(previous != nullptr){
+        epochs_.retire(const_cast<Value*>(previous));
+    }
+    return DONE;
+}
+
+/**
+* Splices out a node with at most one child and retires it.
+* parent and node must be locked.
+*/
+template<typename Key, typename Value>
+bool ConcurrentAVLTree<Key, Value>::attemptUnlink_nl(Link* parent, NodeType* node)
+{
+    NodeType* parentLeft = parent->getLeft();
+    NodeType* parentRight = parent->getRight();
+    if(parentLeft != node && parentRight != node){
+        // Node is no longer a child of parent
+        return false;
+    }
+
+    NodeType* left = node->getLeft();
+    NodeType* right = node->getRight();
+    if(left != nullptr && right != nullptr){
+        return false;
+    }
+    NodeType* splice = (left != nullptr) ? left : right;
+    if(parentLeft == node){
+        parent->setLeft(splice);
+    }
+    else{
+        parent->setRight(splice);
+    }
+    if(splice != nullptr){
+        splice->setParent(parent);
+    }
+
+    node->setVersion(Link::UNLINKED);
+    node->setValue(nullptr);
+    epochs_.retire(node);
+    return true;
+}
+
+/**
+* What node needs: UNLINK_REQUIRED for a routing node with at most one
+* child, REBALANCE_REQUIRED if it is out of balance, NOTHING_REQUIRED, or
+* else the height it should have. The reads are not atomic as a whole, but
+* whoever changes a node afterwards becomes responsible for fixing it.
+*/
+template<typename Key, typename Value>
+int ConcurrentAVLTree<Key, Value>::nodeCondition(Link* node)
+{
+    NodeType* nL = node->getLeft();
+    NodeType* nR = node->getRight();
+    if((nL == nullptr || nR == nullptr) && node->getValue() == nullptr){
+        return UNLINK_REQUIRED;
+    }
+
+    int hN = node->getHeight();
+    int hL0 = height(nL);
+    int hR0 = height(nR);
+    int hNRepl = 1 + std::max(hL0, hR0);
+    int bal = hL0 - hR0;
+    if(bal < -1 || bal > 1){
+        return REBALANCE_REQUIRED;
+    }
+    return (hN != hNRepl) ? hNRepl : NOTHING_REQUIRED;
+}
+
+/**
+* Repairs heights and balance from node up towards the root, locking one
+* node (or a parent and node, for a rotation) at a time. Stops as soon as a
+* node needs nothing, or at holder_, the only link without a parent.
+*
+* A rebalance may hand back a node below the one it was given, while the
+* node and its parent may still need work. Fixing the deeper node need not
+* reach them again, so they are kept and walked up from later.
+*/
+template<typename Key, typename Value>
+void ConcurrentAVLTree<Key, Value>::fixHeightAndRebalance(Link* node)
+{
+    std::vector<Link*> pending;
+    while(true){
+        if(node == nullptr || node->getParent() == nullptr){
+            if(pending.empty()){
+                return;
+            }
+            node = pending.back();
+            pending.pop_back();
+            continue;
+        }
+
+        int condition = nodeCondition(node);
+        if(condition == NOTHING_REQUIRED || Link::isUnlinked(node->getVersion())){
+            node = nullptr;
+        }
+        else if(condition != UNLINK_REQUIRED && condition != REBALANCE_REQUIRED){
+            std::lock_guard<std::mutex> guard(node->lock);
+            node = fixHeight_nl(node);
+        }
+        else{
+            Link* nParent = node->getParent();
+            std::lock_guard<std::mutex> parentGuard(nParent->lock);
+            if(!Link::isUnlinked(nParent->getVersion()) && node->getParent() == nParent){
+                std::lock_guard<std::mutex> nodeGuard(node->lock);
+                Link* next = rebalance_nl(nParent, static_cast<NodeType*>(node));
+                if(next != nullptr && next != nParent && next != nParent->getParent()){
+                    pending.push_back(nParent);
+                    if(next != node){
+                        pending.push_back(node);
+                    }
+                }
+                node = next;
+            }
+            // Otherwise try node again with its new parent
+        }
+    }
+}
+
+/**
+* Fixes node's height if that is all it needs. Returns the next link that
+* needs work: node itself if it needs more than a height fix, its parent
+* if its height changed, or NULL.
+*/
+template<typename Key, typename Value>
+typename ConcurrentAVLTree<Key, Value>::Link*
+ConcurrentAVLTree<Key, Value>::fixHeight_nl(Link* node)
+{
+    int condition = nodeCondition(node);
+    switch(condition){
+        case REBALANCE_REQUIRED:
+        case UNLINK_REQUIRED:
+            return node;
+        case NOTHING_REQUIRED:
+            return nullptr;
+        default:
+            node->setHeight(condition);
+            return node->getParent();
+    }
+}
+
+/**
+* Unlinks, rotates or fixes the height of n. nParent and n are locked.
+*/
+template<typename Key, typename Value>
+typename ConcurrentAVLTree<Key, Value>::Link*
+ConcurrentAVLTree<Key, Value>::rebalance_nl(Link* nParent, NodeType* n)
+{
+    NodeType* nL = n->getLeft();
+    NodeType* nR = n->getRight();
+    if((nL == nullptr || nR == nullptr) && n->getValue() == nullptr){
+        if(attemptUnlink_nl(nParent, n)){
+            return fixHeight_nl(nParent);
+        }
+        return n;
+    }
+
+    int hN = n->getHeight();
+    int hL0 = height(nL);
+    int hR0 = height(nR);
+    int hNRepl = 1 + std::max(hL0, hR0);
+    int bal = hL0 - hR0;
+    if(bal > 1){
+        return rebalanceToRight_nl(nParent, n, nL, hR0);
+    }
+    if(bal < -1){
+        return rebalanceToLeft_nl(nParent, n, nR, hL0);
+    }
+    if(hNRepl != hN){
+        n->setHeight(hNRepl);
+        return fixHeight_nl(nParent);
+    }
+    return nullptr;
+}
+
+/**
+* n is left heavy. Rotates right, or left-right if nL leans right. If a
+* double rotation would leave nL unbalanced (only possible while other
+* threads are still fixing the nodes below), nL is rotated on its own first
+* and n is left for a later pass.
+*/
+template<typename Key, typename Value>
+typename ConcurrentAVLTree<Key, Value>::Link*
+ConcurrentAVLTree<Key, Value>::rebalanceToRight_nl(Link* nParent, NodeType* n, NodeType* nL, int hR0)
+{
+    std::lock_guard<std::mutex> leftGuard(nL->lock);
+    int hL = nL->getHeight();
+    if(hL - hR0 <= 1){
+        return n;
+    }
+
+    NodeType* nLR = nL->getRight();
+    int hLL0 = height(nL->getLeft());
+    int hLR0 = height(nLR);
+    if(hLL0 >= hLR0){
+        return rotateRight_nl(nParent, n, nL, hR0, hLL0, nLR, hLR0);
+    }
+
+    {
+        std::lock_guard<std::mutex> innerGuard(nLR->lock);
+        int hLR = nLR->getHeight();
+        if(hLL0 >= hLR){
+            return rotateRight_nl(nParent, n, nL, hR0, hLL0, nLR, hLR);
+        }
+        int hLRL = height(nLR->getLeft());
+        int b = hLL0 - hLRL;
+        if(b >= -1 && b <= 1){
+            return rotateRightOverLeft_nl(nParent, n, nL, hR0, hLL0, nLR, hLRL);
+        }
+    }
+    return rebalanceToLeft_nl(n, nL, nLR, hLL0);
+}
+
+/**
+* Mirror image of rebalanceToRight_nl().
+*/
+template<typename Key, typename Value>
+typename ConcurrentAVLTree<Key, Value>::Link*
+ConcurrentAVLTree<Key, Value>::rebalanceToLeft_nl(Link* nParent, NodeType* n, NodeType* nR, int hL0)
+{
+    std::lock_guard<std::mutex> rightGuard(nR->lock);
+    int hR = nR->getHeight();
+    if(hL0 - hR >= -1){
+        return n;
+    }
+
+    NodeType* nRL = nR->getLeft();
+    int hRL0 = height(nRL);
+    int hRR0 = height(nR->getRight());
+    if(hRR0 >= hRL0){
+        return rotateLeft_nl(nParent, n, nR, hL0, hRR0, nRL, hRL0);
+    }
+
+    {
+        std::lock_guard<std::mutex> innerGuard(nRL->lock);
+        int hRL = nRL->getHeight();
+        if(hRR0 >= hRL){
+            return rotateLeft_nl(nParent, n, nR, hL0, hRR0, nRL, hRL);
+        }
+        int hRLR = height(nRL->getRight());
+        int b = hRR0 - hRLR;
+        if(b >= -1 && b <= 1){
+            return rotateLeftOverRight_nl(nParent, n, nR, hL0, hRR0, nRL, hRLR);
+        }
+    }
+    return rebalanceToRight_nl(n, nR, nRL, hRR0);
+}
+
+/**
+* Rotates nL up over n. n's key range shrinks, so its version is marked
+* while the links change. Returns whichever of the damaged nodes still
+* needs work, deepest first.
+*/
+template<typename Key, typename Value>
+typename ConcurrentAVLTree<Key, Value>::Link*
+ConcurrentAVLTree<Key, Value>::rotateRight_nl(Link* nParent, NodeType* n, NodeType* nL,
+                                              int hR, int hLL, NodeType* nLR, int hLR)
+{
+    std::uint64_t nodeVersion = n->getVersion();
+    NodeType* nPL = nParent->getLeft();
+
+    n->setVersion(nodeVersion | Link::SHRINKING);
+    n->setLeft(nLR);
+    if(nLR != nullptr){
+        nLR->setParent(n);
+    }
+    nL->setRight(n);
+    n->setParent(nL);
+    if(nPL == n){
+        nParent->setLeft(nL);
+    }
+    else{
+        nParent->setRight(nL);
+    }
+    nL->setParent(nParent);
+
+    int hNRepl = 1 + std::max(hLR, hR);
+    n->setHeight(hNRepl);
+    nL->setHeight(1 + std::max(hLL, hNRepl));
+    n->setVersion(nodeVersion + Link::SHRINK_INCREMENT);
+
+    int balN = hLR - hR;
+    if(balN < -1 || balN > 1){
+        return n;
+    }
+    if((nLR == nullptr || hR == 0) && n->getValue() == nullptr){
+        return n;
+    }
+    int balL = hLL - hNRepl;
+    if(balL < -1 || balL > 1){
+        return nL;
+    }
+    if(hLL == 0 && nL->getValue() == nullptr){
+        return nL;
+    }
+    return fixHeight_nl(nParent);
+}
+
+/**
+* Mirror image of rotateRight_nl().
+*/
+template<typename Key, typename Value>
+typename ConcurrentAVLTree<Key, Value>::Link*
+ConcurrentAVLTree<Key, Value>::rotateLeft_nl(Link* nParent, NodeType* n, NodeType* nR,
+                                             int hL, int hRR, NodeType* nRL, int hRL)
+{
+    std::uint64_t nodeVersion = n->getVersion();
+    NodeType* nPL = nParent->getLeft();
+
+    n->setVersion(nodeVersion | Link::SHRINKING);
+    n->setRight(nRL);
+    if(nRL != nullptr){
+        nRL->setParent(n);
+    }
+    nR->setLeft(n);
+    n->setParent(nR);
+    if(nPL == n){
+        nParent->setLeft(nR);
+    }
+    else{
+        nParent->setRight(nR);
+    }
+    nR->setParent(nParent);
+
+    int hNRepl = 1 + std::max(hL, hRL);
+    n->setHeight(hNRepl);
+    nR->setHeight(1 + std::max(hNRepl, hRR));
+    n->setVersion(nodeVersion + Link::SHRINK_INCREMENT);
+
+    int balN = hRL - hL;
+    if(balN < -1 || balN > 1){
+        return n;
+    }
+    if((nRL == nullptr || hL == 0) && n->getValue() == nullptr){
+        return n;
+    }
+    int balR = hRR - hNRepl;
+    if(balR < -1 || balR > 1){
+        return nR;
+    }
+    if(hRR == 0 && nR->getValue() == nullptr){
+        return nR;
+    }
+    return fixHeight_nl(nParent);
+}
+
+/**
+* Rotates nLR up over both nL and n, shrinking both of them.
+*/
+template<typename Key, typename Value>
+typename ConcurrentAVLTree<Key, Value>::Link*
+ConcurrentAVLTree<Key, Value>::rotateRightOverLeft_nl(Link* nParent, NodeType* n, NodeType* nL,
+                                                      int hR, int hLL, NodeType* nLR, int hLRL)
+{
+    std::uint64_t nodeVersion = n->getVersion();
+    std::uint64_t leftVersion = nL->getVersion();
+    NodeType* nPL = nParent->getLeft();
+    NodeType* nLRL = nLR->getLeft();
+    NodeType* nLRR = nLR->getRight();
+    int hLRR = height(nLRR);
+
+    n->setVersion(nodeVersion | Link::SHRINKING);
+    nL->setVersion(leftVersion | Link::SHRINKING);
+
+    n->setLeft(nLRR);
+    if(nLRR != nullptr){
+        nLRR->setParent(n);
+    }
+    nL->setRight(nLRL);
+    if(nLRL != nullptr){
+        nLRL->setParent(nL);
+    }
+    nLR->setLeft(nL);
+    nL->setParent(nLR);
+    nLR->setRight(n);
+    n->setParent(nLR);
+    if(nPL == n){
+        nParent->setLeft(nLR);
+    }
+    else{
+        nParent->setRight(nLR);
+    }
+    nLR->setParent(nParent);
+
+    int hNRepl = 1 + std::max(hLRR, hR);
+    n->setHeight(hNRepl);
+    int hLRepl = 1 + std::max(hLL, hLRL);
+    nL->setHeight(hLRepl);
+    nLR->setHeight(1 + std::max(hLRepl, hNRepl));
+
+    n->setVersion(nodeVersion + Link::SHRINK_INCREMENT);
+    nL->setVersion(leftVersion + Link::SHRINK_INCREMENT);
+
+    int balN = hLRR - hR;
+    if(balN < -1 || balN > 1){
+        return n;
+    }
+    if((nLRR == nullptr || hR == 0) && n->getValue() == nullptr){
+        return n;
+    }
+    if((nLRL == nullptr || hLL == 0) && nL->getValue() == nullptr){
+        return nL;
+    }
+    int balLR = hLRepl - hNRepl;
+    if(balLR < -1 || balLR > 1){
+        return nLR;
+    }
+    return fixHeight_nl(nParent);
+}
+
+/**
+* Mirror image of rotateRightOverLeft_nl().
+*/
+template<typename Key, typename Value>
+typename ConcurrentAVLTree<Key, Value>::Link*
+ConcurrentAVLTree<Key, Value>::rotateLeftOverRight_nl(Link* nParent, NodeType* n, NodeType* nR,
+                                                      int hL, int hRR, NodeType* nRL, int hRLR)
+{
+    std::uint64_t nodeVersion = n->getVersion();
+    std::uint64_t rightVersion = nR->getVersion();
+    NodeType* nPL = nParent->getLeft();
+    NodeType* nRLL = nRL->getLeft();
+    NodeType* nRLR = nRL->getRight();
+    int hRLL = height(nRLL);
+
+    n->setVersion(nodeVersion | Link::SHRINKING);
+    nR->setVersion(rightVersion | Link::SHRINKING);
+
+    n->setRight(nRLL);
+    if(nRLL != nullptr){
+        nRLL->setParent(n);
+    }
+    nR->setLeft(nRLR);
+    if(nRLR != nullptr){
+        nRLR->setParent(nR);
+    }
+    nRL->setRight(nR);
+    nR->setParent(nRL);
+    nRL->setLeft(n);
+    n->setParent(nRL);
+    if(nPL == n){
+        nParent->setLeft(nRL);
+    }
+    else{
+        nParent->setRight(nRL);
+    }
+    nRL->setParent(nParent);
+
+    int hNRepl = 1 + std::max(hL, hRLL);
+    n->setHeight(hNRepl);
+    int hRRepl = 1 + std::max(hRLR, hRR);
+    nR->setHeight(hRRepl);
+    nRL->setHeight(1 + std::max(hNRepl, hRRepl));
+
+    n->setVersion(nodeVersion + Link::SHRINK_INCREMENT);
+    nR->setVersion(rightVersion + Link::SHRINK_INCREMENT);
+
+    int balN = hRLL - hL;
+    if(balN < -1 || balN > 1){
+        return n;
+    }
+    if((nRLL == nullptr || hL == 0) && n->getValue() == nullptr){
+        return n;
+    }
+    if((nRLR == nullptr || hRR == 0) && nR->getValue() == nullptr){
+        return nR;
+    }
+    int balRL = hRRepl - hNRepl;
+    if(balRL < -1 || balRL > 1){
+        return nRL;
+    }
+    return fixHeight_nl(nParent);
+}
+
+template<typename Key, typename Value>
+void ConcurrentAVLTree<Key, Value>::deleteSubtree(NodeType* node)
+{
+    if(node == nullptr){
+        return;
+    }
+    deleteSubtree(node->getLeft());
+    deleteSubtree(node->getRight());
+    delete node->getValue();
+    delete node;
+}
+
+/*
+  ---------------------------------------------------
+  End implementations for the ConcurrentAVLTree class.
+  ---------------------------------------------------
+*/
+
+#endif
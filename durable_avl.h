@@ -0,0 +1,770 @@
+#ifndef DURABLE_AVL_H
+#define DURABLE_AVL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <exception>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include "avlbst.h"
+#include "snapshot.h"
+#include "bulk_build.h"
+
+const unsigned char MUTATION_LOG_MAGIC[4] = { 'A', 'V', 'L', 'L' };
+const unsigned MUTATION_LOG_VERSION = 1;
+
+/**
+* An AVLTree that survives restarts. Every insert() and remove() is applied
+* to the tree and appended to a log file; the log is written and fsynced a
+* batch of operations at a time, or whenever sync() is called, so a crash
+* loses at most the operations since the last batch.
+*
+* The directory holds numbered files. snapshot.N is a snapshot in the
+* format of AVLTree::save() of everything logged before log.N, and the
+* logs from N on hold what came after. Once the current log passes a size
+* limit, a new log is started and a background thread folds the older
+* logs into a new snapshot. It works only from the files (the old
+* snapshot streamed in key order, merged with the net effect of the logs),
+* so it never touches or locks the tree. Opening the directory loads the
+* newest snapshot and replays only the logs after it.
+*
+* Read through tree(). Like AVLTree, a DurableAVLTree is not safe to use
+* from several threads at once.
+*/
+template <typename Key, typename Value,
+          typename KeyCodec = SnapshotCodec<Key>, typename ValueCodec = SnapshotCodec<Value> >
+class DurableAVLTree
+{
+public:
+    explicit DurableAVLTree(const std::string& directory, size_t syncEvery = 64,
+                            size_t compactBytes = 64 << 20);
+    ~DurableAVLTree();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    // Writes and fsyncs the operations not yet in the log
+    void sync();
+    // Starts a new log and waits until everything before it is in a snapshot
+    void compact();
+
+    const AVLTree<Key, Value>& tree() const;
+    // The operations replayed from logs when the directory was opened
+    size_t replayed() const;
+
+    // Deletes a closed tree's directory and the files it wrote there
+    static void destroy(const std::string& directory);
+
+protected:
+    enum Operation { OP_INSERT = 1, OP_REMOVE = 2 };
+
+    // Applies logged operations to the tree
+    struct TreeReplay
+    {
+        explicit TreeReplay(AVLTree<Key, Value>* tree) : tree_(tree), count_(0) { }
+        void insert(const Key& key, const Value& value);
+        void remove(const Key& key);
+        AVLTree<Key, Value>* tree_;
+        size_t count_;
+    };
+
+    // Collects the net effect of logged operations on each key: its last
+    // value, or no value if it was last removed
+    struct NetChanges
+    {
+        void insert(const Key& key, const Value& value);
+        void remove(const Key& key);
+        std::map<Key, std::pair<bool, Value> > changes_;
+    };
+
+    std::string pathOf(const char* kind, std::uint64_t generation) const;
+    void recover();
+    void openLog(std::uint64_t generation);
+    void commitBatch();
+    void rotate();
+    void compactLoop();
+    void compactTo(std::uint64_t target);
+    void writeMerged(std::uint64_t snapshotGeneration, NetChanges& changes, std::uint64_t target);
+    void syncDirectory();
+
+    template<typename Apply>
+    static void readLog(const std::string& path, Apply& apply);
+    static std::uint32_t checksum(const std::string& bytes);
+    static void writeAll(int fd, const void* data, size_t size);
+
+    std::string directory_;
+    size_t syncEvery_;
+    size_t compactBytes_;
+    AVLTree<Key, Value> tree_;
+    size_t replayed_;
+
+    // The log being appended to, and the batch not yet written to it
+    int logFd_;
+    std::uint64_t logGeneration_;
+    size_t logBytes_;
+    std::ostringstream batch_;
+    SnapshotWriter batchWriter_;
+    size_t batchOps_;
+
+    // Shared with the compaction thread
+    std::mutex lock_;
+    std::condition_variable changed_;
+    std::uint64_t snapshotGeneration_;
+    std::uint64_t compactTarget_;
+    std::exception_ptr compactError_;
+    bool stopping_;
+    std::thread compactor_;
+
+private:
+    DurableAVLTree(const DurableAVLTree&);
+    DurableAVLTree& operator=(const DurableAVLTree&);
+};
+
+/*
+  ------------------------------------------------
+  Begin implementations for the DurableAVLTree class.
+  ------------------------------------------------
+*/
+
+/**
+* Opens directory, creating it if need be, and recovers the tree from it.
+* A batch is written every syncEvery operations, and the log is handed to
+* compaction once it grows past compactBytes.
+*/
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+DurableAVLTree<Key, Value, KeyCodec, ValueCodec>::DurableAVLTree(const std::string& directory,
+    size_t syncEvery, size_t compactBytes) :
+    directory_(directory),
+    syncEvery_(std::max<size_t>(syncEvery, 1)),
+    compactBytes_(compactBytes),
+    replayed_(0),
+    logFd_(-1),
+    logGeneration_(0),
+    logBytes_(0),
+    batchWriter_(batch_),
+    batchOps_(0),
+    snapshotGeneration_(0),
+    compactTarget_(0),
+    stopping_(false)
+{
+    if(::mkdir(directory_.c_str(), 0755) != 0 && errno != EEXIST){
+        throw std::runtime_error("Cannot create " + directory_ + ": " + std::strerror(errno));
+    }
+    recover();
+    compactor_ = std::thread(&DurableAVLTree::compactLoop, this);
+}
+
+/**
+* Writes out the last batch and lets a running compaction finish.
+*/
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+DurableAVLTree<Key, Value, KeyCodec, ValueCodec>::~DurableAVLTree()
+{
+    try{
+        commitBatch();
+    }
+    catch(...){
+        // Nothing to report to from a destructor; the batch is lost as in a crash
+    }
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        stopping_ = true;
+    }
+    changed_.notify_all();
+    compactor_.join();
+    ::close(logFd_);
+}
+
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+void DurableAVLTree<Key, Value, KeyCodec, ValueCodec>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    tree_.insert(keyValuePair);
+    batchWriter_.writeByte(OP_INSERT);
+    KeyCodec::write(batchWriter_, keyValuePair.first, nullptr);
+    ValueCodec::write(batchWriter_, keyValuePair.second, nullptr);
+    if(++batchOps_ >= syncEvery_){
+        commitBatch();
+    }
+}
+
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+void DurableAVLTree<Key, Value, KeyCodec, ValueCodec>::remove(const Key& key)
+{
+    tree_.remove(key);
+    batchWriter_.writeByte(OP_REMOVE);
+    KeyCodec::write(batchWriter_, key, nullptr);
+    if(++batchOps_ >= syncEvery_){
+        commitBatch();
+    }
+}
+
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+void DurableAVLTree<Key, Value, KeyCodec, ValueCodec>::sync()
+{
+    commitBatch();
+}
+
+/**
+* Throws whatever stopped the compaction, if it failed. The files it was
+* working from are left in place, so nothing is lost.
+*/
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+void DurableAVLTree<Key, Value, KeyCodec, ValueCodec>::compact()
+{
+    commitBatch();
+    rotate();
+    std::unique_lock<std::mutex> guard(lock_);
+    std::uint64_t target = compactTarget_;
+    changed_.wait(guard, [&]{ return snapshotGeneration_ >= target || compactError_; });
+    if(compactError_){
+        std::exception_ptr error = compactError_;
+        compactError_ = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+const AVLTree<Key, Value>& DurableAVLTree<Key, Value, KeyCodec, ValueCodec>::tree() const
+{
+    return tree_;
+}
+
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+size_t DurableAVLTree<Key, Value, KeyCodec, ValueCodec>::replayed() const
+{
+    return replayed_;
+}
+
+/**
+* Unlinks the snapshots, logs and leftover temporary files in directory,
+* then the directory itself. Anything else in it is left alone, so the
+* directory is only removed if the tree's files were all there was. A
+* directory that does not exist is not an error.
+*/
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+void DurableAVLTree<Key, Value, KeyCodec, ValueCodec>::destroy(const std::string& directory)
+{
+    DIR* dir = ::opendir(directory.c_str());
+    if(dir == nullptr){
+        if(errno == ENOENT){
+            return;
+        }
+        throw std::runtime_error("Cannot read " + directory + ": " + std::strerror(errno));
+    }
+    std::vector<std::string> names;
+    while(struct dirent* entry = ::readdir(dir)){
+        std::string name = entry->d_name;
+        bool temporary = name.size() > 4 && name.compare(name.size() - 4, 4, ".tmp") == 0;
+        if(temporary || name.compare(0, 9, "snapshot.") == 0 || name.compare(0, 4, "log.") == 0){
+            names.push_back(name);
+        }
+    }
+    ::closedir(dir);
+    for(size_t i = 0; i < names.size(); i++){
+        if(::unlink((directory + "/" + names[i]).c_str()) != 0 && errno != ENOENT){
+            throw std::runtime_error("Cannot remove " + names[i] + " in " + directory + ": " + std::strerror(errno));
+        }
+    }
+    if(::rmdir(directory.c_str()) != 0 && errno != ENOENT){
+        throw std::runtime_error("Cannot remove " + directory + ": " + std::strerror(errno));
+    }
+}
+
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+void DurableAVLTree<Key, Value, KeyCodec, ValueCodec>::TreeReplay::insert(const Key& key, const Value& value)
+{
+    tree_->insert(std::make_pair(key, value));
+    count_++;
+}
+
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+void DurableAVLTree<Key, Value, KeyCodec, ValueCodec>::TreeReplay::remove(const Key& key)
+{
+    tree_->remove(key);
+    count_++;
+}
+
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+void DurableAVLTree<Key, Value, KeyCodec, ValueCodec>::NetChanges::insert(const Key& key, const Value& value)
+{
+    changes_[key] = std::make_pair(true, value);
+}
+
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+void DurableAVLTree<Key, Value, KeyCodec, ValueCodec>::NetChanges::remove(const Key& key)
+{
+    changes_[key] = std::make_pair(false, Value());
+}
+
+/**
+* Zero padded, so that the names sort in generation order.
+*/
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+std::string DurableAVLTree<Key, Value, KeyCodec, ValueCodec>::pathOf(const char* kind, std::uint64_t generation) const
+{
+    char number[32];
+    std::snprintf(number, sizeof(number), ".%020llu", static_cast<unsigned long long>(generation));
+    return directory_ + "/" + kind + number;
+}
+
+/**
+* Loads the newest snapshot, replays every log from its generation on, and
+* removes files that a finished compaction left behind. Appending starts
+* in a fresh log, and if any log was replayed, compaction is asked to fold
+* it in.
+*/
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+void DurableAVLTree<Key, Value, KeyCodec, ValueCodec>::recover()
+{
+    std::vector<std::uint64_t> snapshots;
+    std::vector<std::uint64_t> logs;
+    DIR* dir = ::opendir(directory_.c_str());
+    if(dir == nullptr){
+        throw std::runtime_error("Cannot read " + directory_ + ": " + std::strerror(errno));
+    }
+    while(struct dirent* entry = ::readdir(dir)){
+        std::string name = entry->d_name;
+        if(name.size() > 4 && name.compare(name.size() - 4, 4, ".tmp") == 0){
+            // A compaction that never finished
+            ::unlink((directory_ + "/" + name).c_str());
+        }
+        else if(name.compare(0, 9, "snapshot.") == 0){
+            snapshots.push_back(std::strtoull(name.c_str() + 9, nullptr, 10));
+        }
+        else if(name.compare(0, 4, "log.") == 0){
+            logs.push_back(std::strtoull(name.c_str() + 4, nullptr, 10));
+        }
+    }
+    ::closedir(dir);
+    std::sort(snapshots.begin(), snapshots.end());
+    std::sort(logs.begin(), logs.end());
+
+    if(!snapshots.empty()){
+        snapshotGeneration_ = snapshots.back();
+        int fd = ::open(pathOf("snapshot", snapshotGeneration_).c_str(), O_RDONLY);
+        if(fd < 0){
+            throw std::runtime_error("Cannot open snapshot in " + directory_ + ": " + std::strerror(errno));
+        }
+        try{
+            tree_.template load<KeyCodec, ValueCodec>(fd);
+        }
+        catch(...){
+            ::close(fd);
+            throw;
+        }
+        ::close(fd);
+        for(size_t i = 0; i + 1 < snapshots.size(); i++){
+            ::unlink(pathOf("snapshot", snapshots[i]).c_str());
+        }
+    }
+
+    TreeReplay replay(&tree_);
+    std::uint64_t next = snapshotGeneration_;
+    bool replayedLog = false;
+    for(size_t i = 0; i < logs.size(); i++){
+        if(logs[i] < snapshotGeneration_){
+            ::unlink(pathOf("log", logs[i]).c_str());
+            continue;
+        }
+        readLog(pathOf("log", logs[i]), replay);
+        replayedLog = true;
+        next = logs[i] + 1;
+    }
+    replayed_ = replay.count_;
+
+    openLog(next);
+    if(replayedLog){
+        compactTarget_ = next;
+    }
+}
+
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+void DurableAVLTree<Key, Value, KeyCodec, ValueCodec>::openLog(std::uint64_t generation)
+{
+    std::string path = pathOf("log", generation);
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if(fd < 0){
+        throw std::runtime_error("Cannot create " + path + ": " + std::strerror(errno));
+    }
+    unsigned char header[sizeof(MUTATION_LOG_MAGIC) + 1];
+    std::memcpy(header, MUTATION_LOG_MAGIC, sizeof(MUTATION_LOG_MAGIC));
+    header[sizeof(MUTATION_LOG_MAGIC)] = static_cast<unsigned char>(MUTATION_LOG_VERSION);
+    try{
+        writeAll(fd, header, sizeof(header));
+        ::fdatasync(fd);
+    }
+    catch(...){
+        ::close(fd);
+        throw;
+    }
+    if(logFd_ >= 0){
+        ::close(logFd_);
+    }
+    logFd_ = fd;
+    logGeneration_ = generation;
+    logBytes_ = sizeof(header);
+    syncDirectory();
+}
+
+/**
+* Writes the batch as one frame, its length, the operations and a
+* checksum, and fsyncs it. A frame cut short by a crash fails its checksum
+* and is dropped on recovery along with anything after it.
+*/
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+void DurableAVLTree<Key, Value, KeyCodec, ValueCodec>::commitBatch()
+{
+    if(batchOps_ == 0){
+        return;
+    }
+    batchWriter_.flush();
+    std::string operations = batch_.str();
+    batch_.str(std::string());
+
+    std::ostringstream frame;
+    SnapshotWriter frameWriter(frame);
+    frameWriter.writeVarint(batchOps_);
+    frameWriter.writeBytes(operations.data(), operations.size());
+    frameWriter.flush();
+    std::string payload = frame.str();
+
+    std::ostringstream record;
+    SnapshotWriter recordWriter(record);
+    recordWriter.writeVarint(payload.size());
+    recordWriter.writeBytes(payload.data(), payload.size());
+    std::uint32_t sum = checksum(payload);
+    recordWriter.writeBytes(&sum, sizeof(sum));
+    recordWriter.flush();
+    std::string bytes = record.str();
+
+    batchOps_ = 0;
+    writeAll(logFd_, bytes.data(), bytes.size());
+    if(::fdatasync(logFd_) != 0){
+        throw std::runtime_error(std::string("Cannot sync the mutation log: ") + std::strerror(errno));
+    }
+    logBytes_ += bytes.size();
+    if(logBytes_ >= compactBytes_){
+        rotate();
+    }
+}
+
+/**
+* Starts the next log and hands everything before it to compaction.
+*/
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+void DurableAVLTree<Key, Value, KeyCodec, ValueCodec>::rotate()
+{
+    openLog(logGeneration_ + 1);
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        compactTarget_ = logGeneration_;
+    }
+    changed_.notify_all();
+}
+
+/**
+* The compaction thread: waits for a target newer than the snapshot and
+* compacts up to it. On failure it records the error and waits for the
+* next target, leaving the files as they were.
+*/
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+void DurableAVLTree<Key, Value, KeyCodec, ValueCodec>::compactLoop()
+{
+    std::unique_lock<std::mutex> guard(lock_);
+    std::uint64_t failedAt = 0;
+    while(true){
+        changed_.wait(guard, [&]{
+            return stopping_ || (compactTarget_ > snapshotGeneration_ && compactTarget_ != failedAt);
+        });
+        if(stopping_){
+            return;
+        }
+        std::uint64_t target = compactTarget_;
+        guard.unlock();
+        std::exception_ptr error;
+        try{
+            compactTo(target);
+        }
+        catch(...){
+            error = std::current_exception();
+        }
+        guard.lock();
+        if(error){
+            compactError_ = error;
+            failedAt = target;
+        }
+        else{
+            snapshotGeneration_ = target;
+        }
+        changed_.notify_all();
+    }
+}
+
+/**
+* Builds snapshot.target out of the current snapshot and the logs before
+* target, then removes them. The new snapshot is written under a
+* temporary name and renamed into place, so a crash part way leaves the
+* old files to recover from.
+*/
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+void DurableAVLTree<Key, Value, KeyCodec, ValueCodec>::compactTo(std::uint64_t target)
+{
+    std::uint64_t from;
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        from = snapshotGeneration_;
+    }
+    NetChanges changes;
+    for(std::uint64_t generation = from; generation < target; generation++){
+        std::string path = pathOf("log", generation);
+        if(::access(path.c_str(), F_OK) == 0){
+            readLog(path, changes);
+        }
+    }
+    writeMerged(from, changes, target);
+    ::unlink(pathOf("snapshot", from).c_str());
+    for(std::uint64_t generation = from; generation < target; generation++){
+        ::unlink(pathOf("log", generation).c_str());
+    }
+}
+
+/**
+* Streams the snapshot of generation from, if there is one, in key order
+* alongside the changes, which are also in key order, and writes the
+* merge as snapshot.target.
+*/
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+void DurableAVLTree<Key, Value, KeyCodec, ValueCodec>::writeMerged(std::uint64_t from,
+    NetChanges& changes, std::uint64_t target)
+{
+    typedef SnapshotPairIterator<Key, Value, KeyCodec, ValueCodec> PairIterator;
+
+    int inFd = ::open(pathOf("snapshot", from).c_str(), O_RDONLY);
+    std::string tempPath = pathOf("snapshot", target) + ".tmp";
+    int outFd = ::open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(outFd < 0){
+        if(inFd >= 0){
+            ::close(inFd);
+        }
+        throw std::runtime_error("Cannot create " + tempPath + ": " + std::strerror(errno));
+    }
+    try{
+        std::unique_ptr<SnapshotReader> in;
+        size_t count = 0;
+        if(inFd >= 0){
+            in.reset(new SnapshotReader(inFd, 0));
+            unsigned char magic[sizeof(SNAPSHOT_MAGIC)];
+            in->readBytes(magic, sizeof(magic));
+            if(std::memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) != 0 || in->readVarint() != SNAPSHOT_VERSION){
+                throw std::runtime_error("Not a tree snapshot");
+            }
+            count = static_cast<size_t>(in->readVarint());
+        }
+        PairIterator old(in.get(), count);
+        PairIterator oldEnd;
+
+        SnapshotWriter out(outFd);
+        out.writeBytes(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+        out.writeVarint(SNAPSHOT_VERSION);
+        out.writePaddedVarint(0);
+        size_t written = 0;
+        Key previous = Key();
+        typename std::map<Key, std::pair<bool, Value> >::const_iterator change = changes.changes_.begin();
+        while(old != oldEnd || change != changes.changes_.end()){
+            const Key* key;
+            const Value* value;
+            bool fromLog = old == oldEnd || (change != changes.changes_.end() && !(old->first < change->first));
+            if(fromLog){
+                // A logged change replaces the snapshot's pair for its key
+                if(old != oldEnd && !(change->first < old->first)){
+                    ++old;
+                }
+                key = &change->first;
+                value = change->second.first ? &change->second.second : nullptr;
+                ++change;
+            }
+            else{
+                key = &old->first;
+                value = &old->second;
+            }
+            if(value != nullptr){
+                KeyCodec::write(out, *key, written > 0 ? &previous : nullptr);
+                ValueCodec::write(out, *value, nullptr);
+                previous = *key;
+                written++;
+            }
+            if(!fromLog){
+                ++old;
+            }
+        }
+        out.flush();
+
+        unsigned char padded[SnapshotWriter::PADDED_VARINT_SIZE];
+        SnapshotWriter::encodePaddedVarint(written, padded);
+        off_t offset = sizeof(SNAPSHOT_MAGIC) + 1;
+        if(::pwrite(outFd, padded, sizeof(padded), offset) != static_cast<ssize_t>(sizeof(padded))
+            || ::fsync(outFd) != 0){
+            throw std::runtime_error("Cannot write " + tempPath + ": " + std::strerror(errno));
+        }
+    }
+    catch(...){
+        if(inFd >= 0){
+            ::close(inFd);
+        }
+        ::close(outFd);
+        ::unlink(tempPath.c_str());
+        throw;
+    }
+    if(inFd >= 0){
+        ::close(inFd);
+    }
+    ::close(outFd);
+    if(::rename(tempPath.c_str(), pathOf("snapshot", target).c_str()) != 0){
+        ::unlink(tempPath.c_str());
+        throw std::runtime_error("Cannot rename " + tempPath + ": " + std::strerror(errno));
+    }
+    syncDirectory();
+}
+
+/**
+* Makes file creations and renames in the directory durable.
+*/
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+void DurableAVLTree<Key, Value, KeyCodec, ValueCodec>::syncDirectory()
+{
+    int fd = ::open(directory_.c_str(), O_RDONLY);
+    if(fd >= 0){
+        ::fsync(fd);
+        ::close(fd);
+    }
+}
+
+/**
+* Replays the log at path into apply, frame by frame, stopping at the
+* first frame that is cut short or fails its checksum. Only the last
+* frame of a log can be torn, since a crash ends the log.
+*/
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+template<typename Apply>
+void DurableAVLTree<Key, Value, KeyCodec, ValueCodec>::readLog(const std::string& path, Apply& apply)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    struct stat info;
+    if(fd < 0 || ::fstat(fd, &info) != 0){
+        int error = errno;
+        if(fd >= 0){
+            ::close(fd);
+        }
+        throw std::runtime_error("Cannot open " + path + ": " + std::strerror(error));
+    }
+    SnapshotReader frames(fd);
+    unsigned char header[sizeof(MUTATION_LOG_MAGIC) + 1];
+    try{
+        frames.readBytes(header, sizeof(header));
+    }
+    catch(std::runtime_error&){
+        // A log cut short in its header holds no operations
+        ::close(fd);
+        return;
+    }
+    if(std::memcmp(header, MUTATION_LOG_MAGIC, sizeof(MUTATION_LOG_MAGIC)) != 0
+        || header[sizeof(MUTATION_LOG_MAGIC)] != MUTATION_LOG_VERSION){
+        ::close(fd);
+        throw std::runtime_error("Not a mutation log: " + path);
+    }
+    try{
+        while(true){
+            std::string payload;
+            try{
+                std::uint64_t length = frames.readVarint();
+                if(length > static_cast<std::uint64_t>(info.st_size)){
+                    break;
+                }
+                payload.resize(static_cast<size_t>(length));
+                frames.readBytes(&payload[0], payload.size());
+                std::uint32_t sum;
+                frames.readBytes(&sum, sizeof(sum));
+                if(sum != checksum(payload)){
+                    break;
+                }
+            }
+            catch(std::runtime_error&){
+                break;
+            }
+
+            std::istringstream operations(payload);
+            SnapshotReader in(operations);
+            std::uint64_t count = in.readVarint();
+            for(std::uint64_t i = 0; i < count; i++){
+                unsigned char op = in.readByte();
+                Key key = KeyCodec::read(in, nullptr);
+                if(op == OP_INSERT){
+                    apply.insert(key, ValueCodec::read(in, nullptr));
+                }
+                else{
+                    apply.remove(key);
+                }
+            }
+        }
+    }
+    catch(...){
+        ::close(fd);
+        throw;
+    }
+    ::close(fd);
+}
+
+/**
+* 32-bit FNV-1a.
+*/
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+std::uint32_t DurableAVLTree<Key, Value, KeyCodec, ValueCodec>::checksum(const std::string& bytes)
+{
+    std::uint32_t hash = 2166136261u;
+    for(size_t i = 0; i < bytes.size(); i++){
+        hash = (hash ^ static_cast<unsigned char>(bytes[i])) * 16777619u;
+    }
+    return hash;
+}
+
+template<typename Key, typename Value, typename KeyCodec, typename ValueCodec>
+void DurableAVLTree<Key, Value, KeyCodec, ValueCodec>::writeAll(int fd, const void* data, size_t size)
+{
+    const char* bytes = static_cast<const char*>(data);
+    while(size > 0){
+        ssize_t written = ::write(fd, bytes, size);
+        if(written < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            throw std::runtime_error(std::string("Cannot write the mutation log: ") + std::strerror(errno));
+        }
+        bytes += written;
+        size -= static_cast<size_t>(written);
+    }
+}
+
+/*
+  ----------------------------------------------
+  End implementations for the DurableAVLTree class.
+  ----------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,203 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+/**
+* Epoch-based memory reclamation for structures that readers traverse
+* without locks.
+*
+* A thread holds a Guard for as long as it may touch shared nodes. An object
+* that has been unlinked is retire()d instead of deleted, and it is only
+* reclaimed once every guard that was active when it was retired is gone.
+*
+* Readers are counted per epoch in cache-line sized stripes, so entering a
+* guard never writes to a line shared by every thread. Only the three most
+* recent epochs can have readers, so three sets of counters and three
+* limbo lists are enough.
+*/
+class EpochDomain
+{
+public:
+    EpochDomain();
+    ~EpochDomain();
+
+    /**
+    * Marks the calling thread as active in the current epoch for its lifetime.
+    */
+    class Guard
+    {
+    public:
+        explicit Guard(EpochDomain& domain);
+        ~Guard();
+
+    private:
+        Guard(const Guard&);
+        Guard& operator=(const Guard&);
+
+        std::atomic<long>* readers_;
+    };
+
+    void retire(void* object, void (*reclaim)(void*));
+    template<typename T> void retire(T* object);
+
+private:
+    EpochDomain(const EpochDomain&);
+    EpochDomain& operator=(const EpochDomain&);
+
+    static const std::size_t STRIPES = 64;
+    static const std::size_t RETIRES_PER_ADVANCE = 64;
+
+    // Padded so that two stripes never share a cache line
+    struct ReaderCount
+    {
+        std::atomic<long> readers;
+        char pad[64 - sizeof(std::atomic<long>)];
+    };
+
+    struct Retired
+    {
+        void* object;
+        void (*reclaim)(void*);
+    };
+
+    template<typename T> static void deleteObject(void* object);
+    static std::size_t stripe();
+    bool tryAdvance();
+    void reclaim(std::vector<Retired>& limbo);
+
+    std::atomic<std::uint64_t> epoch_;
+    ReaderCount active_[3][STRIPES];
+    std::mutex lock_;
+    std::vector<Retired> limbo_[3];
+    std::size_t sinceAdvance_;
+};
+
+/*
+  ---------------------------------------------
+  Begin implementations for the EpochDomain class.
+  ---------------------------------------------
+*/
+
+inline EpochDomain::EpochDomain() :
+    epoch_(0),
+    sinceAdvance_(0)
+{
+    for(std::size_t e = 0; e < 3; e++){
+        for(std::size_t s = 0; s < STRIPES; s++){
+            active_[e][s].readers.store(0);
+        }
+    }
+}
+
+/**
+* Reclaims everything still waiting. No thread may hold a guard anymore.
+*/
+inline EpochDomain::~EpochDomain()
+{
+    for(std::size_t e = 0; e < 3; e++){
+        reclaim(limbo_[e]);
+    }
+}
+
+/**
+* Registers as a reader of the current epoch. If the epoch moves on while we
+* register, the count we added may already have been checked, so we take it
+* back and try again in the new epoch.
+*/
+inline EpochDomain::Guard::Guard(EpochDomain& domain)
+{
+    std::size_t s = stripe();
+    while(true){
+        std::uint64_t epoch = domain.epoch_.load();
+        readers_ = &domain.active_[epoch % 3][s].readers;
+        readers_->fetch_add(1);
+        if(domain.epoch_.load() == epoch){
+            return;
+        }
+        readers_->fetch_sub(1);
+    }
+}
+
+inline EpochDomain::Guard::~Guard()
+{
+    readers_->fetch_sub(1);
+}
+
+/**
+* Hands over an object that no reader can reach anymore from the structure.
+* Readers that found it earlier may still be using it, so reclaim is only
+* called once they are all gone.
+*/
+inline void EpochDomain::retire(void* object, void (*reclaim)(void*))
+{
+    Retired retired = { object, reclaim };
+    std::lock_guard<std::mutex> guard(lock_);
+    limbo_[epoch_.load() % 3].push_back(retired);
+    if(++sinceAdvance_ >= RETIRES_PER_ADVANCE){
+        sinceAdvance_ = 0;
+        tryAdvance();
+    }
+}
+
+template<typename T>
+void EpochDomain::retire(T* object)
+{
+    retire(object, &EpochDomain::deleteObject<T>);
+}
+
+template<typename T>
+void EpochDomain::deleteObject(void* object)
+{
+    delete static_cast<T*>(object);
+}
+
+/**
+* Gives each thread a fixed stripe, handed out round robin.
+*/
+inline std::size_t EpochDomain::stripe()
+{
+    static std::atomic<std::size_t> next(0);
+    static thread_local std::size_t mine = next++ % STRIPES;
+    return mine;
+}
+
+/**
+* Moves from epoch e to e + 1 if no reader is left in e - 1. Readers of
+* e - 1 were the last ones that could have seen objects retired in e - 1,
+* so those can be reclaimed, and their list is reused for epoch e + 2.
+* Must be called with lock_ held.
+*/
+inline bool EpochDomain::tryAdvance()
+{
+    std::uint64_t epoch = epoch_.load();
+    std::size_t previous = (epoch + 2) % 3;
+    for(std::size_t s = 0; s < STRIPES; s++){
+        if(active_[previous][s].readers.load() != 0){
+            return false;
+        }
+    }
+    epoch_.store(epoch + 1);
+    reclaim(limbo_[previous]);
+    return true;
+}
+
+inline void EpochDomain::reclaim(std::vector<Retired>& limbo)
+{
+    for(std::size_t i = 0; i < limbo.size(); i++){
+        limbo[i].reclaim(limbo[i].object);
+    }
+    limbo.clear();
+}
+
+/*
+  -------------------------------------------
+  End implementations for the EpochDomain class.
+  -------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,329 @@
+#ifndef FROZEN_INDEX_H
+#define FROZEN_INDEX_H
+
+#include <cstddef>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/**
+* How FrozenIndex orders its search keys in memory.
+*
+* EYTZINGER_LAYOUT stores the implicit tree in breadth-first order, so the
+* children of slot i are at 2i and 2i + 1 and the next few levels can be
+* prefetched together. VEB_LAYOUT stores it in van Emde Boas order: the top
+* half of the levels first, then each bottom subtree, recursively, so every
+* subtree of height 2^k sits in one block no matter what the block size is.
+*/
+enum FrozenLayout { EYTZINGER_LAYOUT, VEB_LAYOUT };
+
+/**
+* An immutable, pointer-free index over a sorted set of pairs, built once
+* and then only searched. The pairs are kept in one sorted array, which is
+* what iteration walks. Searches run over a separate array of keys in the
+* chosen layout, and each slot records where its pair sits in the sorted
+* array. The descent has no data-dependent branches: each step only
+* computes the next slot from one comparison.
+*
+* Key must be default constructible and assignable.
+*/
+template <typename Key, typename Value>
+class FrozenIndex
+{
+public:
+    typedef typename std::vector<std::pair<Key, Value> >::const_iterator iterator;
+
+    FrozenIndex();
+    // [first, last) must be sorted by key, without duplicates
+    template<typename InputIt>
+    FrozenIndex(InputIt first, InputIt last, FrozenLayout layout);
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    Value const & operator[](const Key& key) const;
+
+    bool empty() const;
+    size_t size() const;
+    FrozenLayout layout() const;
+
+protected:
+    size_t eytzingerLowerBound(const Key& key) const;
+    size_t vebLowerBound(const Key& key) const;
+    void buildEytzinger(size_t slot, size_t& next);
+    void buildVeb(size_t bfs, size_t depth, size_t* positions, size_t& next);
+    void splitVeb(size_t top, size_t height);
+    static size_t dropTrailingOnes(size_t i);
+    static void prefetch(const Key* key);
+
+    FrozenLayout layout_;
+    std::vector<std::pair<Key, Value> > items_;
+    // Search keys in layout order, and the index in items_ of each one
+    std::vector<Key> keys_;
+    std::vector<size_t> ranks_;
+
+    // The van Emde Boas layout is over a perfect tree of height vebHeight_.
+    // For each depth d, a node there roots a bottom tree of vebBottom_[d]
+    // nodes, below a top tree of vebTop_[d] nodes whose root is at depth
+    // vebTopDepth_[d].
+    size_t vebHeight_;
+    std::vector<size_t> vebTop_;
+    std::vector<size_t> vebBottom_;
+    std::vector<size_t> vebTopDepth_;
+};
+
+/*
+  ---------------------------------------------
+  Begin implementations for the FrozenIndex class.
+  ---------------------------------------------
+*/
+
+template<typename Key, typename Value>
+FrozenIndex<Key, Value>::FrozenIndex() :
+    layout_(EYTZINGER_LAYOUT),
+    keys_(1),
+    ranks_(1),
+    vebHeight_(0)
+{
+
+}
+
+template<typename Key, typename Value>
+template<typename InputIt>
+FrozenIndex<Key, Value>::FrozenIndex(InputIt first, InputIt last, FrozenLayout layout) :
+    layout_(layout),
+    vebHeight_(0)
+{
+    for(; first != last; ++first){
+        items_.push_back(std::pair<Key, Value>(first->first, first->second));
+    }
+    size_t next = 0;
+
+    if(layout_ == EYTZINGER_LAYOUT){
+        // Slot 0 is unused so that the children of i are 2i and 2i + 1
+        keys_.resize(items_.size() + 1);
+        ranks_.resize(items_.size() + 1);
+        buildEytzinger(1, next);
+        return;
+    }
+
+    // The van Emde Boas position formula needs a perfect tree, so the
+    // slots past the last pair repeat the largest key. They come after the
+    // real one in order, so a search never stops at them first.
+    while((size_t(1) << vebHeight_) - 1 < items_.size()){
+        vebHeight_++;
+    }
+    vebTop_.assign(vebHeight_, 0);
+    vebBottom_.assign(vebHeight_, 0);
+    vebTopDepth_.assign(vebHeight_, 0);
+    splitVeb(0, vebHeight_);
+    keys_.resize((size_t(1) << vebHeight_) - 1);
+    ranks_.resize(keys_.size());
+    if(!keys_.empty()){
+        std::vector<size_t> positions(vebHeight_);
+        buildVeb(1, 0, &positions[0], next);
+    }
+}
+
+template<typename Key, typename Value>
+typename FrozenIndex<Key, Value>::iterator FrozenIndex<Key, Value>::begin() const
+{
+    return items_.begin();
+}
+
+template<typename Key, typename Value>
+typename FrozenIndex<Key, Value>::iterator FrozenIndex<Key, Value>::end() const
+{
+    return items_.end();
+}
+
+template<typename Key, typename Value>
+typename FrozenIndex<Key, Value>::iterator FrozenIndex<Key, Value>::find(const Key& key) const
+{
+    iterator it = lower_bound(key);
+    if(it == end() || key < it->first){
+        return end();
+    }
+    return it;
+}
+
+/**
+* Returns an iterator to the smallest key that is not less than key.
+*/
+template<typename Key, typename Value>
+typename FrozenIndex<Key, Value>::iterator FrozenIndex<Key, Value>::lower_bound(const Key& key) const
+{
+    size_t rank = (layout_ == EYTZINGER_LAYOUT) ? eytzingerLowerBound(key) : vebLowerBound(key);
+    return items_.begin() + rank;
+}
+
+/**
+ * @precondition The key exists in the index
+ * Returns the value associated with the key
+ */
+template<typename Key, typename Value>
+Value const & FrozenIndex<Key, Value>::operator[](const Key& key) const
+{
+    iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+template<typename Key, typename Value>
+bool FrozenIndex<Key, Value>::empty() const
+{
+    return items_.empty();
+}
+
+template<typename Key, typename Value>
+size_t FrozenIndex<Key, Value>::size() const
+{
+    return items_.size();
+}
+
+template<typename Key, typename Value>
+FrozenLayout FrozenIndex<Key, Value>::layout() const
+{
+    return layout_;
+}
+
+/**
+* Goes left or right at every level without looking back. The slot index
+* records the path: its bits after the leading one are the turns, 1 for
+* right. The answer is the last node where we went left, found by dropping
+* the trailing right turns and that left turn.
+*/
+template<typename Key, typename Value>
+size_t FrozenIndex<Key, Value>::eytzingerLowerBound(const Key& key) const
+{
+    const size_t n = items_.size();
+    const Key* keys = &keys_[0];
+    size_t i = 1;
+    while(i <= n){
+        // The 16 descendants four levels down are next to each other
+        if(16 * i <= n){
+            prefetch(keys + 16 * i);
+        }
+        i = 2 * i + (keys[i] < key ? 1 : 0);
+    }
+    i = dropTrailingOnes(i);
+    return (i == 0) ? n : ranks_[i];
+}
+
+/**
+* The same descent over the van Emde Boas layout. Where each node lives is
+* worked out from the position of the top tree it hangs off, which is
+* always an ancestor already on the path.
+*/
+template<typename Key, typename Value>
+size_t FrozenIndex<Key, Value>::vebLowerBound(const Key& key) const
+{
+    const Key* keys = keys_.empty() ? nullptr : &keys_[0];
+    size_t positions[64];
+    size_t best = ranks_.size();
+    size_t bfs = 1;
+    for(size_t depth = 0; depth < vebHeight_; depth++){
+        size_t position = 0;
+        if(depth > 0){
+            position = positions[vebTopDepth_[depth]] + vebTop_[depth]
+                + (bfs & vebTop_[depth]) * vebBottom_[depth];
+        }
+        positions[depth] = position;
+        bool less = keys[position] < key;
+        best = less ? best : position;
+        bfs = 2 * bfs + (less ? 1 : 0);
+    }
+    return (best == ranks_.size()) ? items_.size() : ranks_[best];
+}
+
+/**
+* Fills the subtree at slot in order, so the slots get the keys in order.
+*/
+template<typename Key, typename Value>
+void FrozenIndex<Key, Value>::buildEytzinger(size_t slot, size_t& next)
+{
+    if(slot >= keys_.size()){
+        return;
+    }
+    buildEytzinger(2 * slot, next);
+    keys_[slot] = items_[next].first;
+    ranks_[slot] = next++;
+    buildEytzinger(2 * slot + 1, next);
+}
+
+/**
+* Fills the perfect tree in order, placing each node at its van Emde Boas
+* position. bfs is the node's breadth-first index and positions holds the
+* positions of its ancestors by depth.
+*/
+template<typename Key, typename Value>
+void FrozenIndex<Key, Value>::buildVeb(size_t bfs, size_t depth, size_t* positions, size_t& next)
+{
+    if(depth == vebHeight_){
+        return;
+    }
+    size_t position = 0;
+    if(depth > 0){
+        position = positions[vebTopDepth_[depth]] + vebTop_[depth]
+            + (bfs & vebTop_[depth]) * vebBottom_[depth];
+    }
+    positions[depth] = position;
+    buildVeb(2 * bfs, depth + 1, positions, next);
+    size_t rank = (next < items_.size()) ? next : items_.size() - 1;
+    keys_[position] = items_[rank].first;
+    ranks_[position] = rank;
+    next++;
+    buildVeb(2 * bfs + 1, depth + 1, positions, next);
+}
+
+/**
+* Records how the levels [top, top + height) split: the top half of the
+* levels and the trees hanging below them, recursively.
+*/
+template<typename Key, typename Value>
+void FrozenIndex<Key, Value>::splitVeb(size_t top, size_t height)
+{
+    if(height <= 1){
+        return;
+    }
+    size_t topHeight = height / 2;
+    size_t bottomHeight = height - topHeight;
+    size_t depth = top + topHeight;
+    vebTop_[depth] = (size_t(1) << topHeight) - 1;
+    vebBottom_[depth] = (size_t(1) << bottomHeight) - 1;
+    vebTopDepth_[depth] = top;
+    splitVeb(top, topHeight);
+    splitVeb(depth, bottomHeight);
+}
+
+template<typename Key, typename Value>
+size_t FrozenIndex<Key, Value>::dropTrailingOnes(size_t i)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return i >> (__builtin_ctzll(~static_cast<unsigned long long>(i)) + 1);
+#else
+    while(i & 1){
+        i >>= 1;
+    }
+    return i >> 1;
+#endif
+}
+
+template<typename Key, typename Value>
+void FrozenIndex<Key, Value>::prefetch(const Key* key)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(key);
+#else
+    (void)key;
+#endif
+}
+
+/*
+  -------------------------------------------
+  End implementations for the FrozenIndex class.
+  -------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,509 @@
+#ifndef MAPPED_TREE_H
+#define MAPPED_TREE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <type_traits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "compact_avl.h"
+#include "snapshot.h"
+
+/**
+* The fixed-size header at the start of a mapped tree file. The nodes
+* follow at nodeOffset, one IndexedAVLNode per pair, in key order.
+* Everything is in the byte order of the machine that wrote it.
+*/
+struct MappedTreeHeader
+{
+    unsigned char magic[4];
+    std::uint32_t version;
+    std::uint32_t nodeSize;
+    std::uint32_t nodeOffset;
+    std::uint64_t count;
+    std::uint64_t root;
+};
+
+const unsigned char MAPPED_TREE_MAGIC[4] = { 'A', 'V', 'L', 'M' };
+const std::uint32_t MAPPED_TREE_VERSION = 1;
+
+/**
+* A read-only AVL tree that lives in a file and is searched in place
+* through mmap. The nodes are IndexedAVLNodes, which link by index rather
+* than by pointer, so the file needs no fixing up: opening one is a header
+* check and a mapping, however large the tree, and every process that maps
+* the same file shares its pages in the page cache.
+*
+* write() lays the nodes out in key order, linked as a perfectly balanced
+* tree, so iterating is a walk along the array and begin() is node 0.
+* Key and Value must be trivially copyable, and a file can only be read on
+* a machine with the same byte order and type sizes. open() checks the
+* header but trusts the links, since checking them would mean reading
+* every node.
+*/
+template <typename Key, typename Value>
+class MappedTree
+{
+public:
+    typedef IndexedAVLNode<Key, Value> NodeType;
+
+    class iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const std::pair<const Key, Value>* pointer;
+        typedef const std::pair<const Key, Value>& reference;
+
+        iterator();
+
+        const std::pair<const Key, Value>& operator*() const;
+        const std::pair<const Key, Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+        iterator operator++(int);
+        iterator& operator--();
+        iterator operator--(int);
+
+    protected:
+        friend class MappedTree<Key, Value>;
+        explicit iterator(const NodeType* current);
+        const NodeType* current_;
+    };
+
+    MappedTree();
+    explicit MappedTree(const std::string& path);
+    ~MappedTree();
+
+    void open(const std::string& path);
+    void close();
+
+    // Writes the pairs in [first, last), which must be sorted by key
+    // without duplicates, as a file that open() can map
+    template<typename InputIt>
+    static void write(const std::string& path, InputIt first, InputIt last);
+    // The same for the count pairs starting at first, read only once
+    template<typename InputIt>
+    static void writeN(const std::string& path, InputIt first, size_t count);
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key) const;
+    Value const & operator[](const Key& key) const;
+
+    bool empty() const;
+    size_t size() const;
+
+protected:
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+                  "MappedTree stores nodes as raw bytes, so keys and values must be trivially copyable");
+
+    static std::uint32_t nodeOffset();
+    static int balancedHeight(size_t count);
+    template<typename InputIt>
+    static std::uint32_t writeBalanced(SnapshotWriter& out, size_t lo, size_t hi, InputIt& next);
+
+    const NodeType* node(std::uint32_t index) const;
+
+    // Copying would unmap the file twice
+    MappedTree(const MappedTree& other);
+    MappedTree& operator=(const MappedTree& other);
+
+    void* mapping_;
+    size_t mappingSize_;
+    const NodeType* nodes_;
+    size_t count_;
+    std::uint32_t root_;
+};
+
+/*
+  --------------------------------------------------------
+  Begin implementations for the MappedTree::iterator class.
+  --------------------------------------------------------
+*/
+
+template<typename Key, typename Value>
+MappedTree<Key, Value>::iterator::iterator() :
+    current_(nullptr)
+{
+
+}
+
+template<typename Key, typename Value>
+MappedTree<Key, Value>::iterator::iterator(const NodeType* current) :
+    current_(current)
+{
+
+}
+
+template<typename Key, typename Value>
+const std::pair<const Key, Value>& MappedTree<Key, Value>::iterator::operator*() const
+{
+    return current_->getItem();
+}
+
+template<typename Key, typename Value>
+const std::pair<const Key, Value>* MappedTree<Key, Value>::iterator::operator->() const
+{
+    return &(current_->getItem());
+}
+
+template<typename Key, typename Value>
+bool MappedTree<Key, Value>::iterator::operator==(const iterator& rhs) const
+{
+    return current_ == rhs.current_;
+}
+
+template<typename Key, typename Value>
+bool MappedTree<Key, Value>::iterator::operator!=(const iterator& rhs) const
+{
+    return current_ != rhs.current_;
+}
+
+/**
+* The nodes are stored in key order, so the next pair is the next node.
+*/
+template<typename Key, typename Value>
+typename MappedTree<Key, Value>::iterator& MappedTree<Key, Value>::iterator::operator++()
+{
+    ++current_;
+    return *this;
+}
+
+template<typename Key, typename Value>
+typename MappedTree<Key, Value>::iterator MappedTree<Key, Value>::iterator::operator++(int)
+{
+    iterator old = *this;
+    ++current_;
+    return old;
+}
+
+template<typename Key, typename Value>
+typename MappedTree<Key, Value>::iterator& MappedTree<Key, Value>::iterator::operator--()
+{
+    --current_;
+    return *this;
+}
+
+template<typename Key, typename Value>
+typename MappedTree<Key, Value>::iterator MappedTree<Key, Value>::iterator::operator--(int)
+{
+    iterator old = *this;
+    --current_;
+    return old;
+}
+
+/*
+  ------------------------------------------------------
+  End implementations for the MappedTree::iterator class.
+  ------------------------------------------------------
+*/
+
+/*
+  ---------------------------------------------
+  Begin implementations for the MappedTree class.
+  ---------------------------------------------
+*/
+
+template<typename Key, typename Value>
+MappedTree<Key, Value>::MappedTree() :
+    mapping_(nullptr),
+    mappingSize_(0),
+    nodes_(nullptr),
+    count_(0),
+    root_(NodeType::NIL)
+{
+
+}
+
+template<typename Key, typename Value>
+MappedTree<Key, Value>::MappedTree(const std::string& path) :
+    mapping_(nullptr),
+    mappingSize_(0),
+    nodes_(nullptr),
+    count_(0),
+    root_(NodeType::NIL)
+{
+    open(path);
+}
+
+template<typename Key, typename Value>
+MappedTree<Key, Value>::~MappedTree()
+{
+    close();
+}
+
+/**
+* Maps the file at path, replacing whatever was open. Throws
+* std::runtime_error if the file cannot be mapped or was not written by
+* write() for this Key and Value.
+*/
+template<typename Key, typename Value>
+void MappedTree<Key, Value>::open(const std::string& path)
+{
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0){
+        throw std::runtime_error("Cannot open " + path + ": " + std::strerror(errno));
+    }
+    struct stat info;
+    if(::fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(MappedTreeHeader)){
+        ::close(fd);
+        throw std::runtime_error("Not a mapped tree: " + path);
+    }
+    size_t size = static_cast<size_t>(info.st_size);
+    void* mapping = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(mapping == MAP_FAILED){
+        throw std::runtime_error("Cannot map " + path + ": " + std::strerror(errno));
+    }
+
+    const MappedTreeHeader* header = static_cast<const MappedTreeHeader*>(mapping);
+    if(std::memcmp(header->magic, MAPPED_TREE_MAGIC, sizeof(MAPPED_TREE_MAGIC)) != 0
+        || header->version != MAPPED_TREE_VERSION
+        || header->nodeSize != sizeof(NodeType)
+        || header->nodeOffset != nodeOffset()
+        || size < nodeOffset()
+        || header->count > (size - nodeOffset()) / sizeof(NodeType)
+        || (header->count > 0 && header->root >= header->count)){
+        ::munmap(mapping, size);
+        throw std::runtime_error("Not a mapped tree of this type: " + path);
+    }
+    mapping_ = mapping;
+    mappingSize_ = size;
+    nodes_ = reinterpret_cast<const NodeType*>(static_cast<const char*>(mapping) + nodeOffset());
+    count_ = static_cast<size_t>(header->count);
+    root_ = (count_ > 0) ? static_cast<std::uint32_t>(header->root) : NodeType::NIL;
+}
+
+template<typename Key, typename Value>
+void MappedTree<Key, Value>::close()
+{
+    if(mapping_ != nullptr){
+        ::munmap(mapping_, mappingSize_);
+    }
+    mapping_ = nullptr;
+    mappingSize_ = 0;
+    nodes_ = nullptr;
+    count_ = 0;
+    root_ = NodeType::NIL;
+}
+
+/**
+* Streams the pairs out in order. Each node's children are the middles of
+* the two halves of its range, so the links and balances are known as the
+* node is written and nothing has to be patched afterwards.
+*/
+template<typename Key, typename Value>
+template<typename InputIt>
+void MappedTree<Key, Value>::write(const std::string& path, InputIt first, InputIt last)
+{
+    writeN(path, first, static_cast<size_t>(std::distance(first, last)));
+}
+
+template<typename Key, typename Value>
+template<typename InputIt>
+void MappedTree<Key, Value>::writeN(const std::string& path, InputIt first, size_t count)
+{
+    if(count >= NodeType::NIL){
+        throw std::length_error("Too many pairs for a mapped tree");
+    }
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0){
+        throw std::runtime_error("Cannot create " + path + ": " + std::strerror(errno));
+    }
+    try{
+        SnapshotWriter out(fd);
+        MappedTreeHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, MAPPED_TREE_MAGIC, sizeof(MAPPED_TREE_MAGIC));
+        header.version = MAPPED_TREE_VERSION;
+        header.nodeSize = sizeof(NodeType);
+        header.nodeOffset = nodeOffset();
+        header.count = count;
+        header.root = (count > 0) ? count / 2 : 0;
+        out.writeBytes(&header, sizeof(header));
+        for(size_t i = sizeof(header); i < nodeOffset(); i++){
+            out.writeByte(0);
+        }
+        writeBalanced(out, 0, count, first);
+        out.flush();
+    }
+    catch(...){
+        ::close(fd);
+        throw;
+    }
+    if(::close(fd) != 0){
+        throw std::runtime_error("Cannot write " + path + ": " + std::strerror(errno));
+    }
+}
+
+template<typename Key, typename Value>
+typename MappedTree<Key, Value>::iterator MappedTree<Key, Value>::begin() const
+{
+    return iterator(nodes_);
+}
+
+template<typename Key, typename Value>
+typename MappedTree<Key, Value>::iterator MappedTree<Key, Value>::end() const
+{
+    return iterator(nodes_ + count_);
+}
+
+template<typename Key, typename Value>
+typename MappedTree<Key, Value>::iterator MappedTree<Key, Value>::find(const Key& key) const
+{
+    iterator it = lower_bound(key);
+    if(it == end() || key < it->first){
+        return end();
+    }
+    return it;
+}
+
+/**
+* Returns an iterator to the smallest key that is not less than key.
+*/
+template<typename Key, typename Value>
+typename MappedTree<Key, Value>::iterator MappedTree<Key, Value>::lower_bound(const Key& key) const
+{
+    const NodeType* best = nodes_ + count_;
+    std::uint32_t current = root_;
+    while(current != NodeType::NIL){
+        const NodeType* here = node(current);
+        if(here->getKey() < key){
+            current = here->getRight();
+        }
+        else{
+            best = here;
+            current = here->getLeft();
+        }
+    }
+    return iterator(best);
+}
+
+/**
+* Returns an iterator to the smallest key that is greater than key.
+*/
+template<typename Key, typename Value>
+typename MappedTree<Key, Value>::iterator MappedTree<Key, Value>::upper_bound(const Key& key) const
+{
+    const NodeType* best = nodes_ + count_;
+    std::uint32_t current = root_;
+    while(current != NodeType::NIL){
+        const NodeType* here = node(current);
+        if(key < here->getKey()){
+            best = here;
+            current = here->getLeft();
+        }
+        else{
+            current = here->getRight();
+        }
+    }
+    return iterator(best);
+}
+
+/**
+ * @precondition The key exists in the tree
+ * Returns the value associated with the key
+ */
+template<typename Key, typename Value>
+Value const & MappedTree<Key, Value>::operator[](const Key& key) const
+{
+    iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+template<typename Key, typename Value>
+bool MappedTree<Key, Value>::empty() const
+{
+    return count_ == 0;
+}
+
+template<typename Key, typename Value>
+size_t MappedTree<Key, Value>::size() const
+{
+    return count_;
+}
+
+/**
+* The nodes start at the first multiple of their alignment past the header.
+*/
+template<typename Key, typename Value>
+std::uint32_t MappedTree<Key, Value>::nodeOffset()
+{
+    std::uint32_t align = alignof(NodeType);
+    return (sizeof(MappedTreeHeader) + align - 1) / align * align;
+}
+
+/**
+* The height of a subtree built over count pairs by writeBalanced().
+*/
+template<typename Key, typename Value>
+int MappedTree<Key, Value>::balancedHeight(size_t count)
+{
+    int height = 0;
+    while(count > 0){
+        count /= 2;
+        height++;
+    }
+    return height;
+}
+
+/**
+* Writes the nodes for positions [lo, hi) in order and returns the index
+* of the subtree's root, the middle position.
+*/
+template<typename Key, typename Value>
+template<typename InputIt>
+std::uint32_t MappedTree<Key, Value>::writeBalanced(SnapshotWriter& out, size_t lo, size_t hi, InputIt& next)
+{
+    if(lo >= hi){
+        return NodeType::NIL;
+    }
+    size_t mid = lo + (hi - lo) / 2;
+    std::uint32_t left = writeBalanced(out, lo, mid, next);
+
+    // Zeroed first so padding bytes in the node are not written as garbage
+    typename std::aligned_storage<sizeof(NodeType), alignof(NodeType)>::type slot;
+    std::memset(&slot, 0, sizeof(slot));
+    NodeType* current = new (&slot) NodeType(next->first, next->second);
+    ++next;
+    std::uint32_t right = (mid + 1 < hi) ? static_cast<std::uint32_t>(mid + 1 + (hi - mid - 1) / 2) : NodeType::NIL;
+    current->setLeft(left);
+    current->setRight(right);
+    current->setBalance(balancedHeight(hi - mid - 1) - balancedHeight(mid - lo));
+    out.writeBytes(current, sizeof(NodeType));
+
+    writeBalanced(out, mid + 1, hi, next);
+    return static_cast<std::uint32_t>(mid);
+}
+
+template<typename Key, typename Value>
+const typename MappedTree<Key, Value>::NodeType* MappedTree<Key, Value>::node(std::uint32_t index) const
+{
+    return nodes_ + index;
+}
+
+/*
+  -------------------------------------------
+  End implementations for the MappedTree class.
+  -------------------------------------------
+*/
+
+#endif
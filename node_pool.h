@@ -0,0 +1,304 @@
+#ifndef NODE_POOL_H
+#define NODE_POOL_H
+
+#include <cstddef>
+#include <new>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+
+/**
+* An interface for the memory that a search tree carves its nodes out of.
+* The tree only ever asks for node-sized blocks, so implementations are
+* free to hand out fixed-size slots.
+*/
+class NodeResource
+{
+public:
+    virtual ~NodeResource() { }
+
+    virtual void* allocate(std::size_t size) = 0;
+    virtual void deallocate(void* block) = 0;
+
+    // Frees every block at once. Returns false if the resource
+    // cannot do that, in which case blocks must be deallocated one by one.
+    virtual bool release() = 0;
+};
+
+/**
+* A resource that forwards to the global operator new/delete,
+* i.e. the behaviour of a plain "new Node" per insert.
+*/
+class NewDeleteResource : public NodeResource
+{
+public:
+    virtual void* allocate(std::size_t size) { return ::operator new(size); }
+    virtual void deallocate(void* block) { ::operator delete(block); }
+    virtual bool release() { return false; }
+};
+
+/**
+* A slab allocator for tree nodes. Nodes are bump-allocated out of large
+* slabs that double in size (up to a cap), and removed nodes go on a free
+* list to be reused by the next insert. release() drops every slab, so the
+* cost of clearing a tree is one free per slab instead of one per node.
+*
+* Slabs are reference counted so that nodes can move between trees: an
+* arena can absorb() another arena's memory, or attach() to it so that the
+* other arena's slabs stay alive for as long as either arena needs them.
+*/
+class NodeArena : public NodeResource
+{
+public:
+    explicit NodeArena(std::size_t firstSlabNodes = 64, std::size_t maxSlabNodes = 65536);
+    virtual ~NodeArena();
+
+    virtual void* allocate(std::size_t size);
+    virtual void deallocate(void* block);
+    virtual bool release();
+
+    void absorb(NodeArena& other);
+    void attach(const NodeArena& other);
+
+    std::size_t slabCount() const;
+
+private:
+    // The arena owns raw slabs, so it must not be copied.
+    NodeArena(const NodeArena&);
+    NodeArena& operator=(const NodeArena&);
+
+    // A group of slabs that is freed once no arena refers to it anymore
+    struct SlabStore
+    {
+        ~SlabStore();
+        std::mutex lock;
+        std::vector<char*> slabs;
+    };
+
+    void addSlab();
+    void useBlockSize(std::size_t blockSize);
+    void addStore(const std::shared_ptr<SlabStore>& store);
+
+    struct FreeBlock { FreeBlock* next; };
+
+    // stores_[0], if present, is where this arena adds its new slabs
+    std::vector<std::shared_ptr<SlabStore> > stores_;
+    FreeBlock* freeList_;
+    FreeBlock* freeTail_;
+    char* cursor_;
+    char* limit_;
+    std::size_t blockSize_;
+    std::size_t nextSlabNodes_;
+    std::size_t firstSlabNodes_;
+    std::size_t maxSlabNodes_;
+};
+
+/*
+  -------------------------------------------
+  Begin implementations for the NodeArena class.
+  -------------------------------------------
+*/
+
+inline NodeArena::SlabStore::~SlabStore()
+{
+    for(std::size_t i = 0; i < slabs.size(); i++){
+        ::operator delete(slabs[i]);
+    }
+}
+
+inline NodeArena::NodeArena(std::size_t firstSlabNodes, std::size_t maxSlabNodes) :
+    freeList_(nullptr),
+    freeTail_(nullptr),
+    cursor_(nullptr),
+    limit_(nullptr),
+    blockSize_(0),
+    nextSlabNodes_(firstSlabNodes),
+    firstSlabNodes_(firstSlabNodes),
+    maxSlabNodes_(maxSlabNodes)
+{
+
+}
+
+inline NodeArena::~NodeArena()
+{
+    release();
+}
+
+/**
+* Hands out one block. The block size is fixed by the first request
+* (a tree only ever allocates a single node type). Slabs start max-aligned
+* and a type's size is a multiple of its alignment, so blocks only need
+* rounding up to hold a free list link, not to alignof(std::max_align_t).
+*/
+inline void* NodeArena::allocate(std::size_t size)
+{
+    if(blockSize_ == 0){
+        std::size_t align = alignof(FreeBlock);
+        std::size_t blockSize = (size + align - 1) / align * align;
+        if(blockSize < sizeof(FreeBlock)){
+            blockSize = sizeof(FreeBlock);
+        }
+        blockSize_ = blockSize;
+    }
+    if(size > blockSize_){
+        throw std::bad_alloc();
+    }
+
+    if(freeList_ != nullptr){
+        FreeBlock* block = freeList_;
+        freeList_ = block->next;
+        if(freeList_ == nullptr){
+            freeTail_ = nullptr;
+        }
+        return block;
+    }
+    if(cursor_ == limit_){
+        addSlab();
+    }
+    void* block = cursor_;
+    cursor_ += blockSize_;
+    return block;
+}
+
+/**
+* Puts a block back on the free list for the next allocate().
+*/
+inline void NodeArena::deallocate(void* block)
+{
+    if(block == nullptr){
+        return;
+    }
+    FreeBlock* freed = static_cast<FreeBlock*>(block);
+    freed->next = freeList_;
+    if(freeList_ == nullptr){
+        freeTail_ = freed;
+    }
+    freeList_ = freed;
+}
+
+/**
+* Drops this arena's hold on all of its slabs. Anything still living in
+* them is gone unless another arena is attached to the same slabs, so the
+* caller must have run any destructors it cares about first.
+*/
+inline bool NodeArena::release()
+{
+    stores_.clear();
+    freeList_ = nullptr;
+    freeTail_ = nullptr;
+    cursor_ = nullptr;
+    limit_ = nullptr;
+    blockSize_ = 0;
+    nextSlabNodes_ = firstSlabNodes_;
+    return true;
+}
+
+/**
+* Takes over all of other's memory, including its free blocks, and leaves
+* other empty. Used when the nodes of another tree are moved into this one.
+* Costs O(1) per slab store, whatever the length of the free lists. If it
+* throws, neither arena has changed.
+*/
+inline void NodeArena::absorb(NodeArena& other)
+{
+    if(&other == this || other.stores_.empty()){
+        return;
+    }
+    // Once there is room for other's stores, only the block size check can throw
+    stores_.reserve(stores_.size() + other.stores_.size());
+    useBlockSize(other.blockSize_);
+    for(std::size_t i = 0; i < other.stores_.size(); i++){
+        addStore(other.stores_[i]);
+    }
+
+    // Splice other's free list in front of ours
+    if(other.freeList_ != nullptr){
+        other.freeTail_->next = freeList_;
+        if(freeList_ == nullptr){
+            freeTail_ = other.freeTail_;
+        }
+        freeList_ = other.freeList_;
+    }
+    other.stores_.clear();
+    other.freeList_ = nullptr;
+    other.freeTail_ = nullptr;
+    other.cursor_ = nullptr;
+    other.limit_ = nullptr;
+    other.blockSize_ = 0;
+    other.nextSlabNodes_ = other.firstSlabNodes_;
+}
+
+/**
+* Keeps other's slabs alive for as long as this arena, so that nodes
+* allocated by other can be handed to this arena's tree. Both arenas keep
+* allocating from their own slabs.
+*/
+inline void NodeArena::attach(const NodeArena& other)
+{
+    if(&other == this){
+        return;
+    }
+    useBlockSize(other.blockSize_);
+    for(std::size_t i = 0; i < other.stores_.size(); i++){
+        addStore(other.stores_[i]);
+    }
+}
+
+inline std::size_t NodeArena::slabCount() const
+{
+    std::size_t count = 0;
+    for(std::size_t i = 0; i < stores_.size(); i++){
+        std::lock_guard<std::mutex> guard(stores_[i]->lock);
+        count += stores_[i]->slabs.size();
+    }
+    return count;
+}
+
+inline void NodeArena::addSlab()
+{
+    // Start a store of our own rather than adding to one that was absorbed
+    if(stores_.empty() || cursor_ == nullptr){
+        stores_.insert(stores_.begin(), std::make_shared<SlabStore>());
+    }
+    std::size_t bytes = blockSize_ * nextSlabNodes_;
+    char* slab = static_cast<char*>(::operator new(bytes));
+    {
+        std::lock_guard<std::mutex> guard(stores_[0]->lock);
+        stores_[0]->slabs.push_back(slab);
+    }
+    cursor_ = slab;
+    limit_ = slab + bytes;
+    if(nextSlabNodes_ < maxSlabNodes_){
+        nextSlabNodes_ *= 2;
+    }
+}
+
+inline void NodeArena::useBlockSize(std::size_t blockSize)
+{
+    if(blockSize == 0){
+        return;
+    }
+    if(blockSize_ != 0 && blockSize_ != blockSize){
+        throw std::logic_error("NodeArena: cannot share memory between different node types");
+    }
+    blockSize_ = blockSize;
+}
+
+inline void NodeArena::addStore(const std::shared_ptr<SlabStore>& store)
+{
+    for(std::size_t i = 0; i < stores_.size(); i++){
+        if(stores_[i] == store){
+            return;
+        }
+    }
+    stores_.push_back(store);
+}
+
+/*
+  -----------------------------------------
+  End implementations for the NodeArena class.
+  -----------------------------------------
+*/
+
+#endif
@@ -0,0 +1,541 @@
+#ifndef PERSISTENT_AVL_H
+#define PERSISTENT_AVL_H
+
+#include <iostream>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <iterator>
+
+/**
+* A node of a PersistentAVLTree. Nodes never change once built, so one node
+* can be shared by many versions of the tree. That is also why there is no
+* parent pointer: a shared node has a different parent in each version.
+*/
+template <typename Key, typename Value>
+class PersistentAVLNode
+{
+public:
+    typedef std::shared_ptr<const PersistentAVLNode<Key, Value> > Ptr;
+
+    PersistentAVLNode(const std::pair<const Key, Value>& item, const Ptr& left, const Ptr& right);
+
+    const std::pair<const Key, Value>& getItem() const;
+    const Key& getKey() const;
+    const Value& getValue() const;
+    const Ptr& getLeft() const;
+    const Ptr& getRight() const;
+    int getHeight() const;
+
+    static int heightOf(const Ptr& node);
+
+private:
+    std::pair<const Key, Value> item_;
+    Ptr left_;
+    Ptr right_;
+    int height_;
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the PersistentAVLNode class.
+  -------------------------------------------------
+*/
+
+/**
+* Builds a node over two existing (possibly shared) subtrees.
+*/
+template<typename Key, typename Value>
+PersistentAVLNode<Key, Value>::PersistentAVLNode(const std::pair<const Key, Value>& item, const Ptr& left, const Ptr& right) :
+    item_(item),
+    left_(left),
+    right_(right),
+    height_(1 + std::max(heightOf(left), heightOf(right)))
+{
+
+}
+
+template<typename Key, typename Value>
+const std::pair<const Key, Value>& PersistentAVLNode<Key, Value>::getItem() const
+{
+    return item_;
+}
+
+template<typename Key, typename Value>
+const Key& PersistentAVLNode<Key, Value>::getKey() const
+{
+    return item_.first;
+}
+
+template<typename Key, typename Value>
+const Value& PersistentAVLNode<Key, Value>::getValue() const
+{
+    return item_.second;
+}
+
+template<typename Key, typename Value>
+const typename PersistentAVLNode<Key, Value>::Ptr& PersistentAVLNode<Key, Value>::getLeft() const
+{
+    return left_;
+}
+
+template<typename Key, typename Value>
+const typename PersistentAVLNode<Key, Value>::Ptr& PersistentAVLNode<Key, Value>::getRight() const
+{
+    return right_;
+}
+
+template<typename Key, typename Value>
+int PersistentAVLNode<Key, Value>::getHeight() const
+{
+    return height_;
+}
+
+/**
+* The height of a subtree, 0 for an empty one.
+*/
+template<typename Key, typename Value>
+int PersistentAVLNode<Key, Value>::heightOf(const Ptr& node)
+{
+    return (node == nullptr) ? 0 : node->height_;
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the PersistentAVLNode class.
+  -----------------------------------------------
+*/
+
+/**
+* An AVL tree whose insert and remove copy only the O(log n) nodes on the
+* path from the root to the change and share every other node with the
+* previous version.
+*
+* The current root is published with an atomic store, so any thread can
+* take a snapshot() in O(1) and then read or iterate it without locks while
+* writers carry on. Writers are serialized with a mutex that readers never
+* touch. Nodes are reference counted, so a version's nodes are freed as soon
+* as no snapshot or later version refers to them anymore.
+*/
+template <typename Key, typename Value>
+class PersistentAVLTree
+{
+public:
+    typedef PersistentAVLNode<Key, Value> NodeType;
+    typedef typename NodeType::Ptr NodePtr;
+
+    /**
+    * An immutable version of the tree. It stays valid and unchanged for as
+    * long as it exists, no matter what happens to the tree.
+    */
+    class Snapshot
+    {
+    public:
+        /**
+        * An in-order iterator. With no parent pointers it keeps the path
+        * from the root on an explicit stack. It must not outlive its snapshot.
+        */
+        class iterator
+        {
+        public:
+            typedef std::forward_iterator_tag iterator_category;
+            typedef const std::pair<const Key, Value> value_type;
+            typedef std::ptrdiff_t difference_type;
+            typedef const std::pair<const Key, Value>* pointer;
+            typedef const std::pair<const Key, Value>& reference;
+
+            iterator();
+
+            const std::pair<const Key, Value>& operator*() const;
+            const std::pair<const Key, Value>* operator->() const;
+
+            bool operator==(const iterator& rhs) const;
+            bool operator!=(const iterator& rhs) const;
+
+            iterator& operator++();
+
+        protected:
+            friend class Snapshot;
+            void pushLeftPath(const NodeType* current);
+            std::vector<const NodeType*> path_;
+        };
+
+        Snapshot();
+
+        iterator begin() const;
+        iterator end() const;
+        iterator find(const Key& key) const;
+        const Value& operator[](const Key& key) const;
+        bool empty() const;
+        int height() const;
+
+    protected:
+        friend class PersistentAVLTree<Key, Value>;
+        explicit Snapshot(const NodePtr& root);
+        NodePtr root_;
+    };
+
+    PersistentAVLTree();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+
+    Snapshot snapshot() const;
+
+protected:
+    // Path copying helpers; each returns the root of the new version of the subtree
+    static NodePtr insertHelper(const NodePtr& current, const std::pair<const Key, Value>& keyValuePair);
+    static NodePtr removeHelper(const NodePtr& current, const Key& key, bool* removed);
+    static NodePtr removeLargest(const NodePtr& current, NodePtr* largest);
+    static NodePtr balance(const std::pair<const Key, Value>& item, const NodePtr& left, const NodePtr& right);
+    static NodePtr makeNode(const std::pair<const Key, Value>& item, const NodePtr& left, const NodePtr& right);
+
+    void publish(const NodePtr& root);
+
+    // Only ever read and written through std::atomic_load/atomic_store
+    NodePtr root_;
+    std::mutex writeLock_;
+};
+
+/*
+--------------------------------------------------------------
+Begin implementations for the PersistentAVLTree::Snapshot class.
+--------------------------------------------------------------
+*/
+
+template<typename Key, typename Value>
+PersistentAVLTree<Key, Value>::Snapshot::iterator::iterator()
+{
+
+}
+
+template<typename Key, typename Value>
+const std::pair<const Key, Value>&
+PersistentAVLTree<Key, Value>::Snapshot::iterator::operator*() const
+{
+    return path_.back()->getItem();
+}
+
+template<typename Key, typename Value>
+const std::pair<const Key, Value>*
+PersistentAVLTree<Key, Value>::Snapshot::iterator::operator->() const
+{
+    return &(path_.back()->getItem());
+}
+
+template<typename Key, typename Value>
+bool PersistentAVLTree<Key, Value>::Snapshot::iterator::operator==(const iterator& rhs) const
+{
+    if(path_.empty() || rhs.path_.empty()){
+        return path_.empty() && rhs.path_.empty();
+    }
+    return path_.back() == rhs.path_.back();
+}
+
+template<typename Key, typename Value>
+bool PersistentAVLTree<Key, Value>::Snapshot::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Advances to the next key in order: the leftmost node of the right
+* subtree if there is one, otherwise the nearest ancestor still on the
+* stack whose left subtree we just finished.
+*/
+template<typename Key, typename Value>
+typename PersistentAVLTree<Key, Value>::Snapshot::iterator&
+PersistentAVLTree<Key, Value>::Snapshot::iterator::operator++()
+{
+    const NodeType* current = path_.back();
+    path_.pop_back();
+    if(current->getRight() != nullptr){
+        pushLeftPath(current->getRight().get());
+    }
+    return *this;
+}
+
+/**
+* Pushes current and its chain of left children. Only nodes whose key is
+* still ahead of the iterator are kept on the stack.
+*/
+template<typename Key, typename Value>
+void PersistentAVLTree<Key, Value>::Snapshot::iterator::pushLeftPath(const NodeType* current)
+{
+    while(current != nullptr){
+        path_.push_back(current);
+        current = current->getLeft().get();
+    }
+}
+
+template<typename Key, typename Value>
+PersistentAVLTree<Key, Value>::Snapshot::Snapshot()
+{
+
+}
+
+template<typename Key, typename Value>
+PersistentAVLTree<Key, Value>::Snapshot::Snapshot(const NodePtr& root) :
+    root_(root)
+{
+
+}
+
+template<typename Key, typename Value>
+typename PersistentAVLTree<Key, Value>::Snapshot::iterator
+PersistentAVLTree<Key, Value>::Snapshot::begin() const
+{
+    iterator it;
+    it.pushLeftPath(root_.get());
+    return it;
+}
+
+template<typename Key, typename Value>
+typename PersistentAVLTree<Key, Value>::Snapshot::iterator
+PersistentAVLTree<Key, Value>::Snapshot::end() const
+{
+    return iterator();
+}
+
+/**
+* Returns an iterator to the item with the given key, or end(). The stack
+* keeps only the ancestors we went left from, which are exactly the ones
+* still to come in order.
+*/
+template<typename Key, typename Value>
+typename PersistentAVLTree<Key, Value>::Snapshot::iterator
+PersistentAVLTree<Key, Value>::Snapshot::find(const Key& key) const
+{
+    iterator it;
+    const NodeType* current = root_.get();
+    while(current != nullptr){
+        if(key < current->getKey()){
+            it.path_.push_back(current);
+            current = current->getLeft().get();
+        }
+        else if(current->getKey() < key){
+            current = current->getRight().get();
+        }
+        else{
+            it.path_.push_back(current);
+            return it;
+        }
+    }
+    return end();
+}
+
+/**
+ * @precondition The key exists in the snapshot
+ * Returns the value associated with the key
+ */
+template<typename Key, typename Value>
+const Value& PersistentAVLTree<Key, Value>::Snapshot::operator[](const Key& key) const
+{
+    iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+template<typename Key, typename Value>
+bool PersistentAVLTree<Key, Value>::Snapshot::empty() const
+{
+    return root_ == nullptr;
+}
+
+template<typename Key, typename Value>
+int PersistentAVLTree<Key, Value>::Snapshot::height() const
+{
+    return NodeType::heightOf(root_);
+}
+
+/*
+------------------------------------------------------------
+End implementations for the PersistentAVLTree::Snapshot class.
+------------------------------------------------------------
+*/
+
+/*
+-----------------------------------------------------
+Begin implementations for the PersistentAVLTree class.
+-----------------------------------------------------
+*/
+
+template<typename Key, typename Value>
+PersistentAVLTree<Key, Value>::PersistentAVLTree()
+{
+
+}
+
+/**
+* Inserts a pair, or overwrites the value if the key is already there,
+* and publishes the result as the new current version.
+*/
+template<typename Key, typename Value>
+void PersistentAVLTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    std::lock_guard<std::mutex> guard(writeLock_);
+    NodePtr current = std::atomic_load(&root_);
+    publish(insertHelper(current, keyValuePair));
+}
+
+/**
+* Removes a key if it is there and publishes the result. A missing key
+* publishes nothing.
+*/
+template<typename Key, typename Value>
+void PersistentAVLTree<Key, Value>::remove(const Key& key)
+{
+    std::lock_guard<std::mutex> guard(writeLock_);
+    NodePtr current = std::atomic_load(&root_);
+    bool removed = false;
+    NodePtr next = removeHelper(current, key, &removed);
+    if(removed){
+        publish(next);
+    }
+}
+
+/**
+* Publishes an empty version. Older versions live on in their snapshots.
+*/
+template<typename Key, typename Value>
+void PersistentAVLTree<Key, Value>::clear()
+{
+    std::lock_guard<std::mutex> guard(writeLock_);
+    publish(NodePtr());
+}
+
+/**
+* Returns the current version in O(1). Safe to call from any thread.
+*/
+template<typename Key, typename Value>
+typename PersistentAVLTree<Key, Value>::Snapshot
+PersistentAVLTree<Key, Value>::snapshot() const
+{
+    return Snapshot(std::atomic_load(&root_));
+}
+
+template<typename Key, typename Value>
+void PersistentAVLTree<Key, Value>::publish(const NodePtr& root)
+{
+    std::atomic_store(&root_, root);
+}
+
+template<typename Key, typename Value>
+typename PersistentAVLTree<Key, Value>::NodePtr
+PersistentAVLTree<Key, Value>::insertHelper(const NodePtr& current, const std::pair<const Key, Value>& keyValuePair)
+{
+    if(current == nullptr){
+        return makeNode(keyValuePair, NodePtr(), NodePtr());
+    }
+    if(keyValuePair.first < current->getKey()){
+        return balance(current->getItem(), insertHelper(current->getLeft(), keyValuePair), current->getRight());
+    }
+    if(current->getKey() < keyValuePair.first){
+        return balance(current->getItem(), current->getLeft(), insertHelper(current->getRight(), keyValuePair));
+    }
+    return makeNode(keyValuePair, current->getLeft(), current->getRight());
+}
+
+/**
+* Removes key from the subtree. A node with two children is replaced by a
+* copy of its predecessor, like the swap in AVLTree::remove().
+* Subtrees the key is not in are returned as they are, uncopied.
+*/
+template<typename Key, typename Value>
+typename PersistentAVLTree<Key, Value>::NodePtr
+PersistentAVLTree<Key, Value>::removeHelper(const NodePtr& current, const Key& key, bool* removed)
+{
+    if(current == nullptr){
+        return current;
+    }
+    if(key < current->getKey()){
+        NodePtr left = removeHelper(current->getLeft(), key, removed);
+        if(!*removed){
+            return current;
+        }
+        return balance(current->getItem(), left, current->getRight());
+    }
+    if(current->getKey() < key){
+        NodePtr right = removeHelper(current->getRight(), key, removed);
+        if(!*removed){
+            return current;
+        }
+        return balance(current->getItem(), current->getLeft(), right);
+    }
+
+    *removed = true;
+    if(current->getLeft() == nullptr){
+        return current->getRight();
+    }
+    if(current->getRight() == nullptr){
+        return current->getLeft();
+    }
+    NodePtr predecessor;
+    NodePtr left = removeLargest(current->getLeft(), &predecessor);
+    return balance(predecessor->getItem(), left, current->getRight());
+}
+
+/**
+* Returns the subtree without its largest node, which goes in largest.
+*/
+template<typename Key, typename Value>
+typename PersistentAVLTree<Key, Value>::NodePtr
+PersistentAVLTree<Key, Value>::removeLargest(const NodePtr& current, NodePtr* largest)
+{
+    if(current->getRight() == nullptr){
+        *largest = current;
+        return current->getLeft();
+    }
+    return balance(current->getItem(), current->getLeft(), removeLargest(current->getRight(), largest));
+}
+
+/**
+* Builds a node over left and right, rotating (by building new nodes) if
+* their heights differ by 2. Left and right must already be AVL trees.
+*/
+template<typename Key, typename Value>
+typename PersistentAVLTree<Key, Value>::NodePtr
+PersistentAVLTree<Key, Value>::balance(const std::pair<const Key, Value>& item, const NodePtr& left, const NodePtr& right)
+{
+    int leftHeight = NodeType::heightOf(left);
+    int rightHeight = NodeType::heightOf(right);
+    // Left heavy
+    if(leftHeight > rightHeight + 1){
+        if(NodeType::heightOf(left->getLeft()) >= NodeType::heightOf(left->getRight())){
+            return makeNode(left->getItem(), left->getLeft(), makeNode(item, left->getRight(), right));
+        }
+        const NodePtr& inner = left->getRight();
+        return makeNode(inner->getItem(),
+            makeNode(left->getItem(), left->getLeft(), inner->getLeft()),
+            makeNode(item, inner->getRight(), right));
+    }
+    // Right heavy
+    if(rightHeight > leftHeight + 1){
+        if(NodeType::heightOf(right->getRight()) >= NodeType::heightOf(right->getLeft())){
+            return makeNode(right->getItem(), makeNode(item, left, right->getLeft()), right->getRight());
+        }
+        const NodePtr& inner = right->getLeft();
+        return makeNode(inner->getItem(),
+            makeNode(item, left, inner->getLeft()),
+            makeNode(right->getItem(), inner->getRight(), right->getRight()));
+    }
+    return makeNode(item, left, right);
+}
+
+template<typename Key, typename Value>
+typename PersistentAVLTree<Key, Value>::NodePtr
+PersistentAVLTree<Key, Value>::makeNode(const std::pair<const Key, Value>& item, const NodePtr& left, const NodePtr& right)
+{
+    return std::make_shared<const NodeType>(item, left, right);
+}
+
+/*
+---------------------------------------------------
+End implementations for the PersistentAVLTree class.
+---------------------------------------------------
+*/
+
+#endif
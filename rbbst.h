@@ -0,0 +1,610 @@
+#ifndef RBBST_H
+#define RBBST_H
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+#include "bst.h"
+
+/**
+* A node for a red-black tree, which adds the color to the plain Node. The
+* color is a single bit; with BST_PACKED_BALANCE it lives in the tag of
+* the parent pointer, so the node is no bigger than a plain Node.
+*/
+template <typename Key, typename Value>
+class RBNode : public Node<Key, Value>
+{
+public:
+    // New nodes are red
+    RBNode(const Key& key, const Value& value, RBNode<Key, Value>* parent);
+    ~RBNode();
+
+    bool isRed() const;
+    void setRed(bool red);
+
+    // Hide the Node versions, as in AVLNode
+    RBNode<Key, Value>* getParent() const;
+    RBNode<Key, Value>* getLeft() const;
+    RBNode<Key, Value>* getRight() const;
+
+protected:
+#ifdef BST_PACKED_BALANCE
+    static_assert(alignof(Node<Key, Value>) >= 2, "BST_PACKED_BALANCE needs aligned nodes");
+#else
+    bool red_;
+#endif
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the RBNode class.
+  -------------------------------------------------
+*/
+
+template<class Key, class Value>
+RBNode<Key, Value>::RBNode(const Key& key, const Value& value, RBNode<Key, Value>* parent) :
+    Node<Key, Value>(key, value, parent)
+#ifndef BST_PACKED_BALANCE
+    , red_(true)
+#endif
+{
+#ifdef BST_PACKED_BALANCE
+    setRed(true);
+#endif
+}
+
+template<class Key, class Value>
+RBNode<Key, Value>::~RBNode()
+{
+
+}
+
+template<class Key, class Value>
+bool RBNode<Key, Value>::isRed() const
+{
+#ifdef BST_PACKED_BALANCE
+    return (this->getParentTag() & 1) != 0;
+#else
+    return red_;
+#endif
+}
+
+template<class Key, class Value>
+void RBNode<Key, Value>::setRed(bool red)
+{
+#ifdef BST_PACKED_BALANCE
+    this->setParentTag(red ? 1 : 0);
+#else
+    red_ = red;
+#endif
+}
+
+template<class Key, class Value>
+RBNode<Key, Value>* RBNode<Key, Value>::getParent() const
+{
+    return static_cast<RBNode<Key, Value>*>(Node<Key, Value>::getParent());
+}
+
+template<class Key, class Value>
+RBNode<Key, Value>* RBNode<Key, Value>::getLeft() const
+{
+    return static_cast<RBNode<Key, Value>*>(this->left_);
+}
+
+template<class Key, class Value>
+RBNode<Key, Value>* RBNode<Key, Value>::getRight() const
+{
+    return static_cast<RBNode<Key, Value>*>(this->right_);
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the RBNode class.
+  -----------------------------------------------
+*/
+
+/**
+* A red-black tree. It is less strictly balanced than an AVLTree, up to
+* 2 log n deep rather than 1.44 log n, but an insert does at most two
+* rotations and a remove at most three, where an AVL remove can rotate at
+* every level. Recoloring walks up the tree, O(1) amortized per update.
+*/
+template <class Key, class Value>
+class RedBlackTree : public BinarySearchTree<Key, Value>
+{
+public:
+    RedBlackTree();
+    template<typename InputIt>
+    RedBlackTree(InputIt first, InputIt last);
+    virtual ~RedBlackTree();
+
+    virtual void insert(const std::pair<const Key, Value>& keyValuePair);
+    virtual void remove(const Key& key);
+    virtual void setScapegoatAlpha(double alpha);
+    virtual void rebalance();
+    virtual void rebuildOptimal();
+
+    template<typename InputIt>
+    void assign(InputIt first, InputIt last);
+
+    bool isRedBlack() const;
+
+protected:
+    virtual void destroyNode(Node<Key, Value>* current);
+    virtual Node<Key, Value>* insertLeaf(Node<Key, Value>* parent, bool left, size_t depth,
+        const Key& key, const Value& value);
+    void nodeSwap(RBNode<Key, Value>* n1, RBNode<Key, Value>* n2);
+
+    void insertFix(RBNode<Key, Value>* node);
+    void removeFix(RBNode<Key, Value>* node, RBNode<Key, Value>* parent);
+    void rotateLeft(RBNode<Key, Value>* node);
+    void rotateRight(RBNode<Key, Value>* node);
+    static bool isRed(const RBNode<Key, Value>* node);
+    static int blackHeight(const RBNode<Key, Value>* node);
+    static void recolor(RBNode<Key, Value>* node, size_t depth, size_t redDepth);
+
+    RBNode<Key, Value>* buildBalanced(const std::vector<std::pair<Key, Value> >& items,
+        size_t lo, size_t hi, RBNode<Key, Value>* parent, size_t depth, size_t redDepth);
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the RedBlackTree class.
+  -------------------------------------------------
+*/
+
+template<class Key, class Value>
+RedBlackTree<Key, Value>::RedBlackTree()
+{
+
+}
+
+/**
+* Builds a balanced red-black tree out of the pairs in [first, last).
+*/
+template<class Key, class Value>
+template<typename InputIt>
+RedBlackTree<Key, Value>::RedBlackTree(InputIt first, InputIt last)
+{
+    assign(first, last);
+}
+
+/**
+* Clears here rather than in ~BinarySearchTree(), where destroyNode() would
+* no longer reach the RBNode version.
+*/
+template<class Key, class Value>
+RedBlackTree<Key, Value>::~RedBlackTree()
+{
+    this->clear();
+}
+
+template<class Key, class Value>
+void RedBlackTree<Key, Value>::destroyNode(Node<Key, Value>* current)
+{
+    this->template destroyNodeAs<RBNode<Key, Value> >(current);
+}
+
+/**
+* Replaces the contents of the tree with the pairs in [first, last) in O(n),
+* with no rotations. Splitting around the middle puts every leaf on one of
+* the two deepest levels; the full levels are black and the partial last
+* one red, so every path has the same number of black nodes.
+*/
+template<class Key, class Value>
+template<typename InputIt>
+void RedBlackTree<Key, Value>::assign(InputIt first, InputIt last)
+{
+    std::vector<std::pair<Key, Value> > items;
+    BinarySearchTree<Key, Value>::sortedItems(first, last, items);
+    this->clear();
+    size_t fullLevels = 0;
+    while((size_t(2) << fullLevels) - 1 <= items.size()){
+        fullLevels++;
+    }
+    this->root_ = buildBalanced(items, 0, items.size(), nullptr, 0, fullLevels);
+}
+
+template<class Key, class Value>
+RBNode<Key, Value>* RedBlackTree<Key, Value>::buildBalanced(const std::vector<std::pair<Key, Value> >& items,
+    size_t lo, size_t hi, RBNode<Key, Value>* parent, size_t depth, size_t redDepth)
+{
+    if(lo >= hi){
+        return nullptr;
+    }
+    size_t mid = lo + (hi - lo) / 2;
+    RBNode<Key, Value>* current =
+        this->template createNode<RBNode<Key, Value> >(items[mid].first, items[mid].second, parent);
+    current->setLeft(buildBalanced(items, lo, mid, current, depth + 1, redDepth));
+    current->setRight(buildBalanced(items, mid + 1, hi, current, depth + 1, redDepth));
+    current->setRed(depth == redDepth);
+    current->updateSubtreeSize();
+    return current;
+}
+
+/**
+* Overwrites the value if the key is already in the tree, otherwise adds
+* it with insertLeaf().
+*/
+template<class Key, class Value>
+void RedBlackTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    Node<Key, Value>* parent;
+    bool left;
+    size_t depth;
+    Node<Key, Value>* found = this->findSlot(keyValuePair.first, &parent, &left, &depth);
+    if(found != nullptr){
+        found->setValue(keyValuePair.second);
+        return;
+    }
+    insertLeaf(parent, left, depth, keyValuePair.first, keyValuePair.second);
+}
+
+/**
+* The new node goes in red where findSlot() found room for it, and
+* insertFix() repairs a red parent.
+*/
+template<class Key, class Value>
+Node<Key, Value>* RedBlackTree<Key, Value>::insertLeaf(Node<Key, Value>* parentNode, bool left, size_t depth,
+    const Key& key, const Value& value)
+{
+    (void)depth;
+    RBNode<Key, Value>* parent = static_cast<RBNode<Key, Value>*>(parentNode);
+    RBNode<Key, Value>* added = this->template createNode<RBNode<Key, Value> >(key, value, parent);
+    if(parent == nullptr){
+        this->root_ = added;
+    }
+    else if(left){
+        parent->setLeft(added);
+    }
+    else{
+        parent->setRight(added);
+    }
+
+    // Sizes first, so that the rotations below see correct child sizes
+    this->updateSizesToRoot(parent);
+    insertFix(added);
+    return added;
+}
+
+/**
+* Rejects scapegoat mode: its rebuilds relink nodes without recoloring
+* them, which breaks the red-black rules that remove() relies on.
+*/
+template<class Key, class Value>
+void RedBlackTree<Key, Value>::setScapegoatAlpha(double alpha)
+{
+    if(alpha != 0){
+        throw std::logic_error("RedBlackTree does not support scapegoat mode");
+    }
+}
+
+/**
+* Relinks the nodes into a complete tree as the plain tree does, then
+* colors it the way assign() colors the trees it builds: the full levels
+* black and a partial last level red.
+*/
+template<class Key, class Value>
+void RedBlackTree<Key, Value>::rebalance()
+{
+    BinarySearchTree<Key, Value>::rebalance();
+    size_t count = this->size();
+    size_t fullLevels = 0;
+    while((size_t(2) << fullLevels) - 1 <= count){
+        fullLevels++;
+    }
+    recolor(static_cast<RBNode<Key, Value>*>(this->root_), 0, fullLevels);
+}
+
+/**
+* Not supported: a hot key near the root can leave a path with too few
+* black nodes to color any other path to match.
+*/
+template<class Key, class Value>
+void RedBlackTree<Key, Value>::rebuildOptimal()
+{
+    throw std::logic_error("RedBlackTree cannot be rebuilt for lookup weights");
+}
+
+template<class Key, class Value>
+void RedBlackTree<Key, Value>::recolor(RBNode<Key, Value>* node, size_t depth, size_t redDepth)
+{
+    if(node == nullptr){
+        return;
+    }
+    node->setRed(depth == redDepth);
+    recolor(node->getLeft(), depth + 1, redDepth);
+    recolor(node->getRight(), depth + 1, redDepth);
+}
+
+/**
+* Fixes a red node with a red parent. A red uncle means recoloring and
+* moving the problem two levels up; a black uncle ends it with one or
+* two rotations.
+*/
+template<class Key, class Value>
+void RedBlackTree<Key, Value>::insertFix(RBNode<Key, Value>* node)
+{
+    while(isRed(node->getParent())){
+        RBNode<Key, Value>* parent = node->getParent();
+        // The parent is red, so it is not the root and has a parent
+        RBNode<Key, Value>* grandparent = parent->getParent();
+        if(grandparent->getLeft() == parent){
+            RBNode<Key, Value>* uncle = grandparent->getRight();
+            if(isRed(uncle)){
+                parent->setRed(false);
+                uncle->setRed(false);
+                grandparent->setRed(true);
+                node = grandparent;
+                continue;
+            }
+            if(parent->getRight() == node){
+                rotateLeft(parent);
+                parent = node;
+            }
+            rotateRight(grandparent);
+        }
+        else{
+            RBNode<Key, Value>* uncle = grandparent->getLeft();
+            if(isRed(uncle)){
+                parent->setRed(false);
+                uncle->setRed(false);
+                grandparent->setRed(true);
+                node = grandparent;
+                continue;
+            }
+            if(parent->getLeft() == node){
+                rotateRight(parent);
+                parent = node;
+            }
+            rotateLeft(grandparent);
+        }
+        parent->setRed(false);
+        grandparent->setRed(true);
+        break;
+    }
+    static_cast<RBNode<Key, Value>*>(this->root_)->setRed(false);
+}
+
+/*
+ * As in the other trees, a node with 2 children is swapped with its
+ * predecessor first, so the node taken out has at most 1 child.
+ */
+template<class Key, class Value>
+void RedBlackTree<Key, Value>::remove(const Key& key)
+{
+    RBNode<Key, Value>* temp = static_cast<RBNode<Key, Value>*>(this->internalFind(key));
+    if(temp == nullptr){
+        return;
+    }
+
+    if(temp->getLeft() != nullptr && temp->getRight() != nullptr){
+        nodeSwap(temp, static_cast<RBNode<Key, Value>*>(this->predecessor(temp)));
+    }
+
+    RBNode<Key, Value>* parent = temp->getParent();
+    RBNode<Key, Value>* child = temp->getLeft();
+    if(child == nullptr){
+        child = temp->getRight();
+    }
+    if(child != nullptr){
+        child->setParent(parent);
+    }
+    if(parent == nullptr){
+        this->root_ = child;
+    }
+    else if(parent->getLeft() == temp){
+        parent->setLeft(child);
+    }
+    else{
+        parent->setRight(child);
+    }
+
+    bool removedBlack = !temp->isRed();
+    this->destroyNode(temp);
+    this->updateSizesToRoot(parent);
+    // Taking out a black node leaves its paths one black short
+    if(removedBlack){
+        removeFix(child, parent);
+    }
+}
+
+/**
+* Fixes the subtree at node, under parent, having one black node fewer
+* than its sibling's. A red node is simply made black. Otherwise a red
+* sibling is rotated up first; then a sibling with two black children is
+* made red and the shortage moves up to parent, and any other sibling
+* ends it with one or two rotations.
+*/
+template<class Key, class Value>
+void RedBlackTree<Key, Value>::removeFix(RBNode<Key, Value>* node, RBNode<Key, Value>* parent)
+{
+    while(parent != nullptr && !isRed(node)){
+        // node may be null, but then its sibling is not, since it has to
+        // hold a black node more
+        if(parent->getLeft() == node){
+            RBNode<Key, Value>* sibling = parent->getRight();
+            if(sibling->isRed()){
+                sibling->setRed(false);
+                parent->setRed(true);
+                rotateLeft(parent);
+                sibling = parent->getRight();
+            }
+            if(!isRed(sibling->getLeft()) && !isRed(sibling->getRight())){
+                sibling->setRed(true);
+                node = parent;
+                parent = node->getParent();
+                continue;
+            }
+            if(!isRed(sibling->getRight())){
+                sibling->getLeft()->setRed(false);
+                sibling->setRed(true);
+                rotateRight(sibling);
+                sibling = parent->getRight();
+            }
+            sibling->setRed(parent->isRed());
+            parent->setRed(false);
+            sibling->getRight()->setRed(false);
+            rotateLeft(parent);
+        }
+        else{
+            RBNode<Key, Value>* sibling = parent->getLeft();
+            if(sibling->isRed()){
+                sibling->setRed(false);
+                parent->setRed(true);
+                rotateRight(parent);
+                sibling = parent->getLeft();
+            }
+            if(!isRed(sibling->getLeft()) && !isRed(sibling->getRight())){
+                sibling->setRed(true);
+                node = parent;
+                parent = node->getParent();
+                continue;
+            }
+            if(!isRed(sibling->getLeft())){
+                sibling->getRight()->setRed(false);
+                sibling->setRed(true);
+                rotateLeft(sibling);
+                sibling = parent->getLeft();
+            }
+            sibling->setRed(parent->isRed());
+            parent->setRed(false);
+            sibling->getLeft()->setRed(false);
+            rotateRight(parent);
+        }
+        node = static_cast<RBNode<Key, Value>*>(this->root_);
+        break;
+    }
+    if(node != nullptr){
+        node->setRed(false);
+    }
+}
+
+/**
+* Makes node's right child take its place.
+*/
+template<class Key, class Value>
+void RedBlackTree<Key, Value>::rotateLeft(RBNode<Key, Value>* node)
+{
+    RBNode<Key, Value>* child = node->getRight();
+    RBNode<Key, Value>* parent = node->getParent();
+    child->setParent(parent);
+    if(parent == nullptr){
+        this->root_ = child;
+    }
+    else if(parent->getLeft() == node){
+        parent->setLeft(child);
+    }
+    else{
+        parent->setRight(child);
+    }
+
+    node->setRight(child->getLeft());
+    if(child->getLeft() != nullptr){
+        child->getLeft()->setParent(node);
+    }
+    child->setLeft(node);
+    node->setParent(child);
+    node->updateSubtreeSize();
+    child->updateSubtreeSize();
+}
+
+/**
+* Makes node's left child take its place.
+*/
+template<class Key, class Value>
+void RedBlackTree<Key, Value>::rotateRight(RBNode<Key, Value>* node)
+{
+    RBNode<Key, Value>* child = node->getLeft();
+    RBNode<Key, Value>* parent = node->getParent();
+    child->setParent(parent);
+    if(parent == nullptr){
+        this->root_ = child;
+    }
+    else if(parent->getLeft() == node){
+        parent->setLeft(child);
+    }
+    else{
+        parent->setRight(child);
+    }
+
+    node->setLeft(child->getRight());
+    if(child->getRight() != nullptr){
+        child->getRight()->setParent(node);
+    }
+    child->setRight(node);
+    node->setParent(child);
+    node->updateSubtreeSize();
+    child->updateSubtreeSize();
+}
+
+/**
+* Missing children count as black.
+*/
+template<class Key, class Value>
+bool RedBlackTree<Key, Value>::isRed(const RBNode<Key, Value>* node)
+{
+    return node != nullptr && node->isRed();
+}
+
+/**
+* Returns true if the tree keeps the red-black rules: the root is black,
+* no red node has a red child, and every path down to a leaf has the same
+* number of black nodes. Checks the parent links on the way. O(n).
+*/
+template<class Key, class Value>
+bool RedBlackTree<Key, Value>::isRedBlack() const
+{
+    const RBNode<Key, Value>* root = static_cast<const RBNode<Key, Value>*>(this->root_);
+    if(root == nullptr){
+        return true;
+    }
+    return !root->isRed() && root->getParent() == nullptr && blackHeight(root) >= 0;
+}
+
+/**
+* The number of black nodes on each path down from node, counting node,
+* or -1 if the paths differ or a rule is broken below node.
+*/
+template<class Key, class Value>
+int RedBlackTree<Key, Value>::blackHeight(const RBNode<Key, Value>* node)
+{
+    if(node == nullptr){
+        return 0;
+    }
+    const RBNode<Key, Value>* left = node->getLeft();
+    const RBNode<Key, Value>* right = node->getRight();
+    if((left != nullptr && left->getParent() != node) || (right != nullptr && right->getParent() != node)){
+        return -1;
+    }
+    if(node->isRed() && (isRed(left) || isRed(right))){
+        return -1;
+    }
+    int leftHeight = blackHeight(left);
+    int rightHeight = blackHeight(right);
+    if(leftHeight < 0 || leftHeight != rightHeight){
+        return -1;
+    }
+    return leftHeight + (node->isRed() ? 0 : 1);
+}
+
+/**
+* Swaps the colors along with the places, so each position keeps its color.
+*/
+template<class Key, class Value>
+void RedBlackTree<Key, Value>::nodeSwap(RBNode<Key, Value>* n1, RBNode<Key, Value>* n2)
+{
+    BinarySearchTree<Key, Value>::nodeSwap(n1, n2);
+    bool tempRed = n1->isRed();
+    n1->setRed(n2->isRed());
+    n2->setRed(tempRed);
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the RedBlackTree class.
+  -----------------------------------------------
+*/
+
+#endif
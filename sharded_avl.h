@@ -0,0 +1,561 @@
+#ifndef SHARDED_AVL_H
+#define SHARDED_AVL_H
+
+#include <iostream>
+#include <cstddef>
+#include <utility>
+#include <iterator>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include "avlbst.h"
+
+/**
+* A map that splits the key space into ranges, each held by its own AVLTree
+* behind its own lock, so that threads working on different ranges never
+* contend.
+*
+* The shard table (the ranges and their trees) is immutable and published
+* atomically. Resizing builds a new table: a shard that grows past twice its
+* fair share is split near its median, and a shard that shrinks well below it
+* is merged with a neighbour, using AVLTree::split() and join() so that no
+* node is copied. A shard that was replaced is marked retired, and an
+* operation that finds its shard retired looks it up again.
+*
+* Like ConcurrentAVLTree, values are copied out and iterators are weakly
+* consistent: each step finds the next key in whatever shard holds it now.
+*/
+template <typename Key, typename Value>
+class ShardedAVLMap
+{
+public:
+    explicit ShardedAVLMap(size_t targetShards = 16, size_t minShardSize = 1024);
+
+    class iterator
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef std::pair<Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const std::pair<Key, Value>* pointer;
+        typedef const std::pair<Key, Value>& reference;
+
+        iterator();
+
+        const std::pair<Key, Value>& operator*() const;
+        const std::pair<Key, Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+    protected:
+        friend class ShardedAVLMap<Key, Value>;
+        explicit iterator(const ShardedAVLMap* map);
+        void seek(const Key* after);
+
+        const ShardedAVLMap* map_;
+        std::pair<Key, Value> item_;
+        bool atEnd_;
+    };
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+
+    size_t size() const;
+    bool empty() const;
+    size_t shardCount() const;
+
+    iterator begin() const;
+    iterator end() const;
+
+protected:
+    // An AVLTree that shows its root key, so a shard can be split near its
+    // median without walking it
+    class ShardTree : public AVLTree<Key, Value>
+    {
+    public:
+        const Key* rootKey() const
+        {
+            return (this->root_ == nullptr) ? nullptr : &this->root_->getKey();
+        }
+    };
+
+    struct Shard
+    {
+        Shard() : count(0), retired(false) { }
+        std::mutex lock;
+        ShardTree tree;
+        // Exact with BST_ORDER_STATISTICS. Without it a split can only
+        // estimate how many keys each half gets, so the count is approximate;
+        // it only steers splits and merges.
+        size_t count;
+        // Set once the shard has been replaced by a split or merge
+        bool retired;
+    };
+
+    struct Table
+    {
+        // boundaries[i] is the smallest key that belongs to shards[i + 1]
+        std::vector<Key> boundaries;
+        std::vector<std::shared_ptr<Shard> > shards;
+
+        size_t indexOf(const Key& key) const;
+    };
+
+    std::shared_ptr<Shard> lockShardFor(const Key& key, std::unique_lock<std::mutex>& guard) const;
+    size_t fairShare() const;
+    void resize(const std::shared_ptr<Shard>& shard);
+    bool mergeIfSmall(const std::shared_ptr<const Table>& table, size_t index, size_t share);
+    void splitShard(const std::shared_ptr<const Table>& table, size_t index);
+    void mergeShards(const std::shared_ptr<const Table>& table, size_t index);
+
+    // Only ever read and written through std::atomic_load/atomic_store
+    std::shared_ptr<const Table> table_;
+    // Serializes splits and merges; never taken while holding a shard lock
+    std::mutex resizeLock_;
+    std::atomic<size_t> total_;
+    size_t targetShards_;
+    size_t minShardSize_;
+
+private:
+    ShardedAVLMap(const ShardedAVLMap&);
+    ShardedAVLMap& operator=(const ShardedAVLMap&);
+};
+
+/*
+  ---------------------------------------------------------
+  Begin implementations for the ShardedAVLMap::iterator class.
+  ---------------------------------------------------------
+*/
+
+template<typename Key, typename Value>
+ShardedAVLMap<Key, Value>::iterator::iterator() :
+    map_(nullptr),
+    item_(),
+    atEnd_(true)
+{
+
+}
+
+template<typename Key, typename Value>
+ShardedAVLMap<Key, Value>::iterator::iterator(const ShardedAVLMap* map) :
+    map_(map),
+    item_(),
+    atEnd_(true)
+{
+
+}
+
+template<typename Key, typename Value>
+const std::pair<Key, Value>& ShardedAVLMap<Key, Value>::iterator::operator*() const
+{
+    return item_;
+}
+
+template<typename Key, typename Value>
+const std::pair<Key, Value>* ShardedAVLMap<Key, Value>::iterator::operator->() const
+{
+    return &item_;
+}
+
+template<typename Key, typename Value>
+bool ShardedAVLMap<Key, Value>::iterator::operator==(const iterator& rhs) const
+{
+    if(atEnd_ || rhs.atEnd_){
+        return atEnd_ && rhs.atEnd_;
+    }
+    return !(item_.first < rhs.item_.first) && !(rhs.item_.first < item_.first);
+}
+
+template<typename Key, typename Value>
+bool ShardedAVLMap<Key, Value>::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+template<typename Key, typename Value>
+typename ShardedAVLMap<Key, Value>::iterator&
+ShardedAVLMap<Key, Value>::iterator::operator++()
+{
+    Key current = item_.first;
+    seek(&current);
+    return *this;
+}
+
+/**
+* Moves to the smallest key greater than *after, or the smallest key of all
+* if after is NULL. Starts in the shard that would hold *after and moves on
+* to the next shard while there is nothing bigger. If a shard turns out to
+* be retired, starts over with the current table.
+*/
+template<typename Key, typename Value>
+void ShardedAVLMap<Key, Value>::iterator::seek(const Key* after)
+{
+    while(true){
+        std::shared_ptr<const Table> table = std::atomic_load(&map_->table_);
+        size_t index = (after == nullptr) ? 0 : table->indexOf(*after);
+        bool retired = false;
+        for(; index < table->shards.size() && !retired; index++){
+            Shard& shard = *table->shards[index];
+            std::lock_guard<std::mutex> guard(shard.lock);
+            if(shard.retired){
+                retired = true;
+                break;
+            }
+            typename AVLTree<Key, Value>::iterator it =
+                (after == nullptr) ? shard.tree.begin() : shard.tree.upper_bound(*after);
+            if(it != shard.tree.end()){
+                item_ = std::pair<Key, Value>(it->first, it->second);
+                atEnd_ = false;
+                return;
+            }
+        }
+        if(!retired){
+            atEnd_ = true;
+            return;
+        }
+    }
+}
+
+/*
+  -------------------------------------------------------
+  End implementations for the ShardedAVLMap::iterator class.
+  -------------------------------------------------------
+*/
+
+/*
+  -------------------------------------------------
+  Begin implementations for the ShardedAVLMap class.
+  -------------------------------------------------
+*/
+
+/**
+* Starts with a single shard. Shards split once they hold more than twice
+* max(minShardSize, size() / targetShards) keys, so a growing map ends up
+* with around targetShards of them.
+*/
+template<typename Key, typename Value>
+ShardedAVLMap<Key, Value>::ShardedAVLMap(size_t targetShards, size_t minShardSize) :
+    total_(0),
+    targetShards_(std::max<size_t>(targetShards, 1)),
+    minShardSize_(std::max<size_t>(minShardSize, 1))
+{
+    std::shared_ptr<Table> table = std::make_shared<Table>();
+    table->shards.push_back(std::make_shared<Shard>());
+    table_ = table;
+}
+
+/**
+* Inserts a pair, or overwrites the value if the key is already there.
+*/
+template<typename Key, typename Value>
+void ShardedAVLMap<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    bool needsResize = false;
+    std::shared_ptr<Shard> shard;
+    {
+        std::unique_lock<std::mutex> guard;
+        shard = lockShardFor(keyValuePair.first, guard);
+        bool added = shard->tree.insert_or_assign(keyValuePair.first, keyValuePair.second).second;
+        if(added){
+            shard->count++;
+            total_++;
+            needsResize = shard->count > 2 * fairShare();
+        }
+    }
+    if(needsResize){
+        resize(shard);
+    }
+}
+
+template<typename Key, typename Value>
+void ShardedAVLMap<Key, Value>::remove(const Key& key)
+{
+    bool needsResize = false;
+    std::shared_ptr<Shard> shard;
+    {
+        std::unique_lock<std::mutex> guard;
+        shard = lockShardFor(key, guard);
+        if(shard->tree.erase(key) != 0){
+            if(shard->count > 0){
+                shard->count--;
+            }
+            total_--;
+            // Check when the shard first drops below a quarter of its share,
+            // and again once it is empty
+            size_t quarter = fairShare() / 4;
+            needsResize = shard->count < quarter && (shard->count + 1 >= quarter || shard->tree.empty());
+        }
+    }
+    if(needsResize){
+        resize(shard);
+    }
+}
+
+/**
+* Copies the value for key into value and returns true, or returns false
+* if the key is not there.
+*/
+template<typename Key, typename Value>
+bool ShardedAVLMap<Key, Value>::find(const Key& key, Value& value) const
+{
+    std::unique_lock<std::mutex> guard;
+    std::shared_ptr<Shard> shard = lockShardFor(key, guard);
+    typename AVLTree<Key, Value>::iterator it = shard->tree.find(key);
+    if(it == shard->tree.end()){
+        return false;
+    }
+    value = it->second;
+    return true;
+}
+
+template<typename Key, typename Value>
+bool ShardedAVLMap<Key, Value>::contains(const Key& key) const
+{
+    std::unique_lock<std::mutex> guard;
+    std::shared_ptr<Shard> shard = lockShardFor(key, guard);
+    return shard->tree.find(key) != shard->tree.end();
+}
+
+template<typename Key, typename Value>
+size_t ShardedAVLMap<Key, Value>::size() const
+{
+    return total_.load();
+}
+
+template<typename Key, typename Value>
+bool ShardedAVLMap<Key, Value>::empty() const
+{
+    return size() == 0;
+}
+
+template<typename Key, typename Value>
+size_t ShardedAVLMap<Key, Value>::shardCount() const
+{
+    return std::atomic_load(&table_)->shards.size();
+}
+
+template<typename Key, typename Value>
+typename ShardedAVLMap<Key, Value>::iterator
+ShardedAVLMap<Key, Value>::begin() const
+{
+    iterator it(this);
+    it.seek(nullptr);
+    return it;
+}
+
+template<typename Key, typename Value>
+typename ShardedAVLMap<Key, Value>::iterator
+ShardedAVLMap<Key, Value>::end() const
+{
+    return iterator(this);
+}
+
+/**
+* The shard whose range holds key.
+*/
+template<typename Key, typename Value>
+size_t ShardedAVLMap<Key, Value>::Table::indexOf(const Key& key) const
+{
+    return std::upper_bound(boundaries.begin(), boundaries.end(), key) - boundaries.begin();
+}
+
+/**
+* Returns the live shard for key with its lock held by guard.
+*/
+template<typename Key, typename Value>
+std::shared_ptr<typename ShardedAVLMap<Key, Value>::Shard>
+ShardedAVLMap<Key, Value>::lockShardFor(const Key& key, std::unique_lock<std::mutex>& guard) const
+{
+    while(true){
+        std::shared_ptr<const Table> table = std::atomic_load(&table_);
+        std::shared_ptr<Shard> shard = table->shards[table->indexOf(key)];
+        std::unique_lock<std::mutex> lock(shard->lock);
+        if(!shard->retired){
+            guard.swap(lock);
+            return shard;
+        }
+    }
+}
+
+template<typename Key, typename Value>
+size_t ShardedAVLMap<Key, Value>::fairShare() const
+{
+    return std::max(minShardSize_, total_.load() / targetShards_);
+}
+
+/**
+* Splits or merges shard if it is still in the table and still out of
+* proportion by the time we hold the resize lock. After a split, also
+* merges the shards that have fallen below a quarter of the fair share: a
+* shard can get there without a single remove, just because the map grew
+* around it, and then nothing else would look at it.
+*/
+template<typename Key, typename Value>
+void ShardedAVLMap<Key, Value>::resize(const std::shared_ptr<Shard>& shard)
+{
+    std::lock_guard<std::mutex> resizeGuard(resizeLock_);
+    std::shared_ptr<const Table> table = std::atomic_load(&table_);
+    size_t index = 0;
+    while(index < table->shards.size() && table->shards[index] != shard){
+        index++;
+    }
+    if(index == table->shards.size()){
+        return;
+    }
+
+    size_t count;
+    {
+        std::lock_guard<std::mutex> guard(shard->lock);
+        count = shard->count;
+    }
+    size_t share = fairShare();
+    if(count <= 2 * share){
+        mergeIfSmall(table, index, share);
+        return;
+    }
+
+    splitShard(table, index);
+    size_t i = 0;
+    table = std::atomic_load(&table_);
+    while(i < table->shards.size()){
+        if(mergeIfSmall(table, i, share)){
+            // The merged shard takes index i or i - 1; look at it again
+            table = std::atomic_load(&table_);
+            i = (i > 0) ? i - 1 : 0;
+        }
+        else{
+            i++;
+        }
+    }
+}
+
+/**
+* Merges shards[index] with its smaller neighbour if it holds less than a
+* quarter of share keys and the two together stay well below the size at
+* which they would be split again. Returns true if it merged. The resize
+* lock must be held.
+*/
+template<typename Key, typename Value>
+bool ShardedAVLMap<Key, Value>::mergeIfSmall(const std::shared_ptr<const Table>& table, size_t index, size_t share)
+{
+    if(table->shards.size() < 2){
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> guard(table->shards[index]->lock);
+        if(table->shards[index]->count >= share / 4){
+            return false;
+        }
+    }
+    size_t left = index;
+    if(index + 1 == table->shards.size()){
+        left = index - 1;
+    }
+    else if(index > 0){
+        std::lock_guard<std::mutex> guard(table->shards[index - 1]->lock);
+        std::lock_guard<std::mutex> nextGuard(table->shards[index + 1]->lock);
+        if(table->shards[index - 1]->count < table->shards[index + 1]->count){
+            left = index - 1;
+        }
+    }
+    size_t combined;
+    {
+        std::lock_guard<std::mutex> leftGuard(table->shards[left]->lock);
+        std::lock_guard<std::mutex> rightGuard(table->shards[left + 1]->lock);
+        combined = table->shards[left]->count + table->shards[left + 1]->count;
+    }
+    if(combined > share + share / 2){
+        return false;
+    }
+    mergeShards(table, left);
+    return true;
+}
+
+/**
+* Replaces shards[index] with two shards split at its median key, or near
+* it, in O(log n). The resize lock must be held.
+*/
+template<typename Key, typename Value>
+void ShardedAVLMap<Key, Value>::splitShard(const std::shared_ptr<const Table>& table, size_t index)
+{
+    Shard& old = *table->shards[index];
+    std::shared_ptr<Shard> low = std::make_shared<Shard>();
+    std::shared_ptr<Shard> high = std::make_shared<Shard>();
+    std::shared_ptr<Table> next = std::make_shared<Table>(*table);
+
+    std::lock_guard<std::mutex> guard(old.lock);
+    if(old.count < 2 || old.tree.empty()){
+        return;
+    }
+#ifdef BST_ORDER_STATISTICS
+    Key median = old.tree.select(old.count / 2)->first;
+#else
+    // The real median would take a walk over the shard with its lock held.
+    // The root's subtrees differ in height by at most 1, which is close enough.
+    Key median = *old.tree.rootKey();
+#endif
+    old.tree.split(median, low->tree, high->tree);
+#ifdef BST_ORDER_STATISTICS
+    low->count = low->tree.size();
+#else
+    low->count = old.count / 2;
+#endif
+    high->count = old.count - low->count;
+    old.count = 0;
+    old.retired = true;
+
+    next->boundaries.insert(next->boundaries.begin() + index, median);
+    next->shards[index] = low;
+    next->shards.insert(next->shards.begin() + index + 1, high);
+    std::atomic_store(&table_, std::shared_ptr<const Table>(next));
+}
+
+/**
+* Replaces shards[index] and shards[index + 1] with one shard, joining the
+* two trees around the smallest key of the right one.
+* The resize lock must be held.
+*/
+template<typename Key, typename Value>
+void ShardedAVLMap<Key, Value>::mergeShards(const std::shared_ptr<const Table>& table, size_t index)
+{
+    Shard& left = *table->shards[index];
+    Shard& right = *table->shards[index + 1];
+    std::shared_ptr<Shard> merged = std::make_shared<Shard>();
+    std::shared_ptr<Table> next = std::make_shared<Table>(*table);
+
+    std::lock_guard<std::mutex> leftGuard(left.lock);
+    std::lock_guard<std::mutex> rightGuard(right.lock);
+    merged->count = left.count + right.count;
+    if(right.tree.begin() == right.tree.end()){
+        merged->tree.setUnion(left.tree);
+    }
+    else{
+        std::pair<const Key, Value> pivot = *right.tree.begin();
+        right.tree.remove(pivot.first);
+        merged->tree.join(left.tree, pivot, right.tree);
+    }
+    left.count = 0;
+    right.count = 0;
+    left.retired = true;
+    right.retired = true;
+
+    next->boundaries.erase(next->boundaries.begin() + index);
+    next->shards[index] = merged;
+    next->shards.erase(next->shards.begin() + index + 1);
+    std::atomic_store(&table_, std::shared_ptr<const Table>(next));
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the ShardedAVLMap class.
+  -----------------------------------------------
+*/
+
+#endif
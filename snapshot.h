@@ -0,0 +1,453 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <cstddef>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <sys/types.h>
+#include <unistd.h>
+
+// Every snapshot starts with these four bytes and a varint version
+const unsigned char SNAPSHOT_MAGIC[4] = { 'A', 'V', 'L', 'S' };
+const unsigned SNAPSHOT_VERSION = 1;
+
+/**
+* A buffered byte sink for tree snapshots, writing to either a stream or a
+* file descriptor. Bytes go out in large blocks, so encoding one small key
+* at a time costs no system calls. flush() must be called at the end; the
+* destructor does not, since it cannot report a failed write.
+*/
+class SnapshotWriter
+{
+public:
+    explicit SnapshotWriter(std::ostream& out);
+    explicit SnapshotWriter(int fd);
+
+    void writeByte(unsigned char byte);
+    void writeBytes(const void* data, size_t size);
+    void writeVarint(std::uint64_t value);
+    void writePaddedVarint(std::uint64_t value);
+    void flush();
+
+    // A padded varint always takes this many bytes, so that it can be
+    // overwritten in place once the value is known
+    static const size_t PADDED_VARINT_SIZE = 10;
+    static void encodePaddedVarint(std::uint64_t value, unsigned char* out);
+
+    // The bytes a writer holds before it writes them out
+    static const size_t BUFFER_SIZE = 1 << 16;
+
+private:
+    std::ostream* out_;
+    int fd_;
+    std::vector<unsigned char> buffer_;
+    size_t used_;
+};
+
+/**
+* The matching byte source. A stream is read through its own buffer, so
+* the stream is left just past the snapshot. A file descriptor is read in
+* large blocks and may be left past that, unless the reader is given an
+* offset to start at: then it reads with pread() and leaves the
+* descriptor's own offset alone, so several readers can share one file.
+* Running out of bytes before the snapshot is complete throws
+* std::runtime_error.
+*/
+class SnapshotReader
+{
+public:
+    explicit SnapshotReader(std::istream& in);
+    explicit SnapshotReader(int fd);
+    SnapshotReader(int fd, off_t offset);
+
+    unsigned char readByte();
+    void readBytes(void* data, size_t size);
+    std::uint64_t readVarint();
+
+    // The bytes a reader of a file descriptor holds at a time
+    static const size_t BUFFER_SIZE = 1 << 16;
+
+private:
+    void refill();
+
+    std::streambuf* in_;
+    int fd_;
+    // Where the next pread() starts, or -1 to read() from the descriptor
+    off_t offset_;
+    std::vector<unsigned char> buffer_;
+    size_t next_;
+    size_t end_;
+};
+
+/**
+* How a key or value is written to a snapshot. Each codec has
+*
+*   static void write(SnapshotWriter& out, const T& value, const T* previous);
+*   static T read(SnapshotReader& in, const T* previous);
+*
+* Keys are written in increasing order and get the key before them as
+* previous (nullptr for the first); values always get nullptr. Any class
+* with these two functions can be passed to AVLTree::save() and load() in
+* place of the defaults below.
+*
+* The default for types with no codec of their own copies their bytes,
+* so it only accepts trivially copyable types.
+*/
+template <typename T, bool Integral = std::is_integral<T>::value && !std::is_same<T, bool>::value>
+class SnapshotCodec
+{
+public:
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "SnapshotCodec has no default encoding for this type; pass a codec to save() and load()");
+
+    static void write(SnapshotWriter& out, const T& value, const T* previous);
+    static T read(SnapshotReader& in, const T* previous);
+};
+
+/**
+* Integers are written as varints: a key as its gap from the key before
+* it, which is small for dense keys, and anything else zigzag encoded so
+* that small negative numbers stay short too.
+*/
+template <typename T>
+class SnapshotCodec<T, true>
+{
+public:
+    static void write(SnapshotWriter& out, const T& value, const T* previous);
+    static T read(SnapshotReader& in, const T* previous);
+
+private:
+    typedef typename std::make_unsigned<T>::type Unsigned;
+};
+
+/**
+* Strings are written as their length followed by their bytes.
+*/
+template <>
+class SnapshotCodec<std::string, false>
+{
+public:
+    static void write(SnapshotWriter& out, const std::string& value, const std::string* previous);
+    static std::string read(SnapshotReader& in, const std::string* previous);
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the SnapshotWriter class.
+  -------------------------------------------------
+*/
+
+inline SnapshotWriter::SnapshotWriter(std::ostream& out) :
+    out_(&out),
+    fd_(-1),
+    buffer_(BUFFER_SIZE),
+    used_(0)
+{
+
+}
+
+inline SnapshotWriter::SnapshotWriter(int fd) :
+    out_(nullptr),
+    fd_(fd),
+    buffer_(BUFFER_SIZE),
+    used_(0)
+{
+
+}
+
+inline void SnapshotWriter::writeByte(unsigned char byte)
+{
+    if(used_ == BUFFER_SIZE){
+        flush();
+    }
+    buffer_[used_++] = byte;
+}
+
+inline void SnapshotWriter::writeBytes(const void* data, size_t size)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    while(size > 0){
+        if(used_ == BUFFER_SIZE){
+            flush();
+        }
+        size_t chunk = std::min(size, BUFFER_SIZE - used_);
+        std::memcpy(&buffer_[used_], bytes, chunk);
+        used_ += chunk;
+        bytes += chunk;
+        size -= chunk;
+    }
+}
+
+/**
+* Seven bits per byte, low bits first, with the top bit set on every byte
+* but the last.
+*/
+inline void SnapshotWriter::writeVarint(std::uint64_t value)
+{
+    while(value >= 0x80){
+        writeByte(static_cast<unsigned char>(value | 0x80));
+        value >>= 7;
+    }
+    writeByte(static_cast<unsigned char>(value));
+}
+
+/**
+* Writes value as a varint of exactly PADDED_VARINT_SIZE bytes, using
+* continuation bytes with nothing in them. readVarint() reads it back
+* like any other.
+*/
+inline void SnapshotWriter::writePaddedVarint(std::uint64_t value)
+{
+    unsigned char bytes[PADDED_VARINT_SIZE];
+    encodePaddedVarint(value, bytes);
+    writeBytes(bytes, sizeof(bytes));
+}
+
+inline void SnapshotWriter::encodePaddedVarint(std::uint64_t value, unsigned char* out)
+{
+    for(size_t i = 0; i + 1 < PADDED_VARINT_SIZE; i++){
+        out[i] = static_cast<unsigned char>((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    out[PADDED_VARINT_SIZE - 1] = static_cast<unsigned char>(value);
+}
+
+inline void SnapshotWriter::flush()
+{
+    if(out_ != nullptr){
+        out_->write(reinterpret_cast<const char*>(&buffer_[0]), used_);
+        out_->flush();
+        if(!*out_){
+            throw std::runtime_error("Snapshot write failed");
+        }
+        used_ = 0;
+        return;
+    }
+    size_t done = 0;
+    while(done < used_){
+        ssize_t written = ::write(fd_, &buffer_[done], used_ - done);
+        if(written < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            throw std::runtime_error(std::string("Snapshot write failed: ") + std::strerror(errno));
+        }
+        done += static_cast<size_t>(written);
+    }
+    used_ = 0;
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the SnapshotWriter class.
+  -----------------------------------------------
+*/
+
+/*
+  -------------------------------------------------
+  Begin implementations for the SnapshotReader class.
+  -------------------------------------------------
+*/
+
+inline SnapshotReader::SnapshotReader(std::istream& in) :
+    in_(in.rdbuf()),
+    fd_(-1),
+    offset_(-1),
+    next_(0),
+    end_(0)
+{
+
+}
+
+inline SnapshotReader::SnapshotReader(int fd) :
+    in_(nullptr),
+    fd_(fd),
+    offset_(-1),
+    buffer_(BUFFER_SIZE),
+    next_(0),
+    end_(0)
+{
+
+}
+
+inline SnapshotReader::SnapshotReader(int fd, off_t offset) :
+    in_(nullptr),
+    fd_(fd),
+    offset_(offset),
+    buffer_(BUFFER_SIZE),
+    next_(0),
+    end_(0)
+{
+
+}
+
+inline unsigned char SnapshotReader::readByte()
+{
+    if(in_ != nullptr){
+        std::streambuf::int_type byte = in_->sbumpc();
+        if(std::streambuf::traits_type::eq_int_type(byte, std::streambuf::traits_type::eof())){
+            throw std::runtime_error("Truncated snapshot");
+        }
+        return static_cast<unsigned char>(byte);
+    }
+    if(next_ == end_){
+        refill();
+    }
+    return buffer_[next_++];
+}
+
+inline void SnapshotReader::readBytes(void* data, size_t size)
+{
+    unsigned char* bytes = static_cast<unsigned char*>(data);
+    if(in_ != nullptr){
+        if(static_cast<size_t>(in_->sgetn(reinterpret_cast<char*>(bytes), size)) != size){
+            throw std::runtime_error("Truncated snapshot");
+        }
+        return;
+    }
+    while(size > 0){
+        if(next_ == end_){
+            refill();
+        }
+        size_t chunk = std::min(size, end_ - next_);
+        std::memcpy(bytes, &buffer_[next_], chunk);
+        next_ += chunk;
+        bytes += chunk;
+        size -= chunk;
+    }
+}
+
+inline std::uint64_t SnapshotReader::readVarint()
+{
+    std::uint64_t value = 0;
+    for(int shift = 0; shift < 64; shift += 7){
+        unsigned char byte = readByte();
+        value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+        if(!(byte & 0x80)){
+            return value;
+        }
+    }
+    throw std::runtime_error("Corrupt snapshot: varint too long");
+}
+
+/**
+* Reads the next block from the file descriptor. Throws if there is
+* nothing left to read.
+*/
+inline void SnapshotReader::refill()
+{
+    ssize_t result;
+    do{
+        if(offset_ < 0){
+            result = ::read(fd_, &buffer_[0], BUFFER_SIZE);
+        }
+        else{
+            result = ::pread(fd_, &buffer_[0], BUFFER_SIZE, offset_);
+        }
+    } while(result < 0 && errno == EINTR);
+    if(result < 0){
+        throw std::runtime_error(std::string("Snapshot read failed: ") + std::strerror(errno));
+    }
+    size_t got = static_cast<size_t>(result);
+    if(got == 0){
+        throw std::runtime_error("Truncated snapshot");
+    }
+    if(offset_ >= 0){
+        offset_ += static_cast<off_t>(got);
+    }
+    next_ = 0;
+    end_ = got;
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the SnapshotReader class.
+  -----------------------------------------------
+*/
+
+/*
+  ------------------------------------------------
+  Begin implementations for the SnapshotCodec class.
+  ------------------------------------------------
+*/
+
+template<typename T, bool Integral>
+void SnapshotCodec<T, Integral>::write(SnapshotWriter& out, const T& value, const T* previous)
+{
+    (void)previous;
+    out.writeBytes(&value, sizeof(T));
+}
+
+template<typename T, bool Integral>
+T SnapshotCodec<T, Integral>::read(SnapshotReader& in, const T* previous)
+{
+    (void)previous;
+    T value;
+    in.readBytes(&value, sizeof(T));
+    return value;
+}
+
+template<typename T>
+void SnapshotCodec<T, true>::write(SnapshotWriter& out, const T& value, const T* previous)
+{
+    Unsigned bits = static_cast<Unsigned>(value);
+    if(previous != nullptr){
+        // Keys only go up, so the gap is positive even when the sign flips
+        out.writeVarint(bits - static_cast<Unsigned>(*previous));
+    }
+    else if(std::is_signed<T>::value){
+        Unsigned sign = (value < 0) ? ~Unsigned(0) : Unsigned(0);
+        out.writeVarint(static_cast<Unsigned>(bits << 1) ^ sign);
+    }
+    else{
+        out.writeVarint(bits);
+    }
+}
+
+template<typename T>
+T SnapshotCodec<T, true>::read(SnapshotReader& in, const T* previous)
+{
+    Unsigned bits = static_cast<Unsigned>(in.readVarint());
+    if(previous != nullptr){
+        return static_cast<T>(static_cast<Unsigned>(static_cast<Unsigned>(*previous) + bits));
+    }
+    if(std::is_signed<T>::value){
+        Unsigned sign = (bits & 1) ? ~Unsigned(0) : Unsigned(0);
+        return static_cast<T>(static_cast<Unsigned>(bits >> 1) ^ sign);
+    }
+    return static_cast<T>(bits);
+}
+
+inline void SnapshotCodec<std::string, false>::write(SnapshotWriter& out, const std::string& value,
+    const std::string* previous)
+{
+    (void)previous;
+    out.writeVarint(value.size());
+    out.writeBytes(value.data(), value.size());
+}
+
+inline std::string SnapshotCodec<std::string, false>::read(SnapshotReader& in, const std::string* previous)
+{
+    (void)previous;
+    std::string value(static_cast<size_t>(in.readVarint()), '\0');
+    if(!value.empty()){
+        in.readBytes(&value[0], value.size());
+    }
+    return value;
+}
+
+/*
+  ----------------------------------------------
+  End implementations for the SnapshotCodec class.
+  ----------------------------------------------
+*/
+
+#endif
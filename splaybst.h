@@ -0,0 +1,329 @@
+#ifndef SPLAYBST_H
+#define SPLAYBST_H
+
+#include <stdexcept>
+#include "bst.h"
+
+/**
+* How much a SplayTree restructures on each access.
+*  - FULL_SPLAY moves every node that is found, inserted or removed next
+*    to, to the root.
+*  - SEMI_SPLAY only roughly halves its depth, which rotates less and
+*    adapts more slowly.
+*  - SPLAY_ON_WRITE leaves lookups alone and splays only on insert and
+*    remove, so any number of threads may look up at once as long as
+*    nothing writes.
+*/
+enum SplayMode { FULL_SPLAY, SEMI_SPLAY, SPLAY_ON_WRITE };
+
+/**
+* A self-adjusting search tree. Each access splays the node it reaches up
+* toward the root, so keys used often or recently stay near the top and
+* are found in a few steps, and any sequence of m operations costs
+* O(m log n) in total. Nodes are plain Nodes with no balance data.
+*
+* find() and operator[] are the splaying lookups. Called on a const tree,
+* or in SPLAY_ON_WRITE mode, they leave the tree as it is.
+*/
+template <class Key, class Value>
+class SplayTree : public BinarySearchTree<Key, Value>
+{
+public:
+    typedef typename BinarySearchTree<Key, Value>::iterator iterator;
+
+    explicit SplayTree(SplayMode mode = FULL_SPLAY);
+    virtual ~SplayTree();
+
+    virtual void remove(const Key& key);
+    virtual void setScapegoatAlpha(double alpha);
+
+    iterator find(const Key& key);
+    iterator find(const Key& key) const;
+    Value& operator[](const Key& key);
+    Value const & operator[](const Key& key) const;
+
+    SplayMode getSplayMode() const;
+    void setSplayMode(SplayMode mode);
+
+protected:
+    virtual Node<Key, Value>* insertLeaf(Node<Key, Value>* parent, bool left, size_t depth,
+        const Key& key, const Value& value);
+    virtual void accessed(Node<Key, Value>* current);
+    Node<Key, Value>* splayFind(const Key& key);
+    void splay(Node<Key, Value>* current, bool write);
+    void rotateUp(Node<Key, Value>* current);
+
+    SplayMode mode_;
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the SplayTree class.
+  -------------------------------------------------
+*/
+
+template<class Key, class Value>
+SplayTree<Key, Value>::SplayTree(SplayMode mode) :
+    mode_(mode)
+{
+
+}
+
+template<class Key, class Value>
+SplayTree<Key, Value>::~SplayTree()
+{
+
+}
+
+template<class Key, class Value>
+SplayMode SplayTree<Key, Value>::getSplayMode() const
+{
+    return mode_;
+}
+
+template<class Key, class Value>
+void SplayTree<Key, Value>::setSplayMode(SplayMode mode)
+{
+    mode_ = mode;
+}
+
+/**
+* Splaying already bounds the amortized cost, and the splaying insert()
+* and remove() never check for a scapegoat, so the mode is rejected.
+*/
+template<class Key, class Value>
+void SplayTree<Key, Value>::setScapegoatAlpha(double alpha)
+{
+    if(alpha != 0){
+        throw std::logic_error("SplayTree does not support scapegoat mode");
+    }
+}
+
+/**
+* insert() and the upserts come here when the key is already in the tree.
+* They count as writes, so the node is splayed in every mode.
+*/
+template<class Key, class Value>
+void SplayTree<Key, Value>::accessed(Node<Key, Value>* current)
+{
+    splay(current, true);
+}
+
+/**
+* Adds the node where findSlot() found room for it and splays it.
+*/
+template<class Key, class Value>
+Node<Key, Value>* SplayTree<Key, Value>::insertLeaf(Node<Key, Value>* parent, bool left, size_t depth,
+    const Key& key, const Value& value)
+{
+    (void)depth;
+    Node<Key, Value>* added = this->template createNode<Node<Key, Value> >(key, value, parent);
+    if(parent == nullptr){
+        this->root_ = added;
+        return added;
+    }
+    if(left){
+        parent->setLeft(added);
+    }
+    else{
+        parent->setRight(added);
+    }
+    // Sizes first, so that the rotations see correct child sizes
+    this->updateSizesToRoot(parent);
+    splay(added, true);
+    return added;
+}
+
+/*
+ * Removes as the plain tree does, swapping a node with 2 children with
+ * its predecessor, then splays the parent of the node taken out. A miss
+ * splays the last node looked at.
+ */
+template<class Key, class Value>
+void SplayTree<Key, Value>::remove(const Key& key)
+{
+    Node<Key, Value>* temp = this->root_;
+    Node<Key, Value>* last = nullptr;
+    while(temp != nullptr && (key < temp->getKey() || temp->getKey() < key)){
+        last = temp;
+        temp = (key < temp->getKey()) ? temp->getLeft() : temp->getRight();
+    }
+    if(temp == nullptr){
+        if(last != nullptr){
+            splay(last, true);
+        }
+        return;
+    }
+
+    if(temp->getLeft() != nullptr && temp->getRight() != nullptr){
+        this->nodeSwap(temp, this->predecessor(temp));
+    }
+
+    Node<Key, Value>* parent = temp->getParent();
+    Node<Key, Value>* child = temp->getLeft();
+    if(child == nullptr){
+        child = temp->getRight();
+    }
+    if(child != nullptr){
+        child->setParent(parent);
+    }
+    if(parent == nullptr){
+        this->root_ = child;
+    }
+    else if(parent->getLeft() == temp){
+        parent->setLeft(child);
+    }
+    else{
+        parent->setRight(child);
+    }
+
+    this->destroyNode(temp);
+    this->updateSizesToRoot(parent);
+    if(parent != nullptr){
+        splay(parent, true);
+    }
+}
+
+/**
+* Returns an iterator to the item with the given key, or the end iterator,
+* splaying the node found or else the last node looked at.
+*/
+template<class Key, class Value>
+typename SplayTree<Key, Value>::iterator SplayTree<Key, Value>::find(const Key& key)
+{
+    return this->iteratorAt(splayFind(key));
+}
+
+/**
+* Looks up without splaying.
+*/
+template<class Key, class Value>
+typename SplayTree<Key, Value>::iterator SplayTree<Key, Value>::find(const Key& key) const
+{
+    return BinarySearchTree<Key, Value>::find(key);
+}
+
+template<class Key, class Value>
+Value& SplayTree<Key, Value>::operator[](const Key& key)
+{
+    Node<Key, Value>* found = splayFind(key);
+    if(found == nullptr) throw std::out_of_range("Invalid key");
+    return found->getValue();
+}
+
+template<class Key, class Value>
+Value const & SplayTree<Key, Value>::operator[](const Key& key) const
+{
+    return BinarySearchTree<Key, Value>::operator[](key);
+}
+
+/**
+* Finds key, counts the hit, splays the node found or the last node
+* looked at, and returns the node with key, or nullptr.
+*/
+template<class Key, class Value>
+Node<Key, Value>* SplayTree<Key, Value>::splayFind(const Key& key)
+{
+    Node<Key, Value>* temp = this->root_;
+    Node<Key, Value>* last = nullptr;
+    while(temp != nullptr){
+        last = temp;
+        if(key < temp->getKey()){
+            temp = temp->getLeft();
+        }
+        else if(temp->getKey() < key){
+            temp = temp->getRight();
+        }
+        else{
+            break;
+        }
+    }
+    if(temp != nullptr){
+        temp->recordHit();
+    }
+    if(last != nullptr){
+        splay(last, false);
+    }
+    return temp;
+}
+
+/**
+* Rotates current up toward the root, two levels at a time. When current
+* and its parent are children on the same side, a full splay rotates the
+* grandparent and then the parent; a semi-splay rotates only the parent
+* and carries on from there, so current ends up about half as deep.
+* Lookups do nothing in SPLAY_ON_WRITE mode.
+*/
+template<class Key, class Value>
+void SplayTree<Key, Value>::splay(Node<Key, Value>* current, bool write)
+{
+    if(mode_ == SPLAY_ON_WRITE && !write){
+        return;
+    }
+    while(current->getParent() != nullptr){
+        Node<Key, Value>* parent = current->getParent();
+        Node<Key, Value>* grandparent = parent->getParent();
+        if(grandparent == nullptr){
+            rotateUp(current);
+        }
+        else if((grandparent->getLeft() == parent) == (parent->getLeft() == current)){
+            rotateUp(parent);
+            if(mode_ == SEMI_SPLAY){
+                current = parent;
+            }
+            else{
+                rotateUp(current);
+            }
+        }
+        else{
+            rotateUp(current);
+            rotateUp(current);
+        }
+    }
+}
+
+/**
+* Rotates current above its parent, to whichever side it is on.
+*/
+template<class Key, class Value>
+void SplayTree<Key, Value>::rotateUp(Node<Key, Value>* current)
+{
+    Node<Key, Value>* parent = current->getParent();
+    Node<Key, Value>* grandparent = parent->getParent();
+    current->setParent(grandparent);
+    if(grandparent == nullptr){
+        this->root_ = current;
+    }
+    else if(grandparent->getLeft() == parent){
+        grandparent->setLeft(current);
+    }
+    else{
+        grandparent->setRight(current);
+    }
+
+    if(parent->getLeft() == current){
+        parent->setLeft(current->getRight());
+        if(current->getRight() != nullptr){
+            current->getRight()->setParent(parent);
+        }
+        current->setRight(parent);
+    }
+    else{
+        parent->setRight(current->getLeft());
+        if(current->getLeft() != nullptr){
+            current->getLeft()->setParent(parent);
+        }
+        current->setLeft(parent);
+    }
+    parent->setParent(current);
+    parent->updateSubtreeSize();
+    current->updateSubtreeSize();
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the SplayTree class.
+  -----------------------------------------------
+*/
+
+#endif